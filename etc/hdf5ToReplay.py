@@ -0,0 +1,92 @@
+#!/usr/bin/env python
+"""
+Convert an NDFileHDF5 file written by the Xspress3 driver into a replay file
+for the simulator (xspress3SimReplay iocsh command).
+
+Spectra are read from /entry/data/data (frames x channels x bins). Scalers
+are read from the CHAN<n>SCA<k> NDAttributes and timestamps from the
+TIMESTAMP or NDArrayTimeStamp attribute, when present. Dead time corrected
+(floating point) data is rounded to integers.
+
+Usage: hdf5ToReplay.py [--period SECONDS] input.h5 output.xsp3rpl
+
+The file layout is described in xspress3App/src/xsp3SimReplay.h.
+"""
+import argparse
+import struct
+import sys
+
+import h5py
+import numpy
+
+MAGIC = b"XSP3RPL1"
+HEADER_SIZE = 64
+NUM_SCALERS = 9
+FLAG_TIMESTAMPS = 0x1
+
+
+def readScalers(attributes, numFrames, numChannels):
+    scalers = numpy.zeros((numFrames, numChannels, NUM_SCALERS), dtype="<u4")
+    for chan in range(numChannels):
+        for scaler in range(8):
+            name = "CHAN{}SCA{}".format(chan + 1, scaler)
+            if attributes is not None and name in attributes:
+                values = numpy.asarray(attributes[name][:numFrames], dtype=numpy.float64)
+                scalers[:len(values), chan, scaler] = numpy.clip(numpy.rint(values), 0, 0xFFFFFFFF)
+    return scalers
+
+
+def readTimestamps(attributes, numFrames):
+    if attributes is None:
+        return None
+    for name in ("TIMESTAMP", "NDArrayTimeStamp"):
+        if name in attributes:
+            stamps = numpy.asarray(attributes[name][:numFrames], dtype="<f8")
+            if len(stamps) == numFrames:
+                return stamps
+    return None
+
+
+def convert(inputName, outputName, period):
+    with h5py.File(inputName, "r") as h5:
+        data = h5["/entry/data/data"]
+        if data.ndim == 2:
+            numFrames, numBins = data.shape
+            numChannels = 1
+        else:
+            numFrames, numChannels, numBins = data.shape[0], data.shape[-2], data.shape[-1]
+        attributes = h5.get("/entry/instrument/NDAttributes")
+
+        scalers = readScalers(attributes, numFrames, numChannels)
+        stamps = readTimestamps(attributes, numFrames)
+        flags = FLAG_TIMESTAMPS if stamps is not None else 0
+
+        with open(outputName, "wb") as out:
+            header = struct.pack("<8s6Id", MAGIC, HEADER_SIZE, numChannels, numBins,
+                                 NUM_SCALERS, numFrames, flags, period)
+            out.write(header.ljust(HEADER_SIZE, b"\0"))
+            # Spectra a frame at a time, so large files need not fit in memory
+            for frame in range(numFrames):
+                spectra = numpy.asarray(data[frame], dtype=numpy.float64).reshape(numChannels, numBins)
+                out.write(numpy.clip(numpy.rint(spectra), 0, 0xFFFFFFFF).astype("<u4").tobytes())
+            out.write(scalers.tobytes())
+            if stamps is not None:
+                out.write(stamps.tobytes())
+
+    print("%s: %d frames, %d channels, %d bins%s" % (outputName, numFrames, numChannels, numBins,
+                                                     ", with timestamps" if stamps is not None else ""))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Convert an Xspress3 HDF5 file to a simulator replay file")
+    parser.add_argument("input", help="NDFileHDF5 file")
+    parser.add_argument("output", help="Replay file to write")
+    parser.add_argument("--period", type=float, default=0.0,
+                        help="Frame period in seconds, used when the file has no timestamps")
+    args = parser.parse_args()
+    convert(args.input, args.output, args.period)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
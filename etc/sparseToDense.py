@@ -0,0 +1,92 @@
+#!/usr/bin/env python
+"""
+Decode the sparse frames written by the Xspress3 driver with SPARSE set,
+and write them to a new HDF5 file as dense spectra.
+
+Frames are read from /entry/data/data (frames x words). The driver pads
+every frame with zeros to the same length, the longest encoding of the
+acquisition's frames, and records the encoded length in the SPARSE_WORDS
+NDAttribute; the padding is ignored. The encoding and the dense shape of
+each frame come from the SPARSE_ENCODING, SPARSE_BINS, SPARSE_CHANNELS and
+SPARSE_SUB_FRAMES NDAttributes. The output is
+/entry/data/data, frames x channels x bins, or frames x sub-frames x
+channels x bins for sub-frame data.
+
+The encoding is described in xspress3App/src/xsp3Sparse.h; decode() can
+be imported to read the frames directly.
+
+Usage: sparseToDense.py input.h5 output.h5
+"""
+import argparse
+import sys
+
+import h5py
+import numpy
+
+PAIRS = 1
+BITMAP = 2
+
+
+def decode(words, encoding, bins, spectra):
+    """Decode one frame into an array of spectra x bins counts."""
+    words = numpy.asarray(words, dtype="<u4")
+    offsets = words[:spectra + 1].astype(numpy.int64)
+    nonZero = int(offsets[-1])
+    dense = numpy.zeros((spectra, bins), dtype="<u4")
+    rows = numpy.repeat(numpy.arange(spectra), numpy.diff(offsets))
+    if encoding == PAIRS:
+        pairs = words[spectra + 1:spectra + 1 + 2 * nonZero].reshape(-1, 2)
+        dense[rows, pairs[:, 0]] = pairs[:, 1]
+    elif encoding == BITMAP:
+        mapWords = (bins + 31) // 32
+        start = spectra + 1
+        bitmap = words[start:start + spectra * mapWords].reshape(spectra, mapWords)
+        values = words[start + spectra * mapWords:start + spectra * mapWords + nonZero]
+        bits = numpy.unpackbits(bitmap.astype("<u4").view(numpy.uint8), bitorder="little")
+        mask = bits.reshape(spectra, mapWords * 32)[:, :bins].astype(bool)
+        dense[mask] = values
+    else:
+        dense[:] = words[:spectra * bins].reshape(spectra, bins)
+    return dense
+
+
+def attribute(attributes, name, frame, default):
+    if attributes is None or name not in attributes:
+        return default
+    return int(attributes[name][frame])
+
+
+def convert(inputName, outputName):
+    with h5py.File(inputName, "r") as h5, h5py.File(outputName, "w") as out:
+        data = h5["/entry/data/data"]
+        attributes = h5.get("/entry/instrument/NDAttributes")
+        numFrames = data.shape[0]
+        bins = attribute(attributes, "SPARSE_BINS", 0, 0)
+        channels = attribute(attributes, "SPARSE_CHANNELS", 0, 0)
+        subFrames = attribute(attributes, "SPARSE_SUB_FRAMES", 0, 1)
+        if bins <= 0 or channels <= 0:
+            raise ValueError("%s has no SPARSE_BINS and SPARSE_CHANNELS attributes" % inputName)
+        shape = (numFrames, channels, bins) if subFrames == 1 else (numFrames, subFrames, channels, bins)
+        dense = out.create_dataset("/entry/data/data", shape, dtype="<u4",
+                                   chunks=(1,) + shape[1:], compression="gzip")
+        # A frame at a time, so large files need not fit in memory
+        for frame in range(numFrames):
+            encoding = attribute(attributes, "SPARSE_ENCODING", frame, PAIRS)
+            words = attribute(attributes, "SPARSE_WORDS", frame, data.shape[1])
+            spectra = decode(data[frame, :words], encoding, bins, channels * subFrames)
+            dense[frame] = spectra.reshape(shape[1:])
+
+    print("%s: %d frames, %d channels, %d bins" % (outputName, numFrames, channels, bins))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode sparse Xspress3 frames into dense spectra")
+    parser.add_argument("input", help="HDF5 file of sparse frames")
+    parser.add_argument("output", help="HDF5 file to write")
+    args = parser.parse_args()
+    convert(args.input, args.output)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -35,6 +35,24 @@ epicsEnvSet("EPICS_DB_INCLUDE_PATH", "$(ADCORE)/db:$(XSPRESS3)/db:.")
 # circBuffer 0 or 1. set to 1 if more than 12216 frames required
 xspress3Config("$(PORT)", "$(NUM_CHANNELS)", "$(XSP3CARDS)", "$(XSP3ADDR)", "$(MAXFRAMES)", "$(MAXDRIVERFRAMES)", "$(NUM_BINS)", 0, 0, 0, 0, "$(CIRC_BUFFER)")
 
+# Simulation mode only (simTest=1): tune the generated spectra
+# xspress3SimSystem(portName, generation (0 Xspress3, 2 Mini, 3 Xspress4), producer threads, ring frames)
+#xspress3SimSystem("$(PORT)", 0, 4, 256)
+# xspress3SimSpectra(portName, countRate (counts/s per element), seed)
+#xspress3SimSpectra("$(PORT)", 200000, 1)
+# xspress3SimTrigger(portName, rate (Hz) of emulated TTL/LVDS triggers, jitter (fraction of period), seed)
+#xspress3SimTrigger("$(PORT)", 1000, 0.01, 1)
+# xspress3SimReplay(portName, replay file from etc/hdf5ToReplay.py, loop (0 or 1), frame rate (Hz, 0 for recorded timestamps))
+#xspress3SimReplay("$(PORT)", "/tmp/scan.xsp3rpl", 1, 0)
+# xspress3SimFault(portName, latency|busy|drop|overrun|error|none|report, probability, value (latency s, busy polls))
+#xspress3SimFault("$(PORT)", "drop", 0.001, 0)
+
+# Record every Xspress3 API call into a ring file, or play one back instead of the detector (before connecting)
+# xspress3Trace(portName, trace file ("" to stop), size (MB), record frame data (0 or 1))
+#xspress3Trace("$(PORT)", "/tmp/xspress3.trc", 256, 0)
+# xspress3TraceReplay(portName, trace file ("" to report), speed (1 as recorded, 0 as fast as possible))
+#xspress3TraceReplay("$(PORT)", "/tmp/xspress3.trc", 1)
+
 #
 # Create a processing plugin
 
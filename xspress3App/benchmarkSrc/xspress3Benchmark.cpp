@@ -0,0 +1,473 @@
+/**
+ * License: This file is part of 'xspress3'
+ *
+ * 'xspress3' is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 'xspress3' is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with 'xspress3'.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @brief Readout throughput benchmark for the Xspress3 driver.
+ *
+ * Instantiates the driver in simulation mode and drives complete
+ * acquisitions through the normal asyn interfaces, so that frames go
+ * through the real data task (xsp3DataTaskC) exactly as they would in an
+ * IOC. Every NDArray published on NDARRAY_DATA is timestamped, and one
+ * result line is written per configuration in the sweep.
+ *
+ * Usage: xspress3Benchmark [-c channels] [-b bins] [-t raw,dtc] [-r rates]
+ *                          [-n frames] [-j threads] [-F faults] [-f json|csv] [-o file]
+ *
+ * Lists are comma separated. Faults are injected into the simulator as a
+ * list of fault=probability[:value] (see xspress3SimFault), to measure
+ * throughput and how long the driver takes to stop under failure. A rate of 0 runs the simulator as fast as it
+ * will go. Driver diagnostics are sent to stderr so stdout only carries
+ * results.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include <epicsTime.h>
+#include <epicsThread.h>
+#include <epicsEvent.h>
+#include <epicsExit.h>
+#include <asynDriver.h>
+#include <asynDrvUser.h>
+#include <asynGenericPointer.h>
+#include <asynInt32SyncIO.h>
+#include <asynFloat64SyncIO.h>
+
+#include "xspress3Epics.h"
+
+/* Acquire time used when running at the maximum rate (80 ITFG clock ticks) */
+static const double maxRateAcquireTime = 1.0e-6;
+static const double ioTimeout = 5.0;
+static const int producerRingFrames = 256;
+static int producerThreads = 0;
+static const char *faultList = NULL;
+
+struct benchCase {
+    int channels;
+    int bins;
+    int dtc;
+    double rate;
+};
+
+struct benchResult {
+    int received;
+    double elapsed;
+    double fps;
+    double cpuPerFrame;
+    double latencyP50;
+    double latencyP90;
+    double latencyP99;
+    double latencyMax;
+    double stopTime;
+};
+
+/**
+ * Collects the arrival time of every NDArray published by the driver.
+ * The callback runs in the driver's data task, so it only records the
+ * time and signals when the last expected frame has arrived.
+ */
+class benchSink {
+public:
+    benchSink() : expected(0), received(0) { done = epicsEventMustCreate(epicsEventEmpty); }
+    ~benchSink() { epicsEventDestroy(done); }
+
+    void arm(int numFrames)
+    {
+        expected = numFrames;
+        received = 0;
+        arrival.assign(numFrames, 0.0);
+    }
+
+    static void arrayCallback(void *userPvt, asynUser *pasynUser, void *pointer)
+    {
+        benchSink *sink = (benchSink *)userPvt;
+        NDArray *pArray = (NDArray *)pointer;
+        epicsTimeStamp now;
+
+        epicsTimeGetCurrent(&now);
+        /* Erase publishes a blank frame with a negative uniqueId */
+        if (pArray->uniqueId < 1 || pArray->uniqueId > sink->expected) return;
+        sink->arrival[pArray->uniqueId-1] = now.secPastEpoch + now.nsec/1e9;
+        if (++sink->received == sink->expected) epicsEventSignal(sink->done);
+    }
+
+    int expected;
+    int received;
+    std::vector<double> arrival;
+    epicsEventId done;
+};
+
+static bool parseList(const char *text, std::vector<double> &values)
+{
+    std::string list(text);
+    size_t start = 0;
+
+    values.clear();
+    while (start <= list.size()) {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos) end = list.size();
+        std::string item = list.substr(start, end-start);
+        if (item.empty()) return false;
+        char *stop = NULL;
+        double value = strtod(item.c_str(), &stop);
+        if (*stop != '\0' || value < 0) return false;
+        values.push_back(value);
+        start = end+1;
+    }
+    return !values.empty();
+}
+
+static double cpuSeconds(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec/1e6 +
+           usage.ru_stime.tv_sec + usage.ru_stime.tv_usec/1e6;
+}
+
+static double percentile(const std::vector<double> &sorted, double fraction)
+{
+    if (sorted.empty()) return 0.0;
+    size_t index = (size_t)(fraction*(sorted.size()-1) + 0.5);
+    return sorted[index];
+}
+
+static asynStatus writeInt32(const char *port, int addr, const char *drvInfo, int value)
+{
+    asynUser *pasynUser;
+    asynStatus status = pasynInt32SyncIO->connect(port, addr, &pasynUser, drvInfo);
+    if (status == asynSuccess) {
+        status = pasynInt32SyncIO->write(pasynUser, value, ioTimeout);
+        pasynInt32SyncIO->disconnect(pasynUser);
+    }
+    if (status != asynSuccess)
+        fprintf(stderr, "xspress3Benchmark: failed to write %s=%d on %s\n", drvInfo, value, port);
+    return status;
+}
+
+static int readInt32(const char *port, int addr, const char *drvInfo)
+{
+    asynUser *pasynUser;
+    epicsInt32 value = -1;
+    if (pasynInt32SyncIO->connect(port, addr, &pasynUser, drvInfo) == asynSuccess) {
+        pasynInt32SyncIO->read(pasynUser, &value, ioTimeout);
+        pasynInt32SyncIO->disconnect(pasynUser);
+    }
+    return value;
+}
+
+/**
+ * Apply a list of fault=probability[:value] to the simulator on a port.
+ */
+static bool setFaults(const char *port, const char *list)
+{
+    std::string faults(list);
+    size_t start = 0;
+
+    while (start < faults.size()) {
+        size_t end = faults.find(',', start);
+        if (end == std::string::npos) end = faults.size();
+        std::string item = faults.substr(start, end-start);
+        size_t equals = item.find('=');
+        double value = 0.0;
+        if (equals == std::string::npos) return false;
+        std::string name = item.substr(0, equals);
+        double probability = atof(item.c_str() + equals + 1);
+        size_t colon = item.find(':', equals);
+        if (colon != std::string::npos) value = atof(item.c_str() + colon + 1);
+        if (xspress3SimFault(port, name.c_str(), probability, value) != asynSuccess) return false;
+        start = end+1;
+    }
+    return true;
+}
+
+static asynStatus writeFloat64(const char *port, int addr, const char *drvInfo, double value)
+{
+    asynUser *pasynUser;
+    asynStatus status = pasynFloat64SyncIO->connect(port, addr, &pasynUser, drvInfo);
+    if (status == asynSuccess) {
+        status = pasynFloat64SyncIO->write(pasynUser, value, ioTimeout);
+        pasynFloat64SyncIO->disconnect(pasynUser);
+    }
+    if (status != asynSuccess)
+        fprintf(stderr, "xspress3Benchmark: failed to write %s=%g on %s\n", drvInfo, value, port);
+    return status;
+}
+
+/**
+ * Register the sink for NDArray callbacks in the same way as an NDPlugin.
+ */
+static asynStatus registerSink(asynUser *pasynUser, const char *port, benchSink *sink)
+{
+    asynInterface *pasynInterface;
+    void *registrarPvt;
+
+    if (pasynManager->connectDevice(pasynUser, port, 0) != asynSuccess) return asynError;
+    pasynInterface = pasynManager->findInterface(pasynUser, asynDrvUserType, 1);
+    if (pasynInterface == NULL) return asynError;
+    asynDrvUser *pasynDrvUser = (asynDrvUser *)pasynInterface->pinterface;
+    if (pasynDrvUser->create(pasynInterface->drvPvt, pasynUser, NDArrayDataString, NULL, NULL) != asynSuccess)
+        return asynError;
+    pasynInterface = pasynManager->findInterface(pasynUser, asynGenericPointerType, 1);
+    if (pasynInterface == NULL) return asynError;
+    asynGenericPointer *pasynGenericPointer = (asynGenericPointer *)pasynInterface->pinterface;
+    return pasynGenericPointer->registerInterruptUser(pasynInterface->drvPvt, pasynUser,
+                                                      benchSink::arrayCallback, sink, &registrarPvt);
+}
+
+/**
+ * The asynUser stays registered for the life of the port, so is only freed
+ * if the registration fails.
+ */
+static asynStatus connectSink(const char *port, benchSink *sink)
+{
+    asynUser *pasynUser = pasynManager->createAsynUser(0, 0);
+    asynStatus status = registerSink(pasynUser, port, sink);
+
+    if (status != asynSuccess) {
+        pasynManager->disconnect(pasynUser);
+        pasynManager->freeAsynUser(pasynUser);
+    }
+    return status;
+}
+
+/**
+ * Run one acquisition of numFrames frames with a freshly created driver.
+ * Each case gets its own port because asyn ports cannot be removed.
+ */
+static bool runCase(const benchCase &bc, int index, int numFrames, benchResult &result)
+{
+    char port[32];
+    benchSink *sink = new benchSink;
+    double acquireTime = bc.rate > 0 ? 1.0/bc.rate : maxRateAcquireTime;
+    double timeout = numFrames*acquireTime*2.0 + 30.0;
+    epicsTimeStamp start;
+
+    epicsSnprintf(port, sizeof(port), "XSP3BENCH%d", index);
+    new Xspress3(port, bc.channels, 1, "127.0.0.1", numFrames, numFrames, bc.bins, 0, 0, 0, 1, 0);
+    if (producerThreads > 0 &&
+        xspress3SimSystem(port, XspressGen3, producerThreads, producerRingFrames) != asynSuccess) {
+        return false;
+    }
+    if (faultList != NULL && !setFaults(port, faultList)) {
+        fprintf(stderr, "xspress3Benchmark: bad fault list %s\n", faultList);
+        return false;
+    }
+
+    if (connectSink(port, sink) != asynSuccess) {
+        fprintf(stderr, "xspress3Benchmark: cannot register for arrays on %s\n", port);
+        return false;
+    }
+    if (writeInt32(port, 0, xsp3ConnectParamString, 1) ||
+        writeInt32(port, 0, xsp3EraseStartParamString, 0) ||
+        writeInt32(port, 0, xsp3DtcEnableParamString, bc.dtc) ||
+        writeInt32(port, 0, xsp3TriggerModeParamString, 1) ||
+        writeInt32(port, 0, NDArrayCallbacksString, 1) ||
+        writeInt32(port, 0, ADNumImagesString, numFrames) ||
+        writeFloat64(port, 0, ADAcquireTimeString, acquireTime)) {
+        return false;
+    }
+
+    sink->arm(numFrames);
+    double cpuStart = cpuSeconds();
+    epicsTimeGetCurrent(&start);
+    if (writeInt32(port, 0, ADAcquireString, 1)) return false;
+    epicsEventWaitWithTimeout(sink->done, timeout);
+    double cpuUsed = cpuSeconds() - cpuStart;
+
+    /* Time to stop, including waiting for the detector to go idle */
+    epicsTimeStamp stopStart, stopEnd;
+    epicsTimeGetCurrent(&stopStart);
+    writeInt32(port, 0, ADAcquireString, 0);
+    while (readInt32(port, 0, ADStatusString) == ADStatusAcquire &&
+           epicsTimeGetCurrent(&stopEnd) == 0 && epicsTimeDiffInSeconds(&stopEnd, &stopStart) < 30.0) {
+        epicsThreadSleep(0.001);
+    }
+    epicsTimeGetCurrent(&stopEnd);
+    if (faultList != NULL) xspress3SimFault(port, "report", 0, 0);
+
+    /* Latency is measured from the time the simulator makes the frame available */
+    double t0 = start.secPastEpoch + start.nsec/1e9;
+    double last = t0;
+    std::vector<double> latency;
+    latency.reserve(numFrames);
+    for (int frame=0; frame<numFrames; frame++) {
+        if (sink->arrival[frame] == 0.0) continue;
+        latency.push_back(sink->arrival[frame] - (t0 + (frame+1)*acquireTime));
+        last = std::max(last, sink->arrival[frame]);
+    }
+    std::sort(latency.begin(), latency.end());
+
+    result.received = sink->received;
+    result.elapsed = last - t0;
+    result.fps = result.elapsed > 0 ? result.received/result.elapsed : 0.0;
+    result.cpuPerFrame = result.received > 0 ? cpuUsed/result.received : 0.0;
+    result.latencyP50 = percentile(latency, 0.50);
+    result.latencyP90 = percentile(latency, 0.90);
+    result.latencyP99 = percentile(latency, 0.99);
+    result.latencyMax = latency.empty() ? 0.0 : latency.back();
+    result.stopTime = epicsTimeDiffInSeconds(&stopEnd, &stopStart);
+    /* The sink stays registered with the port, so it is never deleted */
+    return true;
+}
+
+static void printResult(FILE *out, bool csv, const benchCase &bc, int numFrames, const benchResult &r)
+{
+    if (csv) {
+        fprintf(out, "%d,%d,%s,%g,%d,%d,%.6f,%.1f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+                bc.channels, bc.bins, bc.dtc ? "dtc" : "raw", bc.rate, numFrames, r.received,
+                r.elapsed, r.fps, r.cpuPerFrame*1e6,
+                r.latencyP50*1e3, r.latencyP90*1e3, r.latencyP99*1e3, r.latencyMax*1e3, r.stopTime*1e3);
+    } else {
+        fprintf(out, "{\"channels\": %d, \"bins\": %d, \"type\": \"%s\", \"rate_hz\": %g, "
+                "\"frames\": %d, \"received\": %d, \"elapsed_s\": %.6f, \"frames_per_s\": %.1f, "
+                "\"cpu_us_per_frame\": %.3f, \"latency_ms_p50\": %.3f, \"latency_ms_p90\": %.3f, "
+                "\"latency_ms_p99\": %.3f, \"latency_ms_max\": %.3f, \"stop_ms\": %.3f}\n",
+                bc.channels, bc.bins, bc.dtc ? "dtc" : "raw", bc.rate, numFrames, r.received,
+                r.elapsed, r.fps, r.cpuPerFrame*1e6,
+                r.latencyP50*1e3, r.latencyP90*1e3, r.latencyP99*1e3, r.latencyMax*1e3, r.stopTime*1e3);
+    }
+    fflush(out);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [-c channels] [-b bins] [-t raw,dtc] [-r rates] [-n frames] [-j threads] [-F faults] [-f json|csv] [-o file]\n"
+            "  -c  comma separated channel counts (default 1,4,16,64)\n"
+            "  -b  comma separated spectrum lengths (default 1024,4096)\n"
+            "  -t  data types to test, raw and/or dtc (default raw,dtc)\n"
+            "  -r  comma separated frame rates in Hz, 0 for maximum (default 1000,0)\n"
+            "  -n  frames per configuration (default 1000)\n"
+            "  -j  simulator threads generating frames ahead of the driver (default 0)\n"
+            "  -F  simulator faults, comma separated fault=probability[:value] (default none)\n"
+            "  -f  output format (default json, one object per line)\n"
+            "  -o  write results to a file instead of stdout\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<double> channels, bins, rates;
+    std::vector<int> types;
+    int numFrames = 1000;
+    bool csv = false;
+    const char *outName = NULL;
+    int opt;
+
+    parseList("1,4,16,64", channels);
+    parseList("1024,4096", bins);
+    parseList("1000,0", rates);
+    types.push_back(0);
+    types.push_back(1);
+
+    while ((opt = getopt(argc, argv, "c:b:t:r:n:j:F:f:o:h")) != -1) {
+        switch (opt) {
+        case 'c':
+            if (!parseList(optarg, channels)) { usage(argv[0]); return 1; }
+            break;
+        case 'b':
+            if (!parseList(optarg, bins)) { usage(argv[0]); return 1; }
+            break;
+        case 'r':
+            if (!parseList(optarg, rates)) { usage(argv[0]); return 1; }
+            break;
+        case 't':
+            types.clear();
+            if (strstr(optarg, "raw")) types.push_back(0);
+            if (strstr(optarg, "dtc")) types.push_back(1);
+            if (types.empty()) { usage(argv[0]); return 1; }
+            break;
+        case 'n':
+            numFrames = atoi(optarg);
+            if (numFrames < 1) { usage(argv[0]); return 1; }
+            break;
+        case 'j':
+            producerThreads = atoi(optarg);
+            break;
+        case 'F':
+            faultList = optarg;
+            break;
+        case 'f':
+            if (strcmp(optarg, "csv") == 0) {
+                csv = true;
+            } else if (strcmp(optarg, "json") == 0) {
+                csv = false;
+            } else {
+                fprintf(stderr, "xspress3Benchmark: unknown format %s\n", optarg);
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'o':
+            outName = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    /* Keep the result stream clean: anything the driver prints goes to stderr */
+    FILE *out = outName ? fopen(outName, "w") : fdopen(dup(fileno(stdout)), "w");
+    if (out == NULL) {
+        perror("xspress3Benchmark");
+        return 1;
+    }
+    fflush(stdout);
+    dup2(fileno(stderr), fileno(stdout));
+
+    if (csv) {
+        fprintf(out, "channels,bins,type,rate_hz,frames,received,elapsed_s,frames_per_s,"
+                "cpu_us_per_frame,latency_ms_p50,latency_ms_p90,latency_ms_p99,latency_ms_max,stop_ms\n");
+    }
+
+    int index = 0;
+    int failures = 0;
+    for (size_t c=0; c<channels.size(); c++) {
+        for (size_t b=0; b<bins.size(); b++) {
+            for (size_t t=0; t<types.size(); t++) {
+                for (size_t r=0; r<rates.size(); r++) {
+                    benchCase bc;
+                    benchResult result;
+                    bc.channels = (int)channels[c];
+                    bc.bins = (int)bins[b];
+                    bc.dtc = types[t];
+                    bc.rate = rates[r];
+                    if (!runCase(bc, index++, numFrames, result)) {
+                        failures++;
+                        continue;
+                    }
+                    if (result.received != numFrames) failures++;
+                    printResult(out, csv, bc, numFrames, result);
+                }
+            }
+        }
+    }
+
+    fclose(out);
+    epicsExit(failures ? 1 : 0);
+    return 0;
+}
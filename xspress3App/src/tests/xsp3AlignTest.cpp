@@ -0,0 +1,100 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE Align
+#include <boost/test/unit_test.hpp>
+
+#include <vector>
+#include "xsp3Align.h"
+
+#define BINS 4096
+#define NUM_CHANNELS 3
+
+static double total(const std::vector<double> &spectrum)
+{
+    double sum = 0;
+    for (size_t i = 0; i < spectrum.size(); i++)
+        sum += spectrum[i];
+    return sum;
+}
+
+BOOST_AUTO_TEST_CASE(matchingCalibrationJustSumsChannels)
+{
+    xsp3EnergyCal_t cal = {0.0, 0.01, 0.0};
+    std::vector<xsp3EnergyCal_t> cals(NUM_CHANNELS, cal);
+    std::vector<epicsUInt32> frame(BINS*NUM_CHANNELS);
+    std::vector<double> out(BINS, -1);
+    xsp3Align align;
+
+    for (size_t i = 0; i < frame.size(); i++)
+        frame[i] = i % 1000;
+    BOOST_CHECK_EQUAL(align.configure(cals, BINS, 0.0, 0.01, BINS), 0);
+    align.sum(&frame[0], BINS, NUM_CHANNELS, 1, &out[0]);
+    for (int bin = 0; bin < BINS; bin++) {
+        double expected = 0;
+        for (int chan = 0; chan < NUM_CHANNELS; chan++)
+            expected += frame[chan*BINS + bin];
+        BOOST_CHECK_CLOSE(out[bin] + 1, expected + 1, 1e-9);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(peaksAtDifferentBinsLineUp)
+{
+    // The same 8 keV line on channels with -2%, 0 and +2% gain
+    xsp3EnergyCal_t cal = {0.0, 0.01, 0.0};
+    std::vector<xsp3EnergyCal_t> cals(NUM_CHANNELS, cal);
+    std::vector<epicsFloat64> frame(BINS*NUM_CHANNELS, 0.0);
+    std::vector<double> out(BINS);
+    xsp3Align align;
+    int peak = 0;
+
+    cals[0].gain = 0.0098;
+    cals[2].gain = 0.0102;
+    for (int chan = 0; chan < NUM_CHANNELS; chan++)
+        frame[chan*BINS + (int) (xsp3EnergyToBin(cals[chan], 8.0) + 0.5)] = 1000;
+    BOOST_CHECK_EQUAL(align.configure(cals, BINS, 0.0, 0.01, BINS), 0);
+    BOOST_CHECK(align.getTaps(0) <= 3);
+    align.sum(&frame[0], BINS, NUM_CHANNELS, 1, &out[0]);
+    for (int bin = 0; bin < BINS; bin++)
+        if (out[bin] > out[peak]) peak = bin;
+    BOOST_CHECK_EQUAL(peak, 800);
+    // Nearly all the counts are within a bin of the line, and none are lost
+    BOOST_CHECK(out[799] + out[800] + out[801] > 0.95*3000);
+    BOOST_CHECK_CLOSE(total(out), 3000, 1e-9);
+}
+
+BOOST_AUTO_TEST_CASE(countsAreConservedOverSubFrames)
+{
+    xsp3EnergyCal_t cal = {-0.05, 0.0098, 2e-8};
+    std::vector<xsp3EnergyCal_t> cals(NUM_CHANNELS, cal);
+    const int subFrames = 2;
+    std::vector<epicsUInt32> frame(BINS*NUM_CHANNELS*subFrames, 0);
+    std::vector<double> out(BINS / 2);
+    xsp3Align align;
+
+    // Counts away from the ends, where some of the spectrum falls off the axis
+    for (int i = 0; i < subFrames*NUM_CHANNELS; i++)
+        for (int bin = 100; bin < 2000; bin++)
+            frame[i*BINS + bin] = 3;
+    // A coarser axis takes several input bins into each output bin
+    BOOST_CHECK_EQUAL(align.configure(cals, BINS, 0.0, 0.05, BINS / 2), 0);
+    BOOST_CHECK(align.getTaps(0) >= 5);
+    align.sum(&frame[0], BINS, NUM_CHANNELS, subFrames, &out[0]);
+    BOOST_CHECK_CLOSE(total(out), 3.0*1900*NUM_CHANNELS*subFrames, 1e-9);
+}
+
+BOOST_AUTO_TEST_CASE(channelWithBadCalibrationIsLeftOut)
+{
+    xsp3EnergyCal_t cal = {0.0, 0.01, 0.0};
+    std::vector<xsp3EnergyCal_t> cals(NUM_CHANNELS, cal);
+    std::vector<epicsUInt32> frame(BINS*NUM_CHANNELS, 1);
+    std::vector<double> out(BINS);
+    xsp3Align align;
+
+    cals[1].gain = 0;
+    BOOST_CHECK_EQUAL(align.configure(cals, BINS, 0.0, 0.01, BINS), 1);
+    BOOST_CHECK_EQUAL(align.getTaps(1), 0);
+    align.sum(&frame[0], BINS, NUM_CHANNELS, 1, &out[0]);
+    BOOST_CHECK_CLOSE(total(out), 2.0*BINS, 1e-9);
+    // A frame of another length gives nothing rather than reading past it
+    align.sum(&frame[0], BINS / 2, NUM_CHANNELS, 1, &out[0]);
+    BOOST_CHECK_EQUAL(total(out), 0);
+}
@@ -0,0 +1,88 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE EnergyRoi
+#include <boost/test/unit_test.hpp>
+
+#include <vector>
+#include "xsp3EnergyRoi.h"
+
+#define BINS 4096
+#define NUM_CHANNELS 3
+
+BOOST_AUTO_TEST_CASE(linearCalibrationSelectsBinsInRange)
+{
+    // 10 eV bins starting at 0
+    xsp3EnergyCal_t cal = {0.0, 0.01, 0.0};
+    int llm, hlm;
+
+    // Fe Ka, 6.3 to 6.5 keV: bins 630 to 650
+    xsp3EnergyToBins(cal, 6.3, 6.5, BINS, &llm, &hlm);
+    BOOST_CHECK_EQUAL(llm, 630);
+    BOOST_CHECK_EQUAL(hlm, 651);
+    // Between bins
+    xsp3EnergyToBins(cal, 6.305, 6.495, BINS, &llm, &hlm);
+    BOOST_CHECK_EQUAL(llm, 631);
+    BOOST_CHECK_EQUAL(hlm, 650);
+    // Off the ends of the spectrum
+    xsp3EnergyToBins(cal, -1.0, 100.0, BINS, &llm, &hlm);
+    BOOST_CHECK_EQUAL(llm, 0);
+    BOOST_CHECK_EQUAL(hlm, BINS);
+    xsp3EnergyToBins(cal, 50.0, 60.0, BINS, &llm, &hlm);
+    BOOST_CHECK_EQUAL(llm, hlm);
+}
+
+BOOST_AUTO_TEST_CASE(gainChangeMovesTheBins)
+{
+    // A channel with 2% more gain puts the same line in lower bins
+    xsp3EnergyCal_t nominal = {0.0, 0.01, 0.0};
+    xsp3EnergyCal_t high = {0.0, 0.0102, 0.0};
+    int llm, hlm, highLlm, highHlm;
+
+    xsp3EnergyToBins(nominal, 8.0, 8.1, BINS, &llm, &hlm);
+    xsp3EnergyToBins(high, 8.0, 8.1, BINS, &highLlm, &highHlm);
+    BOOST_CHECK(highLlm < llm);
+    BOOST_CHECK(highHlm < hlm);
+}
+
+BOOST_AUTO_TEST_CASE(quadraticCalibrationInverts)
+{
+    xsp3EnergyCal_t cal = {-0.05, 0.0098, 2e-8};
+
+    for (int bin = 0; bin < BINS; bin += 97) {
+        double energy = cal.offset + cal.gain*bin + cal.quad*bin*bin;
+        BOOST_CHECK_CLOSE(xsp3EnergyToBin(cal, energy) + 1, bin + 1, 1e-6);
+    }
+    BOOST_CHECK(xsp3EnergyCalValid(cal, BINS));
+    // Falls before the end of the spectrum
+    cal.quad = -2e-6;
+    BOOST_CHECK(!xsp3EnergyCalValid(cal, BINS));
+    cal.quad = 0;
+    cal.gain = 0;
+    BOOST_CHECK(!xsp3EnergyCalValid(cal, BINS));
+}
+
+BOOST_AUTO_TEST_CASE(sumsEachChannelAndSubFrame)
+{
+    const int subFrames = 2;
+    std::vector<epicsUInt32> frame(BINS*NUM_CHANNELS*subFrames, 1);
+    std::vector<double> totals(NUM_CHANNELS*XSP3_NUM_ROIS, -1);
+    xsp3RoiSums sums;
+
+    sums.resize(NUM_CHANNELS);
+    for (int chan = 0; chan < NUM_CHANNELS; chan++) {
+        sums.setRange(chan, 0, 10*chan, 10*chan + 5);
+    }
+    // Past the end of the spectrum, and backwards
+    sums.setRange(1, 1, BINS - 2, BINS + 10);
+    sums.setRange(2, 1, 20, 10);
+    sums.sum(&frame[0], BINS, NUM_CHANNELS, subFrames, &totals[0]);
+    for (int chan = 0; chan < NUM_CHANNELS; chan++) {
+        BOOST_CHECK_EQUAL(totals[chan*XSP3_NUM_ROIS], 5*subFrames);
+        BOOST_CHECK_EQUAL(totals[chan*XSP3_NUM_ROIS + XSP3_NUM_ROIS - 1], 0);
+    }
+    BOOST_CHECK_EQUAL(totals[1*XSP3_NUM_ROIS + 1], 2*subFrames);
+    BOOST_CHECK_EQUAL(totals[2*XSP3_NUM_ROIS + 1], 0);
+
+    std::vector<epicsFloat64> corrected(BINS*NUM_CHANNELS, 0.5);
+    sums.sum(&corrected[0], BINS, NUM_CHANNELS, 1, &totals[0]);
+    BOOST_CHECK_CLOSE(totals[0], 2.5, 1e-9);
+}
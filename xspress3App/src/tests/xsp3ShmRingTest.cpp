@@ -0,0 +1,179 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE ShmRing
+#include <boost/test/unit_test.hpp>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include "xsp3ShmRing.h"
+
+#define BINS 64
+#define CHANNELS 4
+#define SCALERS 9
+#define DATA_BYTES (BINS*CHANNELS*sizeof(uint32_t))
+#define SCALER_BYTES (SCALERS*CHANNELS*sizeof(uint32_t))
+
+// A name of our own, so tests running at once do not share a segment
+static std::string ringName(const char *test)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "/xsp3ShmTest_%s_%d", test, (int) getpid());
+    return name;
+}
+
+// Write frame n with every word of its spectra and scalers set to n
+static void writeFrame(xsp3ShmWriter &writer, uint32_t n)
+{
+    std::vector<uint32_t> data(BINS*CHANNELS, n), scalers(SCALERS*CHANNELS, n);
+    xsp3ShmFrameHeader_t info;
+
+    memset(&info, 0, sizeof(info));
+    info.frameNumber = n;
+    info.dataType = xsp3ShmUInt32;
+    info.ndims = 2;
+    info.dims[0] = BINS;
+    info.dims[1] = CHANNELS;
+    info.numChannels = CHANNELS;
+    info.numScalers = SCALERS;
+    info.dataBytes = DATA_BYTES;
+    info.scalerBytes = SCALER_BYTES;
+    BOOST_REQUIRE_EQUAL(writer.write(info, &data[0], &scalers[0]), 0);
+}
+
+static bool frameHolds(const xsp3ShmFrame_t &frame, uint32_t n)
+{
+    const uint32_t *data = reinterpret_cast<const uint32_t *>(&frame.data[0]);
+    const uint32_t *scalers = reinterpret_cast<const uint32_t *>(&frame.scalers[0]);
+
+    if (frame.data.size() != DATA_BYTES || frame.scalers.size() != SCALER_BYTES) return false;
+    for (size_t i = 0; i < BINS*CHANNELS; i++)
+        if (data[i] != n) return false;
+    for (size_t i = 0; i < SCALERS*CHANNELS; i++)
+        if (scalers[i] != n) return false;
+    return frame.header.frameNumber == n;
+}
+
+BOOST_AUTO_TEST_CASE(framesInOrder)
+{
+    std::string name = ringName("order");
+    xsp3ShmWriter writer;
+    xsp3ShmReader reader;
+    xsp3ShmFrame_t frame;
+
+    BOOST_REQUIRE_EQUAL(writer.open(name.c_str(), 8, DATA_BYTES + SCALER_BYTES), 0);
+    writeFrame(writer, 0);
+    // The reader starts at the next frame written
+    BOOST_REQUIRE_EQUAL(reader.open(name.c_str()), 0);
+    BOOST_CHECK_EQUAL(reader.next(&frame), xsp3ShmNotReady);
+    for (uint32_t n = 1; n < 4; n++)
+        writeFrame(writer, n);
+    for (uint32_t n = 1; n < 4; n++) {
+        BOOST_REQUIRE_EQUAL(reader.next(&frame), xsp3ShmOk);
+        BOOST_CHECK(frameHolds(frame, n));
+        BOOST_CHECK_EQUAL(frame.header.frame, n);
+    }
+    BOOST_CHECK_EQUAL(reader.next(&frame), xsp3ShmNotReady);
+    BOOST_CHECK_EQUAL(reader.getLost(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(slowReaderLosesOldestFrames)
+{
+    std::string name = ringName("slow");
+    xsp3ShmWriter writer;
+    xsp3ShmReader reader;
+    xsp3ShmFrame_t frame;
+
+    BOOST_REQUIRE_EQUAL(writer.open(name.c_str(), 4, DATA_BYTES + SCALER_BYTES), 0);
+    BOOST_REQUIRE_EQUAL(reader.open(name.c_str()), 0);
+    for (uint32_t n = 0; n < 10; n++)
+        writeFrame(writer, n);
+    for (uint32_t n = 6; n < 10; n++) {
+        BOOST_REQUIRE_EQUAL(reader.next(&frame), xsp3ShmOk);
+        BOOST_CHECK(frameHolds(frame, n));
+    }
+    BOOST_CHECK_EQUAL(reader.getLost(), 6u);
+    BOOST_CHECK_EQUAL(reader.read(2, &frame), xsp3ShmOverwritten);
+}
+
+BOOST_AUTO_TEST_CASE(peekWithoutCopying)
+{
+    std::string name = ringName("peek");
+    xsp3ShmWriter writer;
+    xsp3ShmReader reader;
+    int status;
+
+    BOOST_REQUIRE_EQUAL(writer.open(name.c_str(), 2, DATA_BYTES + SCALER_BYTES), 0);
+    BOOST_REQUIRE_EQUAL(reader.open(name.c_str()), 0);
+    writeFrame(writer, 0);
+    const xsp3ShmFrameHeader_t *slot = reader.peek(0, &status);
+    BOOST_REQUIRE(slot != NULL);
+    BOOST_CHECK_EQUAL(status, xsp3ShmOk);
+    BOOST_CHECK_EQUAL(static_cast<const uint32_t *>(xsp3ShmScalers(slot))[0], 0u);
+    BOOST_CHECK(reader.valid(0, slot));
+    writeFrame(writer, 1);
+    writeFrame(writer, 2);
+    BOOST_CHECK(!reader.valid(0, slot));
+}
+
+BOOST_AUTO_TEST_CASE(replacedRingIsStale)
+{
+    std::string name = ringName("stale");
+    xsp3ShmWriter writer;
+    xsp3ShmReader reader;
+    xsp3ShmFrame_t frame;
+
+    BOOST_REQUIRE_EQUAL(writer.open(name.c_str(), 4, DATA_BYTES + SCALER_BYTES), 0);
+    BOOST_REQUIRE_EQUAL(reader.open(name.c_str()), 0);
+    // The same geometry keeps the segment, and the readers on it
+    BOOST_REQUIRE_EQUAL(writer.open(name.c_str(), 4, DATA_BYTES), 0);
+    writeFrame(writer, 0);
+    BOOST_CHECK_EQUAL(reader.next(&frame), xsp3ShmOk);
+    // Bigger frames need a new segment
+    BOOST_REQUIRE_EQUAL(writer.open(name.c_str(), 4, 2*(DATA_BYTES + SCALER_BYTES)), 0);
+    BOOST_CHECK_EQUAL(reader.next(&frame), xsp3ShmStale);
+    BOOST_REQUIRE_EQUAL(reader.open(name.c_str()), 0);
+    writeFrame(writer, 5);
+    BOOST_REQUIRE_EQUAL(reader.next(&frame), xsp3ShmOk);
+    BOOST_CHECK(frameHolds(frame, 5));
+    BOOST_CHECK_EQUAL(frame.header.frame, 0u);
+}
+
+#define RACE_FRAMES 20000
+
+static void *raceWriter(void *arg)
+{
+    xsp3ShmWriter *writer = static_cast<xsp3ShmWriter *>(arg);
+    for (uint32_t n = 0; n < RACE_FRAMES; n++)
+        writeFrame(*writer, n);
+    return NULL;
+}
+
+BOOST_AUTO_TEST_CASE(readerRacingWriterSeesNoTornFrames)
+{
+    std::string name = ringName("race");
+    xsp3ShmWriter writer;
+    xsp3ShmReader reader;
+    xsp3ShmFrame_t frame;
+    pthread_t thread;
+    uint64_t good = 0, torn = 0;
+
+    BOOST_REQUIRE_EQUAL(writer.open(name.c_str(), 4, DATA_BYTES + SCALER_BYTES), 0);
+    BOOST_REQUIRE_EQUAL(reader.open(name.c_str()), 0);
+    pthread_create(&thread, NULL, raceWriter, &writer);
+    while (reader.getPosition() < RACE_FRAMES) {
+        // Checked first, so a frame not ready now will never be
+        bool finished = (writer.getWritten() == RACE_FRAMES);
+        int status = reader.next(&frame);
+        if (status == xsp3ShmOk) {
+            good++;
+            if (!frameHolds(frame, (uint32_t) frame.header.frame)) torn++;
+        } else if (finished && status == xsp3ShmNotReady) {
+            break;
+        }
+    }
+    pthread_join(thread, NULL);
+    BOOST_CHECK_EQUAL(torn, 0u);
+    BOOST_CHECK_EQUAL(good + reader.getLost(), (uint64_t) RACE_FRAMES);
+}
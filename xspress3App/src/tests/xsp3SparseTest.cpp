@@ -0,0 +1,102 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE Sparse
+#include <boost/test/unit_test.hpp>
+
+#include <vector>
+#include "xsp3Sparse.h"
+
+#define BINS 4096
+#define NUM_SPECTRA 4
+
+// A frame with a few counts in each spectrum, including the first and last bins
+static std::vector<uint32_t> lowCountFrame(size_t bins, size_t numSpectra)
+{
+    std::vector<uint32_t> frame(bins*numSpectra, 0);
+    for (size_t s = 0; s < numSpectra; s++) {
+        frame[s*bins] = 1;
+        frame[s*bins + bins - 1] = 7;
+        for (size_t bin = 100 + s; bin < bins; bin += 301)
+            frame[s*bins + bin] = (uint32_t) (bin*s + 1);
+    }
+    return frame;
+}
+
+static std::vector<uint32_t> roundTrip(int encoding, const std::vector<uint32_t> &frame, size_t bins, size_t numSpectra, size_t *numWords)
+{
+    size_t nonZero = xsp3SparseNonZero(&frame[0], bins, numSpectra);
+    int used = xsp3SparseChoose(encoding, bins, numSpectra, nonZero);
+    std::vector<uint32_t> words(xsp3SparseSize(used, bins, numSpectra, nonZero) + 1);
+    std::vector<uint32_t> decoded(frame.size(), 0xFFFFFFFF);
+
+    *numWords = xsp3SparseEncode(used, &frame[0], bins, numSpectra, &words[0]);
+    BOOST_CHECK_EQUAL(*numWords, words.size() - 1);
+    // Padding after the encoded words is ignored
+    BOOST_CHECK_EQUAL(xsp3SparseDecode(used, &words[0], words.size(), bins, numSpectra, &decoded[0]), 0);
+    return decoded;
+}
+
+BOOST_AUTO_TEST_CASE(pairsRoundTrip)
+{
+    std::vector<uint32_t> frame = lowCountFrame(BINS, NUM_SPECTRA);
+    size_t numWords;
+    BOOST_CHECK(roundTrip(xsp3SparsePairs, frame, BINS, NUM_SPECTRA, &numWords) == frame);
+    BOOST_CHECK(numWords*10 < frame.size());
+}
+
+BOOST_AUTO_TEST_CASE(bitmapRoundTrip)
+{
+    std::vector<uint32_t> frame = lowCountFrame(BINS, NUM_SPECTRA);
+    size_t numWords;
+    BOOST_CHECK(roundTrip(xsp3SparseBitmap, frame, BINS, NUM_SPECTRA, &numWords) == frame);
+}
+
+BOOST_AUTO_TEST_CASE(oddBins)
+{
+    // Bins that are not a whole number of blocks or bitmap words
+    std::vector<uint32_t> frame = lowCountFrame(1003, 3);
+    size_t numWords;
+    BOOST_CHECK(roundTrip(xsp3SparsePairs, frame, 1003, 3, &numWords) == frame);
+    BOOST_CHECK(roundTrip(xsp3SparseBitmap, frame, 1003, 3, &numWords) == frame);
+}
+
+BOOST_AUTO_TEST_CASE(emptyAndFullFrames)
+{
+    std::vector<uint32_t> empty(BINS*NUM_SPECTRA, 0), full(BINS*NUM_SPECTRA, 3);
+    size_t numWords;
+    BOOST_CHECK(roundTrip(xsp3SparseAuto, empty, BINS, NUM_SPECTRA, &numWords) == empty);
+    BOOST_CHECK_EQUAL(numWords, (size_t) NUM_SPECTRA + 1);
+    BOOST_CHECK(roundTrip(xsp3SparseAuto, full, BINS, NUM_SPECTRA, &numWords) == full);
+}
+
+BOOST_AUTO_TEST_CASE(autoChoosesSmaller)
+{
+    BOOST_CHECK_EQUAL(xsp3SparseChoose(xsp3SparseAuto, BINS, NUM_SPECTRA, 10), xsp3SparsePairs);
+    BOOST_CHECK_EQUAL(xsp3SparseChoose(xsp3SparseAuto, BINS, NUM_SPECTRA, 2000), xsp3SparseBitmap);
+    BOOST_CHECK_EQUAL(xsp3SparseChoose(xsp3SparseBitmap, BINS, NUM_SPECTRA, 10), xsp3SparseBitmap);
+}
+
+BOOST_AUTO_TEST_CASE(maxSizeBoundsEveryFrame)
+{
+    const int encodings[] = {xsp3SparsePairs, xsp3SparseBitmap, xsp3SparseAuto};
+    for (int e = 0; e < 3; e++) {
+        size_t maxWords = xsp3SparseMaxSize(encodings[e], BINS, NUM_SPECTRA);
+        for (size_t nonZero = 0; nonZero <= (size_t) BINS*NUM_SPECTRA; nonZero += 97)
+            BOOST_CHECK(xsp3SparseSize(encodings[e], BINS, NUM_SPECTRA, nonZero) <= maxWords);
+        BOOST_CHECK_EQUAL(xsp3SparseSize(encodings[e], BINS, NUM_SPECTRA, BINS*NUM_SPECTRA), maxWords);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(decodeRejectsBadData)
+{
+    std::vector<uint32_t> frame = lowCountFrame(BINS, NUM_SPECTRA);
+    std::vector<uint32_t> decoded(frame.size());
+    size_t nonZero = xsp3SparseNonZero(&frame[0], BINS, NUM_SPECTRA);
+    std::vector<uint32_t> words(xsp3SparseSize(xsp3SparsePairs, BINS, NUM_SPECTRA, nonZero));
+
+    xsp3SparseEncode(xsp3SparsePairs, &frame[0], BINS, NUM_SPECTRA, &words[0]);
+    BOOST_CHECK_EQUAL(xsp3SparseDecode(xsp3SparsePairs, &words[0], words.size() - 1, BINS, NUM_SPECTRA, &decoded[0]), -1);
+    words[NUM_SPECTRA + 1] = BINS;
+    BOOST_CHECK_EQUAL(xsp3SparseDecode(xsp3SparsePairs, &words[0], words.size(), BINS, NUM_SPECTRA, &decoded[0]), -1);
+    words[1] = words[2] + 1;
+    BOOST_CHECK_EQUAL(xsp3SparseDecode(xsp3SparsePairs, &words[0], words.size(), BINS, NUM_SPECTRA, &decoded[0]), -1);
+}
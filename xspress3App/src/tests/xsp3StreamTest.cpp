@@ -0,0 +1,155 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE Stream
+#include <boost/test/unit_test.hpp>
+
+#include <vector>
+#include "epicsThread.h"
+#include "xspress3Epics.h"
+#include "xsp3Compress.h"
+#include "xsp3StreamServer.h"
+
+#define BINS 256
+#define NUM_CHANNELS 4
+#define SCALER_BYTES (XSP3_SW_NUM_SCALERS*NUM_CHANNELS*sizeof(u_int32_t))
+
+// asynPorts seem to hang around even after the xspress destructor so use a new port name for each test.
+static char portName[] = "stream0";
+
+// A driver for its array pool, and a server on a free port of the loopback interface
+struct xsp3StreamLoopback
+{
+    Xspress3 xsp;
+    xsp3StreamServer server;
+
+    xsp3StreamLoopback() : xsp(portName, NUM_CHANNELS)
+    {
+        portName[6]++;
+        BOOST_REQUIRE_EQUAL(server.start(0), 0);
+    }
+
+    // Frame n, with every count and scaler set to n
+    void submit(uint32_t n)
+    {
+        size_t dims[2] = {BINS, NUM_CHANNELS};
+        std::vector<u_int32_t> scalers(XSP3_SW_NUM_SCALERS*NUM_CHANNELS, n);
+        xsp3StreamHeader_t info;
+        NDArray *pMCA;
+
+        BOOST_REQUIRE(!xsp.createMCAArray(dims, pMCA, NDUInt32));
+        std::fill((u_int32_t *) pMCA->pData, (u_int32_t *) pMCA->pData + BINS*NUM_CHANNELS, n);
+        memset(&info, 0, sizeof(info));
+        info.frameNumber = n;
+        info.numScalers = XSP3_SW_NUM_SCALERS;
+        info.scalerBytes = SCALER_BYTES;
+        server.submit(pMCA, info, &scalers[0]);
+        pMCA->release();
+    }
+
+    void connect(xsp3StreamClient &client, int numClients)
+    {
+        int clients = 0;
+        unsigned long frames, dropped, disconnected;
+
+        BOOST_REQUIRE_EQUAL(client.connect("127.0.0.1", server.getPort()), 0);
+        for (int i = 0; i < 100 && clients < numClients; i++) {
+            epicsThreadSleep(0.01);
+            server.getStats(&clients, &frames, &dropped, &disconnected);
+        }
+        BOOST_REQUIRE_EQUAL(clients, numClients);
+    }
+};
+
+static bool frameHolds(const xsp3StreamFrame_t &frame, uint32_t n)
+{
+    const u_int32_t *data = reinterpret_cast<const u_int32_t *>(&frame.data[0]);
+    const u_int32_t *scalers = reinterpret_cast<const u_int32_t *>(&frame.scalers[0]);
+
+    if (frame.header.dims[0] != BINS || frame.header.dims[1] != NUM_CHANNELS ||
+        frame.data.size() != BINS*NUM_CHANNELS*sizeof(u_int32_t) || frame.scalers.size() != SCALER_BYTES) return false;
+    for (size_t i = 0; i < BINS*NUM_CHANNELS; i++)
+        if (data[i] != n) return false;
+    for (size_t i = 0; i < XSP3_SW_NUM_SCALERS*NUM_CHANNELS; i++)
+        if (scalers[i] != n) return false;
+    return frame.header.frameNumber == n;
+}
+
+BOOST_FIXTURE_TEST_SUITE(stream, xsp3StreamLoopback)
+
+BOOST_AUTO_TEST_CASE(framesReachEveryClientInOrder)
+{
+    xsp3StreamClient first, second;
+    xsp3StreamFrame_t frame;
+
+    // Deep enough for the whole burst, whenever the sending threads get to run
+    server.configure(xsp3CompressNone, 5, 1, 32, xsp3StreamDropOldest);
+    connect(first, 1);
+    connect(second, 2);
+    for (uint32_t n = 0; n < 20; n++)
+        submit(n);
+    for (uint32_t n = 0; n < 20; n++) {
+        BOOST_REQUIRE_EQUAL(first.receive(&frame), 0);
+        BOOST_CHECK(frameHolds(frame, n));
+        BOOST_CHECK_EQUAL(frame.header.sequence, n);
+        BOOST_REQUIRE_EQUAL(second.receive(&frame), 0);
+        BOOST_CHECK(frameHolds(frame, n));
+    }
+    BOOST_CHECK_EQUAL(first.getDropped(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(slowClientLosesOldestFrames)
+{
+    xsp3StreamClient client;
+    xsp3StreamFrame_t frame;
+    uint64_t received = 0;
+
+    server.configure(xsp3CompressNone, 5, 1, 2, xsp3StreamDropOldest);
+    connect(client, 1);
+    // Far more than the socket buffers and the queue hold, before the client reads any
+    for (uint32_t n = 0; n < 2000; n++)
+        submit(n);
+    while (received + client.getDropped() < 2000) {
+        BOOST_REQUIRE_EQUAL(client.receive(&frame), 0);
+        BOOST_CHECK(frameHolds(frame, frame.header.frameNumber));
+        received++;
+    }
+    BOOST_CHECK(client.getDropped() > 0);
+    BOOST_CHECK_EQUAL(received + client.getDropped(), 2000u);
+    // The newest frame always gets through
+    BOOST_CHECK_EQUAL(frame.header.frameNumber, 1999u);
+}
+
+BOOST_AUTO_TEST_CASE(slowClientIsDisconnected)
+{
+    xsp3StreamClient slow;
+    xsp3StreamFrame_t frame;
+    int clients = 1;
+    unsigned long frames, dropped, disconnected = 0;
+
+    server.configure(xsp3CompressNone, 5, 1, 2, xsp3StreamDisconnect);
+    connect(slow, 1);
+    for (uint32_t n = 0; n < 2000; n++)
+        submit(n);
+    for (int i = 0; i < 100 && clients > 0; i++) {
+        epicsThreadSleep(0.01);
+        server.getStats(&clients, &frames, &dropped, &disconnected);
+    }
+    BOOST_CHECK_EQUAL(clients, 0);
+    BOOST_CHECK_EQUAL(disconnected, 1u);
+    // What was sent before the disconnect arrives whole, then the stream ends
+    while (slow.receive(&frame) == 0)
+        BOOST_CHECK(frameHolds(frame, frame.header.frameNumber));
+    BOOST_CHECK(!slow.isConnected());
+}
+
+BOOST_AUTO_TEST_CASE(nothingQueuedWithoutClients)
+{
+    int clients;
+    unsigned long frames, dropped, disconnected;
+
+    submit(0);
+    server.getStats(&clients, &frames, &dropped, &disconnected);
+    BOOST_CHECK_EQUAL(clients, 0);
+    BOOST_CHECK_EQUAL(frames, 0u);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,55 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE SubFrame
+#include <boost/test/unit_test.hpp>
+
+#include <vector>
+#include "asynInt32SyncIO.h"
+#include "xspress3Epics.h"
+
+#define NUM_CHANNELS 10
+
+static const char portName[] = "subframe";
+
+static asynStatus writeInt32(const char *port, const char *drvInfo, int value)
+{
+    asynUser *pasynUser;
+    asynStatus status = pasynInt32SyncIO->connect(port, 0, &pasynUser, drvInfo);
+    if (status == asynSuccess) {
+        status = pasynInt32SyncIO->write(pasynUser, value, 1.0);
+        pasynInt32SyncIO->disconnect(pasynUser);
+    }
+    return status;
+}
+
+BOOST_AUTO_TEST_CASE(fewerChannelsThanTheSystem)
+{
+    // Sub-frames of 256 bins on 3 of the channels, so the array is smaller than the system
+    const size_t bins = 256, subFrames = 2, numChannels = 3;
+    Xspress3 xsp(portName, NUM_CHANNELS);
+    size_t dims[3];
+
+    BOOST_REQUIRE(writeInt32(portName, xsp3ConnectParamString, 1) == asynSuccess);
+    BOOST_CHECK(writeInt32(portName, xsp3NumChannelsParamString, numChannels) == asynSuccess);
+    BOOST_CHECK(writeInt32(portName, xsp3SubFrameBitsParamString, 8) == asynSuccess);
+    BOOST_CHECK(writeInt32(portName, xsp3SubFramesParamString, subFrames) == asynSuccess);
+    BOOST_CHECK_EQUAL(xsp.getDims(dims), 3);
+    BOOST_CHECK_EQUAL(dims[0], bins);
+    BOOST_CHECK_EQUAL(dims[1], numChannels);
+    BOOST_CHECK_EQUAL(dims[2], subFrames);
+
+    // A guard after the array catches sub-frames laid out for all the channels
+    std::vector<u_int32_t> frame(bins*numChannels*subFrames + bins*NUM_CHANNELS, 0xdeadbeef);
+    std::vector<u_int32_t> scalers(XSP3_SW_NUM_SCALERS*NUM_CHANNELS);
+    std::vector<u_int32_t> histogram(bins*subFrames*numChannels);
+    xsp3Api *xsp3 = xsp.getXsp3();
+    xsp3->histogram_start(xsp.getXsp3Handle(), -1);
+    BOOST_CHECK(xsp.readFrame(&scalers[0], &frame[0], 1, dims[0], dims[1]) == false);
+    // The histogram holds the sub-frames of each channel together
+    xsp3->histogram_read4d(xsp.getXsp3Handle(), &histogram[0], 0, 0, 0, 1, bins, subFrames, numChannels, 1);
+    for (size_t chan = 0; chan < numChannels; chan++)
+        for (size_t sf = 0; sf < subFrames; sf++)
+            for (size_t bin = 0; bin < bins; bin++)
+                BOOST_CHECK_EQUAL(frame[(sf*numChannels + chan)*bins + bin], histogram[(chan*subFrames + sf)*bins + bin]);
+    for (size_t i = bins*numChannels*subFrames; i < frame.size(); i++)
+        BOOST_CHECK_EQUAL(frame[i], 0xdeadbeefu);
+}
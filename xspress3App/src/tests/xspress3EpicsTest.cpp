@@ -62,7 +62,7 @@ BOOST_AUTO_TEST_CASE(readFrameDouble)
     double *pMCAData, *pSCA;
     pSCA = (double*)malloc(XSP3_SW_NUM_SCALERS * NUM_CHANNELS * 8);
     pMCAData = (double*)malloc(MAX_SPECTRA * NUM_CHANNELS * 8);
-    BOOST_CHECK(xsp.readFrame(pSCA, pMCAData, 1, MAX_SPECTRA) == false);
+    BOOST_CHECK(xsp.readFrame(pSCA, pMCAData, 1, MAX_SPECTRA, NUM_CHANNELS) == false);
     free(pSCA);
     free(pMCAData);
 }
@@ -70,7 +70,7 @@ BOOST_AUTO_TEST_CASE(readFrameDouble)
 BOOST_AUTO_TEST_CASE(readFrameUInt)
 {
     u_int32_t SCA[XSP3_SW_NUM_SCALERS], MCAData[MAX_SPECTRA * NUM_CHANNELS];
-    BOOST_CHECK(xsp.readFrame(&SCA[0], &MCAData[0], 1, MAX_SPECTRA) == false);
+    BOOST_CHECK(xsp.readFrame(&SCA[0], &MCAData[0], 1, MAX_SPECTRA, NUM_CHANNELS) == false);
 }
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -89,7 +89,7 @@ BOOST_AUTO_TEST_CASE(integration)
     pData = (double*)pMCA->pData;
     xsp.createSCAArray(pSCA);
     xsp3->histogram_start(xsp.getXsp3Handle(), -1);
-    xsp.readFrame(static_cast<double*>(pSCA), pData, 1, MAX_SPECTRA);
+    xsp.readFrame(static_cast<double*>(pSCA), pData, 1, MAX_SPECTRA, NUM_CHANNELS);
     BOOST_CHECK(pData[0] == 1);
     for (int i=0; i<MAX_SPECTRA; i++)
         BOOST_CHECK(pData[i] == (int)pData[i] % 100);
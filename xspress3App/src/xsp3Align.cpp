@@ -0,0 +1,126 @@
+/*
+ * xsp3Align.cpp
+ *
+ * Sum of the channels of a frame on a common energy axis.
+ */
+
+#include <math.h>
+#include "xsp3Align.h"
+
+xsp3Align::xsp3Align() :
+    inBins(0),
+    outBins(0)
+{
+}
+
+/**
+ * Work out the weights taking each channel onto the common axis. A channel
+ * whose calibration does not rise over the spectrum is left out of the sum.
+ *
+ * @param cals Calibration of each channel
+ * @param inBins Bins in each channel's spectrum
+ * @param offset keV at the centre of output bin 0
+ * @param gain keV per output bin, greater than 0
+ * @param outBins Bins in the sum
+ * @return The number of channels left out
+ */
+int xsp3Align::configure(const std::vector<xsp3EnergyCal_t> &cals, int inBins, double offset, double gain, int outBins)
+{
+    int numChannels = (int) cals.size();
+    int invalid = 0;
+    std::vector<double> edges(outBins + 1);
+
+    this->inBins = inBins;
+    this->outBins = outBins;
+    taps.assign(numChannels, 0);
+    start.assign(numChannels, std::vector<int>());
+    weights.assign(numChannels, std::vector<double>());
+    for (int chan = 0; chan < numChannels; chan++) {
+        int maxTaps = 0;
+
+        if (!xsp3EnergyCalValid(cals[chan], inBins) || gain <= 0) {
+            invalid++;
+            continue;
+        }
+        // Edges of the output bins, as positions on the channel's spectrum where
+        // input bin i runs from i to i+1, clipped to the spectrum
+        for (int j = 0; j <= outBins; j++) {
+            double edge = xsp3EnergyToBin(cals[chan], offset + gain*(j - 0.5)) + 0.5;
+            edges[j] = (edge < 0) ? 0 : (edge > inBins) ? inBins : edge;
+        }
+        for (int j = 0; j < outBins; j++) {
+            if (edges[j+1] > edges[j]) {
+                int n = (int) ceil(edges[j+1]) - (int) floor(edges[j]);
+                maxTaps = (n > maxTaps) ? n : maxTaps;
+            }
+        }
+        if (maxTaps == 0) {
+            // The axis misses the spectrum altogether
+            maxTaps = 1;
+        }
+        taps[chan] = maxTaps;
+        start[chan].assign(outBins, 0);
+        weights[chan].assign((size_t) outBins*maxTaps, 0.0);
+        for (int j = 0; j < outBins; j++) {
+            double low = edges[j], high = edges[j+1];
+            int first = (int) floor(low);
+
+            // Keep every tap on the spectrum; the weights past the range stay 0
+            first = (first + maxTaps > inBins) ? inBins - maxTaps : first;
+            start[chan][j] = first;
+            for (int t = 0; t < maxTaps && high > low; t++) {
+                double binLow = first + t, binHigh = first + t + 1;
+                double overlap = ((high < binHigh) ? high : binHigh) - ((low > binLow) ? low : binLow);
+                weights[chan][(size_t) j*maxTaps + t] = (overlap > 0) ? overlap : 0.0;
+            }
+        }
+    }
+    return invalid;
+}
+
+template <typename T>
+void xsp3Align::sumFrame(const T *pData, int inBins, int numChannels, int subFrames, double *out) const
+{
+    for (int j = 0; j < outBins; j++) {
+        out[j] = 0;
+    }
+    if (inBins != this->inBins) {
+        return;
+    }
+    for (int sub = 0; sub < subFrames; sub++) {
+        for (int chan = 0; chan < numChannels && chan < (int) taps.size(); chan++) {
+            const T *pSpectrum = pData + ((size_t) sub*numChannels + chan)*inBins;
+            const int n = taps[chan];
+            if (n == 0) {
+                continue;
+            }
+            const int *pStart = &start[chan][0];
+            const double *pWeights = &weights[chan][0];
+            for (int j = 0; j < outBins; j++) {
+                const T *pIn = pSpectrum + pStart[j];
+                const double *pW = pWeights + (size_t) j*n;
+                double total = 0;
+                for (int t = 0; t < n; t++) {
+                    total += pW[t]*pIn[t];
+                }
+                out[j] += total;
+            }
+        }
+    }
+}
+
+/**
+ * Sum the channels of a frame on the common axis.
+ * @param pData The frame, inBins x channels x sub-frames
+ * @param out Set to the sum, over all the channels and sub-frames, of
+ *        the bins given to configure. All 0 if inBins has changed since.
+ */
+void xsp3Align::sum(const epicsUInt32 *pData, int inBins, int numChannels, int subFrames, double *out) const
+{
+    sumFrame(pData, inBins, numChannels, subFrames, out);
+}
+
+void xsp3Align::sum(const epicsFloat64 *pData, int inBins, int numChannels, int subFrames, double *out) const
+{
+    sumFrame(pData, inBins, numChannels, subFrames, out);
+}
@@ -0,0 +1,46 @@
+/*
+ * xsp3Align.h
+ *
+ * Sum of the channels of a frame in energy. Each channel's spectrum is
+ * resampled onto a common linear energy axis through its calibration, so
+ * channels with slightly different gains add up to sharp peaks instead of
+ * broadened ones.
+ *
+ * Each output bin takes the share of every input bin whose energy range it
+ * overlaps, so counts are conserved. The shares are worked out when a
+ * calibration or the axis changes and kept as a fixed number of weights
+ * per output bin, starting at an input bin, so each frame is only a short
+ * dot product for every bin of every channel.
+ */
+
+#ifndef XSP3ALIGN_H_
+#define XSP3ALIGN_H_
+
+#include <vector>
+#include "epicsTypes.h"
+#include "xsp3EnergyRoi.h"
+
+class xsp3Align {
+public:
+    xsp3Align();
+
+    int configure(const std::vector<xsp3EnergyCal_t> &cals, int inBins, double offset, double gain, int outBins);
+    void sum(const epicsUInt32 *pData, int inBins, int numChannels, int subFrames, double *out) const;
+    void sum(const epicsFloat64 *pData, int inBins, int numChannels, int subFrames, double *out) const;
+
+    int getInBins(void) const { return inBins; }
+    int getOutBins(void) const { return outBins; }
+    int getTaps(int channel) const { return taps[channel]; }
+
+private:
+    template <typename T>
+    void sumFrame(const T *pData, int inBins, int numChannels, int subFrames, double *out) const;
+
+    int inBins;
+    int outBins;
+    std::vector<int> taps;                  // [channel], weights per output bin, 0 to leave the channel out
+    std::vector<std::vector<int> > start;   // [channel][output bin], first input bin
+    std::vector<std::vector<double> > weights; // [channel][output bin][tap]
+};
+
+#endif /* XSP3ALIGN_H_ */
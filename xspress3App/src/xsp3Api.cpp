@@ -1,6 +1,7 @@
 #include "xsp3Api.h"
 
 #define XSP3IF_DEBUG 0x100
+#define XSP3_TRACE_NARGS(args) ((int) (sizeof(args)/sizeof((args)[0])))
 
 /* Uncomment this line to enable debugging */
 xsp3Api::xsp3Api( asynUser * user ) :
@@ -11,8 +12,38 @@ xsp3Api::~xsp3Api()
 {
 }
 
+/**
+ * Start recording every call into a trace file, see xsp3Trace.h.
+ * @param fileName The file to create
+ * @param size Size of the ring in bytes. When it is full the oldest calls are dropped.
+ * @param buffers Record the frame data returned by the read calls too
+ * @return XSP3_OK, or XSP3_ERROR with the reason in getTraceError()
+ */
+int xsp3Api::startTrace(const char *fileName, size_t size, bool buffers)
+{
+    return tracer.open(fileName, size, buffers);
+}
+
+void xsp3Api::stopTrace()
+{
+    tracer.close();
+}
+
+void xsp3Api::trace(int call, int status, const xsp3ApiCallTimer &timer, const int64_t *args, int numArgs,
+                    const void *output, size_t outputSize, const void *output2, size_t output2Size,
+                    const char *text1, const char *text2, const char *text3)
+{
+    double start = timer.started();
+
+    // Tracing was started during the call
+    if (start < 0.0) return;
+    tracer.record(call, status, start, xsp3ApiStats::now() - start, args, numArgs,
+                  output, outputSize, output2, output2Size, text1, text2, text3);
+}
+
 int xsp3Api::clocks_setup(int path, int card, int clk_src, int flags, int tp_type)
 {
+    xsp3ApiCallTimer timer(stats, xsp3CallClocksSetup, tracer.enabled());
     int status;
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "xsp3_clocks_setup( %d, %d, %d, %x, %d ) = ", path, card, clk_src, flags, tp_type );
 
@@ -20,11 +51,18 @@ int xsp3Api::clocks_setup(int path, int card, int clk_src, int flags, int tp_typ
 
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "%d\n", status );
 
+    if (tracer.enabled())
+    {
+        int64_t args[] = { path, card, clk_src, flags, tp_type };
+        trace(xsp3CallClocksSetup, status, timer, args, XSP3_TRACE_NARGS(args));
+    }
+
     return status;
 }
 
 int xsp3Api::close(int path)
 {
+    xsp3ApiCallTimer timer(stats, xsp3CallClose, tracer.enabled());
     int status;
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "xsp3_close( %d ) = ", path );
 
@@ -32,11 +70,18 @@ int xsp3Api::close(int path)
 
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "%d\n", status );
 
+    if (tracer.enabled())
+    {
+        int64_t args[] = { path };
+        trace(xsp3CallClose, status, timer, args, XSP3_TRACE_NARGS(args));
+    }
+
     return status;
 }
 
 int xsp3Api::config(int ncards, int num_tf, char* baseIPaddress, int basePort, char* baseMACaddress, int nchan, int createmodule, char* modname, int debug, int card_index)
 {
+    xsp3ApiCallTimer timer(stats, xsp3CallConfig, tracer.enabled());
     int status;
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "xsp3_config( %d, %d, %s, %d, %s, %d, %d, %s, %d, %d ) = ", ncards, num_tf, baseIPaddress, basePort, baseMACaddress, nchan, createmodule, modname, debug, card_index );
 
@@ -44,11 +89,18 @@ int xsp3Api::config(int ncards, int num_tf, char* baseIPaddress, int basePort, c
 
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "%d\n", status );
 
+    if (tracer.enabled())
+    {
+        int64_t args[] = { ncards, num_tf, basePort, nchan, createmodule, debug, card_index };
+        trace(xsp3CallConfig, status, timer, args, XSP3_TRACE_NARGS(args), NULL, 0, NULL, 0, baseIPaddress, baseMACaddress, modname);
+    }
+
     return status;
 }
 
 int xsp3Api::format_run(int path, int chan, int aux1_mode, int res_thres, int aux2_cont, int disables, int aux2_mode, int nbits_eng)
 {
+    xsp3ApiCallTimer timer(stats, xsp3CallFormatRun, tracer.enabled());
     int status;
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "xsp3_format_run( %d, %d, %d, %d, %d, %d, %d, %d ) = ", path, chan, aux1_mode, res_thres, aux2_cont, disables, aux2_mode, nbits_eng);
 
@@ -56,6 +108,12 @@ int xsp3Api::format_run(int path, int chan, int aux1_mode, int res_thres, int au
 
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "%d\n", status );
 
+    if (tracer.enabled())
+    {
+        int64_t args[] = { path, chan, aux1_mode, res_thres, aux2_cont, disables, aux2_mode, nbits_eng };
+        trace(xsp3CallFormatRun, status, timer, args, XSP3_TRACE_NARGS(args));
+    }
+
     return status;
 }
 
@@ -65,6 +123,7 @@ int xsp3Api::getDeadtimeCorrectionParameters(int path, int chan, int *flags,
                                            double *processDeadTimeInWindowOffset, 
                                            double *processDeadTimeInWindowGradient)
 {
+    xsp3ApiCallTimer timer(stats, xsp3CallGetDeadtimeCorrectionParameters, tracer.enabled());
     int status;
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "xsp3_getDeadtimeCorrectionParameters( %d, %d, &%d,",
                  path, chan, *flags );
@@ -82,11 +141,21 @@ int xsp3Api::getDeadtimeCorrectionParameters(int path, int chan, int *flags,
                  *processDeadTimeInWindowGradient,
                  status );
 
+    if (tracer.enabled())
+    {
+        int64_t args[] = { path, chan };
+        double values[] = { *processDeadTimeAllEventGradient, *processDeadTimeAllEventOffset,
+                            *processDeadTimeInWindowOffset, *processDeadTimeInWindowGradient };
+        trace(xsp3CallGetDeadtimeCorrectionParameters, status, timer, args, XSP3_TRACE_NARGS(args),
+              values, sizeof(values), flags, sizeof(int));
+    }
+
     return status;
 }
 
 char* xsp3Api::get_error_message()
 {
+    xsp3ApiCallTimer timer(stats, xsp3CallGetErrorMessage, tracer.enabled());
     char *message;
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "xsp3_get_error_message() = " );
 
@@ -94,11 +163,15 @@ char* xsp3Api::get_error_message()
 
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "%s\n", message );
 
+    if (tracer.enabled())
+        trace(xsp3CallGetErrorMessage, 0, timer, NULL, 0, NULL, 0, NULL, 0, message);
+
     return message;
 }
 
 int xsp3Api::get_good_thres(int path, int chan, uint32_t *good_thres)
 {
+    xsp3ApiCallTimer timer(stats, xsp3CallGetGoodThres, tracer.enabled());
     int status;
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "xsp3_get_good_thres( %d, %d ", path, chan );
 
@@ -106,11 +179,18 @@ int xsp3Api::get_good_thres(int path, int chan, uint32_t *good_thres)
 
     asynPrint(this->pasynUser, XSP3IF_DEBUG, ", &%d ) = %d\n", *good_thres, status );
 
+    if (tracer.enabled())
+    {
+        int64_t args[] = { path, chan };
+        trace(xsp3CallGetGoodThres, status, timer, args, XSP3_TRACE_NARGS(args), good_thres, sizeof(uint32_t));
+    }
+
     return status;
 }
 
 int xsp3Api::get_window(int path, int chan, int win, uint32_t *low, uint32_t *high)
 {
+    xsp3ApiCallTimer timer(stats, xsp3CallGetWindow, tracer.enabled());
     int status;
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "xsp3_get_window( %d, %d, %d ", path, chan, win );
 
@@ -118,12 +198,20 @@ int xsp3Api::get_window(int path, int chan, int win, uint32_t *low, uint32_t *hi
 
     asynPrint(this->pasynUser, XSP3IF_DEBUG, ", &%d, &%d ) = %d\n", *low, *high, status );
 
+    if (tracer.enabled())
+    {
+        int64_t args[] = { path, chan, win };
+        uint32_t values[] = { *low, *high };
+        trace(xsp3CallGetWindow, status, timer, args, XSP3_TRACE_NARGS(args), values, sizeof(values));
+    }
+
     return status;
 }
 
 int xsp3Api::hist_dtc_read4d(int path, double *hist_buff, double *scal_buff, unsigned eng, unsigned aux, unsigned chan, unsigned tf,
                          unsigned num_eng, unsigned num_aux, unsigned num_chan, unsigned num_tf)
 {
+    xsp3ApiCallTimer timer(stats, xsp3CallHistDtcRead4d, tracer.enabled());
     int status;
 
     status = xsp3Api_hist_dtc_read4d( path, hist_buff, scal_buff, eng, aux, chan, tf,
@@ -137,11 +225,40 @@ int xsp3Api::hist_dtc_read4d(int path, double *hist_buff, double *scal_buff, uns
 
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "%d\n", status );
 
+    if (tracer.enabled())
+    {
+        int64_t args[] = { path, eng, aux, chan, tf, num_eng, num_aux, num_chan, num_tf };
+        bool buffers = tracer.recordBuffers();
+        trace(xsp3CallHistDtcRead4d, status, timer, args, XSP3_TRACE_NARGS(args),
+              buffers ? hist_buff : NULL, (size_t) num_eng*num_aux*num_chan*num_tf*sizeof(double),
+              buffers ? scal_buff : NULL, (size_t) XSP3_SW_NUM_SCALERS*num_chan*num_tf*sizeof(double));
+    }
+
+    return status;
+}
+
+int xsp3Api::histogram_circ_ack(int path, unsigned chan, unsigned tf, unsigned num_chan, unsigned num_tf)
+{
+    xsp3ApiCallTimer timer(stats, xsp3CallHistogramCircAck, tracer.enabled());
+    int status;
+    asynPrint(this->pasynUser, XSP3IF_DEBUG, "xsp3_histogram_circ_ack( %d, %u, %u, %u, %u ) = ", path, chan, tf, num_chan, num_tf);
+
+    status = xsp3Api_histogram_circ_ack( path, chan, tf, num_chan, num_tf);
+
+    asynPrint(this->pasynUser, XSP3IF_DEBUG, "%d\n", status );
+
+    if (tracer.enabled())
+    {
+        int64_t args[] = { path, chan, tf, num_chan, num_tf };
+        trace(xsp3CallHistogramCircAck, status, timer, args, XSP3_TRACE_NARGS(args));
+    }
+
     return status;
 }
 
 int xsp3Api::histogram_clear(int path, int first_chan, int num_chan, int first_frame, int num_frames)
 {
+    xsp3ApiCallTimer timer(stats, xsp3CallHistogramClear, tracer.enabled());
     int status;
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "xsp3_histogram_clear( %d, %d, %d, %d, %d ) = ", path, first_chan, num_chan, first_frame, num_frames);
 
@@ -149,11 +266,18 @@ int xsp3Api::histogram_clear(int path, int first_chan, int num_chan, int first_f
 
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "%d\n", status );
 
+    if (tracer.enabled())
+    {
+        int64_t args[] = { path, first_chan, num_chan, first_frame, num_frames };
+        trace(xsp3CallHistogramClear, status, timer, args, XSP3_TRACE_NARGS(args));
+    }
+
     return status;
 }
 
 int xsp3Api::histogram_pause(int path, int card)
 {
+    xsp3ApiCallTimer timer(stats, xsp3CallHistogramPause, tracer.enabled());
     int status;
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "xsp3_histogram_pause( %d, %d ) = ", path, card );
 
@@ -161,11 +285,18 @@ int xsp3Api::histogram_pause(int path, int card)
 
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "%d\n", status );
 
+    if (tracer.enabled())
+    {
+        int64_t args[] = { path, card };
+        trace(xsp3CallHistogramPause, status, timer, args, XSP3_TRACE_NARGS(args));
+    }
+
     return status;
 }
 
 int xsp3Api::histogram_arm(int path, int card)
 {
+    xsp3ApiCallTimer timer(stats, xsp3CallHistogramArm, tracer.enabled());
     int status;
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "xsp3_histogram_arm( %d, %d ) = ", path, card );
 
@@ -173,11 +304,18 @@ int xsp3Api::histogram_arm(int path, int card)
 
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "%d\n", status );
 
+    if (tracer.enabled())
+    {
+        int64_t args[] = { path, card };
+        trace(xsp3CallHistogramArm, status, timer, args, XSP3_TRACE_NARGS(args));
+    }
+
     return status;
 }
 
 int xsp3Api::histogram_continue(int path, int card)
 {
+    xsp3ApiCallTimer timer(stats, xsp3CallHistogramContinue, tracer.enabled());
     int status;
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "xsp3_histogram_continue( %d, %d ) = ", path, card );
 
@@ -185,11 +323,18 @@ int xsp3Api::histogram_continue(int path, int card)
 
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "%d\n", status );
 
+    if (tracer.enabled())
+    {
+        int64_t args[] = { path, card };
+        trace(xsp3CallHistogramContinue, status, timer, args, XSP3_TRACE_NARGS(args));
+    }
+
     return status;
 }
 
 int xsp3Api::histogram_is_any_busy(int path)
 {
+    xsp3ApiCallTimer timer(stats, xsp3CallHistogramIsAnyBusy, tracer.enabled());
     int status;
 asynPrint(this->pasynUser, XSP3IF_DEBUG, "xsp3_histogram_is_any_busy( %d ) = ", path );
 
@@ -197,11 +342,18 @@ asynPrint(this->pasynUser, XSP3IF_DEBUG, "xsp3_histogram_is_any_busy( %d ) = ",
 
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "%d\n", status );
 
+    if (tracer.enabled())
+    {
+        int64_t args[] = { path };
+        trace(xsp3CallHistogramIsAnyBusy, status, timer, args, XSP3_TRACE_NARGS(args));
+    }
+
     return status;
 }
 
 int xsp3Api::histogram_read4d(int path, uint32_t *buffer, unsigned eng, unsigned aux, unsigned chan, unsigned tf, unsigned num_eng, unsigned num_aux, unsigned num_chan, unsigned num_tf)
 {
+    xsp3ApiCallTimer timer(stats, xsp3CallHistogramRead4d, tracer.enabled());
     int status;
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "xsp3_histogram_read4d( %d, &%u..., %u, %u, %u, %u, %u, %u, %u, %u, ) = ",
                  path, *buffer, eng, aux, chan, tf, num_eng, num_aux, num_chan, num_tf);
@@ -210,11 +362,19 @@ int xsp3Api::histogram_read4d(int path, uint32_t *buffer, unsigned eng, unsigned
 
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "%d\n", status );
 
+    if (tracer.enabled())
+    {
+        int64_t args[] = { path, eng, aux, chan, tf, num_eng, num_aux, num_chan, num_tf };
+        trace(xsp3CallHistogramRead4d, status, timer, args, XSP3_TRACE_NARGS(args),
+              tracer.recordBuffers() ? buffer : NULL, (size_t) num_eng*num_aux*num_chan*num_tf*sizeof(uint32_t));
+    }
+
     return status;
 }
 
 int xsp3Api::histogram_start(int path, int card)
 {
+    xsp3ApiCallTimer timer(stats, xsp3CallHistogramStart, tracer.enabled());
     int status;
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "xsp3_histogram_start( %d, %d ) = ", path, card );
 
@@ -222,11 +382,18 @@ int xsp3Api::histogram_start(int path, int card)
 
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "%d\n", status );
 
+    if (tracer.enabled())
+    {
+        int64_t args[] = { path, card };
+        trace(xsp3CallHistogramStart, status, timer, args, XSP3_TRACE_NARGS(args));
+    }
+
     return status;
 }
 
 int xsp3Api::histogram_stop(int path, int card)
 {
+    xsp3ApiCallTimer timer(stats, xsp3CallHistogramStop, tracer.enabled());
     int status;
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "xsp3_histogram_stop( %d, %d ) = ", path, card );
 
@@ -234,11 +401,18 @@ int xsp3Api::histogram_stop(int path, int card)
 
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "%d\n", status );
 
+    if (tracer.enabled())
+    {
+        int64_t args[] = { path, card };
+        trace(xsp3CallHistogramStop, status, timer, args, XSP3_TRACE_NARGS(args));
+    }
+
     return status;
 }
 
 int xsp3Api::restore_settings(int path, char *dir_name, int force_mismatch)
 {
+    xsp3ApiCallTimer timer(stats, xsp3CallRestoreSettings, tracer.enabled());
     int status;
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "xsp3_restore_settings( %d, %s, %d ) = ", path, dir_name, force_mismatch );
 
@@ -246,11 +420,18 @@ int xsp3Api::restore_settings(int path, char *dir_name, int force_mismatch)
 
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "%d\n", status );
 
+    if (tracer.enabled())
+    {
+        int64_t args[] = { path, force_mismatch };
+        trace(xsp3CallRestoreSettings, status, timer, args, XSP3_TRACE_NARGS(args), NULL, 0, NULL, 0, dir_name);
+    }
+
     return status;
 }
 
 int xsp3Api::save_settings(int path, char *dir_name)
 {
+    xsp3ApiCallTimer timer(stats, xsp3CallSaveSettings, tracer.enabled());
     int status;
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "xsp3_save_settings( %d, %s ) = ", path, dir_name );
 
@@ -258,11 +439,18 @@ int xsp3Api::save_settings(int path, char *dir_name)
 
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "%d\n", status );
 
+    if (tracer.enabled())
+    {
+        int64_t args[] = { path };
+        trace(xsp3CallSaveSettings, status, timer, args, XSP3_TRACE_NARGS(args), NULL, 0, NULL, 0, dir_name);
+    }
+
     return status;
 }
 
 int xsp3Api::scaler_check_progress(int path)
 {
+    xsp3ApiCallTimer timer(stats, xsp3CallScalerCheckProgress, tracer.enabled());
     int status;
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "xsp3_scaler_check_progress( %d ) = ", path );
 
@@ -270,11 +458,18 @@ int xsp3Api::scaler_check_progress(int path)
 
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "%d\n", status );
 
+    if (tracer.enabled())
+    {
+        int64_t args[] = { path };
+        trace(xsp3CallScalerCheckProgress, status, timer, args, XSP3_TRACE_NARGS(args));
+    }
+
     return status;
 }
 
 int xsp3Api::set_glob_timeA(int path, int card, uint32_t time)
 {
+    xsp3ApiCallTimer timer(stats, xsp3CallSetGlobTimeA, tracer.enabled());
     int status;
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "xsp3_set_glob_timeA( %d, %d, %x ) = ", path, card, time);
 
@@ -282,11 +477,18 @@ int xsp3Api::set_glob_timeA(int path, int card, uint32_t time)
 
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "%d\n", status );
 
+    if (tracer.enabled())
+    {
+        int64_t args[] = { path, card, time };
+        trace(xsp3CallSetGlobTimeA, status, timer, args, XSP3_TRACE_NARGS(args));
+    }
+
     return status;
 }
 
 int xsp3Api::set_glob_timeFixed(int path, int card, uint32_t time)
 {
+    xsp3ApiCallTimer timer(stats, xsp3CallSetGlobTimeFixed, tracer.enabled());
     int status;
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "xsp3_set_glob_timeFixed( %d, %d, %u ) = ", path, card, time);
 
@@ -294,11 +496,18 @@ int xsp3Api::set_glob_timeFixed(int path, int card, uint32_t time)
 
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "%d\n", status );
 
+    if (tracer.enabled())
+    {
+        int64_t args[] = { path, card, time };
+        trace(xsp3CallSetGlobTimeFixed, status, timer, args, XSP3_TRACE_NARGS(args));
+    }
+
     return status;
 }
 
 int xsp3Api::set_good_thres(int path, int chan, uint32_t good_thres)
 {
+    xsp3ApiCallTimer timer(stats, xsp3CallSetGoodThres, tracer.enabled());
     int status;
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "xsp3_set_good_thres( %d, %d, %u ) = ", path, chan, good_thres);
 
@@ -306,11 +515,18 @@ int xsp3Api::set_good_thres(int path, int chan, uint32_t good_thres)
 
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "%d\n", status );
 
+    if (tracer.enabled())
+    {
+        int64_t args[] = { path, chan, good_thres };
+        trace(xsp3CallSetGoodThres, status, timer, args, XSP3_TRACE_NARGS(args));
+    }
+
     return status;
 }
 
 int xsp3Api::set_run_flags(int path, int flags)
 {
+    xsp3ApiCallTimer timer(stats, xsp3CallSetRunFlags, tracer.enabled());
     int status;
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "xsp3_set_run_flags( %d, 0x%X ) = ", path, flags);
 
@@ -318,11 +534,18 @@ int xsp3Api::set_run_flags(int path, int flags)
 
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "%d\n", status );
 
+    if (tracer.enabled())
+    {
+        int64_t args[] = { path, flags };
+        trace(xsp3CallSetRunFlags, status, timer, args, XSP3_TRACE_NARGS(args));
+    }
+
     return status;
 }
 
 int xsp3Api::set_window(int path, int chan, int win, int low, int high)
 {
+    xsp3ApiCallTimer timer(stats, xsp3CallSetWindow, tracer.enabled());
     int status;
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "xsp3_set_window( %d, %d, %d, %d. %d ) = ", path, chan, win, low, high);
 
@@ -330,11 +553,18 @@ int xsp3Api::set_window(int path, int chan, int win, int low, int high)
 
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "%d\n", status );
 
+    if (tracer.enabled())
+    {
+        int64_t args[] = { path, chan, win, low, high };
+        trace(xsp3CallSetWindow, status, timer, args, XSP3_TRACE_NARGS(args));
+    }
+
     return status;
 }
 
 int xsp3Api::itfg_setup(int path, int card, int num_tf, uint32_t col_time, int trig_mode, int gap_mode)
 {
+    xsp3ApiCallTimer timer(stats, xsp3CallItfgSetup, tracer.enabled());
     int status;
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "xsp3_itfg_setup( %d, %d, %d, %u, %d, %d ) = ", path, card, num_tf, col_time, trig_mode, gap_mode);
 
@@ -342,11 +572,18 @@ int xsp3Api::itfg_setup(int path, int card, int num_tf, uint32_t col_time, int t
 
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "%d\n", status );
 
+    if (tracer.enabled())
+    {
+        int64_t args[] = { path, card, num_tf, col_time, trig_mode, gap_mode };
+        trace(xsp3CallItfgSetup, status, timer, args, XSP3_TRACE_NARGS(args));
+    }
+
     return status;
 }
 
 int xsp3Api::itfg_setup2(int path, int card, int num_tf, uint32_t col_time, int trig_mode, int gap_mode, int acq_in_pause, int marker_period, int marker_frame)
 {
+    xsp3ApiCallTimer timer(stats, xsp3CallItfgSetup2, tracer.enabled());
     int status;
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "xsp3_itfg_setup2( %d, %d, %d, %u, %d, %d, %d, %d, %d ) = ", path, card, num_tf, col_time, trig_mode, gap_mode, acq_in_pause, marker_period, marker_frame);
 
@@ -354,10 +591,17 @@ int xsp3Api::itfg_setup2(int path, int card, int num_tf, uint32_t col_time, int
 
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "%d\n", status );
 
+    if (tracer.enabled())
+    {
+        int64_t args[] = { path, card, num_tf, col_time, trig_mode, gap_mode, acq_in_pause, marker_period, marker_frame };
+        trace(xsp3CallItfgSetup2, status, timer, args, XSP3_TRACE_NARGS(args));
+    }
+
     return status;
 }
 
 int xsp3Api::itfg_start(int path, int card) {
+    xsp3ApiCallTimer timer(stats, xsp3CallItfgStart, tracer.enabled());
     int status;
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "xsp3_itfg_start( %d, %d ) = ", path, card);
 
@@ -365,10 +609,17 @@ int xsp3Api::itfg_start(int path, int card) {
 
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "%d\n", status );
 
+    if (tracer.enabled())
+    {
+        int64_t args[] = { path, card };
+        trace(xsp3CallItfgStart, status, timer, args, XSP3_TRACE_NARGS(args));
+    }
+
     return status;
 }
 
 int xsp3Api::itfg_stop(int path, int card) {
+    xsp3ApiCallTimer timer(stats, xsp3CallItfgStop, tracer.enabled());
     int status;
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "xsp3_itfg_stop( %d, %d ) = ", path, card);
 
@@ -376,6 +627,12 @@ int xsp3Api::itfg_stop(int path, int card) {
 
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "%d\n", status );
 
+    if (tracer.enabled())
+    {
+        int64_t args[] = { path, card };
+        trace(xsp3CallItfgStop, status, timer, args, XSP3_TRACE_NARGS(args));
+    }
+
     return status;
 }
 
@@ -384,6 +641,7 @@ int xsp3Api::itfg_stop(int path, int card) {
 
 int xsp3Api::has_itfg(int path, int card )
 {
+    xsp3ApiCallTimer timer(stats, xsp3CallHasItfg, tracer.enabled());
     int status;
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "xsp3_has_itfg( %d, %d ) = ", path, card);
 
@@ -391,11 +649,18 @@ int xsp3Api::has_itfg(int path, int card )
 
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "%d\n", status );
 
+    if (tracer.enabled())
+    {
+        int64_t args[] = { path, card };
+        trace(xsp3CallHasItfg, status, timer, args, XSP3_TRACE_NARGS(args));
+    }
+
     return status;
 }
 
 int xsp3Api::scaler_read(int path, uint32_t *dest, unsigned scaler, unsigned chan, unsigned t, unsigned n_scalers, unsigned n_chan, unsigned dt)
 {
+    xsp3ApiCallTimer timer(stats, xsp3CallScalerRead, tracer.enabled());
     int status;
 
     status = xsp3Api_scaler_read(path, dest, scaler, chan, t, n_scalers, n_chan, dt);
@@ -407,11 +672,19 @@ int xsp3Api::scaler_read(int path, uint32_t *dest, unsigned scaler, unsigned cha
 
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "%d\n", status );
 
+    if (tracer.enabled())
+    {
+        int64_t args[] = { path, scaler, chan, t, n_scalers, n_chan, dt };
+        trace(xsp3CallScalerRead, status, timer, args, XSP3_TRACE_NARGS(args),
+              tracer.recordBuffers() ? dest : NULL, (size_t) n_scalers*n_chan*dt*sizeof(uint32_t));
+    }
+
     return status;
 }
 
 int xsp3Api::get_trigger_b(int path, unsigned card, Xspress3_TriggerB *trig_b)
 {
+    xsp3ApiCallTimer timer(stats, xsp3CallGetTriggerB, tracer.enabled());
     int status;
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "xsp3_get_trigger_b( %d, %d ) = ", path, card);
 
@@ -419,11 +692,18 @@ int xsp3Api::get_trigger_b(int path, unsigned card, Xspress3_TriggerB *trig_b)
 
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "%d\n", status );
 
+    if (tracer.enabled())
+    {
+        int64_t args[] = { path, card };
+        trace(xsp3CallGetTriggerB, status, timer, args, XSP3_TRACE_NARGS(args), trig_b, sizeof(Xspress3_TriggerB));
+    }
+
     return status;
 }
 
 int xsp3Api::get_dtcfactor(int path, u_int32_t *scaData, double *dtcFactor, double *dtcAllEvent, unsigned chan) 
 {
+    xsp3ApiCallTimer timer(stats, xsp3CallGetDtcfactor, tracer.enabled());
     int status;
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "xsp3_get_dtcfactor( %d, %d ) = ", path, chan);
 
@@ -431,12 +711,20 @@ int xsp3Api::get_dtcfactor(int path, u_int32_t *scaData, double *dtcFactor, doub
 
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "%d\n", status );
 
+    if (tracer.enabled())
+    {
+        int64_t args[] = { path, chan };
+        double values[] = { dtcFactor ? *dtcFactor : 0.0, dtcAllEvent ? *dtcAllEvent : 0.0 };
+        trace(xsp3CallGetDtcfactor, status, timer, args, XSP3_TRACE_NARGS(args), values, sizeof(values));
+    }
+
     return status;
 
 }
 
 int xsp3Api::get_generation(int path, int card) 
 {
+    xsp3ApiCallTimer timer(stats, xsp3CallGetGeneration, tracer.enabled());
     int status;
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "xsp3_get_generation( %d, %d ) = ", path, card);
 
@@ -444,6 +732,50 @@ int xsp3Api::get_generation(int path, int card)
 
     asynPrint(this->pasynUser, XSP3IF_DEBUG, "%d\n", status );
 
+    if (tracer.enabled())
+    {
+        int64_t args[] = { path, card };
+        trace(xsp3CallGetGeneration, status, timer, args, XSP3_TRACE_NARGS(args));
+    }
+
     return status;
 
 }
+
+int xsp3Api::histogram_get_tf_markers(int path, int chan, unsigned tf, unsigned num_tf, int *markers)
+{
+    xsp3ApiCallTimer timer(stats, xsp3CallHistogramGetTfMarkers, tracer.enabled());
+    int status;
+    asynPrint(this->pasynUser, XSP3IF_DEBUG, "xsp3_histogram_get_tf_markers( %d, %d, %u, %u ) = ", path, chan, tf, num_tf);
+
+    status = xsp3Api_histogram_get_tf_markers(path, chan, tf, num_tf, markers);
+
+    asynPrint(this->pasynUser, XSP3IF_DEBUG, "%d\n", status );
+
+    if (tracer.enabled())
+    {
+        int64_t args[] = { path, chan, tf, num_tf };
+        trace(xsp3CallHistogramGetTfMarkers, status, timer, args, XSP3_TRACE_NARGS(args), markers, (size_t) num_tf*sizeof(int));
+    }
+
+    return status;
+}
+
+int xsp3Api::format_sub_frames(int path, int chan, int just_good, int just_good_thres, int flags, int nbits_eng, int num_sub_frames, int ts_divide)
+{
+    xsp3ApiCallTimer timer(stats, xsp3CallFormatSubFrames, tracer.enabled());
+    int status;
+    asynPrint(this->pasynUser, XSP3IF_DEBUG, "xsp3_format_sub_frames( %d, %d, %d, %d, %d, %d, %d, %d ) = ", path, chan, just_good, just_good_thres, flags, nbits_eng, num_sub_frames, ts_divide);
+
+    status = xsp3Api_format_sub_frames(path, chan, just_good, just_good_thres, flags, nbits_eng, num_sub_frames, ts_divide);
+
+    asynPrint(this->pasynUser, XSP3IF_DEBUG, "%d\n", status );
+
+    if (tracer.enabled())
+    {
+        int64_t args[] = { path, chan, just_good, just_good_thres, flags, nbits_eng, num_sub_frames, ts_divide };
+        trace(xsp3CallFormatSubFrames, status, timer, args, XSP3_TRACE_NARGS(args));
+    }
+
+    return status;
+}
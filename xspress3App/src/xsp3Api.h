@@ -29,11 +29,13 @@
 #include "inttypes.h"
 #include "xspress3.h"
 #include "asynDriver.h"
+#include "xsp3ApiStats.h"
+#include "xsp3Trace.h"
 
 class xsp3Api {
 public:
     xsp3Api(asynUser * pasynUser);
-    ~xsp3Api();
+    virtual ~xsp3Api();
 
 protected:
     virtual int xsp3Api_clocks_setup(int path, int card, int clk_src, int flags, int tp_type) = 0;
@@ -47,6 +49,7 @@ protected:
     virtual int xsp3Api_get_window(int path, int chan, int win, uint32_t *low, uint32_t *high) = 0;
     virtual int xsp3Api_hist_dtc_read4d(int path, double *hist_buff, double *scal_buff, unsigned eng, unsigned aux, unsigned chan, unsigned tf,
                                      unsigned num_eng, unsigned num_aux, unsigned num_chan, unsigned num_tf) = 0;
+    virtual int xsp3Api_histogram_circ_ack(int path, unsigned chan, unsigned tf, unsigned num_chan, unsigned num_tf) = 0;
     virtual int xsp3Api_histogram_clear(int path, int first_chan, int num_chan, int first_frame, int num_frames) = 0;
     virtual int xsp3Api_histogram_arm(int path, int card) = 0;
     virtual int xsp3Api_histogram_continue(int path, int card) = 0;
@@ -72,6 +75,8 @@ protected:
     virtual int xsp3Api_get_trigger_b(int path, unsigned chan, Xspress3_TriggerB *trig_b) = 0;
     virtual int xsp3Api_get_dtcfactor(int path, u_int32_t *scaData, double *dtcFactor, double *dtcAllEvent, unsigned chan) = 0;
     virtual int xsp3Api_get_generation(int path, int card) = 0;
+    virtual int xsp3Api_histogram_get_tf_markers(int path, int chan, unsigned tf, unsigned num_tf, int *markers) = 0;
+    virtual int xsp3Api_format_sub_frames(int path, int chan, int just_good, int just_good_thres, int flags, int nbits_eng, int num_sub_frames, int ts_divide) = 0;
 
 public:
     int clocks_setup(int path, int card, int clk_src, int flags, int tp_type);
@@ -85,6 +90,7 @@ public:
     int get_window(int path, int chan, int win, uint32_t *low, uint32_t *high);
     int hist_dtc_read4d(int path, double *hist_buff, double *scal_buff, unsigned eng, unsigned aux, unsigned chan, unsigned tf,
                     unsigned num_eng, unsigned num_aux, unsigned num_chan, unsigned num_tf);
+    int histogram_circ_ack(int path, unsigned chan, unsigned tf, unsigned num_chan, unsigned num_tf);
     int histogram_clear(int path, int first_chan, int num_chan, int first_frame, int num_frames);
     int histogram_pause(int path, int card);
     int histogram_arm(int path, int card);
@@ -110,9 +116,23 @@ public:
     int get_trigger_b(int path, unsigned card, Xspress3_TriggerB *trig_b);
     int get_dtcfactor(int path, u_int32_t *scaData, double *dtcFactor, double *dtcAllEvent, unsigned chan);
     int get_generation(int path, int card);
+    int histogram_get_tf_markers(int path, int chan, unsigned tf, unsigned num_tf, int *markers);
+    int format_sub_frames(int path, int chan, int just_good, int just_good_thres, int flags, int nbits_eng, int num_sub_frames, int ts_divide);
+
+    xsp3ApiStats &getStats() { return stats; }
+    int startTrace(const char *fileName, size_t size, bool buffers);
+    void stopTrace();
+    bool tracing() const { return tracer.enabled(); }
+    const char *getTraceError() const { return tracer.getError(); }
 
 private:
+    void trace(int call, int status, const xsp3ApiCallTimer &timer, const int64_t *args, int numArgs,
+               const void *output = NULL, size_t outputSize = 0, const void *output2 = NULL, size_t output2Size = 0,
+               const char *text1 = NULL, const char *text2 = NULL, const char *text3 = NULL);
+
     asynUser * pasynUser;
+    xsp3ApiStats stats;
+    xsp3TraceWriter tracer;
 };
 
 #endif /* XSPRESS3INTERFACE_H */
@@ -0,0 +1,179 @@
+/*
+ * xsp3ApiStats.cpp
+ *
+ * Per call latency statistics for xsp3Api, see xsp3ApiStats.h
+ */
+#include "xsp3ApiStats.h"
+#include <string.h>
+#include <time.h>
+
+static const char * const callNames[xsp3CallNum] =
+{
+    "xsp3_clocks_setup",
+    "xsp3_close",
+    "xsp3_config",
+    "xsp3_format_run",
+    "xsp3_getDeadtimeCorrectionParameters",
+    "xsp3_get_error_message",
+    "xsp3_get_good_thres",
+    "xsp3_get_window",
+    "xsp3_hist_dtc_read4d",
+    "xsp3_histogram_circ_ack",
+    "xsp3_histogram_clear",
+    "xsp3_histogram_pause",
+    "xsp3_histogram_arm",
+    "xsp3_histogram_continue",
+    "xsp3_histogram_is_any_busy",
+    "xsp3_histogram_read4d",
+    "xsp3_histogram_start",
+    "xsp3_histogram_stop",
+    "xsp3_restore_settings",
+    "xsp3_save_settings",
+    "xsp3_scaler_check_progress",
+    "xsp3_set_glob_timeA",
+    "xsp3_set_glob_timeFixed",
+    "xsp3_set_good_thres",
+    "xsp3_set_run_flags",
+    "xsp3_set_window",
+    "xsp3_itfg_setup",
+    "xsp3_itfg_setup2",
+    "xsp3_itfg_start",
+    "xsp3_itfg_stop",
+    "xsp3_has_itfg",
+    "xsp3_scaler_read",
+    "xsp3_get_trigger_b",
+    "xsp3_get_dtcfactor",
+    "xsp3_get_generation",
+    "xsp3_histogram_get_tf_markers",
+    "xsp3_format_sub_frames"
+};
+
+xsp3ApiStats::xsp3ApiStats( void ) :
+    enabled_(false)
+{
+    reset();
+}
+
+const char * xsp3ApiStats::name( int call )
+{
+    return (call >= 0 && call < xsp3CallNum) ? callNames[call] : "unknown";
+}
+
+/** Monotonic time in seconds */
+double xsp3ApiStats::now( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+void xsp3ApiStats::reset( void )
+{
+    epicsGuard<epicsMutex> guard(mutex);
+    memset( calls, 0, sizeof(calls) );
+}
+
+void xsp3ApiStats::record( int call, double seconds )
+{
+    double us = seconds*1e6;
+    int bucket = 0;
+
+    if (call < 0 || call >= xsp3CallNum) return;
+    while (us >= 1.0 && bucket < XSP3_API_STATS_BUCKETS-1)
+    {
+        us *= 0.5;
+        bucket++;
+    }
+
+    epicsGuard<epicsMutex> guard(mutex);
+    xsp3ApiCallStats_t &stats = calls[call];
+    stats.count++;
+    stats.total += seconds;
+    if (seconds > stats.max) stats.max = seconds;
+    stats.buckets[bucket]++;
+}
+
+void xsp3ApiStats::get( int call, xsp3ApiCallStats_t &stats )
+{
+    epicsGuard<epicsMutex> guard(mutex);
+    if (call >= 0 && call < xsp3CallNum) stats = calls[call];
+    else memset( &stats, 0, sizeof(stats) );
+}
+
+/**
+ * Totals over all calls.
+ * @param count Set to the number of calls
+ * @param total Set to the time spent in calls, in seconds
+ * @param slowest Set to the call that took the most time in total, or -1 if there were none
+ */
+void xsp3ApiStats::getTotals( unsigned long &count, double &total, int &slowest )
+{
+    epicsGuard<epicsMutex> guard(mutex);
+
+    count = 0;
+    total = 0.0;
+    slowest = -1;
+    for (int call = 0; call < xsp3CallNum; call++)
+    {
+        count += calls[call].count;
+        total += calls[call].total;
+        if (calls[call].count > 0 && (slowest < 0 || calls[call].total > calls[slowest].total))
+            slowest = call;
+    }
+}
+
+/**
+ * Estimate a latency percentile from the histogram, as the upper edge of
+ * the bucket it falls in, in seconds.
+ */
+double xsp3ApiStats::percentile( const xsp3ApiCallStats_t &stats, double fraction )
+{
+    unsigned long target, seen = 0;
+
+    if (stats.count == 0) return 0.0;
+    target = (unsigned long) (fraction*stats.count + 0.5);
+    if (target < 1) target = 1;
+    for (int bucket = 0; bucket < XSP3_API_STATS_BUCKETS; bucket++)
+    {
+        seen += stats.buckets[bucket];
+        if (seen >= target)
+            return bucket == XSP3_API_STATS_BUCKETS-1 ? stats.max : (double) (1UL << bucket)*1e-6;
+    }
+    return stats.max;
+}
+
+/**
+ * Print the statistics of every call made at least once. With details > 1
+ * the histogram buckets are printed too.
+ */
+void xsp3ApiStats::report( FILE * fp, int details )
+{
+    xsp3ApiCallStats_t stats[xsp3CallNum];
+
+    {
+        epicsGuard<epicsMutex> guard(mutex);
+        memcpy( stats, calls, sizeof(stats) );
+    }
+
+    fprintf( fp, "Xspress3 API call statistics (%s):\n", enabled_ ? "recording" : "not recording" );
+    fprintf( fp, "  %-38s %10s %12s %10s %10s %10s %10s\n",
+             "call", "count", "total (s)", "mean (us)", "p50 (us)", "p99 (us)", "max (us)" );
+    for (int call = 0; call < xsp3CallNum; call++)
+    {
+        if (stats[call].count == 0) continue;
+        fprintf( fp, "  %-38s %10lu %12.6f %10.1f %10.1f %10.1f %10.1f\n",
+                 callNames[call], stats[call].count, stats[call].total,
+                 stats[call].total/stats[call].count*1e6,
+                 percentile( stats[call], 0.50 )*1e6, percentile( stats[call], 0.99 )*1e6,
+                 stats[call].max*1e6 );
+        if (details > 1)
+        {
+            fprintf( fp, "    " );
+            for (int bucket = 0; bucket < XSP3_API_STATS_BUCKETS; bucket++)
+                if (stats[call].buckets[bucket] > 0)
+                    fprintf( fp, " %s%luus:%lu", bucket == XSP3_API_STATS_BUCKETS-1 ? ">=" : "<",
+                             1UL << (bucket == XSP3_API_STATS_BUCKETS-1 ? bucket-1 : bucket), stats[call].buckets[bucket] );
+            fprintf( fp, "\n" );
+        }
+    }
+}
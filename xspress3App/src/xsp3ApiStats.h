@@ -0,0 +1,116 @@
+/*
+ * xsp3ApiStats.h
+ *
+ * Call counts and latency histograms for the Xspress3 API calls made
+ * through xsp3Api, to show how much time is spent in libxspress3 (and the
+ * network behind it) rather than in the driver. Latencies are binned by
+ * powers of two microseconds. Recording is off by default, and costs one
+ * test of a flag per call while off.
+ */
+
+#ifndef XSP3APISTATS_H_
+#define XSP3APISTATS_H_
+
+#include <stdio.h>
+#include "epicsMutex.h"
+
+enum xsp3ApiCall
+{
+    xsp3CallClocksSetup,
+    xsp3CallClose,
+    xsp3CallConfig,
+    xsp3CallFormatRun,
+    xsp3CallGetDeadtimeCorrectionParameters,
+    xsp3CallGetErrorMessage,
+    xsp3CallGetGoodThres,
+    xsp3CallGetWindow,
+    xsp3CallHistDtcRead4d,
+    xsp3CallHistogramCircAck,
+    xsp3CallHistogramClear,
+    xsp3CallHistogramPause,
+    xsp3CallHistogramArm,
+    xsp3CallHistogramContinue,
+    xsp3CallHistogramIsAnyBusy,
+    xsp3CallHistogramRead4d,
+    xsp3CallHistogramStart,
+    xsp3CallHistogramStop,
+    xsp3CallRestoreSettings,
+    xsp3CallSaveSettings,
+    xsp3CallScalerCheckProgress,
+    xsp3CallSetGlobTimeA,
+    xsp3CallSetGlobTimeFixed,
+    xsp3CallSetGoodThres,
+    xsp3CallSetRunFlags,
+    xsp3CallSetWindow,
+    xsp3CallItfgSetup,
+    xsp3CallItfgSetup2,
+    xsp3CallItfgStart,
+    xsp3CallItfgStop,
+    xsp3CallHasItfg,
+    xsp3CallScalerRead,
+    xsp3CallGetTriggerB,
+    xsp3CallGetDtcfactor,
+    xsp3CallGetGeneration,
+    xsp3CallHistogramGetTfMarkers,
+    xsp3CallFormatSubFrames,
+    xsp3CallNum
+};
+
+/* Bucket 0 is under 1us, bucket n is [2^(n-1), 2^n) us, the last is everything longer */
+#define XSP3_API_STATS_BUCKETS 24
+
+typedef struct xsp3ApiCallStats
+{
+    unsigned long count;
+    double total;           // Seconds
+    double max;             // Seconds
+    unsigned long buckets[XSP3_API_STATS_BUCKETS];
+} xsp3ApiCallStats_t;
+
+class xsp3ApiStats
+{
+public:
+    xsp3ApiStats( void );
+
+    static const char * name( int call );
+    static double now( void );
+
+    void enable( bool on ) { enabled_ = on; }
+    bool enabled( void ) const { return enabled_; }
+    void reset( void );
+    void record( int call, double seconds );
+
+    void get( int call, xsp3ApiCallStats_t &stats );
+    void getTotals( unsigned long &count, double &total, int &slowest );
+    void report( FILE * fp, int details );
+
+    static double percentile( const xsp3ApiCallStats_t &stats, double fraction );
+
+private:
+    epicsMutex mutex;
+    volatile bool enabled_;
+    xsp3ApiCallStats_t calls[xsp3CallNum];
+};
+
+/**
+ * Times a call from construction to destruction, when recording is on.
+ * Pass timed to read the start time even when it is off, for the trace.
+ */
+class xsp3ApiCallTimer
+{
+public:
+    xsp3ApiCallTimer( xsp3ApiStats &stats, int call, bool timed = false ) :
+        stats(stats), call(call), start((timed || stats.enabled()) ? xsp3ApiStats::now() : -1.0) {}
+    ~xsp3ApiCallTimer( void )
+    {
+        if (start >= 0.0 && stats.enabled()) stats.record( call, xsp3ApiStats::now() - start );
+    }
+    double started( void ) const { return start; }
+
+private:
+    xsp3ApiStats &stats;
+    int call;
+    double start;
+};
+
+#endif /* XSP3APISTATS_H_ */
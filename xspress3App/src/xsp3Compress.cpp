@@ -0,0 +1,284 @@
+/*
+ * xsp3Compress.cpp
+ *
+ * A pool of threads compressing frames with the ADCore codecs.
+ */
+
+#include <time.h>
+#include "epicsThread.h"
+#include "NDPluginCodec.h"
+#include "xsp3Compress.h"
+
+/* Frames that may be waiting or being compressed, per thread */
+#define XSP3_COMPRESS_DEPTH 2
+
+#define XSP3_COMPRESS_MESSAGE_LEN 256
+
+static void xsp3CompressTaskC(void *drvPvt)
+{
+    static_cast<xsp3CompressPool *>(drvPvt)->workTask();
+}
+
+static double threadCpuTime(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+xsp3CompressPool::xsp3CompressPool() :
+    head(0),
+    count(0),
+    codec(xsp3CompressNone),
+    level(5),
+    shuffle(1),
+    numThreads(0),
+    frames(0),
+    failures(0),
+    bytesIn(0.0),
+    bytesOut(0.0),
+    cpuTime(0.0)
+{
+}
+
+/**
+ * Set the codec for the frames submitted from now on, and start threads
+ * until there are at least the number asked for. Call while the pool is
+ * empty, so the ring of frames can be resized.
+ * @param codec An xsp3CompressCodec
+ * @param level Blosc compression level, 1 to 9
+ * @param shuffle Blosc shuffle: 0 none, 1 byte or 2 bit
+ * @param threads Number of compression threads
+ * @return The number of threads running
+ */
+int xsp3CompressPool::configure(int codec, int level, int shuffle, int threads)
+{
+    mutex.lock();
+    this->codec = codec;
+    this->level = level;
+    this->shuffle = shuffle;
+    while (codec != xsp3CompressNone && numThreads < threads) {
+        if (epicsThreadCreate("Xsp3Compress", epicsThreadPriorityMedium,
+                              epicsThreadGetStackSize(epicsThreadStackMedium),
+                              (EPICSTHREADFUNC)xsp3CompressTaskC, this) == NULL) {
+            break;
+        }
+        numThreads++;
+    }
+    if (count == 0 && slots.size() < (size_t) (numThreads*XSP3_COMPRESS_DEPTH)) {
+        slot empty = { NULL, NULL, slotFree };
+        slots.assign(numThreads*XSP3_COMPRESS_DEPTH, empty);
+        head = 0;
+    }
+    threads = numThreads;
+    mutex.unlock();
+    return threads;
+}
+
+/**
+ * Queue a frame to be compressed. The pool owns the frame until take()
+ * returns it.
+ * @return false if the ring is full; take() the oldest frame and try again
+ */
+bool xsp3CompressPool::submit(NDArray *pArray)
+{
+    mutex.lock();
+    if (count == slots.size()) {
+        mutex.unlock();
+        return false;
+    }
+    slot &next = slots[(head + count) % slots.size()];
+    next.pIn = pArray;
+    next.pOut = NULL;
+    next.state = slotQueued;
+    count++;
+    mutex.unlock();
+    workEvent.signal();
+    return true;
+}
+
+/**
+ * Take the oldest frame once it has been compressed. The caller owns it.
+ * @param wait Wait for the oldest frame rather than return NULL if it is not done
+ * @return The frame, compressed if that succeeded, or NULL if there is none ready
+ */
+NDArray *xsp3CompressPool::take(bool wait)
+{
+    NDArray *pArray = NULL;
+    NDArray *pDone = NULL;
+
+    mutex.lock();
+    while (wait && count > 0 && slots[head].state != slotDone) {
+        mutex.unlock();
+        doneEvent.wait();
+        mutex.lock();
+    }
+    if (count > 0 && slots[head].state == slotDone) {
+        slot &oldest = slots[head];
+        pArray = oldest.pIn;
+        if (oldest.pOut != NULL) {
+            pDone = oldest.pIn;
+            pArray = oldest.pOut;
+        }
+        oldest.pIn = oldest.pOut = NULL;
+        oldest.state = slotFree;
+        head = (head + 1) % slots.size();
+        count--;
+    }
+    mutex.unlock();
+    if (pDone != NULL) {
+        pDone->release();
+    }
+    return pArray;
+}
+
+bool xsp3CompressPool::empty()
+{
+    bool isEmpty;
+
+    mutex.lock();
+    isEmpty = (count == 0);
+    mutex.unlock();
+    return isEmpty;
+}
+
+void xsp3CompressPool::resetStats()
+{
+    mutex.lock();
+    frames = failures = 0;
+    bytesIn = bytesOut = cpuTime = 0.0;
+    mutex.unlock();
+}
+
+/**
+ * Totals since resetStats().
+ * @param ratio Uncompressed bytes over compressed bytes, of the frames compressed
+ * @param cpuTime Mean CPU time to compress a frame, in seconds
+ */
+void xsp3CompressPool::getStats(unsigned long *frames, unsigned long *failures, double *ratio, double *cpuTime)
+{
+    mutex.lock();
+    *frames = this->frames;
+    *failures = this->failures;
+    *ratio = (bytesOut > 0.0) ? bytesIn/bytesOut : 1.0;
+    *cpuTime = (this->frames > 0) ? this->cpuTime/this->frames : 0.0;
+    mutex.unlock();
+}
+
+/**
+ * The message from the last frame that could not be compressed.
+ */
+std::string xsp3CompressPool::getError()
+{
+    std::string message;
+
+    mutex.lock();
+    message = error;
+    mutex.unlock();
+    return message;
+}
+
+/**
+ * Compress a frame, with its identity and attributes, into a new array.
+ * @param message Set to the reason if the frame could not be compressed
+ * @return The compressed frame, or NULL; pIn is left for the caller to release
+ */
+NDArray *xsp3CompressPool::compress(NDArray *pIn, int codec, int level, int shuffle, std::string *message)
+{
+    NDCodecStatus_t status = NDCODEC_SUCCESS;
+    char errorMessage[XSP3_COMPRESS_MESSAGE_LEN] = "";
+    NDArray *pOut = NULL;
+
+    switch (codec) {
+    case xsp3CompressLZ4:
+        pOut = compressLZ4(pIn, &status, errorMessage);
+        break;
+    case xsp3CompressBSLZ4:
+        pOut = compressBSLZ4(pIn, &status, errorMessage);
+        break;
+    case xsp3CompressBloscLZ4:
+        pOut = compressBlosc(pIn, level, shuffle, NDCODEC_BLOSC_LZ4, 1, &status, errorMessage);
+        break;
+    case xsp3CompressBloscZstd:
+        pOut = compressBlosc(pIn, level, shuffle, NDCODEC_BLOSC_ZSTD, 1, &status, errorMessage);
+        break;
+    default:
+        return NULL;
+    }
+    if (pOut == NULL || status == NDCODEC_ERROR) {
+        if (pOut != NULL) {
+            pOut->release();
+        }
+        *message = errorMessage[0] ? errorMessage : "codec failed";
+        return NULL;
+    }
+
+    // Carry the frame's identity and attributes over to the compressed array
+    pOut->uniqueId = pIn->uniqueId;
+    pOut->timeStamp = pIn->timeStamp;
+    pOut->epicsTS = pIn->epicsTS;
+    pIn->pAttributeList->copy(pOut->pAttributeList);
+    return pOut;
+}
+
+/**
+ * Compress queued frames, oldest first, until there are none left.
+ */
+void xsp3CompressPool::workTask(void)
+{
+    while (1) {
+        workEvent.wait();
+        while (1) {
+            size_t index = 0;
+            bool found = false, more = false;
+            int frameCodec, frameLevel, frameShuffle;
+
+            mutex.lock();
+            for (size_t i = 0; i < count; i++) {
+                size_t candidate = (head + i) % slots.size();
+                if (slots[candidate].state != slotQueued) continue;
+                if (found) {
+                    more = true;
+                    break;
+                }
+                index = candidate;
+                found = true;
+            }
+            if (!found) {
+                mutex.unlock();
+                break;
+            }
+            slots[index].state = slotBusy;
+            frameCodec = codec;
+            frameLevel = level;
+            frameShuffle = shuffle;
+            mutex.unlock();
+            if (more) {
+                workEvent.signal();
+            }
+
+            NDArray *pIn = slots[index].pIn;
+            NDArrayInfo_t info;
+            std::string message;
+            double start = threadCpuTime();
+            NDArray *pOut = compress(pIn, frameCodec, frameLevel, frameShuffle, &message);
+            double used = threadCpuTime() - start;
+            pIn->getInfo(&info);
+
+            mutex.lock();
+            slots[index].pOut = pOut;
+            slots[index].state = slotDone;
+            if (pOut != NULL) {
+                frames++;
+                bytesIn += info.totalBytes;
+                bytesOut += pOut->compressedSize;
+                cpuTime += used;
+            } else {
+                failures++;
+                error = message;
+            }
+            mutex.unlock();
+            doneEvent.signal();
+        }
+    }
+}
@@ -0,0 +1,71 @@
+/*
+ * xsp3Compress.h
+ *
+ * A pool of threads that compress frames with the ADCore codecs from
+ * NDPluginCodec, so the data task can go on reading out while earlier
+ * frames are compressed. Frames are handed back in the order they were
+ * submitted, ready to publish: compressed, with the NDArray codec set so
+ * NDFileHDF5 can write the chunks directly, or as they were if the codec
+ * failed or is not built into ADCore.
+ */
+
+#ifndef XSP3COMPRESS_H_
+#define XSP3COMPRESS_H_
+
+#include <string>
+#include <vector>
+#include "epicsMutex.h"
+#include "epicsEvent.h"
+#include "ADDriver.h"
+
+enum xsp3CompressCodec {
+    xsp3CompressNone = 0,
+    xsp3CompressLZ4 = 1,        //!< LZ4
+    xsp3CompressBSLZ4 = 2,      //!< Bit shuffle and LZ4
+    xsp3CompressBloscLZ4 = 3,   //!< Blosc with LZ4, and the shuffle set
+    xsp3CompressBloscZstd = 4   //!< Blosc with Zstd, and the shuffle set
+};
+
+class xsp3CompressPool {
+public:
+    xsp3CompressPool();
+
+    int configure(int codec, int level, int shuffle, int threads);
+    int getCodec() const { return codec; }
+    bool submit(NDArray *pArray);
+    NDArray *take(bool wait);
+    bool empty();
+    void resetStats();
+    void getStats(unsigned long *frames, unsigned long *failures, double *ratio, double *cpuTime);
+    std::string getError();
+    void workTask(void);
+
+    static NDArray *compress(NDArray *pIn, int codec, int level, int shuffle, std::string *error);
+
+private:
+    enum slotState { slotFree, slotQueued, slotBusy, slotDone };
+    struct slot {
+        NDArray *pIn;
+        NDArray *pOut;
+        slotState state;
+    };
+
+    std::vector<slot> slots;    // Ring of frames in submission order
+    size_t head;                // Oldest frame
+    size_t count;               // Frames in the ring
+    int codec;
+    int level;
+    int shuffle;
+    int numThreads;
+    unsigned long frames;
+    unsigned long failures;
+    double bytesIn;
+    double bytesOut;
+    double cpuTime;
+    std::string error;
+    epicsMutex mutex;
+    epicsEvent workEvent;
+    epicsEvent doneEvent;
+};
+
+#endif /* XSP3COMPRESS_H_ */
@@ -81,6 +81,13 @@ int xsp3Detector::xsp3Api_hist_dtc_read4d(int path, double *hist_buff, double *s
     return status;
 }
 
+int xsp3Detector::xsp3Api_histogram_circ_ack(int path, unsigned chan, unsigned tf, unsigned num_chan, unsigned num_tf)
+{
+    int status;
+    status = xsp3_histogram_circ_ack( path, chan, tf, num_chan, num_tf);
+    return status;
+}
+
 int xsp3Detector::xsp3Api_histogram_clear(int path, int first_chan, int num_chan, int first_frame, int num_frames)
 {
     int status;
@@ -254,3 +261,13 @@ int xsp3Detector::xsp3Api_get_generation(int path, int card)
     return xsp3_get_generation(path, card);
 }
 
+int xsp3Detector::xsp3Api_histogram_get_tf_markers(int path, int chan, unsigned tf, unsigned num_tf, int *markers)
+{
+    return xsp3_histogram_get_tf_markers(path, chan, tf, num_tf, markers);
+}
+
+int xsp3Detector::xsp3Api_format_sub_frames(int path, int chan, int just_good, int just_good_thres, int flags, int nbits_eng, int num_sub_frames, int ts_divide)
+{
+    return xsp3_format_sub_frames(path, chan, just_good, just_good_thres, flags, nbits_eng, num_sub_frames, ts_divide);
+}
+
@@ -46,6 +46,7 @@ protected:
     virtual int xsp3Api_get_window(int path, int chan, int win, u_int32_t *low, u_int32_t *high);
     virtual int xsp3Api_hist_dtc_read4d(int path, double *hist_buff, double *scal_buff, unsigned eng, unsigned aux, unsigned chan, unsigned tf,
                                      unsigned num_eng, unsigned num_aux, unsigned num_chan, unsigned num_tf);
+    virtual int xsp3Api_histogram_circ_ack(int path, unsigned chan, unsigned tf, unsigned num_chan, unsigned num_tf);
     virtual int xsp3Api_histogram_clear(int path, int first_chan, int num_chan, int first_frame, int num_frames);
     virtual int xsp3Api_histogram_continue(int path, int card);
     virtual int xsp3Api_histogram_pause(int path, int card);
@@ -71,6 +72,8 @@ protected:
     virtual int xsp3Api_get_trigger_b(int path, unsigned chan, Xspress3_TriggerB *trig_b);
     virtual int xsp3Api_get_dtcfactor(int path, u_int32_t *scaData, double *dtcFactor, double *dtcAllEvent, unsigned chan);
     virtual int xsp3Api_get_generation(int path, int card);
+    virtual int xsp3Api_histogram_get_tf_markers(int path, int chan, unsigned tf, unsigned num_tf, int *markers);
+    virtual int xsp3Api_format_sub_frames(int path, int chan, int just_good, int just_good_thres, int flags, int nbits_eng, int num_sub_frames, int ts_divide);
 };
 
 #endif /* XSP3DETECTOR_H */
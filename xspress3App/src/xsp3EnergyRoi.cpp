@@ -0,0 +1,120 @@
+/*
+ * xsp3EnergyRoi.cpp
+ *
+ * MCA regions of interest in bins or keV.
+ */
+
+#include <math.h>
+#include "xsp3EnergyRoi.h"
+
+/* Bin positions this close to a whole bin are taken to be on it */
+#define XSP3_ROI_BIN_TOLERANCE 1e-9
+
+/**
+ * Whether the energy rises with every bin of the spectrum, so each energy
+ * has one bin.
+ */
+bool xsp3EnergyCalValid(const xsp3EnergyCal_t &cal, int bins)
+{
+    return cal.gain > 0 && cal.gain + 2*cal.quad*(bins - 1) > 0;
+}
+
+/**
+ * The bin, not rounded, at an energy. Energies below or above the range of
+ * a quadratic calibration are -HUGE_VAL or HUGE_VAL.
+ */
+double xsp3EnergyToBin(const xsp3EnergyCal_t &cal, double energy)
+{
+    double e = energy - cal.offset;
+    double d;
+
+    if (cal.quad == 0) {
+        return e/cal.gain;
+    }
+    d = cal.gain*cal.gain + 4*cal.quad*e;
+    if (d < 0) {
+        return (cal.quad < 0) ? HUGE_VAL : -HUGE_VAL;
+    }
+    // The root on the rising side, written so it does not cancel when quad is small
+    return 2*e/(cal.gain + sqrt(d));
+}
+
+/**
+ * Convert an energy range to the bins whose energy is within it.
+ * @param low Lowest energy, keV
+ * @param high Highest energy, keV
+ * @param bins Bins in the spectrum
+ * @param llm Set to the first bin
+ * @param hlm Set to one past the last bin, so llm == hlm if no bin is in range
+ */
+void xsp3EnergyToBins(const xsp3EnergyCal_t &cal, double low, double high, int bins, int *llm, int *hlm)
+{
+    double first = ceil(xsp3EnergyToBin(cal, low) - XSP3_ROI_BIN_TOLERANCE);
+    double end = floor(xsp3EnergyToBin(cal, high) + XSP3_ROI_BIN_TOLERANCE) + 1;
+
+    first = (first < 0) ? 0 : (first > bins) ? bins : first;
+    end = (end < first) ? first : (end > bins) ? bins : end;
+    *llm = (int) first;
+    *hlm = (int) end;
+}
+
+xsp3RoiSums::xsp3RoiSums() :
+    numChannels(0)
+{
+}
+
+/**
+ * Set the number of channels. Every ROI is empty until its range is set.
+ */
+void xsp3RoiSums::resize(int numChannels)
+{
+    this->numChannels = numChannels;
+    llm.assign(numChannels*XSP3_NUM_ROIS, 0);
+    hlm.assign(numChannels*XSP3_NUM_ROIS, 0);
+}
+
+/**
+ * Set the bins of an ROI on a channel, from llm to one before hlm.
+ */
+void xsp3RoiSums::setRange(int channel, int roi, int llm, int hlm)
+{
+    this->llm[channel*XSP3_NUM_ROIS + roi] = llm;
+    this->hlm[channel*XSP3_NUM_ROIS + roi] = (hlm > llm) ? hlm : llm;
+}
+
+template <typename T>
+void xsp3RoiSums::sumFrame(const T *pData, int bins, int numChannels, int subFrames, double *totals) const
+{
+    for (int chan = 0; chan < numChannels && chan < this->numChannels; chan++) {
+        for (int roi = 0; roi < XSP3_NUM_ROIS; roi++) {
+            int first = llm[chan*XSP3_NUM_ROIS + roi];
+            int end = hlm[chan*XSP3_NUM_ROIS + roi];
+            double total = 0;
+
+            end = (end > bins) ? bins : end;
+            for (int sub = 0; sub < subFrames; sub++) {
+                const T *pSpectrum = pData + ((size_t) sub*numChannels + chan)*bins;
+                for (int bin = first; bin < end; bin++) {
+                    total += pSpectrum[bin];
+                }
+            }
+            totals[chan*XSP3_NUM_ROIS + roi] = total;
+        }
+    }
+}
+
+/**
+ * Sum every ROI of every channel of a frame.
+ * @param pData The frame, bins x channels x sub-frames
+ * @param totals Set to the sums, XSP3_NUM_ROIS for each channel in turn,
+ *        over all the sub-frames
+ */
+void xsp3RoiSums::sum(const epicsUInt32 *pData, int bins, int numChannels, int subFrames, double *totals) const
+{
+    sumFrame(pData, bins, numChannels, subFrames, totals);
+}
+
+void xsp3RoiSums::sum(const epicsFloat64 *pData, int bins, int numChannels, int subFrames, double *totals) const
+{
+    sumFrame(pData, bins, numChannels, subFrames, totals);
+}
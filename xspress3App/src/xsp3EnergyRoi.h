@@ -0,0 +1,51 @@
+/*
+ * xsp3EnergyRoi.h
+ *
+ * MCA regions of interest, summed by the driver on every frame. Each ROI
+ * is a range of bins on each channel, set directly or converted from a
+ * range in keV through the channel's energy calibration
+ *
+ *   E = offset + gain*bin + quad*bin^2 keV
+ *
+ * so an element line is defined once for every channel and follows
+ * changes of gain. The conversion is made when a calibration or an ROI
+ * changes; each frame only sums the bins.
+ */
+
+#ifndef XSP3ENERGYROI_H_
+#define XSP3ENERGYROI_H_
+
+#include <vector>
+#include "epicsTypes.h"
+
+#define XSP3_NUM_ROIS 16
+
+typedef struct xsp3EnergyCal {
+    double offset;      //!< keV at bin 0
+    double gain;        //!< keV per bin
+    double quad;        //!< keV per bin squared
+} xsp3EnergyCal_t;
+
+bool xsp3EnergyCalValid(const xsp3EnergyCal_t &cal, int bins);
+double xsp3EnergyToBin(const xsp3EnergyCal_t &cal, double energy);
+void xsp3EnergyToBins(const xsp3EnergyCal_t &cal, double low, double high, int bins, int *llm, int *hlm);
+
+class xsp3RoiSums {
+public:
+    xsp3RoiSums();
+
+    void resize(int numChannels);
+    void setRange(int channel, int roi, int llm, int hlm);
+    void sum(const epicsUInt32 *pData, int bins, int numChannels, int subFrames, double *totals) const;
+    void sum(const epicsFloat64 *pData, int bins, int numChannels, int subFrames, double *totals) const;
+
+private:
+    template <typename T>
+    void sumFrame(const T *pData, int bins, int numChannels, int subFrames, double *totals) const;
+
+    int numChannels;
+    std::vector<int> llm;   // [channel][roi], first bin
+    std::vector<int> hlm;   // [channel][roi], one past the last bin
+};
+
+#endif /* XSP3ENERGYROI_H_ */
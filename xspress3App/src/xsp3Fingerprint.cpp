@@ -0,0 +1,105 @@
+/*
+ * xsp3Fingerprint.cpp
+ *
+ * A 64 bit FNV-1a hash of the Xspress3 settings.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "xsp3Fingerprint.h"
+
+#define XSP3_FNV_OFFSET 14695981039346656037ULL
+#define XSP3_FNV_PRIME  1099511628211ULL
+
+/* Directories below the settings directory are hashed to this depth */
+#define XSP3_FINGERPRINT_DEPTH 4
+
+xsp3Fingerprint::xsp3Fingerprint() :
+    hash(XSP3_FNV_OFFSET)
+{
+}
+
+void xsp3Fingerprint::add(const void *data, size_t size)
+{
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    for (size_t i=0; i<size; i++) {
+        hash ^= bytes[i];
+        hash *= XSP3_FNV_PRIME;
+    }
+}
+
+/**
+ * Add a string, including its terminator so that "ab","c" and "a","bc" differ.
+ */
+void xsp3Fingerprint::add(const char *text)
+{
+    if (text == NULL)
+        text = "";
+    add(text, strlen(text) + 1);
+}
+
+int xsp3Fingerprint::addFile(const char *fileName)
+{
+    FILE *fp = fopen(fileName, "rb");
+    if (fp == NULL)
+        return -1;
+
+    char buffer[8192];
+    size_t nread, total = 0;
+    while ((nread = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+        add(buffer, nread);
+        total += nread;
+    }
+    int status = ferror(fp) ? -1 : 0;
+    fclose(fp);
+    add(&total, sizeof(total));
+    return status;
+}
+
+int xsp3Fingerprint::addEntries(const std::string &dirName, int depth)
+{
+    DIR *dir = opendir(dirName.c_str());
+    if (dir == NULL)
+        return -1;
+
+    std::vector<std::string> names;
+    struct dirent *d;
+    while ((d = readdir(dir)) != NULL) {
+        if (strcmp(d->d_name, ".") != 0 && strcmp(d->d_name, "..") != 0)
+            names.push_back(d->d_name);
+    }
+    closedir(dir);
+
+    // readdir order depends on the file system, so hash in name order
+    std::sort(names.begin(), names.end());
+    int status = 0;
+    for (size_t i=0; i<names.size() && status == 0; i++) {
+        std::string path = dirName + "/" + names[i];
+        struct stat info;
+        if (stat(path.c_str(), &info) != 0)
+            return -1;
+        add(names[i].c_str());
+        if (S_ISDIR(info.st_mode)) {
+            if (depth < XSP3_FINGERPRINT_DEPTH)
+                status = addEntries(path, depth + 1);
+        } else if (S_ISREG(info.st_mode)) {
+            status = addFile(path.c_str());
+        }
+    }
+    return status;
+}
+
+/**
+ * Add the names and contents of the files in a directory and the directories
+ * below it.
+ * @return 0, or -1 if the directory or one of its files could not be read.
+ */
+int xsp3Fingerprint::addDirectory(const char *dirName)
+{
+    add(dirName);
+    return addEntries(dirName, 0);
+}
@@ -0,0 +1,34 @@
+/*
+ * xsp3Fingerprint.h
+ *
+ * A 64 bit FNV-1a hash of the settings applied to an Xspress3 system: the
+ * names and contents of the files in a settings directory, as read by
+ * xsp3_restore_settings, and the driver's own settings written after it.
+ * Used to tell whether a restore would change anything.
+ */
+
+#ifndef XSP3FINGERPRINT_H_
+#define XSP3FINGERPRINT_H_
+
+#include <stddef.h>
+#include <string>
+#include "inttypes.h"
+
+class xsp3Fingerprint {
+public:
+    xsp3Fingerprint();
+
+    void add(const void *data, size_t size);
+    void add(int value) { add(&value, sizeof(value)); }
+    void add(const char *text);
+    int addDirectory(const char *dirName);
+    uint64_t value() const { return hash; }
+
+private:
+    int addEntries(const std::string &dirName, int depth);
+    int addFile(const char *fileName);
+
+    uint64_t hash;
+};
+
+#endif /* XSP3FINGERPRINT_H_ */
@@ -0,0 +1,266 @@
+/*
+ * xsp3H5Writer.cpp
+ *
+ * Chunked HDF5 writer for the frames of an acquisition.
+ */
+
+#include <string.h>
+#include "xspress3.h"
+#include "xsp3H5Writer.h"
+
+#ifdef XSP3_HDF5
+#include <hdf5.h>
+#endif
+
+xsp3H5Writer::xsp3H5Writer() :
+    file(-1),
+    data(-1),
+    scalers(-1),
+    memType(-1),
+    rank(0),
+    frameBytes(0),
+    scalerBytes(0),
+    numChannels(0),
+    chunkFrames(1),
+    swmr(false),
+    buffered(0),
+    frames(0)
+{
+}
+
+xsp3H5Writer::~xsp3H5Writer()
+{
+    close();
+}
+
+int xsp3H5Writer::fail(const char *message)
+{
+    error = message;
+    return -1;
+}
+
+#ifdef XSP3_HDF5
+
+/* Create a dataset of rank dimensions with the frames dimension first and
+ * unlimited, chunked chunkFrames frames at a time */
+static hid_t createFrameDataset(hid_t file, const char *name, hid_t fileType, int rank, const hsize_t dims[], int chunkFrames)
+{
+    hsize_t current[4], maximum[4], chunk[4];
+    hid_t space, dcpl, dapl, dataset;
+
+    for (int i = 0; i < rank; i++) {
+        current[i] = maximum[i] = chunk[i] = dims[i];
+    }
+    current[0] = 0;
+    maximum[0] = H5S_UNLIMITED;
+    chunk[0] = chunkFrames;
+    space = H5Screate_simple(rank, current, maximum);
+    dcpl = H5Pcreate(H5P_DATASET_CREATE);
+    H5Pset_chunk(dcpl, rank, chunk);
+    // Whole chunks are written at once, so there is nothing for the chunk cache to gather
+    dapl = H5Pcreate(H5P_DATASET_ACCESS);
+    H5Pset_chunk_cache(dapl, 0, 0, H5D_CHUNK_CACHE_W0_DEFAULT);
+    dataset = H5Dcreate2(file, name, fileType, space, H5P_DEFAULT, dcpl, dapl);
+    H5Pclose(dapl);
+    H5Pclose(dcpl);
+    H5Sclose(space);
+    return dataset;
+}
+
+/* Write count frames from buf to dataset, starting at frame first */
+static herr_t writeFrames(hid_t dataset, hid_t memType, int rank, const hsize_t dims[], hsize_t first, hsize_t count, const void *buf)
+{
+    hsize_t extent[4], start[4], block[4];
+    hid_t fileSpace, memSpace;
+    herr_t status;
+
+    for (int i = 0; i < rank; i++) {
+        extent[i] = block[i] = dims[i];
+        start[i] = 0;
+    }
+    extent[0] = first + count;
+    start[0] = first;
+    block[0] = count;
+    if (H5Dset_extent(dataset, extent) < 0) {
+        return -1;
+    }
+    fileSpace = H5Dget_space(dataset);
+    memSpace = H5Screate_simple(rank, block, NULL);
+    status = H5Sselect_hyperslab(fileSpace, H5S_SELECT_SET, start, NULL, block, NULL);
+    if (status >= 0) {
+        status = H5Dwrite(dataset, memType, memSpace, fileSpace, H5P_DEFAULT, buf);
+    }
+    H5Sclose(memSpace);
+    H5Sclose(fileSpace);
+    return status;
+}
+
+/**
+ * Create a file for an acquisition, replacing any file of that name.
+ * @param ndims The number of dimensions of a frame, 2 or 3
+ * @param dims The dimensions of a frame as an NDArray, bins first
+ * @param isFloat True for Float64 (dead time corrected) frames and scalers, false for UInt32
+ * @param chunkFrames The number of frames in a chunk
+ * @param swmr Open the file for single writer, multiple reader access
+ * @return 0, or -1 with getError() set
+ */
+int xsp3H5Writer::open(const char *fileName, int ndims, const size_t dims[], bool isFloat, int numChannels, int chunkFrames, bool swmr)
+{
+    hsize_t h5Dims[4], scalerDims[3];
+    hid_t fileType, fapl, lcpl, group;
+
+    close();
+    if (ndims < 1 || ndims > 3 || numChannels < 1 || chunkFrames < 1) {
+        return fail("invalid frame dimensions");
+    }
+
+    // The dataset dimensions are the NDArray dimensions reversed, after the frame
+    rank = ndims + 1;
+    frameDims[0] = h5Dims[0] = 0;
+    frameBytes = isFloat ? sizeof(double) : sizeof(u_int32_t);
+    for (int i = 0; i < ndims; i++) {
+        frameDims[i+1] = h5Dims[i+1] = dims[ndims-1-i];
+        frameBytes *= dims[ndims-1-i];
+    }
+    scalerDims[0] = 0;
+    scalerDims[1] = numChannels;
+    scalerDims[2] = XSP3_SW_NUM_SCALERS;
+    scalerBytes = (isFloat ? sizeof(double) : sizeof(u_int32_t))*numChannels*XSP3_SW_NUM_SCALERS;
+    this->numChannels = numChannels;
+    this->chunkFrames = chunkFrames;
+    this->swmr = swmr;
+    buffered = 0;
+    frames = 0;
+    dataChunk.resize(frameBytes*chunkFrames);
+    scalerChunk.resize(scalerBytes*chunkFrames);
+    memType = isFloat ? H5T_NATIVE_DOUBLE : H5T_NATIVE_UINT32;
+    fileType = isFloat ? H5T_IEEE_F64LE : H5T_STD_U32LE;
+
+    fapl = H5Pcreate(H5P_FILE_ACCESS);
+    if (swmr) {
+        H5Pset_libver_bounds(fapl, H5F_LIBVER_LATEST, H5F_LIBVER_LATEST);
+    }
+    file = H5Fcreate(fileName, H5F_ACC_TRUNC, H5P_DEFAULT, fapl);
+    H5Pclose(fapl);
+    if (file < 0) {
+        return fail("could not create the file");
+    }
+    lcpl = H5Pcreate(H5P_LINK_CREATE);
+    H5Pset_create_intermediate_group(lcpl, 1);
+    group = H5Gcreate2(file, "/entry/data", lcpl, H5P_DEFAULT, H5P_DEFAULT);
+    H5Pclose(lcpl);
+    if (group >= 0) {
+        H5Gclose(group);
+    }
+    data = createFrameDataset(file, "/entry/data/data", fileType, rank, h5Dims, chunkFrames);
+    scalers = createFrameDataset(file, "/entry/data/scalers", fileType, 3, scalerDims, chunkFrames);
+    if (group < 0 || data < 0 || scalers < 0) {
+        close();
+        return fail("could not create the datasets");
+    }
+    // Every object must exist before readers can follow the file
+    if (swmr && H5Fstart_swmr_write(file) < 0) {
+        close();
+        return fail("could not start SWMR writing");
+    }
+    return 0;
+}
+
+/**
+ * Add a frame, writing the chunk when it is full.
+ * @param spectra The frame, as laid out in its NDArray
+ * @param scalers The scalers of the frame, XSP3_SW_NUM_SCALERS per channel
+ * @return 0, or -1 with getError() set
+ */
+int xsp3H5Writer::write(const void *spectra, const void *scalers)
+{
+    if (file < 0) {
+        return fail("no file is open");
+    }
+    memcpy(&dataChunk[buffered*frameBytes], spectra, frameBytes);
+    memcpy(&scalerChunk[buffered*scalerBytes], scalers, scalerBytes);
+    buffered++;
+    if (buffered < chunkFrames) {
+        return 0;
+    }
+    return writeChunk();
+}
+
+int xsp3H5Writer::writeChunk(void)
+{
+    hsize_t h5Dims[4], scalerDims[3];
+    int status = 0;
+
+    if (buffered == 0) {
+        return 0;
+    }
+    for (int i = 0; i < rank; i++) {
+        h5Dims[i] = frameDims[i];
+    }
+    scalerDims[0] = 0;
+    scalerDims[1] = numChannels;
+    scalerDims[2] = XSP3_SW_NUM_SCALERS;
+    if (writeFrames(data, memType, rank, h5Dims, frames, buffered, &dataChunk[0]) < 0 ||
+        writeFrames(scalers, memType, 3, scalerDims, frames, buffered, &scalerChunk[0]) < 0) {
+        status = fail("could not write frames");
+    } else {
+        frames += buffered;
+        // Let SWMR readers see the new frames now, rather than when the file is closed
+        if (swmr && (H5Dflush(data) < 0 || H5Dflush(scalers) < 0)) {
+            status = fail("could not flush frames");
+        }
+    }
+    buffered = 0;
+    return status;
+}
+
+/**
+ * Write any frames left in the chunk buffers, and close the file.
+ * @return 0, or -1 with getError() set
+ */
+int xsp3H5Writer::close(void)
+{
+    int status = 0;
+
+    if (file < 0) {
+        return 0;
+    }
+    if (data >= 0 && scalers >= 0) {
+        status = writeChunk();
+    }
+    if (data >= 0) {
+        H5Dclose(data);
+    }
+    if (scalers >= 0) {
+        H5Dclose(scalers);
+    }
+    if (H5Fclose(file) < 0 && status == 0) {
+        status = fail("could not close the file");
+    }
+    file = data = scalers = -1;
+    return status;
+}
+
+#else
+
+int xsp3H5Writer::open(const char *, int, const size_t [], bool, int, int, bool)
+{
+    return fail("built without HDF5");
+}
+
+int xsp3H5Writer::write(const void *, const void *)
+{
+    return fail("built without HDF5");
+}
+
+int xsp3H5Writer::writeChunk(void)
+{
+    return 0;
+}
+
+int xsp3H5Writer::close(void)
+{
+    return 0;
+}
+
+#endif /* XSP3_HDF5 */
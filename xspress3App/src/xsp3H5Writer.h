@@ -0,0 +1,61 @@
+/*
+ * xsp3H5Writer.h
+ *
+ * Writes the frames of an acquisition straight to an HDF5 file from the
+ * data task, as an alternative to publishing them to NDFileHDF5. Frames
+ * are gathered into chunks of chunkFrames frames and each chunk is
+ * written with one call, with no per-frame attributes. The file holds
+ *
+ *   /entry/data/data     [frames, (sub-frames,) channels, bins]
+ *   /entry/data/scalers  [frames, channels, XSP3_SW_NUM_SCALERS]
+ *
+ * as UInt32, or Float64 for dead time corrected frames. With SWMR the
+ * datasets are flushed after each chunk, so readers opening the file in
+ * SWMR mode can follow the acquisition as it is written.
+ *
+ * Built with HDF5 only if XSP3_HDF5 is defined (WITH_HDF5 = YES);
+ * otherwise open() fails.
+ */
+
+#ifndef XSP3H5WRITER_H_
+#define XSP3H5WRITER_H_
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+class xsp3H5Writer {
+public:
+    xsp3H5Writer();
+    ~xsp3H5Writer();
+
+    int open(const char *fileName, int ndims, const size_t dims[], bool isFloat, int numChannels, int chunkFrames, bool swmr);
+    int write(const void *spectra, const void *scalers);
+    int close(void);
+    bool isOpen(void) const { return file >= 0; }
+    unsigned long getFrames(void) const { return frames; }
+    const std::string &getError(void) const { return error; }
+
+private:
+    int writeChunk(void);
+    int fail(const char *message);
+
+    long long file;                 // hid_t of the file, or -1 when closed
+    long long data;
+    long long scalers;
+    long long memType;
+    int rank;                       // Of the data dataset, with the frame dimension
+    size_t frameDims[4];            // Of the data dataset, frame dimension first
+    size_t frameBytes;
+    size_t scalerBytes;
+    int numChannels;
+    int chunkFrames;
+    bool swmr;
+    int buffered;                   // Frames in the chunk buffers
+    unsigned long frames;           // Frames written to the file
+    std::vector<char> dataChunk;
+    std::vector<char> scalerChunk;
+    std::string error;
+};
+
+#endif /* XSP3H5WRITER_H_ */
@@ -0,0 +1,339 @@
+/*
+ * xsp3ShmRing.cpp
+ *
+ * Shared memory ring of frames: the writer used by the driver, and the
+ * reader for analysis processes. See xsp3ShmRing.h for the protocol.
+ */
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "xsp3ShmRing.h"
+
+/* Orders the loads and stores of the sequence lock against those of the slot */
+#define xsp3ShmBarrier() __sync_synchronize()
+
+static size_t roundUp(size_t bytes, size_t align)
+{
+    return (bytes + align - 1)/align*align;
+}
+
+/* Tell the readers of an existing segment of this name that it is being replaced */
+static void markStale(const char *name)
+{
+    struct stat st;
+    int fd = shm_open(name, O_RDWR, 0);
+
+    if (fd < 0) {
+        return;
+    }
+    if (fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(xsp3ShmHeader_t)) {
+        void *p = mmap(NULL, sizeof(xsp3ShmHeader_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p != MAP_FAILED) {
+            xsp3ShmHeader_t *header = static_cast<xsp3ShmHeader_t *>(p);
+            if (header->magic == XSP3_SHM_MAGIC) {
+                header->stale = 1;
+                xsp3ShmBarrier();
+            }
+            munmap(p, sizeof(xsp3ShmHeader_t));
+        }
+    }
+    ::close(fd);
+}
+
+xsp3ShmWriter::xsp3ShmWriter() :
+    header(NULL),
+    size(0)
+{
+}
+
+xsp3ShmWriter::~xsp3ShmWriter()
+{
+    close();
+}
+
+int xsp3ShmWriter::fail(const char *message)
+{
+    error = message;
+    return -1;
+}
+
+/**
+ * Create the segment, or keep the one already open if it has the same
+ * name and number of slots and its slots are big enough, so readers stay
+ * attached between acquisitions.
+ * @param name The POSIX shared memory name, starting with /
+ * @param numSlots The number of frames the ring holds
+ * @param payloadBytes The spectra and scaler bytes of the largest frame
+ * @return 0, or -1 with getError() set
+ */
+int xsp3ShmWriter::open(const char *name, int numSlots, size_t payloadBytes)
+{
+    size_t slotBytes = XSP3_SHM_FRAME_HEADER_BYTES + roundUp(payloadBytes, XSP3_SHM_ALIGN);
+    int fd;
+    void *p;
+
+    if (header != NULL && this->name == name && header->numSlots == (uint32_t) numSlots &&
+        header->payloadBytes >= payloadBytes) {
+        return 0;
+    }
+    close();
+    if (name[0] != '/' || numSlots < 1) {
+        return fail("the name must start with / and the ring needs a slot");
+    }
+
+    markStale(name);
+    shm_unlink(name);
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd < 0) {
+        return fail("could not create the shared memory");
+    }
+    size = XSP3_SHM_HEADER_BYTES + slotBytes*numSlots;
+    if (ftruncate(fd, size) != 0) {
+        ::close(fd);
+        shm_unlink(name);
+        return fail("could not size the shared memory");
+    }
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        shm_unlink(name);
+        return fail("could not map the shared memory");
+    }
+
+    // A new segment is zeroed, so every slot reads as not written yet
+    header = static_cast<xsp3ShmHeader_t *>(p);
+    header->version = XSP3_SHM_VERSION;
+    header->headerBytes = XSP3_SHM_HEADER_BYTES;
+    header->numSlots = numSlots;
+    header->slotBytes = slotBytes;
+    header->payloadBytes = slotBytes - XSP3_SHM_FRAME_HEADER_BYTES;
+    header->written = 0;
+    xsp3ShmBarrier();
+    header->magic = XSP3_SHM_MAGIC;
+    this->name = name;
+    return 0;
+}
+
+/**
+ * Write a frame to the next slot.
+ * @param info The frame's description; the sequence and frame are filled in
+ * @param data info.dataBytes of spectra
+ * @param scalers info.scalerBytes of scalers
+ * @return 0, or -1 with getError() set
+ */
+int xsp3ShmWriter::write(const xsp3ShmFrameHeader_t &info, const void *data, const void *scalers)
+{
+    if (header == NULL) {
+        return fail("the shared memory is not open");
+    }
+    if ((uint64_t) info.dataBytes + info.scalerBytes > header->payloadBytes) {
+        return fail("the frame is bigger than a slot");
+    }
+
+    uint64_t n = header->written;
+    char *base = (char *) header + header->headerBytes + (n % header->numSlots)*header->slotBytes;
+    xsp3ShmFrameHeader_t *slot = reinterpret_cast<xsp3ShmFrameHeader_t *>(base);
+
+    slot->sequence = 2*n + 1;
+    xsp3ShmBarrier();
+    slot->frame = n;
+    slot->acquisition = info.acquisition;
+    slot->frameNumber = info.frameNumber;
+    slot->timeStamp = info.timeStamp;
+    slot->dataType = info.dataType;
+    slot->ndims = info.ndims;
+    memcpy(slot->dims, info.dims, sizeof(slot->dims));
+    slot->numChannels = info.numChannels;
+    slot->numScalers = info.numScalers;
+    slot->dataBytes = info.dataBytes;
+    slot->scalerBytes = info.scalerBytes;
+    memcpy(base + XSP3_SHM_FRAME_HEADER_BYTES, data, info.dataBytes);
+    memcpy(base + XSP3_SHM_FRAME_HEADER_BYTES + info.dataBytes, scalers, info.scalerBytes);
+    xsp3ShmBarrier();
+    slot->sequence = 2*n + 2;
+    xsp3ShmBarrier();
+    header->written = n + 1;
+    return 0;
+}
+
+/**
+ * Mark the segment stale and remove it.
+ */
+void xsp3ShmWriter::close(void)
+{
+    if (header == NULL) {
+        return;
+    }
+    header->stale = 1;
+    xsp3ShmBarrier();
+    munmap(header, size);
+    shm_unlink(name.c_str());
+    header = NULL;
+    size = 0;
+}
+
+xsp3ShmReader::xsp3ShmReader() :
+    header(NULL),
+    size(0),
+    position(0),
+    lost(0)
+{
+}
+
+xsp3ShmReader::~xsp3ShmReader()
+{
+    close();
+}
+
+/**
+ * Map the segment read only. Reading starts with the next frame written.
+ * @return 0, or -1 if there is no segment of that name or it is not a ring
+ *         of this version
+ */
+int xsp3ShmReader::open(const char *name)
+{
+    struct stat st;
+    int fd;
+    void *p;
+
+    close();
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < XSP3_SHM_HEADER_BYTES) {
+        ::close(fd);
+        return -1;
+    }
+    p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        return -1;
+    }
+    header = static_cast<const xsp3ShmHeader_t *>(p);
+    size = st.st_size;
+    xsp3ShmBarrier();
+    if (header->magic != XSP3_SHM_MAGIC || header->version != XSP3_SHM_VERSION ||
+        header->headerBytes + header->slotBytes*header->numSlots > size) {
+        close();
+        return -1;
+    }
+    position = header->written;
+    lost = 0;
+    return 0;
+}
+
+void xsp3ShmReader::close(void)
+{
+    if (header != NULL) {
+        munmap((void *) header, size);
+    }
+    header = NULL;
+    size = 0;
+}
+
+const xsp3ShmFrameHeader_t *xsp3ShmReader::slot(uint64_t n) const
+{
+    const char *base = (const char *) header + header->headerBytes + (n % header->numSlots)*header->slotBytes;
+    return reinterpret_cast<const xsp3ShmFrameHeader_t *>(base);
+}
+
+/**
+ * Find frame n in the ring without copying it. Once finished with the
+ * frame, call valid() to check the writer did not overwrite it meanwhile.
+ * @param status Set to an xsp3ShmStatus
+ * @return The frame's slot, or NULL unless status is xsp3ShmOk
+ */
+const xsp3ShmFrameHeader_t *xsp3ShmReader::peek(uint64_t n, int *status)
+{
+    if (header == NULL) {
+        *status = xsp3ShmError;
+        return NULL;
+    }
+    if (header->stale) {
+        *status = xsp3ShmStale;
+        return NULL;
+    }
+    const xsp3ShmFrameHeader_t *frameSlot = slot(n);
+    uint64_t sequence = frameSlot->sequence;
+    xsp3ShmBarrier();
+    if (sequence < 2*n + 2) {
+        *status = xsp3ShmNotReady;
+        return NULL;
+    }
+    if (sequence > 2*n + 2) {
+        *status = xsp3ShmOverwritten;
+        return NULL;
+    }
+    *status = xsp3ShmOk;
+    return frameSlot;
+}
+
+/**
+ * @return true if frame n, found with peek(), has not been overwritten
+ */
+bool xsp3ShmReader::valid(uint64_t n, const xsp3ShmFrameHeader_t *frameSlot)
+{
+    xsp3ShmBarrier();
+    return frameSlot->sequence == 2*n + 2;
+}
+
+/**
+ * Copy frame n out of the ring.
+ * @return An xsp3ShmStatus
+ */
+int xsp3ShmReader::read(uint64_t n, xsp3ShmFrame_t *frame)
+{
+    int status;
+    const xsp3ShmFrameHeader_t *frameSlot = peek(n, &status);
+
+    if (frameSlot == NULL) {
+        return status;
+    }
+    memcpy(&frame->header, frameSlot, sizeof(frame->header));
+    if ((uint64_t) frame->header.dataBytes + frame->header.scalerBytes > header->payloadBytes) {
+        // Torn by the writer; the sequence check below will say so
+        frame->header.dataBytes = frame->header.scalerBytes = 0;
+    }
+    frame->data.resize(frame->header.dataBytes);
+    frame->scalers.resize(frame->header.scalerBytes);
+    if (frame->header.dataBytes > 0) {
+        memcpy(&frame->data[0], xsp3ShmData(frameSlot), frame->header.dataBytes);
+    }
+    if (frame->header.scalerBytes > 0) {
+        memcpy(&frame->scalers[0], (const char *) xsp3ShmData(frameSlot) + frame->header.dataBytes, frame->header.scalerBytes);
+    }
+    return valid(n, frameSlot) ? xsp3ShmOk : xsp3ShmOverwritten;
+}
+
+/**
+ * Copy the next frame out of the ring. Frames overwritten before they
+ * could be read are skipped and counted in getLost().
+ * @return xsp3ShmOk, xsp3ShmNotReady if the writer has not written the
+ *         next frame yet, or xsp3ShmStale or xsp3ShmError
+ */
+int xsp3ShmReader::next(xsp3ShmFrame_t *frame)
+{
+    while (1) {
+        if (header == NULL) {
+            return xsp3ShmError;
+        }
+        uint64_t written = header->written;
+        if (written > position + header->numSlots) {
+            lost += written - header->numSlots - position;
+            position = written - header->numSlots;
+        }
+        int status = read(position, frame);
+        if (status != xsp3ShmOverwritten) {
+            if (status == xsp3ShmOk) {
+                position++;
+            }
+            return status;
+        }
+        lost++;
+        position++;
+    }
+}
@@ -0,0 +1,156 @@
+/*
+ * xsp3ShmRing.h
+ *
+ * A ring of frames in POSIX shared memory, written by the driver and read
+ * by analysis processes on the same host without copying through EPICS.
+ * This file is the whole interface: it needs only POSIX, so readers can
+ * build xsp3ShmRing.cpp into their own programs or link libxsp3Shm.
+ *
+ * Layout of the segment (all fields in host byte order):
+ *
+ *   offset 0                  xsp3ShmHeader_t
+ *   headerBytes               slot 0
+ *   headerBytes + slotBytes   slot 1 ... up to numSlots
+ *
+ * Each slot is an xsp3ShmFrameHeader_t, padded to XSP3_SHM_FRAME_HEADER_BYTES,
+ * followed by dataBytes of spectra laid out as the frame's NDArray (bins
+ * fastest, then channels, then sub-frames) and then scalerBytes of scalers,
+ * numScalers per channel. Both are UInt32, or Float64 for dead time
+ * corrected frames.
+ *
+ * Frame n (counting from 0 since the segment was created) is written to
+ * slot n % numSlots. The slot's sequence is a sequence lock:
+ *
+ *   writer:  sequence = 2n+1, barrier, write the slot, barrier,
+ *            sequence = 2n+2, barrier, written = n+1
+ *
+ *   reader:  s1 = sequence, barrier, copy or use the slot, barrier,
+ *            s2 = sequence. The frame is good if s1 == s2 == 2n+2; if
+ *            s1 < 2n+2 it is not written yet, and if either is greater
+ *            it was overwritten while being read.
+ *
+ * The writer never waits for readers, so a reader that falls more than
+ * numSlots frames behind loses frames. When the writer replaces the
+ * segment (a new geometry, or the driver restarting) it sets stale in the
+ * old header before unlinking it; readers must then open the name again.
+ */
+
+#ifndef XSP3SHMRING_H_
+#define XSP3SHMRING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define XSP3_SHM_MAGIC 0x33505358       /* "XSP3" */
+#define XSP3_SHM_VERSION 1
+#define XSP3_SHM_HEADER_BYTES 4096
+#define XSP3_SHM_FRAME_HEADER_BYTES 128
+#define XSP3_SHM_ALIGN 64
+
+enum xsp3ShmDataType { xsp3ShmUInt32 = 0, xsp3ShmFloat64 = 1 };
+
+enum xsp3ShmStatus {
+    xsp3ShmOk = 0,
+    xsp3ShmNotReady = 1,        //!< The frame has not been written yet
+    xsp3ShmOverwritten = 2,     //!< The writer reused the slot before the frame was read
+    xsp3ShmStale = 3,           //!< The writer replaced the segment; open it again
+    xsp3ShmError = -1
+};
+
+typedef struct xsp3ShmHeader {
+    uint32_t magic;                 //!< XSP3_SHM_MAGIC
+    uint32_t version;               //!< XSP3_SHM_VERSION
+    uint32_t headerBytes;           //!< Offset of slot 0
+    uint32_t numSlots;
+    uint64_t slotBytes;             //!< Distance between slots
+    uint64_t payloadBytes;          //!< Most spectra and scaler bytes a slot holds
+    volatile uint32_t stale;        //!< Non-zero once the writer has replaced the segment
+    uint32_t reserved;
+    volatile uint64_t written;      //!< Frames written since the segment was created
+} xsp3ShmHeader_t;
+
+typedef struct xsp3ShmFrameHeader {
+    volatile uint64_t sequence;     //!< 2n+1 while frame n is written, 2n+2 once it is
+    uint64_t frame;                 //!< n
+    uint32_t acquisition;           //!< Acquisitions started since the segment was created
+    uint32_t frameNumber;           //!< Frame of the acquisition, from 0
+    double timeStamp;               //!< Read out time, POSIX seconds
+    uint32_t dataType;              //!< xsp3ShmDataType
+    uint32_t ndims;                 //!< 2, or 3 for sub-frames
+    uint32_t dims[3];               //!< Bins, channels, sub-frames
+    uint32_t numChannels;
+    uint32_t numScalers;            //!< Scalers per channel
+    uint32_t dataBytes;
+    uint32_t scalerBytes;
+} xsp3ShmFrameHeader_t;
+
+/* The spectra and scalers of a frame in a slot */
+inline const void *xsp3ShmData(const xsp3ShmFrameHeader_t *slot)
+{
+    return (const char *) slot + XSP3_SHM_FRAME_HEADER_BYTES;
+}
+
+inline const void *xsp3ShmScalers(const xsp3ShmFrameHeader_t *slot)
+{
+    return (const char *) slot + XSP3_SHM_FRAME_HEADER_BYTES + slot->dataBytes;
+}
+
+class xsp3ShmWriter {
+public:
+    xsp3ShmWriter();
+    ~xsp3ShmWriter();
+
+    int open(const char *name, int numSlots, size_t payloadBytes);
+    int write(const xsp3ShmFrameHeader_t &info, const void *data, const void *scalers);
+    void close(void);
+    bool isOpen(void) const { return header != NULL; }
+    uint64_t getWritten(void) const { return header ? header->written : 0; }
+    const std::string &getError(void) const { return error; }
+
+private:
+    int fail(const char *message);
+
+    std::string name;
+    xsp3ShmHeader_t *header;
+    size_t size;
+    std::string error;
+};
+
+/* A copy of a frame taken from the ring */
+typedef struct xsp3ShmFrame {
+    xsp3ShmFrameHeader_t header;
+    std::vector<char> data;
+    std::vector<char> scalers;
+} xsp3ShmFrame_t;
+
+class xsp3ShmReader {
+public:
+    xsp3ShmReader();
+    ~xsp3ShmReader();
+
+    int open(const char *name);
+    void close(void);
+    bool isOpen(void) const { return header != NULL; }
+
+    uint64_t getWritten(void) const { return header ? header->written : 0; }
+    uint64_t getPosition(void) const { return position; }
+    uint64_t getLost(void) const { return lost; }
+    void seek(uint64_t frame) { position = frame; }
+
+    int next(xsp3ShmFrame_t *frame);
+    int read(uint64_t n, xsp3ShmFrame_t *frame);
+    const xsp3ShmFrameHeader_t *peek(uint64_t n, int *status);
+    bool valid(uint64_t n, const xsp3ShmFrameHeader_t *slot);
+
+private:
+    const xsp3ShmFrameHeader_t *slot(uint64_t n) const;
+
+    const xsp3ShmHeader_t *header;
+    size_t size;
+    uint64_t position;
+    uint64_t lost;
+};
+
+#endif /* XSP3SHMRING_H_ */
@@ -5,107 +5,486 @@
  *      Author: npr78
  */
 #include "xsp3SimElement.h"
+#include "xsp3SimRandom.h"
+#include "xspress3.h"
 #include <cmath>
 #include <cstdlib>
+#include <cstring>
 
 
 static int num_detectors=0;
 
+/* Full scale of the simulated energy axis, whatever the number of bins */
+static const double fullScaleEnergy = 40960.0;  // eV
+
+/* Detector resolution: electronic noise FWHM, pair creation energy and Fano factor */
+static const double noiseFWHM = 100.0;          // eV
+static const double pairEnergy = 3.85;          // eV
+static const double fanoFactor = 0.12;
+
+/* Fraction of the counts in the continuum rather than in peaks */
+static const double backgroundFraction = 0.15;
+
+/* Scaler clock, and the reset model: resets per input count and length of each reset */
+static const double clockRate = 80E6;           // Hz
+static const double resetsPerCount = 5E-4;
+static const uint32_t ticksPerReset = 400;      // 5 us
+
+typedef struct xsp3SimLine
+{
+    double energy;      // eV
+    double intensity;   // Relative area
+    double broadening;  // Extra width (sigma, eV), for Compton scatter
+} xsp3SimLine_t;
+
+/* A plausible mixed sample excited at 15 keV */
+static const xsp3SimLine_t simLines[] =
+{
+    {  3691.7, 0.30,   0.0 },   // Ca Ka
+    {  4012.7, 0.04,   0.0 },   // Ca Kb
+    {  6403.8, 1.00,   0.0 },   // Fe Ka
+    {  7058.0, 0.13,   0.0 },   // Fe Kb
+    {  8047.8, 0.60,   0.0 },   // Cu Ka
+    {  8905.3, 0.08,   0.0 },   // Cu Kb
+    {  8638.9, 0.40,   0.0 },   // Zn Ka
+    {  9572.0, 0.06,   0.0 },   // Zn Kb
+    { 10551.5, 0.20,   0.0 },   // Pb La
+    { 12613.7, 0.15,   0.0 },   // Pb Lb
+    { 14200.0, 0.80, 250.0 },   // Compton scatter
+    { 15000.0, 0.50,   0.0 },   // Elastic scatter
+};
+static const int numSimLines = sizeof(simLines)/sizeof(simLines[0]);
+
 xsp3SimElement::xsp3SimElement( int nspectra )
-: threshold(0),
+: seed(0),
+  inputRate(0.0),
+  nominalTime(1.0),
+  countsPerFrame(0.0),
+  scratchFrame(-1),
+  sumFrame(-1),
+  sumTotal(0),
+  threshold(0),
   num_spectra(nspectra),
-  processDeadTimeAllEventGradient(0),
-  processDeadTimeAllEventOffset(0),
-  processDeadTimeInWindowOffset(0),
-  processDeadTimeInWindowGradient(0)
+  eventWidth(6)
 {
     detector = num_detectors++;
+    window[0].low = window[0].high = 0;
+    window[1].low = window[1].high = 0;
+    sumWindow[0] = sumWindow[1] = 0;
+
+    processDeadTimeAllEventOffset = 0.0;
+    processDeadTimeAllEventGradient = eventTime();
+    processDeadTimeInWindowOffset = 0.0;
+    processDeadTimeInWindowGradient = 2.0*eventTime();
+
+    buildShape();
+    buildAliasTable();
+    lambda.assign( num_spectra, 0.0 );
+    expNegLambda.assign( num_spectra, 1.0 );
+    sqrtLambda.assign( num_spectra, 0.0 );
+    scratch.assign( num_spectra, 0 );
 }
 
 xsp3SimElement::~xsp3SimElement( void )
 {
 }
 
-void xsp3SimElement::generateRawSpectra( int frame, unsigned int start, unsigned int n_pts, uint32_t * buffer )
+double xsp3SimElement::getEnergyPerBin( void ) const
 {
-    if ( start+n_pts > num_spectra ) n_pts = num_spectra-start;
+    return num_spectra > 0 ? fullScaleEnergy/num_spectra : 0.0;
+}
 
-    switch (detector%3)
-    {
-    case 1:
+/**
+ * Build the normalised spectral shape. Each element gets a slightly
+ * different gain so that channels are not identical.
+ */
+void xsp3SimElement::buildShape( void )
+{
+    const double binWidth = getEnergyPerBin();
+    const double gain = 1.0 + 0.004*((detector % 7) - 3);
+    double peakTotal = 0.0;
+    double backTotal = 0.0;
+    std::vector<double> background( num_spectra, 0.0 );
+
+    shape.assign( num_spectra, 0.0 );
+
+    for (int line = 0; line < numSimLines; line++)
     {
-        // Delta functions
-        for (unsigned int i=0; i < n_pts; i++)
+        double centre = simLines[line].energy;
+        double sigma2 = pow(noiseFWHM/2.3548, 2) + pairEnergy*fanoFactor*centre +
+                        simLines[line].broadening*simLines[line].broadening;
+        double sigma = sqrt(sigma2);
+        double norm = simLines[line].intensity * binWidth / (sigma*sqrt(2.0*M_PI));
+        int first = (int) ((centre - 5*sigma)/(binWidth*gain));
+        int last  = (int) ((centre + 5*sigma)/(binWidth*gain)) + 1;
+
+        if (first < 0) first = 0;
+        if (last > (int) num_spectra) last = num_spectra;
+        for (int bin = first; bin < last; bin++)
         {
-            if ((start+i+frame)%100 ==0)
-                buffer[i]=100;
-            else
-                buffer[i]=0;
+            double x = (bin + 0.5)*binWidth*gain - centre;
+            double value = norm*exp(-x*x/(2*sigma2));
+            shape[bin] += value;
+            peakTotal += value;
         }
-        break;
     }
-    case 2:
+
+    /* Continuum falling with energy, cut off by the noise threshold at ~1 keV */
+    for (unsigned int bin = 0; bin < num_spectra; bin++)
+    {
+        double energy = (bin + 0.5)*binWidth*gain;
+        double value = energy < 1000.0 ? 0.0 : exp(-energy/8000.0) * (1.0 - exp(-(energy-1000.0)/500.0));
+        background[bin] = value;
+        backTotal += value;
+    }
+
+    for (unsigned int bin = 0; bin < num_spectra; bin++)
     {
-        // Saw tooth
-        for (unsigned int i=0; i < n_pts; i++)
+        double value = 0.0;
+        if (peakTotal > 0.0) value += (1.0-backgroundFraction)*shape[bin]/peakTotal;
+        if (backTotal > 0.0) value += backgroundFraction*background[bin]/backTotal;
+        shape[bin] = value;
+    }
+}
+
+/**
+ * Walker/Vose alias table over the shape, so that individual counts can be
+ * placed in O(1) when the total per frame is small compared to the number
+ * of bins.
+ */
+void xsp3SimElement::buildAliasTable( void )
+{
+    const unsigned int n = num_spectra;
+    std::vector<double> scaled( n );
+    std::vector<uint32_t> small, large;
+    double total = 0.0;
+
+    aliasThreshold.assign( n, 0xFFFFFFFFu );
+    aliasIndex.assign( n, 0 );
+    if (n == 0) return;
+
+    for (unsigned int i = 0; i < n; i++) total += shape[i];
+    for (unsigned int i = 0; i < n; i++)
+    {
+        scaled[i] = total > 0.0 ? shape[i]*n/total : 1.0;
+        aliasIndex[i] = i;
+        if (scaled[i] < 1.0) small.push_back(i);
+        else large.push_back(i);
+    }
+    while (!small.empty() && !large.empty())
+    {
+        uint32_t s = small.back(); small.pop_back();
+        uint32_t l = large.back();
+        aliasThreshold[s] = (uint32_t) (scaled[s]*4294967295.0);
+        aliasIndex[s] = l;
+        scaled[l] -= 1.0 - scaled[s];
+        if (scaled[l] < 1.0)
         {
-            buffer[i]=(start+i+frame)%100;
+            large.pop_back();
+            small.push_back(l);
         }
-        break;
     }
-    default:
-        // Sine wave with noise
-        for (unsigned int i=0; i < n_pts; i++)
+}
+
+void xsp3SimElement::setSeed( uint64_t newSeed )
+{
+    seed = newSeed;
+    scratchFrame = -1;
+    sumFrame = -1;
+}
+
+void xsp3SimElement::setWindow( int win, int low, int high )
+{
+    window[win].low = low;
+    window[win].high = high;
+    sumFrame = -1;
+}
+
+/* Event processing time in seconds */
+double xsp3SimElement::eventTime( void ) const
+{
+    return (eventWidth + 1)/clockRate;
+}
+
+/* Mean fraction of the time not spent in detector resets */
+double xsp3SimElement::liveFraction( void ) const
+{
+    double dead = inputRate*resetsPerCount*ticksPerReset/clockRate;
+    return dead < 1.0 ? 1.0 - dead : 0.0;
+}
+
+/**
+ * Set the input count rate and the nominal frame time. The mean number of
+ * good counts per frame, and the per-bin tables, are only rebuilt when
+ * these change, normally once per acquisition.
+ */
+void xsp3SimElement::setInputRate( double rate, double frameTime )
+{
+    double counts;
+
+    if (rate < 0.0) rate = 0.0;
+    if (frameTime <= 0.0) frameTime = 1.0;
+    inputRate = rate;
+    nominalTime = frameTime;
+
+    counts = rate*frameTime*liveFraction()*exp(-2.0*rate*eventTime());
+    if (counts == countsPerFrame) return;
+
+    countsPerFrame = counts;
+    for (unsigned int bin = 0; bin < num_spectra; bin++)
+    {
+        lambda[bin] = shape[bin]*counts;
+        expNegLambda[bin] = exp(-lambda[bin]);
+        sqrtLambda[bin] = sqrt(lambda[bin]);
+    }
+    scratchFrame = -1;
+    sumFrame = -1;
+}
+
+/**
+ * Draw one complete spectrum (num_spectra bins) for a frame of the given
+ * length in seconds.
+ * The result depends only on the seed, the element, the frame number and
+ * the exposure, so this can be called from any thread.
+ */
+void xsp3SimElement::generateFrame( int frame, double exposure, uint32_t * buffer ) const
+{
+    uint64_t state = xsp3SimStream( seed, detector, frame );
+    double scale = exposure/nominalTime;
+    double counts = countsPerFrame*scale;
+
+    if (counts <= 4.0*num_spectra)
+    {
+        /* Sparse: draw the total, then drop each count into a bin */
+        uint32_t total = xsp3SimPoisson( state, counts );
+        memset( buffer, 0, num_spectra*sizeof(uint32_t) );
+        for (uint32_t count = 0; count < total; count++)
         {
-            buffer[i] = (sin(static_cast<double>(start+i+frame)/90)+1)*100;
+            uint64_t r = xsp3SimRandom( state );
+            uint32_t bin = (uint32_t) (((r >> 32) * num_spectra) >> 32);
+            if ((uint32_t) r > aliasThreshold[bin]) bin = aliasIndex[bin];
+            buffer[bin]++;
         }
     }
+    else if (fabs(scale - 1.0) < 1E-6)
+    {
+        /* Dense: independent Poisson draw for every bin */
+        for (unsigned int bin = 0; bin < num_spectra; bin++)
+            buffer[bin] = xsp3SimPoisson( state, lambda[bin], expNegLambda[bin], sqrtLambda[bin] );
+    }
+    else
+    {
+        /* Dense, but not the nominal frame time, so the tables do not apply */
+        for (unsigned int bin = 0; bin < num_spectra; bin++)
+            buffer[bin] = xsp3SimPoisson( state, lambda[bin]*scale );
+    }
 }
-void xsp3SimElement::generateDTCSpectra( int frame, unsigned int start, unsigned int n_pts, double * buffer )
+
+uint32_t xsp3SimElement::windowSum( const uint32_t * spectrum, int win ) const
 {
-    if ( start+n_pts > num_spectra ) n_pts = num_spectra-start;
+    uint32_t result = 0;
+    int low = window[win].low < 0 ? 0 : window[win].low;
+    int high = window[win].high >= (int) num_spectra ? num_spectra-1 : window[win].high;
 
-    uint32_t ibuffer[n_pts];
+    for (int bin = low; bin <= high; bin++)
+        result += spectrum[bin];
 
-    generateRawSpectra( frame, start, n_pts, ibuffer );
+    return result;
+}
 
-    for (unsigned int i=0; i < n_pts; i++)
-        buffer[i] = ibuffer[i];
+void xsp3SimElement::storeSums( int frame, const uint32_t * spectrum )
+{
+    sumTotal = 0;
+    for (unsigned int bin = 0; bin < num_spectra; bin++)
+        sumTotal += spectrum[bin];
+    sumWindow[0] = windowSum( spectrum, 0 );
+    sumWindow[1] = windowSum( spectrum, 1 );
+    sumFrame = frame;
 }
 
-uint32_t xsp3SimElement::generateRawROI( int frame, int win )
+void xsp3SimElement::fillScratch( int frame, double exposure )
 {
-    int result=0;
-    unsigned int start=window[win].low;
-    unsigned int n_pts =window[win].high-window[win].low+1;
+    if (scratchFrame != frame)
+    {
+        generateFrame( frame, exposure, &scratch[0] );
+        scratchFrame = frame;
+        storeSums( frame, &scratch[0] );
+    }
+}
 
+void xsp3SimElement::generateRawSpectra( int frame, double exposure, unsigned int start, unsigned int n_pts, uint32_t * buffer )
+{
+    if ( start >= num_spectra ) return;
     if ( start+n_pts > num_spectra ) n_pts = num_spectra-start;
 
-    uint32_t buffer[n_pts];
-    generateRawSpectra( frame, start, n_pts, buffer );
+    if ( start == 0 && n_pts == num_spectra && scratchFrame != frame )
+    {
+        generateFrame( frame, exposure, buffer );
+        storeSums( frame, buffer );
+    }
+    else
+    {
+        fillScratch( frame, exposure );
+        memcpy( buffer, &scratch[start], n_pts*sizeof(uint32_t) );
+    }
+}
+
+void xsp3SimElement::generateDTCSpectra( int frame, double exposure, unsigned int start, unsigned int n_pts, double * buffer )
+{
+    uint32_t scalers[XSP3_SW_NUM_SCALERS];
+    double factor;
+
+    if ( start >= num_spectra ) return;
+    if ( start+n_pts > num_spectra ) n_pts = num_spectra-start;
 
+    fillScratch( frame, exposure );
+    generateScalers( frame, exposure, scalers );
+    factor = dtcFactor( scalers, NULL );
     for (unsigned int i=0; i < n_pts; i++)
-        result+=buffer[i];
+        buffer[i] = scratch[start+i]*factor;
+}
 
-    return result;
+uint32_t xsp3SimElement::generateRawROI( int frame, double exposure, int win )
+{
+    fillScratch( frame, exposure );
+    return windowSum( &scratch[0], win );
 }
 
-double xsp3SimElement::generateDTCROI( int frame, int win )
+double xsp3SimElement::generateDTCROI( int frame, double exposure, int win )
 {
-    double result=0;
-    unsigned int start=window[win].low;
-    unsigned int n_pts =window[win].high-window[win].low+1;
+    uint32_t scalers[XSP3_SW_NUM_SCALERS];
 
-    if ( start+n_pts > num_spectra ) n_pts = num_spectra-start;
+    generateScalers( frame, exposure, scalers );
+    return scalers[win ? XSP3_SCALER_INWINDOW1 : XSP3_SCALER_INWINDOW0]*dtcFactor( scalers, NULL );
+}
+
+/**
+ * Fill the XSP3_SW_NUM_SCALERS scalers for a frame. AllGood and the window
+ * counts come from the frame's spectrum; time, resets and pileup are drawn
+ * from the dead time model.
+ */
+void xsp3SimElement::generateScalers( int frame, double exposure, uint32_t * scalers )
+{
+    if (sumFrame != frame)
+    {
+        if (scratchFrame == frame) storeSums( frame, &scratch[0] );
+        else fillScratch( frame, exposure );
+    }
+    modelScalers( frame, exposure, sumTotal, sumWindow, scalers );
+}
 
-    double buffer[n_pts];
-    generateDTCSpectra( frame, start, n_pts, buffer );
+/**
+ * Scalers for a spectrum generated elsewhere by generateFrame. Unlike
+ * generateScalers this leaves the element untouched, so can be called
+ * from any thread.
+ */
+void xsp3SimElement::scalersFromSpectrum( int frame, double exposure, const uint32_t * spectrum, uint32_t * scalers ) const
+{
+    uint32_t total = 0;
+    uint32_t windows[2];
 
-    for (unsigned int i=0; i < n_pts; i++)
-        result+=buffer[i];
+    for (unsigned int bin = 0; bin < num_spectra; bin++)
+        total += spectrum[bin];
+    windows[0] = windowSum( spectrum, 0 );
+    windows[1] = windowSum( spectrum, 1 );
+    modelScalers( frame, exposure, total, windows, scalers );
+}
 
-    return result;
+void xsp3SimElement::modelScalers( int frame, double exposure, uint32_t total, const uint32_t * windows, uint32_t * scalers ) const
+{
+    uint64_t state = xsp3SimStream( seed ^ 0x5343414C45525321ULL, detector, frame );
+    const double tau = eventTime();
+    double ticks = exposure*clockRate;
+    uint32_t resets, resetTicks, pileup;
+    double live;
+
+    if (ticks < 0.0) ticks = 0.0;
+    if (ticks > 4294967295.0) ticks = 4294967295.0;
+    resets = xsp3SimPoisson( state, inputRate*resetsPerCount*exposure );
+    resetTicks = (double) resets*ticksPerReset > ticks ? (uint32_t) ticks : resets*ticksPerReset;
+    live = (ticks - resetTicks)/clockRate;
+    pileup = xsp3SimPoisson( state, inputRate*live*exp(-inputRate*tau)*(1.0 - exp(-inputRate*tau)) );
+
+    scalers[XSP3_SCALER_TIME] = (uint32_t) ticks;
+    scalers[XSP3_SCALER_RESETTICKS] = resetTicks;
+    scalers[XSP3_SCALER_RESETCOUNT] = resets;
+    scalers[XSP3_SCALER_ALLEVENT] = total + pileup;
+    scalers[XSP3_SCALER_ALLGOOD] = total;
+    scalers[XSP3_SCALER_INWINDOW0] = windows[0];
+    scalers[XSP3_SCALER_INWINDOW1] = windows[1];
+    scalers[XSP3_SCALER_PILEUP] = pileup;
+    for (int scaler = XSP3_SCALER_PILEUP+1; scaler < XSP3_SW_NUM_SCALERS; scaler++)
+        scalers[scaler] = 0;
+}
+
+/**
+ * Dead time corrected scalers: AllGood and the windows are scaled by the
+ * correction factor.
+ */
+void xsp3SimElement::generateDTCScalers( int frame, double exposure, double * scalers )
+{
+    uint32_t raw[XSP3_SW_NUM_SCALERS];
+
+    generateScalers( frame, exposure, raw );
+    correctScalers( raw, scalers );
 }
 
+/**
+ * Apply dead time correction to a set of raw scalers.
+ * @return The correction factor used
+ */
+double xsp3SimElement::correctScalers( const uint32_t * raw, double * scalers ) const
+{
+    double factor = dtcFactor( raw, NULL );
+
+    for (int scaler = 0; scaler < XSP3_SW_NUM_SCALERS; scaler++)
+        scalers[scaler] = raw[scaler];
+    scalers[XSP3_SCALER_ALLGOOD] *= factor;
+    scalers[XSP3_SCALER_INWINDOW0] *= factor;
+    scalers[XSP3_SCALER_INWINDOW1] *= factor;
+    return factor;
+}
 
+/**
+ * Invert the dead time model for one frame of scalers.
+ * The input rate n is found from the all event rate m over the live time
+ * by solving m = n exp(-n tau). The factor corrects good counts for the
+ * resets and for both sides of the paralysable dead time.
+ * @param scalers The XSP3_SW_NUM_SCALERS scalers for the frame
+ * @param inputEstimate If not NULL, set to the estimated input counts
+ * @return The correction factor to apply to good counts
+ */
+double xsp3SimElement::dtcFactor( const uint32_t * scalers, double * inputEstimate ) const
+{
+    const double tau = eventTime();
+    double time = scalers[XSP3_SCALER_TIME]/clockRate;
+    double live = ((double) scalers[XSP3_SCALER_TIME] - scalers[XSP3_SCALER_RESETTICKS])/clockRate;
+    double rate, estimate;
 
+    if (inputEstimate != NULL) *inputEstimate = 0.0;
+    if (live <= 0.0) return 1.0;
+
+    rate = scalers[XSP3_SCALER_ALLEVENT]/live;
+    if (rate*tau*M_E >= 1.0)
+    {
+        /* Past the peak of the paralysable curve, there is no unique answer */
+        estimate = 1.0/tau;
+    }
+    else
+    {
+        estimate = rate;
+        for (int iter = 0; iter < 50; iter++)
+        {
+            double next = rate*exp(estimate*tau);
+            if (fabs(next - estimate) <= 1E-9*next)
+            {
+                estimate = next;
+                break;
+            }
+            estimate = next;
+        }
+    }
+
+    if (inputEstimate != NULL) *inputEstimate = estimate*time;
+    return time/live*exp(2.0*estimate*tau);
+}
@@ -9,6 +9,7 @@
 #define XSP3SIMDATA_H_
 
 #include <stdint.h>
+#include <vector>
 
 typedef struct xsp3Window
 {
@@ -16,23 +17,80 @@ typedef struct xsp3Window
     int high;
 } xsp3Window_t;
 
+/**
+ * One simulated detector element.
+ *
+ * The spectral shape (fluorescence lines and scatter peaks on a continuum
+ * background) is computed once when the element is created. Each frame is
+ * then drawn from that shape with a seeded Poisson sampler, so a given
+ * (seed, element, frame) always produces the same spectrum.
+ *
+ * Dead time follows a paralysable model: an event is lost if another
+ * arrives within the event processing time before it, and is rejected as
+ * pileup if another arrives within the processing time after it. Detector
+ * resets, at a rate proportional to the input rate, remove live time.
+ * The spectrum holds the good (not piled up) events, and the scalers are
+ * derived from the same draw so that AllGood and InWindow match it.
+ */
 class xsp3SimElement
 {
 private:
     int detector;
+    uint64_t seed;
+    double inputRate;                   // Input count rate, counts/s
+    double nominalTime;                 // Frame time the tables below are built for
+    double countsPerFrame;              // Mean good counts in a nominal frame
+
+    std::vector<double> shape;          // Normalised spectrum, sums to one
+    std::vector<double> lambda;         // Expected counts per bin per frame
+    std::vector<double> expNegLambda;   // exp(-lambda), for the inversion sampler
+    std::vector<double> sqrtLambda;     // For the normal approximation at high counts
+    std::vector<uint32_t> aliasThreshold;
+    std::vector<uint32_t> aliasIndex;
+
+    std::vector<uint32_t> scratch;      // Holds scratchFrame, for partial reads and ROIs
+    int scratchFrame;
+
+    // Sums of the last spectrum generated, so scalers need not regenerate it
+    int sumFrame;
+    uint32_t sumTotal;
+    uint32_t sumWindow[2];
+
+    void buildShape( void );
+    void buildAliasTable( void );
+    void fillScratch( int frame, double exposure );
+    void storeSums( int frame, const uint32_t * spectrum );
+    double eventTime( void ) const;
+    double liveFraction( void ) const;
+    void modelScalers( int frame, double exposure, uint32_t total, const uint32_t * windows, uint32_t * scalers ) const;
 
 public:
     xsp3SimElement( int numSpectra );
     ~xsp3SimElement( void );
 
-    void generateRawSpectra( int frame, unsigned int start, unsigned int stop, uint32_t * buffer );
-    void generateDTCSpectra( int frame, unsigned int start, unsigned int stop, double * buffer );
-    uint32_t generateRawROI( int frame, int win );
-    double generateDTCROI( int frame, int win );
+    void setSeed( uint64_t seed );
+    void setWindow( int win, int low, int high );
+    void setInputRate( double rate, double frameTime );
+    double getCountsPerFrame( void ) const { return countsPerFrame; }
+    double getEnergyPerBin( void ) const;
+
+    void generateFrame( int frame, double exposure, uint32_t * buffer ) const;
+    uint32_t windowSum( const uint32_t * spectrum, int win ) const;
+
+    void generateRawSpectra( int frame, double exposure, unsigned int start, unsigned int stop, uint32_t * buffer );
+    void generateDTCSpectra( int frame, double exposure, unsigned int start, unsigned int stop, double * buffer );
+    uint32_t generateRawROI( int frame, double exposure, int win );
+    double generateDTCROI( int frame, double exposure, int win );
+    void generateScalers( int frame, double exposure, uint32_t * scalers );
+    void scalersFromSpectrum( int frame, double exposure, const uint32_t * spectrum, uint32_t * scalers ) const;
+    void generateDTCScalers( int frame, double exposure, double * scalers );
+    double correctScalers( const uint32_t * raw, double * scalers ) const;
+    double dtcFactor( const uint32_t * scalers, double * inputEstimate ) const;
 
     uint32_t threshold;
     xsp3Window_t window[2];
     unsigned int num_spectra;
+    int eventWidth;                     // Event processing time, in 80 MHz ticks less one
     double processDeadTimeAllEventGradient;
     double processDeadTimeAllEventOffset;
     double processDeadTimeInWindowOffset;
@@ -0,0 +1,176 @@
+/*
+ * xsp3SimFault.cpp
+ *
+ * Fault injection for the simulator, see xsp3SimFault.h
+ */
+#include "xsp3SimFault.h"
+#include "xsp3SimRandom.h"
+#include "xspress3.h"
+#include <string.h>
+
+static const char * const faultNames[xsp3FaultNum] = { "latency", "busy", "drop", "overrun", "error" };
+
+xsp3SimFault::xsp3SimFault( void ) :
+    active(false),
+    seed(0),
+    state(0),
+    busyPolls(0),
+    stuck(false)
+{
+    clear();
+}
+
+/**
+ * Look up a fault by name.
+ * @return The xsp3SimFaultType, or -1 if the name is not known
+ */
+int xsp3SimFault::lookup( const char * name )
+{
+    if (name == NULL) return -1;
+    for (int fault = 0; fault < xsp3FaultNum; fault++)
+        if (strcmp( name, faultNames[fault] ) == 0) return fault;
+    return -1;
+}
+
+const char * xsp3SimFault::name( int fault )
+{
+    return (fault >= 0 && fault < xsp3FaultNum) ? faultNames[fault] : "unknown";
+}
+
+/**
+ * Set how often a fault happens.
+ * @param fault The xsp3SimFaultType
+ * @param probability Chance of the fault per read call (latency, error), per stop (busy) or per frame (drop, overrun)
+ * @param value Delay in seconds for latency, number of busy polls for busy, unused otherwise
+ * @return XSP3_OK, or XSP3_RANGE_CHECK for a bad fault or probability
+ */
+int xsp3SimFault::set( int fault, double probability, double value )
+{
+    epicsGuard<epicsMutex> guard(mutex);
+
+    if (fault < 0 || fault >= xsp3FaultNum || probability < 0.0 || probability > 1.0 || value < 0.0)
+        return XSP3_RANGE_CHECK;
+
+    this->probability[fault] = probability;
+    this->value[fault] = value;
+    active = false;
+    for (int i = 0; i < xsp3FaultNum; i++)
+        if (this->probability[i] > 0.0) active = true;
+    return XSP3_OK;
+}
+
+/** Turn off all faults and zero the counts. */
+void xsp3SimFault::clear( void )
+{
+    epicsGuard<epicsMutex> guard(mutex);
+
+    for (int fault = 0; fault < xsp3FaultNum; fault++)
+    {
+        probability[fault] = 0.0;
+        value[fault] = 0.0;
+        injected[fault] = 0;
+        lastFrame[fault] = -1;
+    }
+    active = false;
+    busyPolls = 0;
+    stuck = false;
+}
+
+void xsp3SimFault::setSeed( uint64_t seed )
+{
+    epicsGuard<epicsMutex> guard(mutex);
+    this->seed = seed;
+    state = xsp3SimStream( seed, xsp3FaultNum, 0 );
+}
+
+void xsp3SimFault::report( FILE * fp )
+{
+    epicsGuard<epicsMutex> guard(mutex);
+
+    for (int fault = 0; fault < xsp3FaultNum; fault++)
+        fprintf( fp, "  %-8s probability %g, value %g, injected %lu\n",
+                 faultNames[fault], probability[fault], value[fault], injected[fault] );
+}
+
+/** An acquisition has started: clear any busy state left by the last stop. */
+void xsp3SimFault::start( void )
+{
+    epicsGuard<epicsMutex> guard(mutex);
+
+    busyPolls = 0;
+    stuck = false;
+    for (int fault = 0; fault < xsp3FaultNum; fault++)
+        lastFrame[fault] = -1;
+}
+
+/** Histogramming was stopped: decide whether the system stays busy. */
+void xsp3SimFault::stop( void )
+{
+    epicsGuard<epicsMutex> guard(mutex);
+
+    if (!chance( xsp3FaultBusy )) return;
+    busyPolls = (int) value[xsp3FaultBusy];
+    stuck = (busyPolls == 0);
+}
+
+/** Whether a poll of histogram_is_any_busy should see a busy system. */
+bool xsp3SimFault::busy( void )
+{
+    epicsGuard<epicsMutex> guard(mutex);
+
+    if (stuck) return true;
+    if (busyPolls == 0) return false;
+    busyPolls--;
+    return true;
+}
+
+/** Seconds to delay a read call, usually 0. */
+double xsp3SimFault::readLatency( void )
+{
+    epicsGuard<epicsMutex> guard(mutex);
+    return chance( xsp3FaultLatency ) ? value[xsp3FaultLatency] : 0.0;
+}
+
+/** Whether a read call should fail. */
+bool xsp3SimFault::readError( void )
+{
+    epicsGuard<epicsMutex> guard(mutex);
+    return chance( xsp3FaultError );
+}
+
+bool xsp3SimFault::dropped( int frame )
+{
+    epicsGuard<epicsMutex> guard(mutex);
+    return frameFault( xsp3FaultDrop, frame );
+}
+
+bool xsp3SimFault::overrun( int frame )
+{
+    epicsGuard<epicsMutex> guard(mutex);
+    return frameFault( xsp3FaultOverrun, frame );
+}
+
+/* Called with the mutex held. Each frame is only counted once, however often it is read. */
+bool xsp3SimFault::frameFault( int fault, int frame )
+{
+    uint64_t frameState;
+
+    if (probability[fault] <= 0.0) return false;
+    frameState = xsp3SimStream( seed, fault, frame );
+    if (xsp3SimUniform( frameState ) >= probability[fault]) return false;
+    if (frame > lastFrame[fault])
+    {
+        injected[fault]++;
+        lastFrame[fault] = frame;
+    }
+    return true;
+}
+
+/* Called with the mutex held */
+bool xsp3SimFault::chance( int fault )
+{
+    if (probability[fault] <= 0.0) return false;
+    if (xsp3SimUniform( state ) >= probability[fault]) return false;
+    injected[fault]++;
+    return true;
+}
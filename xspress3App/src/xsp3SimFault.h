@@ -0,0 +1,75 @@
+/*
+ * xsp3SimFault.h
+ *
+ * Fault injection for the simulator, so the driver can be exercised under
+ * the conditions seen on misbehaving hardware. Each fault has a
+ * probability and a value:
+ *
+ *   latency  Each read call is delayed by value seconds
+ *   busy     After a stop the system stays busy for value polls of
+ *            histogram_is_any_busy, or until the next start if value is 0
+ *   drop     A frame's data is lost and reads back as zeros
+ *   overrun  A frame is overwritten before it is acknowledged, so
+ *            histogram_circ_ack fails for it
+ *   error    A read call fails with XSP3_ERROR
+ *
+ * Frame faults are decided from the seed and the frame number, so every
+ * read of a frame agrees and the same seed gives the same faults.
+ */
+
+#ifndef XSP3SIMFAULT_H_
+#define XSP3SIMFAULT_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "epicsMutex.h"
+
+enum xsp3SimFaultType
+{
+    xsp3FaultLatency,
+    xsp3FaultBusy,
+    xsp3FaultDrop,
+    xsp3FaultOverrun,
+    xsp3FaultError,
+    xsp3FaultNum
+};
+
+class xsp3SimFault
+{
+public:
+    xsp3SimFault( void );
+
+    static int lookup( const char * name );
+    static const char * name( int fault );
+
+    int set( int fault, double probability, double value );
+    void clear( void );
+    void setSeed( uint64_t seed );
+    bool enabled( void ) const { return active; }
+    void report( FILE * fp );
+
+    void start( void );
+    void stop( void );
+    bool busy( void );
+    double readLatency( void );
+    bool readError( void );
+    bool dropped( int frame );
+    bool overrun( int frame );
+
+private:
+    bool frameFault( int fault, int frame );
+    bool chance( int fault );
+
+    epicsMutex mutex;
+    bool active;
+    uint64_t seed;
+    uint64_t state;
+    double probability[xsp3FaultNum];
+    double value[xsp3FaultNum];
+    unsigned long injected[xsp3FaultNum];
+    int lastFrame[xsp3FaultNum];
+    int busyPolls;
+    bool stuck;
+};
+
+#endif /* XSP3SIMFAULT_H_ */
@@ -0,0 +1,263 @@
+/*
+ * xsp3SimProducer.cpp
+ *
+ * Threaded frame generation for the simulator, see xsp3SimProducer.h
+ */
+#include "xsp3SimProducer.h"
+#include "xspress3.h"
+#include "epicsThread.h"
+#include "epicsStdio.h"
+#include <stdio.h>
+
+xsp3SimProducer::xsp3SimProducer( const std::vector<xsp3SimElement> &detectors ) :
+    detectors(detectors),
+    numThreads(0),
+    runningThreads(0),
+    busyThreads(0),
+    exiting(false),
+    running(false),
+    epoch(0),
+    numChan(0),
+    numBins(0),
+    exposure(1.0),
+    nextFrame(0),
+    readFrame(0)
+{
+}
+
+xsp3SimProducer::~xsp3SimProducer( void )
+{
+    configure( 0, 0 );
+}
+
+void xsp3SimProducer::producerTask( void *drvPvt )
+{
+    xsp3SimProducer *pProducer = (xsp3SimProducer *) drvPvt;
+    pProducer->run();
+}
+
+/**
+ * Set the number of producer threads and the ring length in frames.
+ * Any running threads are stopped first. Zero threads turns the ring off.
+ * @return XSP3_OK, or XSP3_ERROR if a thread could not be created
+ */
+int xsp3SimProducer::configure( int num_threads, int ring_frames )
+{
+    int status = XSP3_OK;
+
+    /* Stop the existing pool */
+    {
+        epicsGuard<epicsMutex> guard(mutex);
+        exiting = true;
+        running = false;
+    }
+    for (;;)
+    {
+        {
+            epicsGuard<epicsMutex> guard(mutex);
+            if (runningThreads == 0) break;
+        }
+        work.signal();
+        done.wait( 0.01 );
+    }
+
+    epicsGuard<epicsMutex> guard(mutex);
+    exiting = false;
+    numThreads = 0;
+    slots.clear();
+    spectra.clear();
+    scalers.clear();
+    if (num_threads <= 0 || ring_frames <= 0) return XSP3_OK;
+
+    slots.resize( ring_frames );
+    for (int i = 0; i < ring_frames; i++)
+    {
+        slots[i].state = slotEmpty;
+        slots[i].frame = -1;
+        slots[i].readers = 0;
+        slots[i].exposure = 0.0;
+    }
+
+    for (int i = 0; i < num_threads; i++)
+    {
+        char name[32];
+        epicsSnprintf( name, sizeof(name), "xsp3SimProd%d", i );
+        if (epicsThreadCreate( name, epicsThreadPriorityMedium,
+                               epicsThreadGetStackSize(epicsThreadStackMedium),
+                               (EPICSTHREADFUNC) producerTask, this ) == NULL)
+        {
+            printf( "xsp3SimProducer: could not create producer thread %d\n", i );
+            status = XSP3_ERROR;
+            break;
+        }
+        numThreads++;
+        runningThreads++;
+    }
+    return status;
+}
+
+/* Wait until no producer is part way through a frame */
+void xsp3SimProducer::waitIdle( void )
+{
+    for (;;)
+    {
+        {
+            epicsGuard<epicsMutex> guard(mutex);
+            if (busyThreads == 0) return;
+        }
+        done.wait( 0.01 );
+    }
+}
+
+/**
+ * Start generating frames from frame 0. The element settings must not
+ * change until stop() is called.
+ * @param num_chan Number of channels in each frame
+ * @param frame_time Frame length in seconds to generate for
+ */
+void xsp3SimProducer::start( int num_chan, double frame_time )
+{
+    if (numThreads == 0) return;
+    stop();
+
+    epicsGuard<epicsMutex> guard(mutex);
+    if (num_chan > (int) detectors.size()) num_chan = detectors.size();
+    numChan = num_chan;
+    numBins = numChan > 0 ? detectors[0].num_spectra : 0;
+    spectra.resize( slots.size()*numChan*numBins );
+    scalers.resize( slots.size()*numChan*XSP3_SW_NUM_SCALERS );
+    for (size_t i = 0; i < slots.size(); i++)
+    {
+        slots[i].state = slotEmpty;
+        slots[i].frame = -1;
+    }
+    exposure = frame_time;
+    nextFrame = 0;
+    readFrame = 0;
+    epoch++;
+    running = true;
+    for (int i = 0; i < numThreads; i++) work.signal();
+}
+
+/**
+ * Stop generating frames. Frames already in the ring can still be read.
+ */
+void xsp3SimProducer::stop( void )
+{
+    {
+        epicsGuard<epicsMutex> guard(mutex);
+        running = false;
+    }
+    waitIdle();
+}
+
+/**
+ * Get a frame from the ring. On success the frame stays valid until
+ * release() is called.
+ * @param frame The frame number
+ * @param frame_time Length of the frame; the ring copy is only used if it was generated for this length
+ * @param pSpectra Set to the spectra, [chan][bin]
+ * @param pScalers Set to the scalers, [chan][scaler]
+ * @return true if the ring holds the frame, false if the caller must generate it
+ */
+bool xsp3SimProducer::acquire( int frame, double frame_time, const uint32_t **pSpectra, const uint32_t **pScalers )
+{
+    epicsGuard<epicsMutex> guard(mutex);
+    size_t index;
+
+    if (slots.empty() || numChan == 0 || frame < 0) return false;
+
+    if (frame > readFrame)
+    {
+        // Slots before this frame may now be reused
+        readFrame = frame;
+        work.signal();
+    }
+
+    index = frame % slots.size();
+    if (slots[index].state != slotReady || slots[index].frame != frame || slots[index].exposure != frame_time)
+        return false;
+
+    slots[index].readers++;
+    *pSpectra = &spectra[index*numChan*numBins];
+    *pScalers = &scalers[index*numChan*XSP3_SW_NUM_SCALERS];
+    return true;
+}
+
+void xsp3SimProducer::release( int frame )
+{
+    epicsGuard<epicsMutex> guard(mutex);
+    size_t index;
+
+    if (slots.empty()) return;
+    index = frame % slots.size();
+    if (slots[index].readers > 0) slots[index].readers--;
+}
+
+void xsp3SimProducer::run( void )
+{
+    for (;;)
+    {
+        int frame = -1;
+        size_t index = 0;
+        unsigned int myEpoch = 0;
+        double frameTime = 0.0;
+        int chans = 0;
+        unsigned int bins = 0;
+
+        {
+            epicsGuard<epicsMutex> guard(mutex);
+            if (exiting)
+            {
+                runningThreads--;
+                done.signal();
+                return;
+            }
+            if (running && !slots.empty() && nextFrame < readFrame + (int) slots.size())
+            {
+                index = nextFrame % slots.size();
+                if (slots[index].readers == 0)
+                {
+                    frame = nextFrame++;
+                    slots[index].state = slotFilling;
+                    slots[index].frame = frame;
+                    myEpoch = epoch;
+                    frameTime = exposure;
+                    chans = numChan;
+                    bins = numBins;
+                    busyThreads++;
+                }
+            }
+        }
+
+        if (frame < 0)
+        {
+            work.wait( 0.001 );
+            continue;
+        }
+
+        // Another producer may have work too
+        work.signal();
+
+        uint32_t *pSpectra = &spectra[index*chans*bins];
+        uint32_t *pScalers = &scalers[index*chans*XSP3_SW_NUM_SCALERS];
+        for (int chan = 0; chan < chans; chan++)
+        {
+            detectors[chan].generateFrame( frame, frameTime, pSpectra );
+            detectors[chan].scalersFromSpectrum( frame, frameTime, pSpectra, pScalers );
+            pSpectra += bins;
+            pScalers += XSP3_SW_NUM_SCALERS;
+        }
+
+        {
+            epicsGuard<epicsMutex> guard(mutex);
+            if (myEpoch == epoch && slots[index].frame == frame)
+            {
+                slots[index].exposure = frameTime;
+                slots[index].state = slotReady;
+            }
+            busyThreads--;
+        }
+        done.signal();
+    }
+}
@@ -0,0 +1,75 @@
+/*
+ * xsp3SimProducer.h
+ *
+ * Pool of threads that generate simulated frames ahead of the reader into
+ * a ring, so the simulator can keep up with high frame rates and many
+ * channels. Each ring slot holds the raw spectra and scalers of every
+ * channel for one frame. Frames the ring does not hold (not generated
+ * yet, already overwritten, or generated for a different frame length)
+ * are left for the caller to generate directly.
+ */
+
+#ifndef XSP3SIMPRODUCER_H_
+#define XSP3SIMPRODUCER_H_
+
+#include <stdint.h>
+#include <vector>
+#include "epicsMutex.h"
+#include "epicsEvent.h"
+#include "xsp3SimElement.h"
+
+class xsp3SimProducer
+{
+public:
+    xsp3SimProducer( const std::vector<xsp3SimElement> &detectors );
+    ~xsp3SimProducer( void );
+
+    int configure( int num_threads, int ring_frames );
+    int getNumThreads( void ) const { return numThreads; }
+
+    void start( int num_chan, double exposure );
+    void stop( void );
+
+    bool acquire( int frame, double exposure, const uint32_t **spectra, const uint32_t **scalers );
+    void release( int frame );
+
+    static void producerTask( void *drvPvt );
+
+private:
+    enum slotState { slotEmpty, slotFilling, slotReady };
+
+    typedef struct xsp3SimSlot
+    {
+        slotState state;
+        int frame;
+        int readers;
+        double exposure;
+    } xsp3SimSlot_t;
+
+    void run( void );
+    void waitIdle( void );
+
+    const std::vector<xsp3SimElement> &detectors;
+    epicsMutex mutex;
+    epicsEvent work;
+    epicsEvent done;
+
+    int numThreads;
+    int runningThreads;
+    int busyThreads;
+    bool exiting;
+
+    bool running;
+    unsigned int epoch;
+    int numChan;
+    unsigned int numBins;
+    double exposure;
+    int nextFrame;
+    int readFrame;
+
+    std::vector<xsp3SimSlot_t> slots;
+    std::vector<uint32_t> spectra;      // [slot][chan][bin]
+    std::vector<uint32_t> scalers;      // [slot][chan][scaler]
+};
+
+#endif /* XSP3SIMPRODUCER_H_ */
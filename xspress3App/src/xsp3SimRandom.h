@@ -0,0 +1,101 @@
+/*
+ * xsp3SimRandom.h
+ *
+ * Small, seedable random number helpers for the simulator. Everything is
+ * inline and keeps its state in a caller supplied uint64_t, so several
+ * threads can generate independent, reproducible streams.
+ */
+
+#ifndef XSP3SIMRANDOM_H_
+#define XSP3SIMRANDOM_H_
+
+#include <stdint.h>
+#include <math.h>
+
+/** splitmix64: one 64 bit random number per call. */
+static inline uint64_t xsp3SimRandom( uint64_t &state )
+{
+    uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/** Derive an independent stream state from a seed and two stream indices. */
+static inline uint64_t xsp3SimStream( uint64_t seed, uint64_t a, uint64_t b )
+{
+    uint64_t state = seed ^ (a * 0xD1B54A32D192ED03ULL) ^ (b * 0x8CB92BA72F3D8DD7ULL);
+    xsp3SimRandom( state );
+    return state;
+}
+
+/** Uniform double in [0,1). */
+static inline double xsp3SimUniform( uint64_t &state )
+{
+    return (xsp3SimRandom( state ) >> 11) * (1.0/9007199254740992.0);
+}
+
+/**
+ * Standard normal deviate by inverting the normal CDF (Acklam's rational
+ * approximation). Only the tails need a log and a sqrt.
+ */
+static inline double xsp3SimNormal( uint64_t &state )
+{
+    static const double a[6] = {-3.969683028665376e+01, 2.209460984245205e+02, -2.759285104469687e+02,
+                                 1.383577518672690e+02, -3.066479806614716e+01, 2.506628277459239e+00};
+    static const double b[5] = {-5.447609879822406e+01, 1.615858368580409e+02, -1.556989798598866e+02,
+                                 6.680131188771972e+01, -1.328068155288572e+01};
+    static const double c[6] = {-7.784894002430293e-03, -3.223964580411365e-01, -2.400758277161838e+00,
+                                -2.549732539343734e+00, 4.374664141464968e+00, 2.938163982698783e+00};
+    static const double d[4] = {7.784695709041462e-03, 3.224671290700398e-01, 2.445134137142996e+00,
+                                3.754408661907416e+00};
+    double p = xsp3SimUniform( state );
+    double q, r;
+
+    if (p < 1e-300) p = 1e-300;
+    if (p < 0.02425) {
+        q = sqrt(-2*log(p));
+        return (((((c[0]*q+c[1])*q+c[2])*q+c[3])*q+c[4])*q+c[5]) / ((((d[0]*q+d[1])*q+d[2])*q+d[3])*q+1);
+    }
+    if (p > 1-0.02425) {
+        q = sqrt(-2*log(1-p));
+        return -(((((c[0]*q+c[1])*q+c[2])*q+c[3])*q+c[4])*q+c[5]) / ((((d[0]*q+d[1])*q+d[2])*q+d[3])*q+1);
+    }
+    q = p - 0.5;
+    r = q*q;
+    return (((((a[0]*r+a[1])*r+a[2])*r+a[3])*r+a[4])*r+a[5])*q / (((((b[0]*r+b[1])*r+b[2])*r+b[3])*r+b[4])*r+1);
+}
+
+/**
+ * Poisson deviate with mean lambda. expNegLambda and sqrtLambda are passed
+ * in so callers can precompute them once per bin rather than once per draw.
+ * Below a mean of 30 the CDF is inverted directly; above it the normal
+ * approximation is used.
+ */
+static inline uint32_t xsp3SimPoisson( uint64_t &state, double lambda, double expNegLambda, double sqrtLambda )
+{
+    if (lambda <= 0.0) return 0;
+    if (lambda < 30.0) {
+        double u = xsp3SimUniform( state );
+        double p = expNegLambda;
+        double f = p;
+        uint32_t k = 0;
+        while (u > f && k < 200) {
+            k++;
+            p *= lambda/k;
+            f += p;
+        }
+        return k;
+    }
+    double x = lambda + sqrtLambda*xsp3SimNormal( state ) + 0.5;
+    return x < 0.0 ? 0 : (x > 4294967295.0 ? 0xFFFFFFFFu : (uint32_t) x);
+}
+
+/** Poisson deviate for a one-off mean. */
+static inline uint32_t xsp3SimPoisson( uint64_t &state, double lambda )
+{
+    if (lambda <= 0.0) return 0;
+    return xsp3SimPoisson( state, lambda, lambda < 30.0 ? exp(-lambda) : 0.0, sqrt(lambda) );
+}
+
+#endif /* XSP3SIMRANDOM_H_ */
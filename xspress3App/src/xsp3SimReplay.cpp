@@ -0,0 +1,184 @@
+/*
+ * xsp3SimReplay.cpp
+ *
+ * Replay of captured data for the simulator, see xsp3SimReplay.h
+ */
+#include "xsp3SimReplay.h"
+#include "xspress3.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <errno.h>
+
+xsp3SimReplay::xsp3SimReplay( void ) :
+    header(NULL),
+    map(NULL),
+    mapSize(0),
+    spectra(NULL),
+    scalerData(NULL),
+    timestamps(NULL),
+    loop(true)
+{
+}
+
+xsp3SimReplay::~xsp3SimReplay( void )
+{
+    close();
+}
+
+/**
+ * Map a capture file and check its header and size.
+ * @param fileName The file to replay
+ * @return XSP3_OK, or XSP3_ERROR with the reason in getError()
+ */
+int xsp3SimReplay::open( const char * fileName )
+{
+    const xsp3ReplayHeader_t * head;
+    struct stat info;
+    uint64_t frameWords, expected;
+    int fd;
+
+    close();
+
+    fd = ::open( fileName, O_RDONLY );
+    if (fd < 0)
+    {
+        error = std::string("Cannot open ") + fileName + ": " + strerror(errno);
+        return XSP3_ERROR;
+    }
+    if (fstat( fd, &info ) != 0 || info.st_size < (off_t) sizeof(xsp3ReplayHeader_t))
+    {
+        error = std::string(fileName) + " is too short for a replay file";
+        ::close( fd );
+        return XSP3_ERROR;
+    }
+
+    mapSize = info.st_size;
+    map = mmap( NULL, mapSize, PROT_READ, MAP_SHARED, fd, 0 );
+    ::close( fd );
+    if (map == MAP_FAILED)
+    {
+        error = std::string("Cannot map ") + fileName + ": " + strerror(errno);
+        map = NULL;
+        return XSP3_ERROR;
+    }
+
+    head = (const xsp3ReplayHeader_t *) map;
+    frameWords = (uint64_t) head->numChannels*(head->numBins + head->numScalers);
+    expected = head->headerSize + head->numFrames*frameWords*sizeof(uint32_t);
+    if (head->flags & XSP3_REPLAY_TIMESTAMPS) expected += head->numFrames*sizeof(double);
+
+    if (memcmp( head->magic, XSP3_REPLAY_MAGIC, sizeof(head->magic) ) != 0)
+        error = std::string(fileName) + " is not a replay file";
+    else if (head->headerSize < sizeof(xsp3ReplayHeader_t) || (head->headerSize % sizeof(double)) != 0)
+        error = std::string(fileName) + " has a bad header size";
+    else if (head->numFrames == 0 || head->numChannels == 0 || head->numBins == 0)
+        error = std::string(fileName) + " has no data";
+    else if (expected > mapSize)
+        error = std::string(fileName) + " is truncated";
+    else
+        error.clear();
+
+    if (!error.empty())
+    {
+        munmap( map, mapSize );
+        map = NULL;
+        mapSize = 0;
+        return XSP3_ERROR;
+    }
+
+    header = head;
+    spectra = (const uint32_t *) ((const char *) map + head->headerSize);
+    scalerData = spectra + (uint64_t) head->numFrames*head->numChannels*head->numBins;
+    timestamps = NULL;
+    if (head->flags & XSP3_REPLAY_TIMESTAMPS)
+        timestamps = (const double *) (scalerData + (uint64_t) head->numFrames*head->numChannels*head->numScalers);
+
+    // Frames are read in order
+    madvise( map, mapSize, MADV_SEQUENTIAL );
+    return XSP3_OK;
+}
+
+void xsp3SimReplay::close( void )
+{
+    if (map != NULL) munmap( map, mapSize );
+    header = NULL;
+    map = NULL;
+    mapSize = 0;
+    spectra = NULL;
+    scalerData = NULL;
+    timestamps = NULL;
+}
+
+int xsp3SimReplay::getNumFrames( void ) const
+{
+    return header ? header->numFrames : 0;
+}
+
+int xsp3SimReplay::getNumChannels( void ) const
+{
+    return header ? header->numChannels : 0;
+}
+
+int xsp3SimReplay::getNumBins( void ) const
+{
+    return header ? header->numBins : 0;
+}
+
+int xsp3SimReplay::getNumScalers( void ) const
+{
+    return header ? header->numScalers : 0;
+}
+
+/**
+ * Map an acquisition frame number onto a recorded frame.
+ * @return The recorded frame, or -1 past the end of the file when not looping
+ */
+int xsp3SimReplay::recordedFrame( int frame ) const
+{
+    if (header == NULL || frame < 0) return -1;
+    if (frame < (int) header->numFrames) return frame;
+    return loop ? frame % header->numFrames : -1;
+}
+
+/**
+ * The spectrum for one channel of a recorded frame. Spectra for consecutive
+ * channels, and consecutive frames, follow on in memory.
+ */
+const uint32_t * xsp3SimReplay::spectrum( int recorded, int chan ) const
+{
+    return spectra + ((uint64_t) recorded*header->numChannels + chan)*header->numBins;
+}
+
+const uint32_t * xsp3SimReplay::scalers( int recorded, int chan ) const
+{
+    return scalerData + ((uint64_t) recorded*header->numChannels + chan)*header->numScalers;
+}
+
+/**
+ * Recorded frame periods, from the timestamps if present, otherwise the
+ * header frame period. Empty if neither is known.
+ */
+void xsp3SimReplay::getPeriods( std::vector<double> &periods ) const
+{
+    periods.clear();
+    if (header == NULL) return;
+
+    if (timestamps != NULL && header->numFrames > 1)
+    {
+        double last = 0.0;
+        for (uint32_t frame = 1; frame < header->numFrames; frame++)
+        {
+            last = timestamps[frame] - timestamps[frame-1];
+            periods.push_back( last > 0.0 ? last : 0.0 );
+        }
+        // The last frame's length is not recorded, repeat the one before
+        periods.push_back( last > 0.0 ? last : 0.0 );
+    }
+    else if (header->framePeriod > 0.0)
+    {
+        periods.push_back( header->framePeriod );
+    }
+}
@@ -0,0 +1,77 @@
+/*
+ * xsp3SimReplay.h
+ *
+ * Replay source for the simulator: serves recorded spectra and scalers
+ * from a memory mapped capture file instead of generating them.
+ *
+ * The file is little endian and laid out as:
+ *
+ *   xsp3ReplayHeader, padded to headerSize bytes
+ *   uint32 spectra[numFrames][numChannels][numBins]
+ *   uint32 scalers[numFrames][numChannels][numScalers]
+ *   double timestamps[numFrames]   (seconds, only if XSP3_REPLAY_TIMESTAMPS)
+ *
+ * The spectra block has the same layout as xsp3_histogram_read4d with one
+ * aux, so requests are served by copying straight out of the mapping.
+ * etc/hdf5ToReplay.py converts NDFileHDF5 files to this format.
+ */
+
+#ifndef XSP3SIMREPLAY_H_
+#define XSP3SIMREPLAY_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#define XSP3_REPLAY_MAGIC "XSP3RPL1"
+#define XSP3_REPLAY_TIMESTAMPS 0x1
+
+typedef struct xsp3ReplayHeader
+{
+    char magic[8];          // XSP3_REPLAY_MAGIC, not null terminated
+    uint32_t headerSize;    // Offset of the spectra block
+    uint32_t numChannels;
+    uint32_t numBins;
+    uint32_t numScalers;
+    uint32_t numFrames;
+    uint32_t flags;         // XSP3_REPLAY_*
+    double framePeriod;     // Seconds, 0 if not known
+} xsp3ReplayHeader_t;
+
+class xsp3SimReplay
+{
+public:
+    xsp3SimReplay( void );
+    ~xsp3SimReplay( void );
+
+    int open( const char * fileName );
+    void close( void );
+    bool isOpen( void ) const { return header != NULL; }
+    const char * getError( void ) const { return error.c_str(); }
+
+    void setLoop( bool loop_frames ) { loop = loop_frames; }
+    bool getLoop( void ) const { return loop; }
+
+    int getNumFrames( void ) const;
+    int getNumChannels( void ) const;
+    int getNumBins( void ) const;
+    int getNumScalers( void ) const;
+
+    int recordedFrame( int frame ) const;
+    const uint32_t * spectrum( int recorded, int chan ) const;
+    const uint32_t * scalers( int recorded, int chan ) const;
+    void getPeriods( std::vector<double> &periods ) const;
+
+private:
+    const xsp3ReplayHeader_t * header;
+    void * map;
+    size_t mapSize;
+    const uint32_t * spectra;
+    const uint32_t * scalerData;
+    const double * timestamps;
+    bool loop;
+    std::string error;
+};
+
+#endif /* XSP3SIMREPLAY_H_ */
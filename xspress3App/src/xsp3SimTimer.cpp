@@ -0,0 +1,320 @@
+/*
+ * xsp3SimTimer.cpp
+ *
+ * Timing engine for the simulator, see xsp3SimTimer.h
+ */
+#include "xsp3SimTimer.h"
+#include "xsp3SimRandom.h"
+#include "xspress3.h"
+
+/* ITFG clock, the same 80 MHz as the ADCs */
+static const double itfgClock = 80E6;
+
+xsp3SimTimer::xsp3SimTimer( void ) :
+    source(xsp3TimeRegister::Software),
+    itfgConfigured(false),
+    itfgFrames(0),
+    itfgColTime(0.0),
+    itfgTrigMode(XSP3_ITFG_TRIG_MODE_BURST),
+    itfgGap(1E-6),
+    extRate(1000.0),
+    extJitter(0.0),
+    extSeed(0),
+    extState(0),
+    scheduleFrames(0),
+    maxFrames(0),
+    numStarts(0),
+    running(false),
+    counting(false),
+    stopElapsed(0.0)
+{
+    startTime = epicsTime::getCurrent();
+}
+
+xsp3SimTimer::~xsp3SimTimer( void )
+{
+}
+
+/**
+ * Time frame source, from the XSP3_GLOB_TIMA_TF_SRC bits of glob_timeA.
+ */
+void xsp3SimTimer::setSource( xsp3TimeRegister::xsp3Trigger newSource )
+{
+    epicsGuard<epicsMutex> guard(mutex);
+    source = newSource;
+}
+
+void xsp3SimTimer::setItfg( int num_tf, uint32_t col_time, int trig_mode, int gap_mode )
+{
+    epicsGuard<epicsMutex> guard(mutex);
+    static const double gaps[] = { 25E-9, 200E-9, 500E-9, 1E-6 };
+
+    itfgConfigured = true;
+    itfgFrames = num_tf;
+    itfgColTime = col_time/itfgClock;
+    itfgTrigMode = trig_mode;
+    itfgGap = gaps[gap_mode & 3];
+}
+
+/**
+ * Configure the emulated external trigger.
+ * @param rate Trigger rate in Hz. Zero means no triggers arrive.
+ * @param jitter RMS variation of each period, as a fraction of the period.
+ * @param seed Seed for the jitter, so runs are reproducible.
+ */
+void xsp3SimTimer::setExternal( double rate, double jitter, uint64_t seed )
+{
+    epicsGuard<epicsMutex> guard(mutex);
+    extRate = rate > 0.0 ? rate : 0.0;
+    extJitter = jitter > 0.0 ? jitter : 0.0;
+    extSeed = seed;
+}
+
+/**
+ * Number of frames configured in xsp3_config. External and software timed
+ * acquisitions stop advancing here.
+ */
+void xsp3SimTimer::setMaxFrames( int max_frames )
+{
+    epicsGuard<epicsMutex> guard(mutex);
+    maxFrames = max_frames;
+}
+
+/**
+ * Pace frames from a list of periods, for replaying recorded data. The
+ * periods are used in turn, wrapping at the end, in every mode except
+ * software timing.
+ * @param periods Frame periods in seconds. Empty to go back to normal timing.
+ * @param max_frames Stop after this many frames, 0 for no limit beyond the usual.
+ */
+void xsp3SimTimer::setSchedule( const std::vector<double> &periods, int max_frames )
+{
+    epicsGuard<epicsMutex> guard(mutex);
+    schedule = periods;
+    scheduleFrames = max_frames;
+}
+
+xsp3SimTimer::timingMode xsp3SimTimer::mode( void ) const
+{
+    switch (source)
+    {
+    case xsp3TimeRegister::Software:
+    case xsp3TimeRegister::SoftwareHWMarker:
+        return timingSoftware;
+    case xsp3TimeRegister::Internal:
+        if (itfgConfigured && itfgTrigMode == XSP3_ITFG_TRIG_MODE_SOFTWARE) return timingSteppedItfg;
+        if (itfgConfigured && itfgTrigMode == XSP3_ITFG_TRIG_MODE_HARDWARE) return timingExternal;
+        if (!schedule.empty()) return timingExternal;
+        return timingBurst;
+    default:
+        return timingExternal;
+    }
+}
+
+double xsp3SimTimer::elapsed( void ) const
+{
+    if (!running) return stopElapsed;
+    return epicsTime::getCurrent() - startTime;
+}
+
+int xsp3SimTimer::frameLimit( void ) const
+{
+    int limit = maxFrames;
+
+    if (source == xsp3TimeRegister::Internal && itfgConfigured) limit = itfgFrames;
+    if (scheduleFrames > 0 && scheduleFrames < limit) limit = scheduleFrames;
+    return limit;
+}
+
+/* Period of the emulated trigger, or the mean recorded period */
+double xsp3SimTimer::externalPeriod( void ) const
+{
+    double total = 0.0;
+
+    if (schedule.empty()) return extRate > 0.0 ? 1.0/extRate : 0.0;
+    for (size_t i = 0; i < schedule.size(); i++) total += schedule[i];
+    return total/schedule.size();
+}
+
+/**
+ * Emulated trigger edges up to time t. Edge n ends frame n.
+ */
+void xsp3SimTimer::generateEdges( double t )
+{
+    const double period = externalPeriod();
+    const size_t limit = frameLimit() > 0 ? frameLimit() : 0;
+
+    if (period <= 0.0) return;
+    while (frameEnds.size() < limit && (frameEnds.empty() || frameEnds.back() <= t))
+    {
+        double begin = frameEnds.empty() ? 0.0 : frameEnds.back();
+        double length = period;
+        if (!schedule.empty())
+        {
+            length = schedule[frameEnds.size() % schedule.size()];
+        }
+        else if (extJitter > 0.0)
+        {
+            length *= 1.0 + extJitter*xsp3SimNormal( extState );
+            if (length < 0.1*period) length = 0.1*period;
+        }
+        frameStarts.push_back( begin );
+        frameEnds.push_back( begin + length );
+    }
+}
+
+int xsp3SimTimer::completedAt( double t )
+{
+    int limit = frameLimit();
+    int frames = 0;
+
+    switch (mode())
+    {
+    case timingBurst:
+        if (itfgColTime <= 0.0) return limit;
+        frames = (int) ((t + itfgGap)/(itfgColTime + itfgGap));
+        return frames > limit ? limit : frames;
+    case timingExternal:
+        generateEdges( t );
+        /* fall through, frameEnds now covers t */
+    case timingSoftware:
+    case timingSteppedItfg:
+        while (frames < (int) frameEnds.size() && frameEnds[frames] <= t) frames++;
+        return frames;
+    }
+    return 0;
+}
+
+/**
+ * Start an acquisition: xsp3_histogram_start.
+ */
+void xsp3SimTimer::start( void )
+{
+    epicsGuard<epicsMutex> guard(mutex);
+    running = true;
+    startTime = epicsTime::getCurrent();
+    stopElapsed = 0.0;
+    frameStarts.clear();
+    frameEnds.clear();
+    extState = xsp3SimStream( extSeed, 0x54544C, numStarts++ );
+    // Software timing counts into frame 0 straight away
+    counting = (mode() == timingSoftware);
+    if (counting) frameStarts.push_back( 0.0 );
+}
+
+void xsp3SimTimer::stop( void )
+{
+    epicsGuard<epicsMutex> guard(mutex);
+    if (!running) return;
+    stopElapsed = epicsTime::getCurrent() - startTime;
+    // Frames not finished by now never will be
+    int completed = completedAt( stopElapsed );
+    frameStarts.resize( completed );
+    frameEnds.resize( completed );
+    running = false;
+    counting = false;
+}
+
+/**
+ * xsp3_histogram_continue. In software timing this ends the current frame
+ * (if counting) and starts the next; with a software triggered ITFG it
+ * starts the next frame of the programmed length.
+ */
+void xsp3SimTimer::trigger( void )
+{
+    epicsGuard<epicsMutex> guard(mutex);
+    double now = elapsed();
+
+    if (!running || (int) frameEnds.size() >= frameLimit()) return;
+
+    if (mode() == timingSoftware)
+    {
+        if (counting)
+        {
+            frameEnds.push_back( now );
+            if ((int) frameEnds.size() >= frameLimit())
+            {
+                counting = false;
+                return;
+            }
+        }
+        frameStarts.push_back( now );
+        counting = true;
+    }
+    else if (mode() == timingSteppedItfg)
+    {
+        double begin = frameEnds.empty() ? now : frameEnds.back() + itfgGap;
+        if (begin < now) begin = now;
+        frameStarts.push_back( begin );
+        frameEnds.push_back( begin + itfgColTime );
+    }
+}
+
+/**
+ * xsp3_histogram_pause. In software timing this ends the current frame.
+ */
+void xsp3SimTimer::pause( void )
+{
+    epicsGuard<epicsMutex> guard(mutex);
+    if (running && mode() == timingSoftware && counting)
+    {
+        frameEnds.push_back( elapsed() );
+        counting = false;
+    }
+}
+
+int xsp3SimTimer::framesCompleted( void )
+{
+    epicsGuard<epicsMutex> guard(mutex);
+    return completedAt( elapsed() );
+}
+
+bool xsp3SimTimer::isRunning( void )
+{
+    epicsGuard<epicsMutex> guard(mutex);
+    return running;
+}
+
+/**
+ * Still acquiring: running and not yet at the end of the programmed frames.
+ */
+bool xsp3SimTimer::isBusy( void )
+{
+    epicsGuard<epicsMutex> guard(mutex);
+    if (!running) return false;
+    if (mode() == timingBurst || mode() == timingSteppedItfg)
+        return completedAt( elapsed() ) < frameLimit();
+    return true;
+}
+
+/**
+ * Length of a frame in seconds. Frames not yet seen report the nominal time.
+ */
+double xsp3SimTimer::frameTime( int frame )
+{
+    epicsGuard<epicsMutex> guard(mutex);
+    if (mode() != timingBurst && frame >= 0 && frame < (int) frameEnds.size() && frame < (int) frameStarts.size())
+        return frameEnds[frame] - frameStarts[frame];
+    if (mode() == timingBurst || mode() == timingSteppedItfg) return itfgColTime;
+    return externalPeriod() > 0.0 ? externalPeriod() : 1.0;
+}
+
+/**
+ * Expected frame length before any frames are taken, used to scale the
+ * simulated counts. Software timed frames have no nominal length, so
+ * one second is assumed.
+ */
+double xsp3SimTimer::nominalFrameTime( void )
+{
+    epicsGuard<epicsMutex> guard(mutex);
+    switch (mode())
+    {
+    case timingBurst:
+    case timingSteppedItfg:
+        return itfgColTime > 0.0 ? itfgColTime : 1.0;
+    case timingExternal:
+        return externalPeriod() > 0.0 ? externalPeriod() : 1.0;
+    default:
+        return 1.0;
+    }
+}
@@ -0,0 +1,88 @@
+/*
+ * xsp3SimTimer.h
+ *
+ * Timing engine for the simulator. Works out how many time frames have
+ * completed, and how long each one was, for every time frame source the
+ * hardware supports: the internal time frame generator (ITFG) in burst or
+ * software triggered mode, software timing stepped by
+ * xsp3_histogram_continue/pause, and external (TTL/LVDS/IDC) triggers,
+ * which are emulated at a configurable rate with random jitter.
+ */
+
+#ifndef XSP3SIMTIMER_H_
+#define XSP3SIMTIMER_H_
+
+#include <stdint.h>
+#include <vector>
+#include "epicsTime.h"
+#include "epicsMutex.h"
+#include "xsp3TimeRegister.h"
+
+class xsp3SimTimer
+{
+public:
+    xsp3SimTimer( void );
+    ~xsp3SimTimer( void );
+
+    void setSource( xsp3TimeRegister::xsp3Trigger source );
+    void setItfg( int num_tf, uint32_t col_time, int trig_mode, int gap_mode );
+    void setExternal( double rate, double jitter, uint64_t seed );
+    void setMaxFrames( int max_frames );
+    void setSchedule( const std::vector<double> &periods, int max_frames );
+
+    void start( void );
+    void stop( void );
+    void trigger( void );
+    void pause( void );
+
+    int framesCompleted( void );
+    bool isRunning( void );
+    bool isBusy( void );
+    double frameTime( int frame );
+    double nominalFrameTime( void );
+
+private:
+    enum timingMode { timingSoftware, timingBurst, timingSteppedItfg, timingExternal };
+
+    timingMode mode( void ) const;
+    double elapsed( void ) const;
+    int frameLimit( void ) const;
+    double externalPeriod( void ) const;
+    int completedAt( double t );
+    void generateEdges( double t );
+
+    epicsMutex mutex;
+    xsp3TimeRegister::xsp3Trigger source;
+
+    // ITFG setup
+    bool itfgConfigured;
+    int itfgFrames;
+    double itfgColTime;
+    int itfgTrigMode;
+    double itfgGap;
+
+    // Emulated external trigger
+    double extRate;
+    double extJitter;
+    uint64_t extSeed;
+    uint64_t extState;
+
+    // Recorded frame periods (replay), used cyclically in place of the ITFG or
+    // emulated trigger when not empty.
+    std::vector<double> schedule;
+    int scheduleFrames;
+
+    int maxFrames;
+    int numStarts;
+    bool running;
+    bool counting;
+    epicsTime startTime;
+    double stopElapsed;
+
+    // Frame boundaries, relative to start, for the modes that are not periodic.
+    // Frame n runs from frameStarts[n] to frameEnds[n].
+    std::vector<double> frameStarts;
+    std::vector<double> frameEnds;
+};
+
+#endif /* XSP3SIMTIMER_H_ */
@@ -1,27 +1,228 @@
 #include "xsp3Simulator.h"
 #include "xsp3SimElement.h"
+#include "epicsThread.h"
+#include "epicsStdio.h"
+#include <string.h>
 
 xsp3Simulator::xsp3Simulator( asynUser * user, int max_detectors, int max_spectra ) :
     xsp3Api(user),
     num_detectors(max_detectors),
+    num_cards(1),
+    num_channels(max_detectors),
+    generation(XspressGen3),
     runFlags(0),
-    frame_time(0.0),
-    num_frames(0),
-    current_frame(0)
+    markerPeriod(0),
+    markerFrame(0),
+    subFrames(1),
+    count_rate(2.0e5),
+    producer(detectors)
 {
     detectors.reserve(max_detectors);
     for (int i=0; i< max_detectors; i++)
         detectors.push_back(xsp3SimElement(max_spectra));
 
-    scanStart = epicsTime::getCurrent();
     this->handle=314158;
+    setErrorMessage( "Simulator is happy" );
+    error_reply[0] = '\0';
+    updateCountsPerFrame();
 }
 xsp3Simulator::~xsp3Simulator()
 {
 }
 
+/**
+ * Set the input count rate of each simulated element, in counts/s.
+ */
+void xsp3Simulator::setCountRate( double rate )
+{
+    count_rate = rate > 0.0 ? rate : 0.0;
+    updateCountsPerFrame();
+}
+
+/**
+ * Set the seed used for all generated data. The same seed reproduces the
+ * same spectra frame by frame.
+ */
+void xsp3Simulator::setSeed( uint64_t seed )
+{
+    for (unsigned int i = 0; i < detectors.size(); i++)
+        detectors[i].setSeed( seed );
+    faults.setSeed( seed );
+}
+
+/**
+ * Configure the emulated external trigger, used when the time frame source
+ * is TTL, LVDS or IDC, or the ITFG is in hardware trigger mode.
+ * @param rate Trigger rate in Hz.
+ * @param jitter RMS period variation as a fraction of the period.
+ * @param seed Seed for the jitter.
+ */
+void xsp3Simulator::setExternalTrigger( double rate, double jitter, uint64_t seed )
+{
+    timer.setExternal( rate, jitter, seed );
+    updateCountsPerFrame();
+}
+
+/**
+ * Configure the emulated system. Call before connecting.
+ * @param gen The XspressGeneration to report; XspressGen3Mini limits the frames with more than one channel
+ * @param threads Number of threads generating frames ahead of the reader, 0 to generate on the reading thread
+ * @param ring_frames Number of frames the producer threads may work ahead
+ * @return XSP3_OK, XSP3_RANGE_CHECK for an unknown generation or XSP3_ERROR if threads could not be created
+ */
+int xsp3Simulator::setSystem( int gen, int threads, int ring_frames )
+{
+    if (gen < XspressGen3 || gen > XspressGen4) return XSP3_RANGE_CHECK;
+    generation = gen;
+    return producer.configure( threads, ring_frames );
+}
+
+/**
+ * Inject a fault at random, see xsp3SimFault.h for the faults and what the
+ * value means for each. The faults are seeded by setSeed.
+ * @param fault The xsp3SimFaultType
+ * @param probability Chance of the fault, 0 to turn it off
+ * @param value The size of the fault
+ * @return XSP3_OK, or XSP3_RANGE_CHECK for a bad fault or probability
+ */
+int xsp3Simulator::setFault( int fault, double probability, double value )
+{
+    return faults.set( fault, probability, value );
+}
+
+/** Turn off all faults and zero the fault counts. */
+void xsp3Simulator::clearFaults( void )
+{
+    faults.clear();
+}
+
+/** Print the fault settings and how many of each have been injected. */
+void xsp3Simulator::reportFaults( FILE * fp )
+{
+    faults.report( fp );
+}
+
+/*
+ * Latency and error faults for a read call.
+ * Returns XSP3_ERROR if the call should fail.
+ */
+int xsp3Simulator::readFaults( const char * function )
+{
+    double delay;
+
+    if (!faults.enabled()) return XSP3_OK;
+
+    delay = faults.readLatency();
+    if (delay > 0.0) epicsThreadSleep( delay );
+
+    if (faults.readError())
+    {
+        char message[64];
+        epicsSnprintf( message, sizeof(message), "Simulated fault in %s", function );
+        setErrorMessage( message );
+        return XSP3_ERROR;
+    }
+    return XSP3_OK;
+}
+
+/* Zero the data of dropped frames, frameBytes apart in the buffer */
+void xsp3Simulator::dropFrames( void * buffer, size_t frameBytes, unsigned tf, unsigned num_tf )
+{
+    if (!faults.enabled()) return;
+
+    for (unsigned int frame = tf; frame < tf + num_tf; frame++)
+        if (faults.dropped( frame ))
+            memset( (char *) buffer + (frame - tf)*frameBytes, 0, frameBytes );
+}
+
+/* Whether a read falls inside what the producer ring holds */
+bool xsp3Simulator::inRing( unsigned eng, unsigned num_eng, unsigned chan, unsigned num_chan ) const
+{
+    return producer.getNumThreads() > 0 && chan + num_chan <= (unsigned) num_channels &&
+           eng + num_eng <= detectors[0].num_spectra;
+}
+
+bool xsp3Simulator::validCard( int card ) const
+{
+    return card == -1 || (card >= 0 && card < num_cards);
+}
+
+/**
+ * Replay a capture file instead of generating data. Change this only
+ * between acquisitions.
+ * @param fileName The file to replay (see xsp3SimReplay.h), or empty to go back to generated data
+ * @param loop Go back to the first recorded frame at the end of the file, rather than stopping
+ * @param rate Frame rate in Hz, or 0 to pace frames from the recorded timestamps
+ * @return XSP3_OK, or XSP3_ERROR if the file could not be used (see getReplayError)
+ */
+int xsp3Simulator::setReplay( const char * fileName, bool loop, double rate )
+{
+    std::vector<double> periods;
+
+    if (fileName == NULL || fileName[0] == '\0')
+    {
+        replay.close();
+        timer.setSchedule( periods, 0 );
+        return XSP3_OK;
+    }
+    if (replay.open( fileName ) != XSP3_OK)
+    {
+        timer.setSchedule( periods, 0 );
+        return XSP3_ERROR;
+    }
+
+    replay.setLoop( loop );
+    if (rate > 0.0) periods.push_back( 1.0/rate );
+    else replay.getPeriods( periods );
+    timer.setSchedule( periods, loop ? 0 : replay.getNumFrames() );
+    return XSP3_OK;
+}
+
+/**
+ * Copy num_eng bins from eng of a recorded spectrum, zero filling anything
+ * not in the recording.
+ */
+void xsp3Simulator::replaySpectrum( int recorded, unsigned chan, unsigned eng, unsigned num_eng, uint32_t *buffer )
+{
+    unsigned int available = 0;
+
+    if (recorded >= 0 && chan < (unsigned) replay.getNumChannels() && eng < (unsigned) replay.getNumBins())
+    {
+        available = replay.getNumBins() - eng;
+        if (available > num_eng) available = num_eng;
+        memcpy( buffer, replay.spectrum( recorded, chan ) + eng, available*sizeof(uint32_t) );
+    }
+    if (available < num_eng)
+        memset( buffer + available, 0, (num_eng - available)*sizeof(uint32_t) );
+}
+
+void xsp3Simulator::replayScalers( int recorded, unsigned chan, uint32_t *scalers )
+{
+    int available = 0;
+
+    if (recorded >= 0 && chan < (unsigned) replay.getNumChannels())
+    {
+        available = replay.getNumScalers() < XSP3_SW_NUM_SCALERS ? replay.getNumScalers() : XSP3_SW_NUM_SCALERS;
+        memcpy( scalers, replay.scalers( recorded, chan ), available*sizeof(uint32_t) );
+    }
+    for (int scaler = available; scaler < XSP3_SW_NUM_SCALERS; scaler++)
+        scalers[scaler] = 0;
+}
+
+/**
+ * Work out the mean counts per frame from the count rate and the nominal
+ * frame time of the current timing mode.
+ */
+void xsp3Simulator::updateCountsPerFrame( void )
+{
+    double exposure = timer.nominalFrameTime();
+    for (unsigned int i = 0; i < detectors.size(); i++)
+        detectors[i].setInputRate( count_rate, exposure );
+}
+
 int xsp3Simulator::xsp3Api_clocks_setup(int path, int card, int clk_src, int flags, int tp_type)
 {
+   if (!validCard(card)) return XSP3_RANGE_CHECK;
    return XSP3_OK;
 }
 
@@ -33,11 +234,36 @@ int xsp3Simulator::xsp3Api_close(int path)
 
 int xsp3Simulator::xsp3Api_config(int ncards, int num_tf, char* baseIPaddress, int basePort, char* baseMACaddress, int nchan, int createmodule, char* modname, int debug, int card_index)
 {
+    /* Xspress3 Mini with more than one channel only has room for this many frames */
+    static const int miniMaxFrames = 12216;
+
+    if (ncards < 1 || ncards > XSP3_MAX_CARDS || nchan < 1 || nchan > (int) num_detectors ||
+        nchan > ncards*XSP3_MAX_CHANS_PER_CARD)
+        return XSP3_RANGE_CHECK;
+
+    num_cards = ncards;
+    num_channels = nchan;
+    if (generation == XspressGen3Mini && nchan > 1 && num_tf > miniMaxFrames)
+        num_tf = miniMaxFrames;
+    timer.setMaxFrames(num_tf);
     return this->handle;
 }
 
 int xsp3Simulator::xsp3Api_format_run(int path, int chan, int aux1_mode, int res_thres, int aux2_cont, int disables, int aux2_mode, int nbits_eng)
 {
+    subFrames = 1;
+    return XSP3_OK;
+}
+
+/**
+ * Sub-frames divide each frame evenly, and are read as the aux dimension
+ * of histogram_read4d.
+ */
+int xsp3Simulator::xsp3Api_format_sub_frames(int path, int chan, int just_good, int just_good_thres, int flags, int nbits_eng, int num_sub_frames, int ts_divide)
+{
+    if (chan >= (int) num_detectors || num_sub_frames < 1 ||
+        nbits_eng < 0 || nbits_eng > 16 || (1u << nbits_eng) > detectors[0].num_spectra) return XSP3_RANGE_CHECK;
+    subFrames = num_sub_frames;
     return XSP3_OK;
 }
 
@@ -55,9 +281,22 @@ int xsp3Simulator::xsp3Api_getDeadtimeCorrectionParameters(int path, int chan, i
     return XSP3_OK;
 }
 
+void xsp3Simulator::setErrorMessage( const char * message )
+{
+    epicsGuard<epicsMutex> guard(errorMutex);
+    strncpy( error_message, message, sizeof(error_message) - 1 );
+    error_message[sizeof(error_message) - 1] = '\0';
+}
+
+/**
+ * The message is copied out under the lock, so a producer thread setting a
+ * new one cannot change or free the buffer the caller is reading.
+ */
 char* xsp3Simulator::xsp3Api_get_error_message()
 {
-    return (char *) "Simulator is happy";
+    epicsGuard<epicsMutex> guard(errorMutex);
+    memcpy( error_reply, error_message, sizeof(error_reply) );
+    return error_reply;
 }
 
 int xsp3Simulator::xsp3Api_get_good_thres(int path, int chan, uint32_t *good_thres)
@@ -77,26 +316,110 @@ int xsp3Simulator::xsp3Api_hist_dtc_read4d(int path, double *hist_buff, double *
                                            unsigned eng, unsigned aux, unsigned chan, unsigned tf,
                                            unsigned num_eng, unsigned num_aux, unsigned num_chan, unsigned num_tf)
 {
+    double *hist_start = hist_buff, *scal_start = scal_buff;
+    int status = readFaults( "xsp3_hist_dtc_read4d" );
+
+    if (status != XSP3_OK) return status;
+
+    if (replay.isOpen())
+    {
+        std::vector<uint32_t> spectrum(num_eng);
+        uint32_t scalers[XSP3_SW_NUM_SCALERS];
+        double corrected[XSP3_SW_NUM_SCALERS];
+
+        for (unsigned int frame = tf; frame < tf + num_tf; frame++ )
+        {
+            int recorded = replay.recordedFrame(frame);
+            for (unsigned int i = chan; i < chan + num_chan; i++)
+            {
+                double factor;
+
+                replayScalers( recorded, i, scalers );
+                factor = detectors[i].correctScalers( scalers, corrected );
+                replaySpectrum( recorded, i, eng, num_eng, &spectrum[0] );
+                for (unsigned int bin = 0; bin < num_eng; bin++)
+                    hist_buff[bin] = spectrum[bin]*factor;
+                hist_buff += num_eng;
+
+                if (scal_buff != NULL)
+                {
+                    memcpy( scal_buff, corrected, sizeof(corrected) );
+                    scal_buff += XSP3_SW_NUM_SCALERS;
+                }
+            }
+        }
+        dropFrames( hist_start, num_chan*num_eng*sizeof(double), tf, num_tf );
+        if (scal_start != NULL)
+            dropFrames( scal_start, num_chan*XSP3_SW_NUM_SCALERS*sizeof(double), tf, num_tf );
+        return XSP3_OK;
+    }
+
     for (unsigned int frame = tf; frame < tf + num_tf; frame++ )
     {
+        double exposure = timer.frameTime(frame);
+        const uint32_t *ringSpectra, *ringScalers;
+
+        if (inRing( eng, num_eng, chan, num_chan ) && producer.acquire( frame, exposure, &ringSpectra, &ringScalers ))
+        {
+            const unsigned int bins = detectors[0].num_spectra;
+            double corrected[XSP3_SW_NUM_SCALERS];
+
+            for (unsigned int i = chan; i < chan + num_chan; i++)
+            {
+                double factor = detectors[i].correctScalers( ringScalers + i*XSP3_SW_NUM_SCALERS, corrected );
+                const uint32_t *spectrum = ringSpectra + i*bins + eng;
+                for (unsigned int bin = 0; bin < num_eng; bin++)
+                    hist_buff[bin] = spectrum[bin]*factor;
+                hist_buff += num_eng;
+
+                if (scal_buff != NULL)
+                {
+                    memcpy( scal_buff, corrected, sizeof(corrected) );
+                    scal_buff += XSP3_SW_NUM_SCALERS;
+                }
+            }
+            producer.release( frame );
+            continue;
+        }
+
         for (unsigned int i = chan; i < chan + num_chan; i++)
         {
-            detectors[i].generateDTCSpectra( frame, eng, num_eng, hist_buff );
+            detectors[i].generateDTCSpectra( frame, exposure, eng, num_eng, hist_buff );
             hist_buff += num_eng;
 
             if (scal_buff != NULL)
             {
-                for (int scaler = 0; scaler < XSP3_SW_NUM_SCALERS; scaler++ )
-                    scal_buff[scaler] = 0.0;
-
-                scal_buff[5]=detectors[i].generateDTCROI(frame, 0 );
-                scal_buff[6]=detectors[i].generateDTCROI(frame, 1 );
-
+                detectors[i].generateDTCScalers( frame, exposure, scal_buff );
                 scal_buff += XSP3_SW_NUM_SCALERS;
             }
         }
     }
 
+    dropFrames( hist_start, num_chan*num_eng*sizeof(double), tf, num_tf );
+    if (scal_start != NULL)
+        dropFrames( scal_start, num_chan*XSP3_SW_NUM_SCALERS*sizeof(double), tf, num_tf );
+    return XSP3_OK;
+}
+
+/**
+ * Acknowledge frames read in circular buffer mode. Frames hit by the
+ * overrun fault were overwritten before they were acknowledged.
+ */
+int xsp3Simulator::xsp3Api_histogram_circ_ack(int path, unsigned chan, unsigned tf, unsigned num_chan, unsigned num_tf)
+{
+    if (chan + num_chan > num_detectors) return XSP3_RANGE_CHECK;
+    if (!faults.enabled()) return XSP3_OK;
+
+    for (unsigned int frame = tf; frame < tf + num_tf; frame++)
+    {
+        if (faults.overrun( frame ))
+        {
+            char message[64];
+            epicsSnprintf( message, sizeof(message), "Circular buffer overrun at frame %u", frame );
+            setErrorMessage( message );
+            return XSP3_ERROR;
+        }
+    }
     return XSP3_OK;
 }
 
@@ -107,47 +430,132 @@ int xsp3Simulator::xsp3Api_histogram_clear(int path, int first_chan, int num_cha
 
 int xsp3Simulator::xsp3Api_histogram_continue(int path, int card)
 {
+    if (!validCard(card)) return XSP3_RANGE_CHECK;
+    timer.trigger();
     return XSP3_OK;
 }
 
 int xsp3Simulator::xsp3Api_histogram_pause(int path, int card)
 {
+    if (!validCard(card)) return XSP3_RANGE_CHECK;
+    timer.pause();
     return XSP3_OK;
 }
 
 int xsp3Simulator::xsp3Api_histogram_arm(int path, int card)
 {
+    if (!validCard(card)) return XSP3_RANGE_CHECK;
     return XSP3_OK;
 }
 
 int xsp3Simulator::xsp3Api_histogram_is_any_busy(int path)
 {
-    //TODO: Occasionally return busy (1).
-    return 0;
+    if (faults.enabled() && faults.busy()) return 1;
+    return timer.isBusy() ? 1 : 0;
 }
 
 int xsp3Simulator::xsp3Api_histogram_read4d(int path, uint32_t *buffer, unsigned eng, unsigned aux, unsigned chan, unsigned tf, unsigned num_eng, unsigned num_aux, unsigned num_chan, unsigned num_tf)
 {
+    uint32_t *start = buffer;
+    int status = readFaults( "xsp3_histogram_read4d" );
+
+    if (status != XSP3_OK) return status;
+
+    if (num_aux > 1)
+    {
+        // Sub-frames, each a spectrum counted for its share of the frame
+        for (unsigned int frame = tf; frame < tf + num_tf; frame++ )
+        {
+            double exposure = timer.frameTime(frame)/subFrames;
+
+            for (unsigned int i = chan; i < chan + num_chan; i++)
+            {
+                for (unsigned int sf = aux; sf < aux + num_aux; sf++)
+                {
+                    detectors[i].generateRawSpectra( frame*subFrames + sf, exposure, eng, num_eng, buffer );
+                    buffer += num_eng;
+                }
+            }
+        }
+        dropFrames( start, num_chan*num_aux*num_eng*sizeof(uint32_t), tf, num_tf );
+        return XSP3_OK;
+    }
+
+    if (replay.isOpen())
+    {
+        const bool whole = (eng == 0 && num_eng == (unsigned) replay.getNumBins() &&
+                            chan + num_chan <= (unsigned) replay.getNumChannels());
+        for (unsigned int frame = tf; frame < tf + num_tf; frame++ )
+        {
+            int recorded = replay.recordedFrame(frame);
+            if (whole && recorded >= 0)
+            {
+                // Full spectra for a run of channels are contiguous in the file
+                memcpy( buffer, replay.spectrum( recorded, chan ), num_chan*num_eng*sizeof(uint32_t) );
+                buffer += num_chan*num_eng;
+                continue;
+            }
+            for (unsigned int i = chan; i < chan + num_chan; i++)
+            {
+                replaySpectrum( recorded, i, eng, num_eng, buffer );
+                buffer += num_eng;
+            }
+        }
+        dropFrames( start, num_chan*num_eng*sizeof(uint32_t), tf, num_tf );
+        return XSP3_OK;
+    }
+
     for (unsigned int frame = tf; frame < tf + num_tf; frame++ )
     {
+        double exposure = timer.frameTime(frame);
+        const uint32_t *ringSpectra, *ringScalers;
+
+        if (inRing( eng, num_eng, chan, num_chan ) && producer.acquire( frame, exposure, &ringSpectra, &ringScalers ))
+        {
+            const unsigned int bins = detectors[0].num_spectra;
+
+            if (num_eng == bins)
+            {
+                memcpy( buffer, ringSpectra + chan*bins, num_chan*bins*sizeof(uint32_t) );
+                buffer += num_chan*bins;
+            }
+            else
+            {
+                for (unsigned int i = chan; i < chan + num_chan; i++)
+                {
+                    memcpy( buffer, ringSpectra + i*bins + eng, num_eng*sizeof(uint32_t) );
+                    buffer += num_eng;
+                }
+            }
+            producer.release( frame );
+            continue;
+        }
+
         for (unsigned int i = chan; i < chan + num_chan; i++)
         {
-            detectors[i].generateRawSpectra( frame, eng, num_eng, buffer );
+            detectors[i].generateRawSpectra( frame, exposure, eng, num_eng, buffer );
             buffer += num_eng;
         }
     }
+    dropFrames( start, num_chan*num_eng*sizeof(uint32_t), tf, num_tf );
     return XSP3_OK;
 }
 
 int xsp3Simulator::xsp3Api_histogram_start(int path, int card)
 {
-    scanStart = epicsTime::getCurrent();
-    current_frame=0;
+    if (!validCard(card)) return XSP3_RANGE_CHECK;
+    timer.start();
+    faults.start();
+    if (!replay.isOpen()) producer.start( num_channels, timer.nominalFrameTime() );
     return XSP3_OK;
 }
 
 int xsp3Simulator::xsp3Api_histogram_stop(int path, int card)
 {
+    if (!validCard(card)) return XSP3_RANGE_CHECK;
+    timer.stop();
+    producer.stop();
+    faults.stop();
     return XSP3_OK;
 }
 
@@ -163,24 +571,21 @@ int xsp3Simulator::xsp3Api_save_settings(int path, char *dir_name)
 
 int xsp3Simulator::xsp3Api_scaler_check_progress(int path)
 {
-    if ( timeRegister.trigger == xsp3TimeRegister::Internal )
-    {
-        current_frame = (epicsTime::getCurrent() - scanStart)/frame_time ;
-        if (current_frame > num_frames) current_frame = num_frames;
-    } else {
-        current_frame+= ((current_frame+1)%10);
-    }
-    return current_frame;
+    return timer.framesCompleted();
 }
 
 int xsp3Simulator::xsp3Api_set_glob_timeA(int path, int card, uint32_t time)
 {
+    if (!validCard(card)) return XSP3_RANGE_CHECK;
     timeRegister.set(time);
+    timer.setSource(timeRegister.trigger);
+    updateCountsPerFrame();
     return XSP3_OK;
 }
 
 int xsp3Simulator::xsp3Api_set_glob_timeFixed(int path, int card, uint32_t time)
 {
+    if (!validCard(card)) return XSP3_RANGE_CHECK;
     return XSP3_OK;
 }
 
@@ -197,56 +602,127 @@ int xsp3Simulator::xsp3Api_set_run_flags(int path, int flags)
 
 int xsp3Simulator::xsp3Api_set_window(int path, int chan, int win, int low, int high)
 {
-    detectors[chan].window[win].low = low;
-    detectors[chan].window[win].high = high;
+    detectors[chan].setWindow( win, low, high );
     return XSP3_OK;
 }
 
 int xsp3Simulator::xsp3Api_itfg_setup(int path, int card, int num_tf, uint32_t col_time, int trig_mode, int gap_mode)
 {
-    frame_time = (double) col_time/80E6;
-    num_frames = num_tf;
+    if (!validCard(card)) return XSP3_RANGE_CHECK;
+    timer.setItfg(num_tf, col_time, trig_mode, gap_mode);
+    markerPeriod = 0;
+    updateCountsPerFrame();
     return XSP3_OK;
 }
 
 int xsp3Simulator::xsp3Api_itfg_setup2(int path, int card, int num_tf, uint32_t col_time, int trig_mode, int gap_mode, int acq_in_pause, int marker_period, int marker_frame)
 {
-    frame_time = (double) col_time/80E6;
-    num_frames = num_tf;
+    if (!validCard(card)) return XSP3_RANGE_CHECK;
+    timer.setItfg(num_tf, col_time, trig_mode, gap_mode);
+    markerPeriod = marker_period;
+    markerFrame = marker_frame;
+    updateCountsPerFrame();
     return XSP3_OK;
 }
 
 int xsp3Simulator::xsp3Api_itfg_start(int path, int card)
 {
+    if (!validCard(card)) return XSP3_RANGE_CHECK;
     return XSP3_OK;
 }
 
 int xsp3Simulator::xsp3Api_itfg_stop(int path, int card)
 {
+    if (!validCard(card)) return XSP3_RANGE_CHECK;
     return XSP3_OK;
 }
 
 int xsp3Simulator::xsp3Api_has_itfg(int path, int card )
 {
+    if (!validCard(card)) return XSP3_RANGE_CHECK;
     return 1;
 }
 
+/**
+ * Scalers for dt frames from t, n_chan channels from chan, and n_scalers
+ * scalers from scaler, with the scaler index varying fastest.
+ */
 int xsp3Simulator::xsp3Api_scaler_read(int path, uint32_t *dest, unsigned scaler, unsigned chan, unsigned t, unsigned n_scalers, unsigned n_chan, unsigned dt)
 {
+    uint32_t scalers[XSP3_SW_NUM_SCALERS];
+    uint32_t *start = dest;
+    int status;
+
+    if (scaler + n_scalers > XSP3_SW_NUM_SCALERS || chan + n_chan > num_detectors) return XSP3_RANGE_CHECK;
+    status = readFaults( "xsp3_scaler_read" );
+    if (status != XSP3_OK) return status;
+
+    for (unsigned int frame = t; frame < t + dt; frame++ )
+    {
+        double exposure = timer.frameTime(frame);
+        int recorded = replay.recordedFrame(frame);
+        const uint32_t *ringSpectra, *ringScalers;
+
+        if (!replay.isOpen() && inRing( 0, 0, chan, n_chan ) && producer.acquire( frame, exposure, &ringSpectra, &ringScalers ))
+        {
+            for (unsigned int i = chan; i < chan + n_chan; i++)
+            {
+                memcpy( dest, ringScalers + i*XSP3_SW_NUM_SCALERS + scaler, n_scalers*sizeof(uint32_t) );
+                dest += n_scalers;
+            }
+            producer.release( frame );
+            continue;
+        }
+
+        for (unsigned int i = chan; i < chan + n_chan; i++)
+        {
+            if (replay.isOpen())
+                replayScalers( recorded, i, scalers );
+            else
+                detectors[i].generateScalers( frame, exposure, scalers );
+            memcpy( dest, &scalers[scaler], n_scalers*sizeof(uint32_t) );
+            dest += n_scalers;
+        }
+    }
+    dropFrames( start, n_chan*n_scalers*sizeof(uint32_t), t, dt );
     return XSP3_OK;
 }
 
 int xsp3Simulator::xsp3Api_get_trigger_b(int path, unsigned chan, Xspress3_TriggerB *trig_b)
 {
+    if (chan >= num_detectors) return XSP3_RANGE_CHECK;
+    memset( trig_b, 0, sizeof(Xspress3_TriggerB) );
+    trig_b->enable = 1;
+    trig_b->event_time = detectors[chan].eventWidth;
     return XSP3_OK;
 }
 
 int xsp3Simulator::xsp3Api_get_dtcfactor(int path, u_int32_t *scaData, double *dtcFactor, double *dtcAllEvent, unsigned chan)
 {
+    if (chan >= num_detectors) return XSP3_RANGE_CHECK;
+    *dtcFactor = detectors[chan].dtcFactor( scaData, dtcAllEvent );
     return XSP3_OK;
 }
 
 int xsp3Simulator::xsp3Api_get_generation(int path, int card)
 {
-    return 0;
+    if (!validCard(card)) return XspressGenError;
+    return generation;
+}
+
+/**
+ * Marker inputs of num_tf frames from tf. Marker 0 is set on the frames the
+ * ITFG marker generator would mark, as set by itfg_setup2; the others are 0.
+ */
+int xsp3Simulator::xsp3Api_histogram_get_tf_markers(int path, int chan, unsigned tf, unsigned num_tf, int *markers)
+{
+    int status;
+
+    if (chan < 0 || (unsigned) chan >= num_detectors) return XSP3_RANGE_CHECK;
+    status = readFaults( "xsp3_histogram_get_tf_markers" );
+    if (status != XSP3_OK) return status;
+
+    for (unsigned int frame = tf; frame < tf + num_tf; frame++ )
+        *markers++ = (markerPeriod > 0 && (int) (frame % markerPeriod) == markerFrame) ? 1 : 0;
+    return XSP3_OK;
 }
@@ -29,8 +29,13 @@
 #include "xsp3Api.h"
 #include "xsp3SimElement.h"
 #include "xsp3TimeRegister.h"
+#include "xsp3SimTimer.h"
+#include "xsp3SimReplay.h"
+#include "xsp3SimProducer.h"
+#include "xsp3SimFault.h"
+#include "epicsMutex.h"
+#include <stdio.h>
 #include <vector>
-#include "epicsTime.h"
 
 class xsp3Simulator: public xsp3Api {
 // Construction
@@ -38,6 +43,16 @@ public:
     xsp3Simulator( asynUser * user, int max_detectors, int max_spectra);
     virtual ~xsp3Simulator();
 
+    void setCountRate( double rate );
+    void setSeed( uint64_t seed );
+    void setExternalTrigger( double rate, double jitter, uint64_t seed );
+    int setReplay( const char * fileName, bool loop, double rate );
+    const char * getReplayError( void ) const { return replay.getError(); }
+    int setSystem( int generation, int threads, int ring_frames );
+    int setFault( int fault, double probability, double value );
+    void clearFaults( void );
+    void reportFaults( FILE * fp );
+
 protected:
     virtual int xsp3Api_clocks_setup(int path, int card, int clk_src, int flags, int tp_type);
     virtual int xsp3Api_close(int path);
@@ -51,6 +66,7 @@ protected:
     virtual int xsp3Api_hist_dtc_read4d(int path, double *hist_buff, double *scal_buff,
                                         unsigned eng, unsigned aux, unsigned chan, unsigned tf,
                                         unsigned num_eng, unsigned num_aux, unsigned num_chan, unsigned num_tf);
+    virtual int xsp3Api_histogram_circ_ack(int path, unsigned chan, unsigned tf, unsigned num_chan, unsigned num_tf);
     virtual int xsp3Api_histogram_clear(int path, int first_chan, int num_chan, int first_frame, int num_frames);
     virtual int xsp3Api_histogram_continue(int path, int card);
     virtual int xsp3Api_histogram_pause(int path, int card);
@@ -78,17 +94,40 @@ protected:
     virtual int xsp3Api_get_trigger_b(int path, unsigned chan, Xspress3_TriggerB *trig_b);
     virtual int xsp3Api_get_dtcfactor(int path, u_int32_t *scaData, double *dtcFactor, double *dtcAllEvent, unsigned chan);
     virtual int xsp3Api_get_generation(int path, int card);
+    virtual int xsp3Api_histogram_get_tf_markers(int path, int chan, unsigned tf, unsigned num_tf, int *markers);
+    virtual int xsp3Api_format_sub_frames(int path, int chan, int just_good, int just_good_thres, int flags, int nbits_eng, int num_sub_frames, int ts_divide);
 
 private:
+    void updateCountsPerFrame( void );
+    void replaySpectrum( int recorded, unsigned chan, unsigned eng, unsigned num_eng, uint32_t *buffer );
+    void replayScalers( int recorded, unsigned chan, uint32_t *scalers );
+    bool validCard( int card ) const;
+    bool inRing( unsigned eng, unsigned num_eng, unsigned chan, unsigned num_chan ) const;
+    int readFaults( const char * function );
+    void dropFrames( void * buffer, size_t frameBytes, unsigned tf, unsigned num_tf );
+    void setErrorMessage( const char * message );
+
     std::vector<xsp3SimElement> detectors;
     int handle;
     unsigned int num_detectors;
+    int num_cards;
+    int num_channels;
+    int generation;
     int runFlags;
-    double frame_time;
-    int num_frames;
+    int markerPeriod;
+    int markerFrame;
+    int subFrames;
     xsp3TimeRegister timeRegister;
-    int current_frame;
-    epicsTime scanStart;
+    xsp3SimTimer timer;
+    xsp3SimReplay replay;
+    double count_rate;
+    xsp3SimFault faults;
+    // Set by the producer threads as well as the caller, so only used under errorMutex
+    epicsMutex errorMutex;
+    char error_message[256];
+    char error_reply[256];
+    // Last, so the producer threads stop before the elements go
+    xsp3SimProducer producer;
 };
 
 #endif /* XSP3SIMULATOR_H */
@@ -0,0 +1,201 @@
+/*
+ * xsp3Sparse.cpp
+ *
+ * Sparse encoding of frames of spectra.
+ */
+
+#include <string.h>
+#include "xsp3Sparse.h"
+
+/* Counts are tested for zero this many at a time */
+#define XSP3_SPARSE_BLOCK 8
+
+/* True if the XSP3_SPARSE_BLOCK counts from p are all 0. A single OR over
+ * the block, which the compiler can vectorise, skips runs of empty bins. */
+static inline bool blockZero(const uint32_t *p)
+{
+    uint32_t any = 0;
+    for (int i = 0; i < XSP3_SPARSE_BLOCK; i++)
+        any |= p[i];
+    return any == 0;
+}
+
+/* Call sink(bin, count) for each non-zero bin of a spectrum, in order */
+template <class Sink>
+static void scanSpectrum(const uint32_t *spectrum, size_t bins, Sink &sink)
+{
+    size_t bin = 0;
+
+    for (; bin + XSP3_SPARSE_BLOCK <= bins; bin += XSP3_SPARSE_BLOCK) {
+        if (blockZero(spectrum + bin)) continue;
+        for (size_t i = bin; i < bin + XSP3_SPARSE_BLOCK; i++) {
+            if (spectrum[i]) sink(i, spectrum[i]);
+        }
+    }
+    for (; bin < bins; bin++) {
+        if (spectrum[bin]) sink(bin, spectrum[bin]);
+    }
+}
+
+struct xsp3SparseCounter {
+    size_t count;
+    xsp3SparseCounter() : count(0) {}
+    void operator()(size_t, uint32_t) { count++; }
+};
+
+struct xsp3SparsePairWriter {
+    uint32_t *out;
+    void operator()(size_t bin, uint32_t count) { *out++ = (uint32_t) bin; *out++ = count; }
+};
+
+struct xsp3SparseBitmapWriter {
+    uint32_t *map;
+    uint32_t *values;
+    void operator()(size_t bin, uint32_t count) { map[bin/32] |= 1u << (bin%32); *values++ = count; }
+};
+
+static size_t mapWords(size_t bins)
+{
+    return (bins + 31)/32;
+}
+
+/**
+ * The number of non-zero bins in numSpectra spectra of bins bins.
+ */
+size_t xsp3SparseNonZero(const uint32_t *spectra, size_t bins, size_t numSpectra)
+{
+    xsp3SparseCounter counter;
+
+    for (size_t s = 0; s < numSpectra; s++)
+        scanSpectrum(spectra + s*bins, bins, counter);
+    return counter.count;
+}
+
+/**
+ * The encoding to use for a frame: for xsp3SparseAuto the smaller of pairs
+ * and bitmap, otherwise encoding itself.
+ */
+int xsp3SparseChoose(int encoding, size_t bins, size_t numSpectra, size_t nonZero)
+{
+    if (encoding != xsp3SparseAuto) return encoding;
+    return (xsp3SparseSize(xsp3SparsePairs, bins, numSpectra, nonZero) <=
+            xsp3SparseSize(xsp3SparseBitmap, bins, numSpectra, nonZero)) ? xsp3SparsePairs : xsp3SparseBitmap;
+}
+
+/**
+ * The number of words a frame with nonZero non-zero bins encodes into.
+ */
+size_t xsp3SparseSize(int encoding, size_t bins, size_t numSpectra, size_t nonZero)
+{
+    switch (xsp3SparseChoose(encoding, bins, numSpectra, nonZero)) {
+    case xsp3SparsePairs:
+        return numSpectra + 1 + 2*nonZero;
+    case xsp3SparseBitmap:
+        return numSpectra + 1 + numSpectra*mapWords(bins) + nonZero;
+    default:
+        return bins*numSpectra;
+    }
+}
+
+/**
+ * The most words any frame of numSpectra spectra of bins bins encodes into.
+ * Both encodings grow with the non-zero bins, so for xsp3SparseAuto too it
+ * is the size of a frame with every bin set.
+ */
+size_t xsp3SparseMaxSize(int encoding, size_t bins, size_t numSpectra)
+{
+    return xsp3SparseSize(encoding, bins, numSpectra, bins*numSpectra);
+}
+
+/**
+ * Encode a frame. words must hold xsp3SparseSize() words; xsp3SparseAuto
+ * must be resolved with xsp3SparseChoose() first, so the reader knows which
+ * encoding was used.
+ * @return The number of words written
+ */
+size_t xsp3SparseEncode(int encoding, const uint32_t *spectra, size_t bins, size_t numSpectra, uint32_t *words)
+{
+    uint32_t *offsets = words;
+    uint32_t nonZero = 0;
+
+    if (encoding == xsp3SparsePairs) {
+        xsp3SparsePairWriter writer;
+        writer.out = words + numSpectra + 1;
+        for (size_t s = 0; s < numSpectra; s++) {
+            offsets[s] = nonZero;
+            scanSpectrum(spectra + s*bins, bins, writer);
+            nonZero = (uint32_t) (writer.out - (words + numSpectra + 1))/2;
+        }
+        offsets[numSpectra] = nonZero;
+        return writer.out - words;
+    }
+
+    if (encoding == xsp3SparseBitmap) {
+        xsp3SparseBitmapWriter writer;
+        uint32_t *map = words + numSpectra + 1;
+        uint32_t *values = map + numSpectra*mapWords(bins);
+        memset(map, 0, numSpectra*mapWords(bins)*sizeof(uint32_t));
+        writer.values = values;
+        for (size_t s = 0; s < numSpectra; s++) {
+            offsets[s] = (uint32_t) (writer.values - values);
+            writer.map = map + s*mapWords(bins);
+            scanSpectrum(spectra + s*bins, bins, writer);
+        }
+        offsets[numSpectra] = (uint32_t) (writer.values - values);
+        return writer.values - words;
+    }
+
+    memcpy(words, spectra, bins*numSpectra*sizeof(uint32_t));
+    return bins*numSpectra;
+}
+
+/**
+ * Decode a frame into numSpectra spectra of bins bins.
+ * @param numWords The length of words, which may include padding
+ * @return 0, or -1 if the words are not a valid encoding of such a frame
+ */
+int xsp3SparseDecode(int encoding, const uint32_t *words, size_t numWords, size_t bins, size_t numSpectra, uint32_t *spectra)
+{
+    const uint32_t *offsets = words;
+
+    if (encoding != xsp3SparsePairs && encoding != xsp3SparseBitmap) {
+        if (encoding != xsp3SparseNone || numWords < bins*numSpectra) return -1;
+        memcpy(spectra, words, bins*numSpectra*sizeof(uint32_t));
+        return 0;
+    }
+
+    if (numWords < numSpectra + 1 || offsets[0] != 0) return -1;
+    for (size_t s = 0; s < numSpectra; s++) {
+        if (offsets[s+1] < offsets[s] || offsets[s+1] - offsets[s] > bins) return -1;
+    }
+    if (numWords < xsp3SparseSize(encoding, bins, numSpectra, offsets[numSpectra])) return -1;
+    memset(spectra, 0, bins*numSpectra*sizeof(uint32_t));
+
+    if (encoding == xsp3SparsePairs) {
+        const uint32_t *pairs = words + numSpectra + 1;
+        for (size_t s = 0; s < numSpectra; s++) {
+            for (uint32_t i = offsets[s]; i < offsets[s+1]; i++) {
+                if (pairs[2*i] >= bins) return -1;
+                spectra[s*bins + pairs[2*i]] = pairs[2*i + 1];
+            }
+        }
+        return 0;
+    }
+
+    const uint32_t *map = words + numSpectra + 1;
+    const uint32_t *values = map + numSpectra*mapWords(bins);
+    uint32_t next = 0;
+    for (size_t s = 0; s < numSpectra; s++) {
+        const uint32_t *spectrumMap = map + s*mapWords(bins);
+        for (size_t w = 0; w < mapWords(bins); w++) {
+            for (uint32_t bits = spectrumMap[w]; bits; bits &= bits - 1) {
+                size_t bin = w*32;
+                for (uint32_t low = bits & (~bits + 1); low > 1; low >>= 1) bin++;
+                if (bin >= bins || next >= offsets[s+1]) return -1;
+                spectra[s*bins + bin] = values[next++];
+            }
+        }
+        if (next != offsets[s+1]) return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,41 @@
+/*
+ * xsp3Sparse.h
+ *
+ * Sparse encoding of a frame of uncorrected spectra, for frames that are
+ * mostly zeros. A frame is numSpectra spectra of bins 32 bit counts, and
+ * is encoded into 32 bit words as:
+ *
+ *  offsets   numSpectra+1 words. offsets[s] is the number of non-zero
+ *            bins in the spectra before s, so offsets[numSpectra] is the
+ *            number in the frame.
+ *  Pairs     then a (bin, count) pair for each non-zero bin, in order.
+ *  Bitmap    then, for each spectrum, (bins+31)/32 words with bit b%32 of
+ *            word b/32 set if bin b is non-zero, followed by the counts of
+ *            the non-zero bins of all the spectra, in order.
+ *
+ * The encoded length follows from the offsets, so a decoder ignores any
+ * padding after it. xsp3SparseMaxSize() is the longest a frame of a given
+ * shape can encode into, so every frame can be padded to the same length.
+ */
+
+#ifndef XSP3SPARSE_H_
+#define XSP3SPARSE_H_
+
+#include <stddef.h>
+#include "inttypes.h"
+
+enum xsp3SparseEncoding {
+    xsp3SparseNone = 0,     //!< Dense spectra
+    xsp3SparsePairs = 1,    //!< (bin, count) pairs
+    xsp3SparseBitmap = 2,   //!< Bitmap of non-zero bins and their counts
+    xsp3SparseAuto = 3      //!< Whichever of pairs and bitmap is smaller for the frame
+};
+
+size_t xsp3SparseNonZero(const uint32_t *spectra, size_t bins, size_t numSpectra);
+int xsp3SparseChoose(int encoding, size_t bins, size_t numSpectra, size_t nonZero);
+size_t xsp3SparseSize(int encoding, size_t bins, size_t numSpectra, size_t nonZero);
+size_t xsp3SparseMaxSize(int encoding, size_t bins, size_t numSpectra);
+size_t xsp3SparseEncode(int encoding, const uint32_t *spectra, size_t bins, size_t numSpectra, uint32_t *words);
+int xsp3SparseDecode(int encoding, const uint32_t *words, size_t numWords, size_t bins, size_t numSpectra, uint32_t *spectra);
+
+#endif /* XSP3SPARSE_H_ */
@@ -0,0 +1,90 @@
+/*
+ * xsp3Stream.h
+ *
+ * The frame stream sent by the driver's TCP server, and a client for it.
+ * The client needs only POSIX sockets, so analysis programs can build
+ * xsp3StreamClient.cpp into their own code or link libxsp3Stream.
+ *
+ * A client subscribes by connecting; the server then sends every frame
+ * read out from then on as a message:
+ *
+ *   xsp3StreamHeader_t       headerBytes bytes (later versions may add fields)
+ *   spectra                  dataBytes bytes
+ *   scalers                  scalerBytes bytes, numScalers per channel
+ *
+ * in host byte order (the server only runs on x86_64 Linux, so little
+ * endian). The spectra are laid out as the frame's NDArray, bins fastest,
+ * as UInt32, or Float64 for dead time corrected frames, and the scalers
+ * are of the same type, channel by channel. If codec is not
+ * xsp3CompressNone the spectra are compressed as by NDPluginCodec, and
+ * uncompressedBytes is their size once decompressed. Scalers are never
+ * compressed.
+ *
+ * Each client has a queue of frames on the server. If a client falls so
+ * far behind that its queue fills, the server either drops its oldest
+ * frames, reporting how many in the dropped field of the next frame it
+ * sends, or disconnects it.
+ */
+
+#ifndef XSP3STREAM_H_
+#define XSP3STREAM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define XSP3_STREAM_MAGIC 0x53505358    /* "XSPS" */
+#define XSP3_STREAM_VERSION 1
+
+typedef struct xsp3StreamHeader {
+    uint32_t magic;                 //!< XSP3_STREAM_MAGIC
+    uint16_t version;               //!< XSP3_STREAM_VERSION
+    uint16_t headerBytes;           //!< Size of the header, data follows
+    uint64_t sequence;              //!< Frames submitted to the server since it started
+    double timeStamp;               //!< Read out time, POSIX seconds
+    uint64_t dataBytes;             //!< Spectra bytes in the message
+    uint64_t uncompressedBytes;     //!< Spectra bytes once decompressed
+    uint32_t acquisition;           //!< Acquisitions started since the IOC started
+    uint32_t frameNumber;           //!< Frame of the acquisition, from 0
+    uint32_t dataType;              //!< 0 UInt32, 1 Float64
+    uint32_t ndims;                 //!< 2, or 3 for sub-frames
+    uint32_t dims[3];               //!< Bins, channels, sub-frames
+    uint32_t numChannels;
+    uint32_t numScalers;            //!< Scalers per channel
+    uint32_t codec;                 //!< xsp3CompressCodec of the spectra
+    uint32_t scalerBytes;
+    uint32_t dropped;               //!< Frames dropped for this client since the last one sent
+} xsp3StreamHeader_t;
+
+/* A frame received from the server */
+typedef struct xsp3StreamFrame {
+    xsp3StreamHeader_t header;
+    std::vector<char> data;
+    std::vector<char> scalers;
+} xsp3StreamFrame_t;
+
+class xsp3StreamClient {
+public:
+    xsp3StreamClient();
+    ~xsp3StreamClient();
+
+    int connect(const char *host, int port);
+    int receive(xsp3StreamFrame_t *frame);
+    void close(void);
+    bool isConnected(void) const { return fd >= 0; }
+    uint64_t getFrames(void) const { return frames; }
+    uint64_t getDropped(void) const { return dropped; }
+    const std::string &getError(void) const { return error; }
+
+private:
+    int fail(const char *message);
+    int readAll(void *buf, size_t bytes);
+
+    int fd;
+    uint64_t frames;
+    uint64_t dropped;
+    std::string error;
+};
+
+#endif /* XSP3STREAM_H_ */
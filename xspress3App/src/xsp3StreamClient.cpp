@@ -0,0 +1,136 @@
+/*
+ * xsp3StreamClient.cpp
+ *
+ * Client for the driver's frame stream.
+ */
+
+#include <errno.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "xsp3Stream.h"
+
+/* Larger messages are taken to be a corrupt stream */
+#define XSP3_STREAM_MAX_BYTES ((uint64_t) 1 << 32)
+
+xsp3StreamClient::xsp3StreamClient() :
+    fd(-1),
+    frames(0),
+    dropped(0)
+{
+}
+
+xsp3StreamClient::~xsp3StreamClient()
+{
+    close();
+}
+
+int xsp3StreamClient::fail(const char *message)
+{
+    error = message;
+    return -1;
+}
+
+/**
+ * Connect to the server, which subscribes to the frames read out from now on.
+ * @return 0, or -1 with getError() set
+ */
+int xsp3StreamClient::connect(const char *host, int port)
+{
+    struct addrinfo hints, *addresses, *address;
+    char service[16];
+    int one = 1;
+
+    close();
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(service, sizeof(service), "%d", port);
+    if (getaddrinfo(host, service, &hints, &addresses) != 0) {
+        return fail("could not resolve the server");
+    }
+    for (address = addresses; address != NULL; address = address->ai_next) {
+        fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        if (::connect(fd, address->ai_addr, address->ai_addrlen) == 0) {
+            break;
+        }
+        ::close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(addresses);
+    if (fd < 0) {
+        return fail("could not connect to the server");
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    frames = dropped = 0;
+    return 0;
+}
+
+int xsp3StreamClient::readAll(void *buf, size_t bytes)
+{
+    char *p = static_cast<char *>(buf);
+
+    while (bytes > 0) {
+        ssize_t n = recv(fd, p, bytes, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        bytes -= n;
+    }
+    return 0;
+}
+
+/**
+ * Wait for the next frame.
+ * @return 0, or -1 with getError() set if the server closed the connection
+ *         or sent something that is not a frame; the connection is closed
+ */
+int xsp3StreamClient::receive(xsp3StreamFrame_t *frame)
+{
+    xsp3StreamHeader_t *header = &frame->header;
+    char skip[256];
+
+    if (fd < 0) {
+        return fail("not connected");
+    }
+    if (readAll(header, sizeof(*header)) != 0) {
+        close();
+        return fail("the server closed the connection");
+    }
+    if (header->magic != XSP3_STREAM_MAGIC || header->version < XSP3_STREAM_VERSION ||
+        header->headerBytes < sizeof(*header) || header->headerBytes - sizeof(*header) > sizeof(skip) ||
+        header->dataBytes > XSP3_STREAM_MAX_BYTES || header->scalerBytes > XSP3_STREAM_MAX_BYTES) {
+        close();
+        return fail("the stream is not a frame stream of this version");
+    }
+    frame->data.resize(header->dataBytes);
+    frame->scalers.resize(header->scalerBytes);
+    if (readAll(skip, header->headerBytes - sizeof(*header)) != 0 ||
+        (header->dataBytes > 0 && readAll(&frame->data[0], header->dataBytes) != 0) ||
+        (header->scalerBytes > 0 && readAll(&frame->scalers[0], header->scalerBytes) != 0)) {
+        close();
+        return fail("the server closed the connection");
+    }
+    frames++;
+    dropped += header->dropped;
+    return 0;
+}
+
+void xsp3StreamClient::close(void)
+{
+    if (fd >= 0) {
+        ::close(fd);
+    }
+    fd = -1;
+}
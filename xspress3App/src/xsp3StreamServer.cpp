@@ -0,0 +1,487 @@
+/*
+ * xsp3StreamServer.cpp
+ *
+ * TCP server streaming frames to subscribed clients.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "epicsThread.h"
+#include "xsp3Compress.h"
+#include "xsp3StreamServer.h"
+
+/* Frames the encoder may fall behind by, in client queue depths, before the
+ * oldest is dropped. A burst from the data task should reach the client
+ * queues, where the policy applies, rather than be lost on the way. */
+#define XSP3_STREAM_PENDING_DEPTHS 4
+
+static void xsp3StreamAcceptTaskC(void *drvPvt)
+{
+    static_cast<xsp3StreamServer *>(drvPvt)->acceptTask();
+}
+
+static void xsp3StreamEncodeTaskC(void *drvPvt)
+{
+    static_cast<xsp3StreamServer *>(drvPvt)->encodeTask();
+}
+
+void xsp3StreamServer::clientTaskC(void *drvPvt)
+{
+    client *pClient = static_cast<client *>(drvPvt);
+    pClient->pServer->clientTask(pClient);
+}
+
+static bool sendAll(int fd, const void *buf, size_t bytes)
+{
+    const char *p = static_cast<const char *>(buf);
+
+    while (bytes > 0) {
+        ssize_t n = send(fd, p, bytes, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        bytes -= n;
+    }
+    return true;
+}
+
+xsp3StreamServer::xsp3StreamServer() :
+    encoderRunning(false),
+    encoderExit(false),
+    acceptRunning(false),
+    listenFd(-1),
+    port(0),
+    codec(xsp3CompressNone),
+    level(5),
+    shuffle(1),
+    queueDepth(16),
+    policy(xsp3StreamDropOldest),
+    sequence(0),
+    frames(0),
+    dropped(0),
+    disconnected(0),
+    compressFailures(0)
+{
+}
+
+xsp3StreamServer::~xsp3StreamServer()
+{
+    stop();
+    mutex.lock();
+    encoderExit = true;
+    mutex.unlock();
+    encodeEvent.signal();
+    while (1) {
+        mutex.lock();
+        bool running = encoderRunning;
+        mutex.unlock();
+        if (!running) break;
+        stopEvent.wait(0.1);
+    }
+}
+
+/**
+ * Set how frames submitted from now on are sent.
+ * @param codec An xsp3CompressCodec for the spectra
+ * @param level Blosc compression level, 1 to 9
+ * @param shuffle Blosc shuffle: 0 none, 1 byte or 2 bit
+ * @param queueDepth Frames queued for each client before the policy applies
+ * @param policy An xsp3StreamPolicy
+ */
+void xsp3StreamServer::configure(int codec, int level, int shuffle, int queueDepth, int policy)
+{
+    mutex.lock();
+    this->codec = codec;
+    this->level = level;
+    this->shuffle = shuffle;
+    this->queueDepth = (queueDepth > 0) ? queueDepth : 1;
+    this->policy = policy;
+    mutex.unlock();
+}
+
+/**
+ * Listen for clients.
+ * @param port The TCP port, or 0 for any free port (see getPort())
+ * @return 0, or -1 with getError() set
+ */
+int xsp3StreamServer::start(int port)
+{
+    struct sockaddr_in address;
+    socklen_t length = sizeof(address);
+    int one = 1;
+    int fd;
+
+    if (isRunning()) {
+        if (port == this->port) {
+            return 0;
+        }
+        stop();
+    }
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        mutex.lock();
+        error = "could not create a socket";
+        mutex.unlock();
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr *) &address, sizeof(address)) != 0 || listen(fd, 8) != 0 ||
+        getsockname(fd, (struct sockaddr *) &address, &length) != 0) {
+        close(fd);
+        mutex.lock();
+        error = "could not listen on the port";
+        mutex.unlock();
+        return -1;
+    }
+
+    mutex.lock();
+    listenFd = fd;
+    this->port = ntohs(address.sin_port);
+    acceptRunning = true;
+    mutex.unlock();
+    if (epicsThreadCreate("Xsp3StreamAccept", epicsThreadPriorityMedium,
+                          epicsThreadGetStackSize(epicsThreadStackSmall),
+                          (EPICSTHREADFUNC)xsp3StreamAcceptTaskC, this) == NULL) {
+        mutex.lock();
+        acceptRunning = false;
+        listenFd = -1;
+        error = "could not start the accept thread";
+        mutex.unlock();
+        close(fd);
+        return -1;
+    }
+    mutex.lock();
+    if (!encoderRunning) {
+        encoderRunning = (epicsThreadCreate("Xsp3StreamEncode", epicsThreadPriorityMedium,
+                                            epicsThreadGetStackSize(epicsThreadStackMedium),
+                                            (EPICSTHREADFUNC)xsp3StreamEncodeTaskC, this) != NULL);
+    }
+    mutex.unlock();
+    return 0;
+}
+
+/**
+ * Stop listening, disconnect every client and drop the frames not sent.
+ */
+void xsp3StreamServer::stop(void)
+{
+    std::deque<message *> unsent;
+
+    mutex.lock();
+    int fd = listenFd;
+    mutex.unlock();
+    if (fd >= 0) {
+        // Wakes the accept thread, which then exits
+        shutdown(fd, SHUT_RDWR);
+        while (1) {
+            mutex.lock();
+            bool running = acceptRunning;
+            mutex.unlock();
+            if (!running) break;
+            stopEvent.wait(0.1);
+        }
+        close(fd);
+    }
+
+    mutex.lock();
+    listenFd = -1;
+    for (std::list<client *>::iterator it = clients.begin(); it != clients.end(); ++it) {
+        (*it)->closing = true;
+        shutdown((*it)->fd, SHUT_RDWR);
+        (*it)->wake.signal();
+    }
+    mutex.unlock();
+    while (1) {
+        mutex.lock();
+        bool connected = !clients.empty();
+        if (!connected) {
+            unsent.swap(pending);
+        }
+        mutex.unlock();
+        if (!connected) break;
+        stopEvent.wait(0.1);
+    }
+    for (size_t i = 0; i < unsent.size(); i++) {
+        release(unsent[i]);
+    }
+}
+
+/**
+ * Queue a frame for the clients connected now, without waiting. The frame
+ * is reserved until every client has sent it, so the caller may release it.
+ * If the encoder is XSP3_STREAM_PENDING_DEPTHS queues behind, its oldest
+ * frame is dropped.
+ * @param info The acquisition, frameNumber, timeStamp, numScalers and
+ *        scalerBytes of the frame; the rest is filled in from pArray
+ * @param scalers info.scalerBytes of scalers
+ * @return false if there are no clients, so the frame was not queued
+ */
+bool xsp3StreamServer::submit(NDArray *pArray, const xsp3StreamHeader_t &info, const void *scalers)
+{
+    message *pOldest = NULL;
+    NDArrayInfo_t arrayInfo;
+
+    mutex.lock();
+    if (clients.empty()) {
+        mutex.unlock();
+        return false;
+    }
+    if (pending.size() >= queueDepth*XSP3_STREAM_PENDING_DEPTHS) {
+        pOldest = pending.front();
+        pending.pop_front();
+        dropped++;
+        for (std::list<client *>::iterator it = clients.begin(); it != clients.end(); ++it) {
+            (*it)->dropped++;
+        }
+    }
+
+    message *pMessage = new message;
+    pArray->getInfo(&arrayInfo);
+    pMessage->refs = 1;
+    pMessage->header = info;
+    pMessage->header.magic = XSP3_STREAM_MAGIC;
+    pMessage->header.version = XSP3_STREAM_VERSION;
+    pMessage->header.headerBytes = sizeof(xsp3StreamHeader_t);
+    pMessage->header.sequence = sequence++;
+    pMessage->header.dataType = (pArray->dataType == NDFloat64) ? 1 : 0;
+    pMessage->header.ndims = pArray->ndims;
+    pMessage->header.dims[1] = pMessage->header.dims[2] = 1;
+    for (int i = 0; i < pArray->ndims && i < 3; i++) {
+        pMessage->header.dims[i] = pArray->dims[i].size;
+    }
+    pMessage->header.numChannels = pMessage->header.dims[1];
+    pMessage->header.codec = xsp3CompressNone;
+    pMessage->header.dataBytes = pMessage->header.uncompressedBytes = arrayInfo.totalBytes;
+    pMessage->header.dropped = 0;
+    pMessage->scalers.assign(static_cast<const char *>(scalers), static_cast<const char *>(scalers) + info.scalerBytes);
+    pArray->reserve();
+    pMessage->pArray = pArray;
+    pending.push_back(pMessage);
+    mutex.unlock();
+    encodeEvent.signal();
+    if (pOldest != NULL) {
+        release(pOldest);
+    }
+    return true;
+}
+
+void xsp3StreamServer::getStats(int *clients, unsigned long *frames, unsigned long *dropped, unsigned long *disconnected)
+{
+    mutex.lock();
+    *clients = (int) this->clients.size();
+    *frames = this->frames;
+    *dropped = this->dropped;
+    *disconnected = this->disconnected;
+    mutex.unlock();
+}
+
+/**
+ * The reason the server could not start, or the last frame could not be compressed.
+ */
+std::string xsp3StreamServer::getError(void)
+{
+    std::string message;
+
+    mutex.lock();
+    message = error;
+    mutex.unlock();
+    return message;
+}
+
+void xsp3StreamServer::release(message *pMessage)
+{
+    mutex.lock();
+    bool last = (--pMessage->refs == 0);
+    mutex.unlock();
+    if (last) {
+        pMessage->pArray->release();
+        delete pMessage;
+    }
+}
+
+/**
+ * Queue a frame for every client, applying the policy to clients whose
+ * queue is full.
+ */
+void xsp3StreamServer::fanOut(message *pMessage)
+{
+    std::vector<message *> lost;
+
+    mutex.lock();
+    for (std::list<client *>::iterator it = clients.begin(); it != clients.end(); ++it) {
+        client *pClient = *it;
+        if (pClient->closing) {
+            continue;
+        }
+        if (pClient->queue.size() >= queueDepth) {
+            if (policy == xsp3StreamDisconnect) {
+                pClient->closing = true;
+                shutdown(pClient->fd, SHUT_RDWR);
+                pClient->wake.signal();
+                disconnected++;
+                continue;
+            }
+            lost.push_back(pClient->queue.front());
+            pClient->queue.pop_front();
+            pClient->dropped++;
+            dropped++;
+        }
+        pMessage->refs++;
+        pClient->queue.push_back(pMessage);
+        pClient->wake.signal();
+    }
+    frames++;
+    mutex.unlock();
+    for (size_t i = 0; i < lost.size(); i++) {
+        release(lost[i]);
+    }
+}
+
+bool xsp3StreamServer::sendMessage(int fd, const message *pMessage, unsigned long dropped)
+{
+    xsp3StreamHeader_t header = pMessage->header;
+
+    header.dropped = (uint32_t) dropped;
+    return sendAll(fd, &header, sizeof(header)) &&
+           sendAll(fd, pMessage->pArray->pData, header.dataBytes) &&
+           sendAll(fd, pMessage->scalers.empty() ? NULL : &pMessage->scalers[0], pMessage->scalers.size());
+}
+
+/**
+ * Accept clients until the server stops, each with its own sending thread.
+ */
+void xsp3StreamServer::acceptTask(void)
+{
+    int one = 1;
+
+    while (1) {
+        int fd = accept(listenFd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EINVAL || errno == EBADF) break;
+            // Out of descriptors or similar; try again later
+            epicsThreadSleep(0.1);
+            continue;
+        }
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        client *pClient = new client;
+        pClient->pServer = this;
+        pClient->fd = fd;
+        pClient->closing = false;
+        pClient->dropped = 0;
+        mutex.lock();
+        clients.push_back(pClient);
+        mutex.unlock();
+        if (epicsThreadCreate("Xsp3StreamClient", epicsThreadPriorityMedium,
+                              epicsThreadGetStackSize(epicsThreadStackSmall),
+                              (EPICSTHREADFUNC)clientTaskC, pClient) == NULL) {
+            mutex.lock();
+            clients.remove(pClient);
+            mutex.unlock();
+            close(fd);
+            delete pClient;
+        }
+    }
+    mutex.lock();
+    acceptRunning = false;
+    mutex.unlock();
+    stopEvent.signal();
+}
+
+/**
+ * Compress the submitted frames, if a codec is set, and queue them for the clients.
+ */
+void xsp3StreamServer::encodeTask(void)
+{
+    while (1) {
+        encodeEvent.wait();
+        while (1) {
+            mutex.lock();
+            if (encoderExit) {
+                encoderRunning = false;
+                mutex.unlock();
+                stopEvent.signal();
+                return;
+            }
+            if (pending.empty()) {
+                mutex.unlock();
+                break;
+            }
+            message *pMessage = pending.front();
+            pending.pop_front();
+            int frameCodec = codec, frameLevel = level, frameShuffle = shuffle;
+            mutex.unlock();
+
+            if (frameCodec != xsp3CompressNone) {
+                std::string reason;
+                NDArray *pOut = xsp3CompressPool::compress(pMessage->pArray, frameCodec, frameLevel, frameShuffle, &reason);
+                if (pOut != NULL) {
+                    pMessage->pArray->release();
+                    pMessage->pArray = pOut;
+                    pMessage->header.codec = frameCodec;
+                    pMessage->header.dataBytes = pOut->compressedSize;
+                } else {
+                    mutex.lock();
+                    compressFailures++;
+                    error = reason;
+                    mutex.unlock();
+                }
+            }
+            fanOut(pMessage);
+            release(pMessage);
+        }
+    }
+}
+
+/**
+ * Send a client its queue until it disconnects or is disconnected.
+ */
+void xsp3StreamServer::clientTask(client *pClient)
+{
+    std::deque<message *> unsent;
+
+    mutex.lock();
+    while (1) {
+        while (!pClient->closing && pClient->queue.empty()) {
+            mutex.unlock();
+            pClient->wake.wait();
+            mutex.lock();
+        }
+        if (pClient->closing) {
+            break;
+        }
+        message *pMessage = pClient->queue.front();
+        pClient->queue.pop_front();
+        unsigned long clientDropped = pClient->dropped;
+        pClient->dropped = 0;
+        mutex.unlock();
+        bool sent = sendMessage(pClient->fd, pMessage, clientDropped);
+        release(pMessage);
+        mutex.lock();
+        if (!sent) {
+            break;
+        }
+    }
+    clients.remove(pClient);
+    unsent.swap(pClient->queue);
+    mutex.unlock();
+
+    for (size_t i = 0; i < unsent.size(); i++) {
+        release(unsent[i]);
+    }
+    close(pClient->fd);
+    delete pClient;
+    stopEvent.signal();
+}
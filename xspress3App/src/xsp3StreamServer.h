@@ -0,0 +1,94 @@
+/*
+ * xsp3StreamServer.h
+ *
+ * TCP server streaming frames to subscribed clients, in the format of
+ * xsp3Stream.h. The data task submits each frame without waiting: the
+ * NDArray is reserved rather than copied, and an encoder thread
+ * compresses it if a codec is set and queues it for every client. Each
+ * client has a thread sending its queue, so a slow client only holds up
+ * itself; when its queue is full the client loses its oldest frames or
+ * is disconnected, as the policy says.
+ */
+
+#ifndef XSP3STREAMSERVER_H_
+#define XSP3STREAMSERVER_H_
+
+#include <deque>
+#include <list>
+#include <string>
+#include <vector>
+#include "epicsMutex.h"
+#include "epicsEvent.h"
+#include "ADDriver.h"
+#include "xsp3Stream.h"
+
+enum xsp3StreamPolicy {
+    xsp3StreamDropOldest = 0,   //!< A slow client loses its oldest queued frames
+    xsp3StreamDisconnect = 1    //!< A slow client is disconnected
+};
+
+class xsp3StreamServer {
+public:
+    xsp3StreamServer();
+    ~xsp3StreamServer();
+
+    int start(int port);
+    void stop(void);
+    bool isRunning(void) const { return listenFd >= 0; }
+    int getPort(void) const { return port; }
+    void configure(int codec, int level, int shuffle, int queueDepth, int policy);
+    bool submit(NDArray *pArray, const xsp3StreamHeader_t &info, const void *scalers);
+    void getStats(int *clients, unsigned long *frames, unsigned long *dropped, unsigned long *disconnected);
+    std::string getError(void);
+
+    void acceptTask(void);
+    void encodeTask(void);
+
+private:
+    /* A frame ready to send, shared by the queues of every client */
+    struct message {
+        int refs;
+        xsp3StreamHeader_t header;
+        NDArray *pArray;
+        std::vector<char> scalers;
+    };
+
+    struct client {
+        xsp3StreamServer *pServer;
+        int fd;
+        bool closing;
+        unsigned long dropped;      // Since the last frame sent
+        std::deque<message *> queue;
+        epicsEvent wake;
+    };
+
+    static void clientTaskC(void *drvPvt);
+    void clientTask(client *pClient);
+    void release(message *pMessage);
+    void fanOut(message *pMessage);
+    bool sendMessage(int fd, const message *pMessage, unsigned long dropped);
+
+    epicsMutex mutex;
+    epicsEvent encodeEvent;
+    epicsEvent stopEvent;
+    std::deque<message *> pending;  // Submitted, waiting for the encoder
+    std::list<client *> clients;
+    bool encoderRunning;
+    bool encoderExit;
+    bool acceptRunning;
+    int listenFd;
+    int port;
+    int codec;
+    int level;
+    int shuffle;
+    size_t queueDepth;
+    int policy;
+    uint64_t sequence;
+    unsigned long frames;           // Sent to at least one client
+    unsigned long dropped;          // Dropped for any client
+    unsigned long disconnected;     // Clients disconnected for falling behind
+    unsigned long compressFailures;
+    std::string error;
+};
+
+#endif /* XSP3STREAMSERVER_H_ */
@@ -25,7 +25,7 @@ void xsp3TimeRegister::set( uint32_t timeRegister )
     trigger = (xsp3Trigger) XSP3_GLOB_TIMA_TF_SRC(timeRegister);
     invert_f0 = ( timeRegister & XSP3_GLOB_TIMA_F0_INV );
     invert_veto = ( timeRegister & XSP3_GLOB_TIMA_VETO_INV );
-    debounce = (timeRegister & 0xFF00) >> 16;
+    debounce = (timeRegister >> 16) & 0xFF;
 }
 
 uint32_t xsp3TimeRegister::get( void )
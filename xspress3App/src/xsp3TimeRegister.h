@@ -12,7 +12,8 @@
 class xsp3TimeRegister {
 
 public:
-    enum xsp3Trigger { Software=0, Internal=1, IDC=2, TTL_veto=3, TTL_both=4, LVDS_veto=5, LVDS_both=6 };
+    // Values match XSP3_GTIMA_SRC_*
+    enum xsp3Trigger { Software=0, Internal=1, SoftwareHWMarker=2, IDC=3, TTL_veto=4, TTL_both=5, LVDS_veto=6, LVDS_both=7 };
 
     xsp3TimeRegister( uint32_t timeRegister=0 );
     ~xsp3TimeRegister();
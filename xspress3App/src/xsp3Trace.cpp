@@ -0,0 +1,348 @@
+/*
+ * xsp3Trace.cpp
+ *
+ * Xspress3 API call trace, see xsp3Trace.h
+ */
+#include "xsp3Trace.h"
+#include "xsp3ApiStats.h"
+#include "xspress3.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <string.h>
+#include <errno.h>
+
+#define XSP3_TRACE_HEADER_SIZE 128
+
+static uint32_t traceAlign( size_t bytes )
+{
+    return (uint32_t) ((bytes + 7) & ~((size_t) 7));
+}
+
+xsp3TraceWriter::xsp3TraceWriter( void ) :
+    header(NULL),
+    ring(NULL),
+    mapSize(0),
+    startMono(0.0),
+    buffers(false)
+{
+}
+
+xsp3TraceWriter::~xsp3TraceWriter( void )
+{
+    close();
+}
+
+/**
+ * Create a trace file and start recording into it.
+ * @param fileName The file to create, replacing any existing file
+ * @param size Size of the ring in bytes
+ * @param record_buffers Record the frame data returned by the read calls, not just the small outputs
+ * @return XSP3_OK, or XSP3_ERROR with the reason in getError()
+ */
+int xsp3TraceWriter::open( const char * fileName, size_t size, bool record_buffers )
+{
+    struct timeval now;
+    void * map;
+    int fd;
+
+    close();
+
+    epicsGuard<epicsMutex> guard(mutex);
+    size = traceAlign( size );
+    if (size < 4096)
+    {
+        error = "Trace ring must be at least 4096 bytes";
+        return XSP3_ERROR;
+    }
+
+    fd = ::open( fileName, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+    if (fd < 0)
+    {
+        error = std::string("Cannot create ") + fileName + ": " + strerror(errno);
+        return XSP3_ERROR;
+    }
+    if (ftruncate( fd, XSP3_TRACE_HEADER_SIZE + size ) != 0)
+    {
+        error = std::string("Cannot size ") + fileName + ": " + strerror(errno);
+        ::close( fd );
+        return XSP3_ERROR;
+    }
+    map = mmap( NULL, XSP3_TRACE_HEADER_SIZE + size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    ::close( fd );
+    if (map == MAP_FAILED)
+    {
+        error = std::string("Cannot map ") + fileName + ": " + strerror(errno);
+        return XSP3_ERROR;
+    }
+
+    gettimeofday( &now, NULL );
+    mapSize = XSP3_TRACE_HEADER_SIZE + size;
+    ring = (char *) map + XSP3_TRACE_HEADER_SIZE;
+    buffers = record_buffers;
+    startMono = xsp3ApiStats::now();
+
+    header = (xsp3TraceHeader_t *) map;
+    memset( header, 0, sizeof(xsp3TraceHeader_t) );
+    header->headerSize = XSP3_TRACE_HEADER_SIZE;
+    header->dataSize = size;
+    header->startTime = now.tv_sec + now.tv_usec*1e-6;
+    // The magic goes in last, so a reader never sees a half made header
+    memcpy( header->magic, XSP3_TRACE_MAGIC, sizeof(header->magic) );
+    error.clear();
+    return XSP3_OK;
+}
+
+void xsp3TraceWriter::close( void )
+{
+    epicsGuard<epicsMutex> guard(mutex);
+
+    if (header == NULL) return;
+    msync( header, mapSize, MS_ASYNC );
+    munmap( header, mapSize );
+    header = NULL;
+    ring = NULL;
+    mapSize = 0;
+}
+
+/* Called with the mutex held: drop the oldest record in the ring */
+void xsp3TraceWriter::freeOldest( void )
+{
+    const xsp3TraceRecord_t * rec = (const xsp3TraceRecord_t *) (ring + header->tail);
+
+    header->tail += rec->size;
+    if (header->tail >= header->dataSize) header->tail = 0;
+    header->used -= rec->size;
+}
+
+/*
+ * Called with the mutex held: make room for size bytes at head, dropping
+ * the oldest records as needed, and padding to the end of the ring if the
+ * record does not fit there.
+ */
+char * xsp3TraceWriter::reserve( uint32_t size )
+{
+    for (;;)
+    {
+        uint64_t contiguous;
+
+        if (header->used == 0)
+        {
+            header->head = header->tail = 0;
+            contiguous = header->dataSize;
+        }
+        else if (header->used == header->dataSize)
+            contiguous = 0;
+        else if (header->tail > header->head)
+            contiguous = header->tail - header->head;
+        else
+            contiguous = header->dataSize - header->head;
+
+        if (contiguous >= size)
+        {
+            char * rec = ring + header->head;
+            header->head += size;
+            if (header->head == header->dataSize) header->head = 0;
+            header->used += size;
+            return rec;
+        }
+
+        if (header->used < header->dataSize && header->tail <= header->head)
+        {
+            // The free space up to the end is too small, pad it and wrap
+            xsp3TraceRecord_t * pad = (xsp3TraceRecord_t *) (ring + header->head);
+            memset( pad, 0, sizeof(uint64_t) );
+            pad->size = (uint32_t) contiguous;
+            pad->call = XSP3_TRACE_PAD;
+            header->used += contiguous;
+            header->head = 0;
+        }
+        else
+        {
+            freeOldest();
+        }
+    }
+}
+
+/**
+ * Add a call to the trace.
+ * @param call The xsp3ApiCall
+ * @param status The value the call returned
+ * @param start Time the call started, from xsp3ApiStats::now()
+ * @param duration Time the call took, in seconds
+ * @param args Integer arguments
+ * @param numArgs Number of integer arguments
+ * @param output Data returned by the call, or NULL
+ * @param outputSize Size of output in bytes
+ * @param output2 More data returned by the call, recorded after output
+ * @param output2Size Size of output2 in bytes
+ * @param text1 String argument, or NULL (also text2 and text3)
+ */
+void xsp3TraceWriter::record( int call, int status, double start, double duration,
+                              const int64_t * args, int numArgs,
+                              const void * output, size_t outputSize,
+                              const void * output2, size_t output2Size,
+                              const char * text1, const char * text2, const char * text3 )
+{
+    const char * texts[3] = { text1, text2, text3 };
+    size_t textSize = 0, size;
+    char * rec, * p;
+
+    if (output == NULL) outputSize = 0;
+    if (output2 == NULL) output2Size = 0;
+    for (int i = 0; i < 3; i++)
+        if (texts[i] != NULL) textSize += strlen( texts[i] ) + 1;
+    size = sizeof(xsp3TraceRecord_t) + numArgs*sizeof(int64_t) + outputSize + output2Size + textSize;
+
+    epicsGuard<epicsMutex> guard(mutex);
+    if (header == NULL) return;
+
+    if (traceAlign( size ) > header->dataSize)
+    {
+        header->dropped++;
+        return;
+    }
+
+    rec = reserve( traceAlign( size ) );
+    xsp3TraceRecord_t * head = (xsp3TraceRecord_t *) rec;
+    memset( head, 0, sizeof(xsp3TraceRecord_t) );
+    head->size = traceAlign( size );
+    head->call = (uint16_t) call;
+    head->numArgs = (uint8_t) numArgs;
+    head->flags = (outputSize + output2Size) > 0 ? XSP3_TRACE_OUTPUT : 0;
+    head->status = status;
+    head->outputSize = (uint32_t) (outputSize + output2Size);
+    head->textSize = (uint32_t) textSize;
+    head->start = start - startMono;
+    head->duration = duration;
+
+    p = rec + sizeof(xsp3TraceRecord_t);
+    memcpy( p, args, numArgs*sizeof(int64_t) );
+    p += numArgs*sizeof(int64_t);
+    if (outputSize > 0) memcpy( p, output, outputSize );
+    p += outputSize;
+    if (output2Size > 0) memcpy( p, output2, output2Size );
+    p += output2Size;
+    for (int i = 0; i < 3; i++)
+    {
+        if (texts[i] == NULL) continue;
+        strcpy( p, texts[i] );
+        p += strlen( texts[i] ) + 1;
+    }
+    header->records++;
+}
+
+xsp3TraceReader::xsp3TraceReader( void ) :
+    map(NULL),
+    mapSize(0)
+{
+}
+
+xsp3TraceReader::~xsp3TraceReader( void )
+{
+    close();
+}
+
+/**
+ * Map a trace file and index its records, oldest first.
+ * @return XSP3_OK, or XSP3_ERROR with the reason in getError()
+ */
+int xsp3TraceReader::open( const char * fileName )
+{
+    const xsp3TraceHeader_t * head;
+    const char * ring;
+    struct stat info;
+    uint64_t offset, remaining;
+    int fd;
+
+    close();
+
+    fd = ::open( fileName, O_RDONLY );
+    if (fd < 0)
+    {
+        error = std::string("Cannot open ") + fileName + ": " + strerror(errno);
+        return XSP3_ERROR;
+    }
+    if (fstat( fd, &info ) != 0 || info.st_size < (off_t) sizeof(xsp3TraceHeader_t))
+    {
+        error = std::string(fileName) + " is too short for a trace file";
+        ::close( fd );
+        return XSP3_ERROR;
+    }
+    mapSize = info.st_size;
+    map = mmap( NULL, mapSize, PROT_READ, MAP_PRIVATE, fd, 0 );
+    ::close( fd );
+    if (map == MAP_FAILED)
+    {
+        error = std::string("Cannot map ") + fileName + ": " + strerror(errno);
+        map = NULL;
+        return XSP3_ERROR;
+    }
+
+    head = (const xsp3TraceHeader_t *) map;
+    if (memcmp( head->magic, XSP3_TRACE_MAGIC, sizeof(head->magic) ) != 0)
+        error = std::string(fileName) + " is not a trace file";
+    else if (head->headerSize < sizeof(xsp3TraceHeader_t) || head->headerSize + head->dataSize > mapSize ||
+             head->tail >= head->dataSize || head->used > head->dataSize)
+        error = std::string(fileName) + " has a bad header";
+    else
+        error.clear();
+    if (!error.empty())
+    {
+        close();
+        return XSP3_ERROR;
+    }
+
+    ring = (const char *) map + head->headerSize;
+    offset = head->tail;
+    remaining = head->used;
+    while (remaining >= sizeof(xsp3TraceRecord_t))
+    {
+        const xsp3TraceRecord_t * rec = (const xsp3TraceRecord_t *) (ring + offset);
+        if (rec->size < sizeof(uint64_t) || rec->size > remaining || offset + rec->size > head->dataSize)
+        {
+            error = std::string(fileName) + " has a corrupt record";
+            break;
+        }
+        if (rec->call != XSP3_TRACE_PAD)
+            records.push_back( rec );
+        remaining -= rec->size;
+        offset += rec->size;
+        if (offset == head->dataSize) offset = 0;
+    }
+    return XSP3_OK;
+}
+
+void xsp3TraceReader::close( void )
+{
+    if (map != NULL) munmap( map, mapSize );
+    map = NULL;
+    mapSize = 0;
+    records.clear();
+}
+
+const int64_t * xsp3TraceReader::args( const xsp3TraceRecord_t * rec )
+{
+    return (const int64_t *) (rec + 1);
+}
+
+const void * xsp3TraceReader::output( const xsp3TraceRecord_t * rec )
+{
+    return args( rec ) + rec->numArgs;
+}
+
+/** The index'th string argument of a record, or NULL */
+const char * xsp3TraceReader::text( const xsp3TraceRecord_t * rec, int index )
+{
+    const char * p = (const char *) output( rec ) + rec->outputSize;
+    const char * end = p + rec->textSize;
+
+    for (int i = 0; p < end; i++)
+    {
+        if (i == index) return p;
+        p += strlen( p ) + 1;
+    }
+    return NULL;
+}
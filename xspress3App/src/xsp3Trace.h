@@ -0,0 +1,127 @@
+/*
+ * xsp3Trace.h
+ *
+ * Binary trace of the Xspress3 API calls made through xsp3Api, written to
+ * a memory mapped ring file so the last part of a long run is always
+ * available, even if the IOC dies. xsp3TraceReplay feeds a trace back to
+ * the driver.
+ *
+ * The file is native endian and laid out as:
+ *
+ *   xsp3TraceHeader, padded to headerSize bytes
+ *   ring of dataSize bytes holding xsp3TraceRecords
+ *
+ * Each record is followed by its integer arguments (int64), the data the
+ * call returned (outputSize bytes) and its string arguments (textSize
+ * bytes, each null terminated), padded to a multiple of 8 bytes. Records
+ * never wrap: a pad record fills the end of the ring instead. The oldest
+ * record is at tail, and used bytes follow it round the ring.
+ */
+
+#ifndef XSP3TRACE_H_
+#define XSP3TRACE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include "epicsMutex.h"
+
+#define XSP3_TRACE_MAGIC "XSP3TRC1"
+#define XSP3_TRACE_PAD 0xFFFF
+
+/* Record flags */
+#define XSP3_TRACE_OUTPUT 0x1       // The returned data is recorded
+#define XSP3_TRACE_TRUNCATED 0x2    // Only part of the returned data is recorded
+
+typedef struct xsp3TraceHeader
+{
+    char magic[8];              // XSP3_TRACE_MAGIC, not null terminated
+    uint32_t headerSize;        // Offset of the ring
+    uint32_t flags;
+    uint64_t dataSize;          // Size of the ring
+    uint64_t head;              // Offset of the next record to write
+    uint64_t tail;              // Offset of the oldest record
+    uint64_t used;              // Bytes of records (and pads) in the ring
+    uint64_t records;           // Records written since tracing started
+    uint64_t dropped;           // Records too big for the ring
+    double startTime;           // Seconds since the epoch when tracing started
+} xsp3TraceHeader_t;
+
+typedef struct xsp3TraceRecord
+{
+    uint32_t size;              // Bytes, including this header, multiple of 8
+    uint16_t call;              // xsp3ApiCall, or XSP3_TRACE_PAD
+    uint8_t numArgs;
+    uint8_t flags;              // XSP3_TRACE_*
+    int32_t status;             // Return code
+    uint32_t outputSize;
+    uint32_t textSize;
+    uint32_t spare;
+    double start;               // Seconds since tracing started
+    double duration;            // Seconds
+} xsp3TraceRecord_t;
+
+/**
+ * Writes trace records into a ring file.
+ */
+class xsp3TraceWriter
+{
+public:
+    xsp3TraceWriter( void );
+    ~xsp3TraceWriter( void );
+
+    int open( const char * fileName, size_t size, bool buffers );
+    void close( void );
+    bool enabled( void ) const { return header != NULL; }
+    bool recordBuffers( void ) const { return buffers; }
+    const char * getError( void ) const { return error.c_str(); }
+    double elapsed( double now ) const { return now - startMono; }
+
+    void record( int call, int status, double start, double duration,
+                 const int64_t * args, int numArgs,
+                 const void * output, size_t outputSize,
+                 const void * output2 = NULL, size_t output2Size = 0,
+                 const char * text1 = NULL, const char * text2 = NULL, const char * text3 = NULL );
+
+private:
+    void freeOldest( void );
+    char * reserve( uint32_t size );
+
+    epicsMutex mutex;
+    xsp3TraceHeader_t * header;
+    char * ring;
+    size_t mapSize;
+    double startMono;
+    bool buffers;
+    std::string error;
+};
+
+/**
+ * Reads the records of a trace file, oldest first.
+ */
+class xsp3TraceReader
+{
+public:
+    xsp3TraceReader( void );
+    ~xsp3TraceReader( void );
+
+    int open( const char * fileName );
+    void close( void );
+    const char * getError( void ) const { return error.c_str(); }
+
+    size_t size( void ) const { return records.size(); }
+    const xsp3TraceRecord_t * get( size_t index ) const { return records[index]; }
+
+    static const int64_t * args( const xsp3TraceRecord_t * rec );
+    static const void * output( const xsp3TraceRecord_t * rec );
+    static const char * text( const xsp3TraceRecord_t * rec, int index );
+
+private:
+    void * map;
+    size_t mapSize;
+    std::vector<const xsp3TraceRecord_t *> records;
+    std::string error;
+};
+
+#endif /* XSP3TRACE_H_ */
@@ -0,0 +1,463 @@
+/*
+ * xsp3TraceReplay.cpp
+ *
+ * Plays back an Xspress3 API trace, see xsp3TraceReplay.h
+ */
+#include "xsp3TraceReplay.h"
+#include "epicsThread.h"
+#include "epicsStdio.h"
+#include <string.h>
+
+#define XSP3_TRACE_NARGS(args) ((int) (sizeof(args)/sizeof((args)[0])))
+
+/* How far after a failed call to look for the error message the driver read */
+#define XSP3_TRACE_MESSAGE_SEARCH 16
+
+xsp3TraceReplay::xsp3TraceReplay(asynUser * pasynUser) :
+    xsp3Api(pasynUser),
+    speed(1.0),
+    origin(xsp3ApiStats::now())
+{
+    memset(cursor, 0, sizeof(cursor));
+    memset(played, 0, sizeof(played));
+    memset(missed, 0, sizeof(missed));
+    strcpy(message, "No error");
+}
+
+xsp3TraceReplay::~xsp3TraceReplay()
+{
+}
+
+/**
+ * Load a trace to play back.
+ * @param fileName A trace file written by xsp3Api::startTrace
+ * @param speed How many times faster than recorded to play it, 0 for as fast as possible
+ * @return XSP3_OK, or XSP3_ERROR with the reason in getError()
+ */
+int xsp3TraceReplay::open(const char *fileName, double speed)
+{
+    epicsGuard<epicsMutex> guard(mutex);
+
+    if (reader.open(fileName) != XSP3_OK)
+    {
+        error = reader.getError();
+        return XSP3_ERROR;
+    }
+    // A corrupt record stops the index, but the records before it can still be played
+    error = reader.getError();
+    for (int call = 0; call < xsp3CallNum; call++)
+    {
+        calls[call].clear();
+        cursor[call] = 0;
+        played[call] = 0;
+        missed[call] = 0;
+    }
+    for (size_t index = 0; index < reader.size(); index++)
+    {
+        int call = reader.get(index)->call;
+        if (call < xsp3CallNum) calls[call].push_back(index);
+    }
+    this->speed = speed > 0.0 ? speed : 0.0;
+    origin = xsp3ApiStats::now();
+    return XSP3_OK;
+}
+
+void xsp3TraceReplay::report(FILE *fp)
+{
+    epicsGuard<epicsMutex> guard(mutex);
+
+    fprintf(fp, "Trace replay: %lu records, speed %g%s\n", (unsigned long) reader.size(), speed,
+            speed > 0.0 ? "" : " (as fast as possible)");
+    if (!error.empty()) fprintf(fp, "  %s\n", error.c_str());
+    fprintf(fp, "  %-38s %10s %10s %10s\n", "call", "recorded", "played", "missed");
+    for (int call = 0; call < xsp3CallNum; call++)
+    {
+        if (calls[call].empty() && missed[call] == 0) continue;
+        fprintf(fp, "  %-38s %10lu %10lu %10lu\n", xsp3ApiStats::name(call),
+                (unsigned long) calls[call].size(), played[call], missed[call]);
+    }
+}
+
+/*
+ * The next recorded call with the same arguments, searching on from the
+ * last one matched and then from the start, or -1 if there is none.
+ */
+long xsp3TraceReplay::match(int call, const int64_t *args, int numArgs)
+{
+    epicsGuard<epicsMutex> guard(mutex);
+    std::vector<size_t> &recs = calls[call];
+
+    for (size_t i = 0; i < recs.size(); i++)
+    {
+        size_t pos = (cursor[call] + i) % recs.size();
+        const xsp3TraceRecord_t *rec = reader.get(recs[pos]);
+
+        if (rec->numArgs != numArgs) continue;
+        if (memcmp(xsp3TraceReader::args(rec), args, numArgs*sizeof(int64_t)) != 0) continue;
+        cursor[call] = pos + 1;
+        return (long) recs[pos];
+    }
+    return -1;
+}
+
+/* The next recorded call, in order, or -1 when they have all been played */
+long xsp3TraceReplay::next(int call)
+{
+    epicsGuard<epicsMutex> guard(mutex);
+
+    if (cursor[call] >= calls[call].size()) return -1;
+    return (long) calls[call][cursor[call]++];
+}
+
+/*
+ * For the polled calls: the last recorded call made before the current
+ * replay time, or the next in order when playing as fast as possible.
+ */
+long xsp3TraceReplay::poll(int call)
+{
+    epicsGuard<epicsMutex> guard(mutex);
+    std::vector<size_t> &recs = calls[call];
+
+    if (recs.empty()) return -1;
+    if (speed <= 0.0)
+    {
+        if (cursor[call] < recs.size()) return (long) recs[cursor[call]++];
+        return (long) recs.back();
+    }
+
+    double now = (xsp3ApiStats::now() - origin)*speed;
+    while (cursor[call] < recs.size() && reader.get(recs[cursor[call]])->start <= now)
+        cursor[call]++;
+    return (long) recs[cursor[call] > 0 ? cursor[call]-1 : 0];
+}
+
+/* Line the replay clock up with a recorded call, made now */
+void xsp3TraceReplay::anchor(long index)
+{
+    epicsGuard<epicsMutex> guard(mutex);
+
+    if (index < 0 || speed <= 0.0) return;
+    origin = xsp3ApiStats::now() - reader.get(index)->start/speed;
+}
+
+/**
+ * Play back a recorded call: take as long as it did and return its status.
+ * A failed call sets the message get_error_message returns to the one the
+ * driver read after the recorded failure.
+ * @param missing Status to return if there was no recorded call (index < 0)
+ */
+int xsp3TraceReplay::play(int call, long index, int missing)
+{
+    const xsp3TraceRecord_t *rec;
+    double delay = 0.0;
+
+    {
+        epicsGuard<epicsMutex> guard(mutex);
+
+        if (index < 0)
+        {
+            missed[call]++;
+            if (missing < 0)
+                epicsSnprintf(message, sizeof(message), "No recorded %s call to play back", xsp3ApiStats::name(call));
+            return missing;
+        }
+        rec = reader.get(index);
+        played[call]++;
+        if (rec->status < 0)
+        {
+            strcpy(message, "Recorded call failed");
+            for (size_t i = index+1; i < reader.size() && i <= (size_t) index+XSP3_TRACE_MESSAGE_SEARCH; i++)
+            {
+                const xsp3TraceRecord_t *next = reader.get(i);
+                const char *text = xsp3TraceReader::text(next, 0);
+                if (next->call == xsp3CallGetErrorMessage && text != NULL)
+                {
+                    strncpy(message, text, sizeof(message)-1);
+                    message[sizeof(message)-1] = '\0';
+                    break;
+                }
+            }
+        }
+        if (speed > 0.0) delay = rec->duration/speed;
+    }
+
+    if (delay > 0.0) epicsThreadSleep(delay);
+    return rec->status;
+}
+
+/*
+ * Play back a call that returns data, copying the recorded data to output
+ * and then output2. Data that was not recorded is returned as zeros.
+ */
+int xsp3TraceReplay::fetch(int call, long index, void *output, size_t outputSize, void *output2, size_t output2Size)
+{
+    if (index >= 0)
+    {
+        const xsp3TraceRecord_t *rec = reader.get(index);
+        const char *data = (const char *) xsp3TraceReader::output(rec);
+        size_t recorded = rec->outputSize;
+        size_t size;
+
+        if (output != NULL)
+        {
+            size = recorded < outputSize ? recorded : outputSize;
+            memcpy(output, data, size);
+            memset((char *) output + size, 0, outputSize - size);
+            data += size;
+            recorded -= size;
+        }
+        if (output2 != NULL)
+        {
+            size = recorded < output2Size ? recorded : output2Size;
+            memcpy(output2, data, size);
+            memset((char *) output2 + size, 0, output2Size - size);
+        }
+    }
+    else
+    {
+        if (output != NULL) memset(output, 0, outputSize);
+        if (output2 != NULL) memset(output2, 0, output2Size);
+    }
+    return play(call, index, XSP3_ERROR);
+}
+
+int xsp3TraceReplay::xsp3Api_clocks_setup(int path, int card, int clk_src, int flags, int tp_type)
+{
+    return play(xsp3CallClocksSetup, next(xsp3CallClocksSetup), XSP3_OK);
+}
+
+int xsp3TraceReplay::xsp3Api_close(int path)
+{
+    return play(xsp3CallClose, next(xsp3CallClose), XSP3_OK);
+}
+
+int xsp3TraceReplay::xsp3Api_config(int ncards, int num_tf, char* baseIPaddress, int basePort, char* baseMACaddress, int nchan, int createmodule, char* modname, int debug, int card_index)
+{
+    long index = next(xsp3CallConfig);
+
+    anchor(index);
+    return play(xsp3CallConfig, index, XSP3_ERROR);
+}
+
+int xsp3TraceReplay::xsp3Api_format_run(int path, int chan, int aux1_mode, int res_thres, int aux2_cont, int disables, int aux2_mode, int nbits_eng)
+{
+    return play(xsp3CallFormatRun, next(xsp3CallFormatRun), XSP3_OK);
+}
+
+int xsp3TraceReplay::xsp3Api_getDeadtimeCorrectionParameters(int path, int chan, int *flags, double *processDeadTimeAllEventGradient,
+                                                          double *processDeadTimeAllEventOffset, double *processDeadTimeInWindowOffset, double *processDeadTimeInWindowGradient)
+{
+    int64_t args[] = { path, chan };
+    double values[4];
+    int status;
+
+    status = fetch(xsp3CallGetDeadtimeCorrectionParameters,
+                   match(xsp3CallGetDeadtimeCorrectionParameters, args, XSP3_TRACE_NARGS(args)),
+                   values, sizeof(values), flags, sizeof(int));
+    *processDeadTimeAllEventGradient = values[0];
+    *processDeadTimeAllEventOffset = values[1];
+    *processDeadTimeInWindowOffset = values[2];
+    *processDeadTimeInWindowGradient = values[3];
+    return status;
+}
+
+char* xsp3TraceReplay::xsp3Api_get_error_message()
+{
+    return message;
+}
+
+int xsp3TraceReplay::xsp3Api_get_good_thres(int path, int chan, u_int32_t *good_thres)
+{
+    int64_t args[] = { path, chan };
+
+    return fetch(xsp3CallGetGoodThres, match(xsp3CallGetGoodThres, args, XSP3_TRACE_NARGS(args)),
+                 good_thres, sizeof(u_int32_t));
+}
+
+int xsp3TraceReplay::xsp3Api_get_window(int path, int chan, int win, u_int32_t *low, u_int32_t *high)
+{
+    int64_t args[] = { path, chan, win };
+
+    return fetch(xsp3CallGetWindow, match(xsp3CallGetWindow, args, XSP3_TRACE_NARGS(args)),
+                 low, sizeof(u_int32_t), high, sizeof(u_int32_t));
+}
+
+int xsp3TraceReplay::xsp3Api_hist_dtc_read4d(int path, double *hist_buff, double *scal_buff, unsigned eng, unsigned aux, unsigned chan, unsigned tf,
+                                          unsigned num_eng, unsigned num_aux, unsigned num_chan, unsigned num_tf)
+{
+    int64_t args[] = { path, eng, aux, chan, tf, num_eng, num_aux, num_chan, num_tf };
+
+    return fetch(xsp3CallHistDtcRead4d, match(xsp3CallHistDtcRead4d, args, XSP3_TRACE_NARGS(args)),
+                 hist_buff, (size_t) num_eng*num_aux*num_chan*num_tf*sizeof(double),
+                 scal_buff, (size_t) XSP3_SW_NUM_SCALERS*num_chan*num_tf*sizeof(double));
+}
+
+int xsp3TraceReplay::xsp3Api_histogram_circ_ack(int path, unsigned chan, unsigned tf, unsigned num_chan, unsigned num_tf)
+{
+    int64_t args[] = { path, chan, tf, num_chan, num_tf };
+
+    return play(xsp3CallHistogramCircAck, match(xsp3CallHistogramCircAck, args, XSP3_TRACE_NARGS(args)), XSP3_OK);
+}
+
+int xsp3TraceReplay::xsp3Api_histogram_clear(int path, int first_chan, int num_chan, int first_frame, int num_frames)
+{
+    return play(xsp3CallHistogramClear, next(xsp3CallHistogramClear), XSP3_OK);
+}
+
+int xsp3TraceReplay::xsp3Api_histogram_continue(int path, int card)
+{
+    return play(xsp3CallHistogramContinue, next(xsp3CallHistogramContinue), XSP3_OK);
+}
+
+int xsp3TraceReplay::xsp3Api_histogram_pause(int path, int card)
+{
+    return play(xsp3CallHistogramPause, next(xsp3CallHistogramPause), XSP3_OK);
+}
+
+int xsp3TraceReplay::xsp3Api_histogram_arm(int path, int card)
+{
+    return play(xsp3CallHistogramArm, next(xsp3CallHistogramArm), XSP3_OK);
+}
+
+int xsp3TraceReplay::xsp3Api_histogram_is_any_busy(int path)
+{
+    return play(xsp3CallHistogramIsAnyBusy, poll(xsp3CallHistogramIsAnyBusy), 0);
+}
+
+int xsp3TraceReplay::xsp3Api_histogram_read4d(int path, u_int32_t *buffer, unsigned eng, unsigned aux, unsigned chan, unsigned tf, unsigned num_eng, unsigned num_aux, unsigned num_chan, unsigned num_tf)
+{
+    int64_t args[] = { path, eng, aux, chan, tf, num_eng, num_aux, num_chan, num_tf };
+
+    return fetch(xsp3CallHistogramRead4d, match(xsp3CallHistogramRead4d, args, XSP3_TRACE_NARGS(args)),
+                 buffer, (size_t) num_eng*num_aux*num_chan*num_tf*sizeof(u_int32_t));
+}
+
+int xsp3TraceReplay::xsp3Api_histogram_start(int path, int card)
+{
+    long index = next(xsp3CallHistogramStart);
+
+    // The recorded progress polls are played back relative to the start
+    anchor(index);
+    return play(xsp3CallHistogramStart, index, XSP3_OK);
+}
+
+int xsp3TraceReplay::xsp3Api_histogram_stop(int path, int card)
+{
+    return play(xsp3CallHistogramStop, next(xsp3CallHistogramStop), XSP3_OK);
+}
+
+int xsp3TraceReplay::xsp3Api_restore_settings(int path, char *dir_name, int force_mismatch)
+{
+    return play(xsp3CallRestoreSettings, next(xsp3CallRestoreSettings), XSP3_OK);
+}
+
+int xsp3TraceReplay::xsp3Api_save_settings(int path, char *dir_name)
+{
+    return play(xsp3CallSaveSettings, next(xsp3CallSaveSettings), XSP3_OK);
+}
+
+int xsp3TraceReplay::xsp3Api_scaler_check_progress(int path)
+{
+    return play(xsp3CallScalerCheckProgress, poll(xsp3CallScalerCheckProgress), 0);
+}
+
+int xsp3TraceReplay::xsp3Api_set_glob_timeA(int path, int card, u_int32_t time)
+{
+    return play(xsp3CallSetGlobTimeA, next(xsp3CallSetGlobTimeA), XSP3_OK);
+}
+
+int xsp3TraceReplay::xsp3Api_set_glob_timeFixed(int path, int card, u_int32_t time)
+{
+    return play(xsp3CallSetGlobTimeFixed, next(xsp3CallSetGlobTimeFixed), XSP3_OK);
+}
+
+int xsp3TraceReplay::xsp3Api_set_good_thres(int path, int chan, u_int32_t good_thres)
+{
+    return play(xsp3CallSetGoodThres, next(xsp3CallSetGoodThres), XSP3_OK);
+}
+
+int xsp3TraceReplay::xsp3Api_set_run_flags(int path, int flags)
+{
+    return play(xsp3CallSetRunFlags, next(xsp3CallSetRunFlags), XSP3_OK);
+}
+
+int xsp3TraceReplay::xsp3Api_set_window(int path, int chan, int win, int low, int high)
+{
+    return play(xsp3CallSetWindow, next(xsp3CallSetWindow), XSP3_OK);
+}
+
+int xsp3TraceReplay::xsp3Api_itfg_setup(int path, int card, int num_tf, u_int32_t col_time, int trig_mode, int gap_mode)
+{
+    return play(xsp3CallItfgSetup, next(xsp3CallItfgSetup), XSP3_OK);
+}
+
+int xsp3TraceReplay::xsp3Api_itfg_setup2(int path, int card, int num_tf, u_int32_t col_time, int trig_mode, int gap_mode, int acq_in_pause, int marker_period, int marker_frame)
+{
+    return play(xsp3CallItfgSetup2, next(xsp3CallItfgSetup2), XSP3_OK);
+}
+
+int xsp3TraceReplay::xsp3Api_itfg_start(int path, int card)
+{
+    return play(xsp3CallItfgStart, next(xsp3CallItfgStart), XSP3_OK);
+}
+
+int xsp3TraceReplay::xsp3Api_itfg_stop(int path, int card)
+{
+    return play(xsp3CallItfgStop, next(xsp3CallItfgStop), XSP3_OK);
+}
+
+int xsp3TraceReplay::xsp3Api_has_itfg(int path, int card)
+{
+    int64_t args[] = { path, card };
+
+    return play(xsp3CallHasItfg, match(xsp3CallHasItfg, args, XSP3_TRACE_NARGS(args)), XSP3_ERROR);
+}
+
+int xsp3TraceReplay::xsp3Api_scaler_read(int path, u_int32_t *dest, unsigned scaler, unsigned chan, unsigned t, unsigned n_scalers, unsigned n_chan, unsigned dt)
+{
+    int64_t args[] = { path, scaler, chan, t, n_scalers, n_chan, dt };
+
+    return fetch(xsp3CallScalerRead, match(xsp3CallScalerRead, args, XSP3_TRACE_NARGS(args)),
+                 dest, (size_t) n_scalers*n_chan*dt*sizeof(u_int32_t));
+}
+
+int xsp3TraceReplay::xsp3Api_get_trigger_b(int path, unsigned chan, Xspress3_TriggerB *trig_b)
+{
+    int64_t args[] = { path, chan };
+
+    return fetch(xsp3CallGetTriggerB, match(xsp3CallGetTriggerB, args, XSP3_TRACE_NARGS(args)),
+                 trig_b, sizeof(Xspress3_TriggerB));
+}
+
+int xsp3TraceReplay::xsp3Api_get_dtcfactor(int path, u_int32_t *scaData, double *dtcFactor, double *dtcAllEvent, unsigned chan)
+{
+    int64_t args[] = { path, chan };
+    double values[2];
+    int status;
+
+    status = fetch(xsp3CallGetDtcfactor, match(xsp3CallGetDtcfactor, args, XSP3_TRACE_NARGS(args)),
+                   values, sizeof(values));
+    if (dtcFactor != NULL) *dtcFactor = values[0];
+    if (dtcAllEvent != NULL) *dtcAllEvent = values[1];
+    return status;
+}
+
+int xsp3TraceReplay::xsp3Api_get_generation(int path, int card)
+{
+    int64_t args[] = { path, card };
+
+    return play(xsp3CallGetGeneration, match(xsp3CallGetGeneration, args, XSP3_TRACE_NARGS(args)), XSP3_ERROR);
+}
+
+int xsp3TraceReplay::xsp3Api_histogram_get_tf_markers(int path, int chan, unsigned tf, unsigned num_tf, int *markers)
+{
+    int64_t args[] = { path, chan, tf, num_tf };
+
+    return fetch(xsp3CallHistogramGetTfMarkers, match(xsp3CallHistogramGetTfMarkers, args, XSP3_TRACE_NARGS(args)),
+                 markers, (size_t) num_tf*sizeof(int));
+}
+
+int xsp3TraceReplay::xsp3Api_format_sub_frames(int path, int chan, int just_good, int just_good_thres, int flags, int nbits_eng, int num_sub_frames, int ts_divide)
+{
+    return play(xsp3CallFormatSubFrames, next(xsp3CallFormatSubFrames), XSP3_OK);
+}
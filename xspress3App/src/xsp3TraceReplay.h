@@ -0,0 +1,101 @@
+/*
+ * xsp3TraceReplay.h
+ *
+ * An xsp3Api that plays back a trace recorded by xsp3Api::startTrace, so a
+ * problem seen on a real system can be reproduced without the hardware.
+ *
+ * Calls return what the recorded calls returned. The read calls, and the
+ * calls that return settings, are matched to recorded calls with the same
+ * arguments; the others take the next recorded call of the same kind, and
+ * succeed if there is none. Every call takes as long as it was recorded to
+ * take, divided by the speed. scaler_check_progress and is_any_busy return
+ * what the recorded system reported at the same time after histogram_start,
+ * so frames become available at the recorded rate. With a speed of 0 the
+ * recorded polls are returned in order, as fast as the driver makes them.
+ *
+ * Frame data is only played back if the trace recorded the buffers; if not
+ * the reads succeed or fail as recorded but return zeros.
+ */
+
+#ifndef XSP3TRACEREPLAY_H_
+#define XSP3TRACEREPLAY_H_
+
+#include <stdio.h>
+#include <vector>
+#include "xsp3Api.h"
+#include "xsp3Trace.h"
+
+#define XSP3_TRACE_MESSAGE_LEN 256
+
+class xsp3TraceReplay: public xsp3Api {
+// Construction
+public:
+    xsp3TraceReplay(asynUser * pasynUser);
+    virtual ~xsp3TraceReplay();
+
+    int open(const char *fileName, double speed);
+    const char *getError() { return error.c_str(); }
+    void report(FILE *fp);
+
+protected:
+    virtual int xsp3Api_clocks_setup(int path, int card, int clk_src, int flags, int tp_type);
+    virtual int xsp3Api_close(int path);
+    virtual int xsp3Api_config(int ncards, int num_tf, char* baseIPaddress, int basePort, char* baseMACaddress, int nchan, int createmodule, char* modname, int debug, int card_index);
+    virtual int xsp3Api_format_run(int path, int chan, int aux1_mode, int res_thres, int aux2_cont, int disables, int aux2_mode, int nbits_eng);
+    virtual int xsp3Api_getDeadtimeCorrectionParameters(int path, int chan, int *flags, double *processDeadTimeAllEventGradient,
+                                                     double *processDeadTimeAllEventOffset, double *processDeadTimeInWindowOffset, double *processDeadTimeInWindowGradient);
+    virtual char* xsp3Api_get_error_message();
+    virtual int xsp3Api_get_good_thres(int path, int chan, u_int32_t *good_thres);
+    virtual int xsp3Api_get_window(int path, int chan, int win, u_int32_t *low, u_int32_t *high);
+    virtual int xsp3Api_hist_dtc_read4d(int path, double *hist_buff, double *scal_buff, unsigned eng, unsigned aux, unsigned chan, unsigned tf,
+                                     unsigned num_eng, unsigned num_aux, unsigned num_chan, unsigned num_tf);
+    virtual int xsp3Api_histogram_circ_ack(int path, unsigned chan, unsigned tf, unsigned num_chan, unsigned num_tf);
+    virtual int xsp3Api_histogram_clear(int path, int first_chan, int num_chan, int first_frame, int num_frames);
+    virtual int xsp3Api_histogram_continue(int path, int card);
+    virtual int xsp3Api_histogram_pause(int path, int card);
+    virtual int xsp3Api_histogram_arm(int path, int card);
+    virtual int xsp3Api_histogram_is_any_busy(int path);
+    virtual int xsp3Api_histogram_read4d(int path, u_int32_t *buffer, unsigned eng, unsigned aux, unsigned chan, unsigned tf, unsigned num_eng, unsigned num_aux, unsigned num_chan, unsigned num_tf);
+    virtual int xsp3Api_histogram_start(int path, int card);
+    virtual int xsp3Api_histogram_stop(int path, int card);
+    virtual int xsp3Api_restore_settings(int path, char *dir_name, int force_mismatch);
+    virtual int xsp3Api_save_settings(int path, char *dir_name);
+    virtual int xsp3Api_scaler_check_progress(int path);
+    virtual int xsp3Api_set_glob_timeA(int path, int card, u_int32_t time);
+    virtual int xsp3Api_set_glob_timeFixed(int path, int card, u_int32_t time);
+    virtual int xsp3Api_set_good_thres(int path, int chan, u_int32_t good_thres);
+    virtual int xsp3Api_set_run_flags(int path, int flags);
+    virtual int xsp3Api_set_window(int path, int chan, int win, int low, int high);
+    virtual int xsp3Api_itfg_setup(int path, int card, int num_tf, u_int32_t col_time, int trig_mode, int gap_mode);
+    virtual int xsp3Api_itfg_setup2(int path, int card, int num_tf, u_int32_t col_time, int trig_mode, int gap_mode, int acq_in_pause, int marker_period, int marker_frame);
+    virtual int xsp3Api_itfg_start(int path, int card);
+    virtual int xsp3Api_itfg_stop(int path, int card);
+    virtual int xsp3Api_has_itfg(int path, int card);
+    virtual int xsp3Api_scaler_read(int path, u_int32_t *dest, unsigned scaler, unsigned chan, unsigned t, unsigned n_scalers, unsigned n_chan, unsigned dt);
+    virtual int xsp3Api_get_trigger_b(int path, unsigned chan, Xspress3_TriggerB *trig_b);
+    virtual int xsp3Api_get_dtcfactor(int path, u_int32_t *scaData, double *dtcFactor, double *dtcAllEvent, unsigned chan);
+    virtual int xsp3Api_get_generation(int path, int card);
+    virtual int xsp3Api_histogram_get_tf_markers(int path, int chan, unsigned tf, unsigned num_tf, int *markers);
+    virtual int xsp3Api_format_sub_frames(int path, int chan, int just_good, int just_good_thres, int flags, int nbits_eng, int num_sub_frames, int ts_divide);
+
+private:
+    long match(int call, const int64_t *args, int numArgs);
+    long next(int call);
+    long poll(int call);
+    void anchor(long index);
+    int play(int call, long index, int missing);
+    int fetch(int call, long index, void *output, size_t outputSize, void *output2 = NULL, size_t output2Size = 0);
+
+    xsp3TraceReader reader;
+    std::vector<size_t> calls[xsp3CallNum];     // Records of each call, as indexes into reader
+    size_t cursor[xsp3CallNum];                 // Next record of each call to play back
+    unsigned long played[xsp3CallNum];
+    unsigned long missed[xsp3CallNum];
+    double speed;
+    double origin;                              // Monotonic time that trace time 0 is played at
+    char message[XSP3_TRACE_MESSAGE_LEN];
+    std::string error;
+    epicsMutex mutex;
+};
+
+#endif /* XSP3TRACEREPLAY_H_ */
@@ -74,6 +74,17 @@ const int INTERRUPT_MASK = asynInt32Mask | asynInt32ArrayMask | asynFloat64Mask
 
 //C Function prototypes to tie in with EPICS
 static void xsp3DataTaskC(void *drvPvt);
+static void xsp3ConnectTaskC(void *drvPvt);
+static void xsp3ReconnectTaskC(void *drvPvt);
+static void xsp3EraseTaskC(void *drvPvt);
+
+/* How often the link is checked while idle, and the range of delays between reconnect attempts, in seconds */
+#define XSP3_RECONNECT_POLL 5.0
+#define XSP3_RECONNECT_MIN_DELAY 1.0
+#define XSP3_RECONNECT_MAX_DELAY 60.0
+
+/* Most frames whose markers are read in one call in fly scan mode */
+#define XSP3_MARKER_READ_MAX 1024
 
 /**
  * Constructor for Xspress3::Xspress3.
@@ -92,7 +103,7 @@ static void xsp3DataTaskC(void *drvPvt);
  */
 Xspress3::Xspress3(const char *portName, int numChannels, int numCards, const char *baseIP, int maxFrames, int maxDriverFrames, int maxSpectra, int maxBuffers, size_t maxMemory, int debug, int simTest, int circBuffer)
   : ADDriver(portName,
-	     numChannels, /* maxAddr - channels use different param lists*/
+	     numChannels+2, /* maxAddr - channels use different param lists, then the live maps and the aligned sum */
 	     NUM_DRIVER_PARAMS,
 	     maxBuffers,
 	     maxMemory,
@@ -122,9 +133,58 @@ Xspress3::Xspress3(const char *portName, int numChannels, int numCards, const ch
     asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s epicsEventCreate failure for start event.\n", functionName);
     return;
   }
+  eraseStartEvent_ = epicsEventMustCreate(epicsEventEmpty);
+  eraseDoneEvent_ = epicsEventMustCreate(epicsEventEmpty);
   this->createInitialParameters();
   //Initialize non static, non const, data members
   xsp3_handle_ = 0;
+  restoreValid_ = false;
+  restoreFingerprint_ = 0;
+  linkLost_ = false;
+  reconnectDelay_ = XSP3_RECONNECT_MIN_DELAY;
+  reconnecting_ = false;
+  eraseActive_ = false;
+  eraseCancel_ = false;
+  eraseAcquiring_ = false;
+  eraseFailed_ = false;
+  itfgValid_ = false;
+  itfgFingerprint_ = 0;
+  acqStartTime_ = 0.0;
+  seqActive_ = false;
+  seqRestore_ = false;
+  seqPrepared_ = false;
+  seqLength_ = 0;
+  seqIndex_ = 0;
+  seqFrameOffset_ = 0;
+  markersFirst_ = 0;
+  markersEnd_ = 0;
+  flyScan_ = false;
+  mapColumns_ = 1;
+  mapSnake_ = 0;
+  mapRowMarker_ = -1;
+  mapRow_ = 0;
+  mapIndex_ = 0;
+  mapColumn_ = 0;
+  subFrames_ = 1;
+  subFrameBits_ = 10;
+  subFrameDivide_ = 0;
+  sparse_ = xsp3SparseNone;
+  compressFailures_ = 0;
+  h5Enable_ = false;
+  h5ChunkFrames_ = 64;
+  h5Swmr_ = 1;
+  shmEnable_ = false;
+  shmSlots_ = 64;
+  memset(&shmFrame_, 0, sizeof(shmFrame_));
+  streamAcquisition_ = 0;
+  roiChanged_ = true;
+  roiEnable_ = false;
+  liveMapRows_ = 0;
+  liveMapPeriod_ = 1.0;
+  liveMapChanged_ = false;
+  memset(&liveMapPublished_, 0, sizeof(liveMapPublished_));
+  alignChanged_ = true;
+  alignEnable_ = false;
   bool paramStatus = this->setInitialParameters(maxFrames, maxDriverFrames, numCards, maxSpectra);
   paramStatus = ((eraseSCAMCAROI() == asynSuccess) && paramStatus);
   //Create the thread that readouts the data
@@ -147,6 +207,24 @@ Xspress3::Xspress3(const char *portName, int numChannels, int numCards, const ch
     xsp3 = new xsp3Detector(this->pasynUserSelf);
   }
 
+  //Create the thread that watches for the link to the system being lost
+  if (epicsThreadCreate("Xsp3Reconnect",
+                        epicsThreadPriorityLow,
+                        epicsThreadGetStackSize(epicsThreadStackMedium),
+                        (EPICSTHREADFUNC)xsp3ReconnectTaskC,
+                        this) == NULL) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s epicsThreadCreate failure for reconnect task.\n", functionName);
+  }
+
+  //Create the thread that clears frames ahead of an acquisition
+  if (epicsThreadCreate("Xsp3Erase",
+                        epicsThreadPriorityMedium,
+                        epicsThreadGetStackSize(epicsThreadStackMedium),
+                        (EPICSTHREADFUNC)xsp3EraseTaskC,
+                        this) == NULL) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s epicsThreadCreate failure for erase task.\n", functionName);
+  }
+
   callParamCallbacks();
 
   if (!paramStatus) {
@@ -166,7 +244,7 @@ Xspress3::Xspress3(const char *portName, int numChannels, int numCards, const ch
  * @param numChannels The number of channels to simulate.
  *
  */
-Xspress3::Xspress3(const char *portName, int numChannels) : ADDriver(portName, numChannels, NUM_DRIVER_PARAMS, -1, -1, INTERFACE_MASK, INTERRUPT_MASK, ASYN_CANBLOCK | ASYN_MULTIDEVICE, 1, 0, 0), debug_(1), numChannels_(numChannels), simTest_(1), baseIP_("127.0.0.1"), circBuffer_(0)
+Xspress3::Xspress3(const char *portName, int numChannels) : ADDriver(portName, numChannels+2, NUM_DRIVER_PARAMS, -1, -1, INTERFACE_MASK, INTERRUPT_MASK, ASYN_CANBLOCK | ASYN_MULTIDEVICE, 1, 0, 0), debug_(1), numChannels_(numChannels), simTest_(1), baseIP_("127.0.0.1"), circBuffer_(0)
 {
     const char *functionName = "Xspress3::Xspress3";
     const int maxFrames = 1000;
@@ -178,6 +256,53 @@ Xspress3::Xspress3(const char *portName, int numChannels) : ADDriver(portName, n
     this->createInitialParameters();
     //Initialize non static, non const, data members
     xsp3_handle_ = 0;
+    restoreValid_ = false;
+    restoreFingerprint_ = 0;
+    linkLost_ = false;
+    reconnectDelay_ = XSP3_RECONNECT_MIN_DELAY;
+    reconnecting_ = false;
+    eraseActive_ = false;
+    eraseCancel_ = false;
+    eraseAcquiring_ = false;
+    eraseFailed_ = false;
+    itfgValid_ = false;
+    itfgFingerprint_ = 0;
+    acqStartTime_ = 0.0;
+    seqActive_ = false;
+    seqRestore_ = false;
+    seqPrepared_ = false;
+    seqLength_ = 0;
+    seqIndex_ = 0;
+    seqFrameOffset_ = 0;
+    markersFirst_ = 0;
+    markersEnd_ = 0;
+    flyScan_ = false;
+    mapColumns_ = 1;
+    mapSnake_ = 0;
+    mapRowMarker_ = -1;
+    mapRow_ = 0;
+    mapIndex_ = 0;
+    mapColumn_ = 0;
+    subFrames_ = 1;
+    subFrameBits_ = 10;
+    subFrameDivide_ = 0;
+    sparse_ = xsp3SparseNone;
+    compressFailures_ = 0;
+    h5Enable_ = false;
+    h5ChunkFrames_ = 64;
+    h5Swmr_ = 1;
+    shmEnable_ = false;
+    shmSlots_ = 64;
+    memset(&shmFrame_, 0, sizeof(shmFrame_));
+    streamAcquisition_ = 0;
+    roiChanged_ = true;
+    roiEnable_ = false;
+    liveMapRows_ = 0;
+    liveMapPeriod_ = 1.0;
+    liveMapChanged_ = false;
+    memset(&liveMapPublished_, 0, sizeof(liveMapPublished_));
+    alignChanged_ = true;
+    alignEnable_ = false;
     bool paramStatus = this->setInitialParameters(maxFrames, maxDriverFrames, numCards, maxSpectra);
     paramStatus = ((eraseSCAMCAROI() == asynSuccess) && paramStatus);
     if (simTest) {
@@ -264,6 +389,105 @@ void Xspress3::createInitialParameters()
     createParam(xsp3EventWidthParamString, asynParamFloat64, &xsp3EventWidthParam);
     createParam(xsp3ChanDTPercentParamString, asynParamFloat64, &xsp3ChanDTPercentParam);
     createParam(xsp3ChanDTFactorParamString, asynParamFloat64, &xsp3ChanDTFactorParam);
+    createParam(xsp3ApiStatsParamString, asynParamInt32, &xsp3ApiStatsParam);
+    createParam(xsp3ApiStatsResetParamString, asynParamInt32, &xsp3ApiStatsResetParam);
+    createParam(xsp3ApiStatsUpdateParamString, asynParamInt32, &xsp3ApiStatsUpdateParam);
+    createParam(xsp3ApiCallsParamString, asynParamInt32, &xsp3ApiCallsParam);
+    createParam(xsp3ApiTimeParamString, asynParamFloat64, &xsp3ApiTimeParam);
+    createParam(xsp3ApiReadTimeParamString, asynParamFloat64, &xsp3ApiReadTimeParam);
+    createParam(xsp3ApiReadMaxParamString, asynParamFloat64, &xsp3ApiReadMaxParam);
+    createParam(xsp3ApiSlowestParamString, asynParamOctet, &xsp3ApiSlowestParam);
+    createParam(xsp3ConnectThreadsParamString, asynParamInt32, &xsp3ConnectThreadsParam);
+    createParam(xsp3ConnectTimeParamString, asynParamFloat64, &xsp3ConnectTimeParam);
+    createParam(xsp3ConnectConfigTimeParamString, asynParamFloat64, &xsp3ConnectConfigTimeParam);
+    createParam(xsp3ConnectClocksTimeParamString, asynParamFloat64, &xsp3ConnectClocksTimeParam);
+    createParam(xsp3ConnectRestoreTimeParamString, asynParamFloat64, &xsp3ConnectRestoreTimeParam);
+    createParam(xsp3ConnectSetupTimeParamString, asynParamFloat64, &xsp3ConnectSetupTimeParam);
+    createParam(xsp3ConnectReadbackTimeParamString, asynParamFloat64, &xsp3ConnectReadbackTimeParam);
+    createParam(xsp3FastRestoreParamString, asynParamInt32, &xsp3FastRestoreParam);
+    createParam(xsp3RestoreSkippedParamString, asynParamInt32, &xsp3RestoreSkippedParam);
+    createParam(xsp3AutoReconnectParamString, asynParamInt32, &xsp3AutoReconnectParam);
+    createParam(xsp3ReconnectParamString, asynParamInt32, &xsp3ReconnectParam);
+    createParam(xsp3ReconnectTimeParamString, asynParamFloat64, &xsp3ReconnectTimeParam);
+    createParam(xsp3ReconnectCountParamString, asynParamInt32, &xsp3ReconnectCountParam);
+    createParam(xsp3ReconnectDelayParamString, asynParamFloat64, &xsp3ReconnectDelayParam);
+    createParam(xsp3EraseChunkParamString, asynParamInt32, &xsp3EraseChunkParam);
+    createParam(xsp3EraseTimeParamString, asynParamFloat64, &xsp3EraseTimeParam);
+    createParam(xsp3StartTimeParamString, asynParamFloat64, &xsp3StartTimeParam);
+    createParam(xsp3EraseOvertakenParamString, asynParamInt32, &xsp3EraseOvertakenParam);
+    createParam(xsp3StepScanParamString, asynParamInt32, &xsp3StepScanParam);
+    createParam(xsp3PointTimeParamString, asynParamFloat64, &xsp3PointTimeParam);
+    createParam(xsp3PointOverheadParamString, asynParamFloat64, &xsp3PointOverheadParam);
+    createParam(xsp3SeqAcquireTimeParamString, asynParamFloat64Array, &xsp3SeqAcquireTimeParam);
+    createParam(xsp3SeqNumImagesParamString, asynParamInt32Array, &xsp3SeqNumImagesParam);
+    createParam(xsp3SeqLengthParamString, asynParamInt32, &xsp3SeqLengthParam);
+    createParam(xsp3SeqEntryParamString, asynParamInt32, &xsp3SeqEntryParam);
+    createParam(xsp3FlyScanParamString, asynParamInt32, &xsp3FlyScanParam);
+    createParam(xsp3MapColumnsParamString, asynParamInt32, &xsp3MapColumnsParam);
+    createParam(xsp3MapRowsParamString, asynParamInt32, &xsp3MapRowsParam);
+    createParam(xsp3MapSnakeParamString, asynParamInt32, &xsp3MapSnakeParam);
+    createParam(xsp3MapRowMarkerParamString, asynParamInt32, &xsp3MapRowMarkerParam);
+    createParam(xsp3MapRowParamString, asynParamInt32, &xsp3MapRowParam);
+    createParam(xsp3MapColumnParamString, asynParamInt32, &xsp3MapColumnParam);
+    createParam(xsp3SubFramesParamString, asynParamInt32, &xsp3SubFramesParam);
+    createParam(xsp3SubFrameBitsParamString, asynParamInt32, &xsp3SubFrameBitsParam);
+    createParam(xsp3SubFrameDivideParamString, asynParamInt32, &xsp3SubFrameDivideParam);
+    createParam(xsp3SparseParamString, asynParamInt32, &xsp3SparseParam);
+    createParam(xsp3SparseRatioParamString, asynParamFloat64, &xsp3SparseRatioParam);
+    createParam(xsp3CompressParamString, asynParamInt32, &xsp3CompressParam);
+    createParam(xsp3CompressLevelParamString, asynParamInt32, &xsp3CompressLevelParam);
+    createParam(xsp3CompressShuffleParamString, asynParamInt32, &xsp3CompressShuffleParam);
+    createParam(xsp3CompressThreadsParamString, asynParamInt32, &xsp3CompressThreadsParam);
+    createParam(xsp3CompressRatioParamString, asynParamFloat64, &xsp3CompressRatioParam);
+    createParam(xsp3CompressTimeParamString, asynParamFloat64, &xsp3CompressTimeParam);
+    createParam(xsp3CompressFailuresParamString, asynParamInt32, &xsp3CompressFailuresParam);
+    createParam(xsp3H5EnableParamString, asynParamInt32, &xsp3H5EnableParam);
+    createParam(xsp3H5FileNameParamString, asynParamOctet, &xsp3H5FileNameParam);
+    createParam(xsp3H5ChunkFramesParamString, asynParamInt32, &xsp3H5ChunkFramesParam);
+    createParam(xsp3H5SwmrParamString, asynParamInt32, &xsp3H5SwmrParam);
+    createParam(xsp3H5FramesParamString, asynParamInt32, &xsp3H5FramesParam);
+    createParam(xsp3H5MessageParamString, asynParamOctet, &xsp3H5MessageParam);
+    createParam(xsp3ShmEnableParamString, asynParamInt32, &xsp3ShmEnableParam);
+    createParam(xsp3ShmNameParamString, asynParamOctet, &xsp3ShmNameParam);
+    createParam(xsp3ShmSlotsParamString, asynParamInt32, &xsp3ShmSlotsParam);
+    createParam(xsp3ShmFramesParamString, asynParamInt32, &xsp3ShmFramesParam);
+    createParam(xsp3ShmMessageParamString, asynParamOctet, &xsp3ShmMessageParam);
+    createParam(xsp3StreamEnableParamString, asynParamInt32, &xsp3StreamEnableParam);
+    createParam(xsp3StreamPortParamString, asynParamInt32, &xsp3StreamPortParam);
+    createParam(xsp3StreamCompressParamString, asynParamInt32, &xsp3StreamCompressParam);
+    createParam(xsp3StreamQueueParamString, asynParamInt32, &xsp3StreamQueueParam);
+    createParam(xsp3StreamPolicyParamString, asynParamInt32, &xsp3StreamPolicyParam);
+    createParam(xsp3StreamClientsParamString, asynParamInt32, &xsp3StreamClientsParam);
+    createParam(xsp3StreamFramesParamString, asynParamInt32, &xsp3StreamFramesParam);
+    createParam(xsp3StreamDroppedParamString, asynParamInt32, &xsp3StreamDroppedParam);
+    createParam(xsp3StreamMessageParamString, asynParamOctet, &xsp3StreamMessageParam);
+    createParam(xsp3ChanCalOffsetParamString, asynParamFloat64, &xsp3ChanCalOffsetParam);
+    createParam(xsp3ChanCalGainParamString, asynParamFloat64, &xsp3ChanCalGainParam);
+    createParam(xsp3ChanCalQuadParamString, asynParamFloat64, &xsp3ChanCalQuadParam);
+    createParam(xsp3RoiMessageParamString, asynParamOctet, &xsp3RoiMessageParam);
+    createParam(xsp3LiveMapParamString, asynParamInt32, &xsp3LiveMapParam);
+    createParam(xsp3LiveMapPeriodParamString, asynParamFloat64, &xsp3LiveMapPeriodParam);
+    createParam(xsp3LiveMapCountParamString, asynParamInt32, &xsp3LiveMapCountParam);
+    createParam(xsp3LiveMapMessageParamString, asynParamOctet, &xsp3LiveMapMessageParam);
+    createParam(xsp3AlignParamString, asynParamInt32, &xsp3AlignParam);
+    createParam(xsp3AlignOffsetParamString, asynParamFloat64, &xsp3AlignOffsetParam);
+    createParam(xsp3AlignGainParamString, asynParamFloat64, &xsp3AlignGainParam);
+    createParam(xsp3AlignMessageParamString, asynParamOctet, &xsp3AlignMessageParam);
+    for (int roi=0; roi<XSP3_NUM_ROIS; roi++) {
+      char name[64];
+      epicsSnprintf(name, sizeof(name), xsp3ChanRoiParamString, roi+1);
+      createParam(name, asynParamFloat64, &xsp3ChanRoiParam[roi]);
+      epicsSnprintf(name, sizeof(name), xsp3ChanRoiLlmParamString, roi+1);
+      createParam(name, asynParamInt32, &xsp3ChanRoiLlmParam[roi]);
+      epicsSnprintf(name, sizeof(name), xsp3ChanRoiHlmParamString, roi+1);
+      createParam(name, asynParamInt32, &xsp3ChanRoiHlmParam[roi]);
+      epicsSnprintf(name, sizeof(name), xsp3RoiNameParamString, roi+1);
+      createParam(name, asynParamOctet, &xsp3RoiNameParam[roi]);
+      epicsSnprintf(name, sizeof(name), xsp3RoiLowEnergyParamString, roi+1);
+      createParam(name, asynParamFloat64, &xsp3RoiLowEnergyParam[roi]);
+      epicsSnprintf(name, sizeof(name), xsp3RoiHighEnergyParamString, roi+1);
+      createParam(name, asynParamFloat64, &xsp3RoiHighEnergyParam[roi]);
+    }
     createParam(xsp3LastParamString, asynParamInt32, &xsp3LastParam);
 }
 
@@ -309,6 +533,89 @@ bool Xspress3::setInitialParameters(int maxFrames, int maxDriverFrames, int numC
     paramStatus = ((setIntegerParam(xsp3PulsePerTriggerParam, 0) == asynSuccess) && paramStatus);
     paramStatus = ((setIntegerParam(xsp3ITFGStartParam, 0) == asynSuccess) && paramStatus);
     paramStatus = ((setIntegerParam(xsp3ITFGStopParam, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3ApiStatsParam, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3ApiCallsParam, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(xsp3ApiTimeParam, 0.0) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(xsp3ApiReadTimeParam, 0.0) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(xsp3ApiReadMaxParam, 0.0) == asynSuccess) && paramStatus);
+    paramStatus = ((setStringParam(xsp3ApiSlowestParam, "") == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3ConnectThreadsParam, 1) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(xsp3ConnectTimeParam, 0.0) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(xsp3ConnectConfigTimeParam, 0.0) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(xsp3ConnectClocksTimeParam, 0.0) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(xsp3ConnectRestoreTimeParam, 0.0) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(xsp3ConnectSetupTimeParam, 0.0) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(xsp3ConnectReadbackTimeParam, 0.0) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3FastRestoreParam, 1) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3RestoreSkippedParam, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3AutoReconnectParam, 1) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3ReconnectParam, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(xsp3ReconnectTimeParam, 0.0) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3ReconnectCountParam, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(xsp3ReconnectDelayParam, 0.0) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3EraseChunkParam, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(xsp3EraseTimeParam, 0.0) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(xsp3StartTimeParam, 0.0) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3EraseOvertakenParam, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3StepScanParam, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(xsp3PointTimeParam, 0.0) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(xsp3PointOverheadParam, 0.0) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3SeqLengthParam, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3SeqEntryParam, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3FlyScanParam, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3MapColumnsParam, 1) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3MapRowsParam, 1) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3MapSnakeParam, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3MapRowMarkerParam, -1) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3MapRowParam, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3MapColumnParam, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3SubFramesParam, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3SubFrameBitsParam, 10) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3SubFrameDivideParam, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3SparseParam, xsp3SparseNone) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(xsp3SparseRatioParam, 1.0) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3CompressParam, xsp3CompressNone) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3CompressLevelParam, 5) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3CompressShuffleParam, 1) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3CompressThreadsParam, 4) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(xsp3CompressRatioParam, 1.0) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(xsp3CompressTimeParam, 0.0) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3CompressFailuresParam, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3H5EnableParam, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setStringParam(xsp3H5FileNameParam, "") == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3H5ChunkFramesParam, 64) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3H5SwmrParam, 1) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3H5FramesParam, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setStringParam(xsp3H5MessageParam, "") == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3ShmEnableParam, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setStringParam(xsp3ShmNameParam, "/xspress3") == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3ShmSlotsParam, 64) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3ShmFramesParam, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setStringParam(xsp3ShmMessageParam, "") == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3StreamEnableParam, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3StreamPortParam, 9999) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3StreamCompressParam, xsp3CompressNone) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3StreamQueueParam, 16) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3StreamPolicyParam, xsp3StreamDropOldest) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3StreamClientsParam, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3StreamFramesParam, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3StreamDroppedParam, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setStringParam(xsp3StreamMessageParam, "") == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3RoiEnableParam, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setStringParam(xsp3RoiMessageParam, "") == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3LiveMapParam, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(xsp3LiveMapPeriodParam, 1.0) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3LiveMapCountParam, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setStringParam(xsp3LiveMapMessageParam, "") == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(xsp3AlignParam, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(xsp3AlignOffsetParam, 0.0) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(xsp3AlignGainParam, 0.01) == asynSuccess) && paramStatus);
+    paramStatus = ((setStringParam(xsp3AlignMessageParam, "") == asynSuccess) && paramStatus);
+    for (int roi=0; roi<XSP3_NUM_ROIS; roi++) {
+        paramStatus = ((setStringParam(xsp3RoiNameParam[roi], "") == asynSuccess) && paramStatus);
+        paramStatus = ((setDoubleParam(xsp3RoiLowEnergyParam[roi], 0.0) == asynSuccess) && paramStatus);
+        paramStatus = ((setDoubleParam(xsp3RoiHighEnergyParam[roi], 0.0) == asynSuccess) && paramStatus);
+    }
 
     for (int chan=0; chan<numChannels_; chan++) {
         paramStatus = ((setIntegerParam(chan, xsp3ChanSca4ThresholdParam, 0) == asynSuccess) && paramStatus);
@@ -324,6 +631,13 @@ bool Xspress3::setInitialParameters(int maxFrames, int maxDriverFrames, int numC
         paramStatus = ((setDoubleParam(chan, xsp3EventWidthParam, 5.0) == asynSuccess) && paramStatus);
         paramStatus = ((setDoubleParam(chan, xsp3ChanDTPercentParam, 0.0) == asynSuccess) && paramStatus);
         paramStatus = ((setDoubleParam(chan, xsp3ChanDTFactorParam, 1.0) == asynSuccess) && paramStatus);
+        paramStatus = ((setDoubleParam(chan, xsp3ChanCalOffsetParam, 0.0) == asynSuccess) && paramStatus);
+        paramStatus = ((setDoubleParam(chan, xsp3ChanCalGainParam, 0.01) == asynSuccess) && paramStatus);
+        paramStatus = ((setDoubleParam(chan, xsp3ChanCalQuadParam, 0.0) == asynSuccess) && paramStatus);
+        for (int roi=0; roi<XSP3_NUM_ROIS; roi++) {
+            paramStatus = ((setIntegerParam(chan, xsp3ChanRoiLlmParam[roi], 0) == asynSuccess) && paramStatus);
+            paramStatus = ((setIntegerParam(chan, xsp3ChanRoiHlmParam[roi], 0) == asynSuccess) && paramStatus);
+        }
     }
     return paramStatus;
 }
@@ -340,11 +654,35 @@ Xspress3::~Xspress3()
 }
 
 
+/**
+ * Open the connections to the xspress3 system with xsp3_config(). This can
+ * block for a long time when the system cannot be reached, so with
+ * unlockConfig set the port lock is released around it; connecting and
+ * reconnecting are refused meanwhile.
+ * @return The handle, or the error from xsp3_config()
+ */
+int Xspress3::configSystem(int numCards, int numFrames, int numChannels, bool unlockConfig)
+{
+  int handle;
+
+  if (unlockConfig) {
+    reconnecting_ = true;
+    this->unlock();
+  }
+  handle = xsp3->config(numCards, numFrames, const_cast<char *>(baseIP_.c_str()), -1, NULL, numChannels, 1, NULL, debug_, 0);
+  if (unlockConfig) {
+    this->lock();
+    reconnecting_ = false;
+  }
+  return handle;
+}
+
 /**
  * Function to connect to the Xspress3 by calling xsp3_config and
  * some other setup functions.
+ * @param unlockConfig Release the port lock around xsp3_config()
  */
-asynStatus Xspress3::connect(void)
+asynStatus Xspress3::connect(bool unlockConfig)
 {
   asynStatus status = asynSuccess;
   int xsp3_num_cards = 0;
@@ -354,6 +692,8 @@ asynStatus Xspress3::connect(void)
   int xsp3_erasestart = 1;
   char configPath[maxStringSize_] = {0};
   char configSavePath[maxStringSize_] = {0};
+  double startTime = xsp3ApiStats::now();
+  double phaseTime;
   const char *functionName = "Xspress3::connect";
 
   getIntegerParam(xsp3NumCardsParam, &xsp3_num_cards);
@@ -372,7 +712,7 @@ asynStatus Xspress3::connect(void)
   asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s Config path is: %s\n", functionName, configPath);
   asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s Config save path is: %s\n", functionName, configSavePath);
 
-  xsp3_handle_ = xsp3->config(xsp3_num_cards, xsp3_num_tf, const_cast<char *>(baseIP_.c_str()), -1, NULL, xsp3_num_channels, 1, NULL, debug_, 0);
+  xsp3_handle_ = configSystem(xsp3_num_cards, xsp3_num_tf, xsp3_num_channels, unlockConfig);
   if (xsp3_handle_ < 0) {
     checkStatus(xsp3_handle_, "xsp3_config", functionName);
     status = asynError;
@@ -380,11 +720,15 @@ asynStatus Xspress3::connect(void)
     setIntegerParam(xsp3ConnectedParam, 1);
 
     int generation = xsp3->get_generation(xsp3_handle_, 0);
+    phaseTime = xsp3ApiStats::now();
+    setDoubleParam(xsp3ConnectConfigTimeParam, phaseTime - startTime);
 
     //Set up clocks on each card
-    for (int i=0; i<xsp3_num_cards && status == asynSuccess; i++) {
-      xsp3_status = xsp3->clocks_setup(xsp3_handle_, i, generation == 3 ? XSP3M_CLK_SRC_LMK61E2 : (generation == 2 ? XSP3M_CLK_SRC_CDCM61004 : XSP3_CLK_SRC_XTAL),
-                                      XSP3_CLK_FLAGS_MASTER | XSP3_CLK_FLAGS_NO_DITHER, 0);
+    clockSource_ = generation == 3 ? XSP3M_CLK_SRC_LMK61E2 : (generation == 2 ? XSP3M_CLK_SRC_CDCM61004 : XSP3_CLK_SRC_XTAL);
+    clockStatus_.assign(xsp3_num_cards, XSP3_OK);
+    runConnectPhase(xsp3ConnectClocks, xsp3_num_cards);
+    for (int i=0; i<xsp3_num_cards; i++) {
+      xsp3_status = clockStatus_[i];
       if (xsp3_status < 0) {
 	      checkStatus(xsp3_status, "xsp3_clocks_setup", functionName);
 	      status = asynError;
@@ -392,6 +736,7 @@ asynStatus Xspress3::connect(void)
 
       printf("xsp3_clocks_setup: Measured frequency %.2f MHz\n", float(xsp3_status)/1.0e6);
     }
+    setDoubleParam(xsp3ConnectClocksTimeParam, xsp3ApiStats::now() - phaseTime);
 
     // Limit frames for Mini > 1 channel
     if (generation == 2 && numChannels_ > 1) {
@@ -411,7 +756,17 @@ asynStatus Xspress3::connect(void)
         status = restoreSettings();
 
     //Set completion status
+    setDoubleParam(xsp3ConnectTimeParam, xsp3ApiStats::now() - startTime);
     if (status == asynSuccess) {
+        double config, clocks, restore, setup, readback, total;
+        getDoubleParam(xsp3ConnectConfigTimeParam, &config);
+        getDoubleParam(xsp3ConnectClocksTimeParam, &clocks);
+        getDoubleParam(xsp3ConnectRestoreTimeParam, &restore);
+        getDoubleParam(xsp3ConnectSetupTimeParam, &setup);
+        getDoubleParam(xsp3ConnectReadbackTimeParam, &readback);
+        getDoubleParam(xsp3ConnectTimeParam, &total);
+        printf("Xspress3 connect: config %.3f s, clocks %.3f s, restore %.3f s, setup %.3f s, readback %.3f s, total %.3f s\n",
+               config, clocks, restore, setup, readback, total);
         asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s Finished setting up Xspress3.\n", functionName);
         setStringParam(ADStatusMessage, "System Connected");
         setIntegerParam(ADStatus, ADStatusIdle);
@@ -428,141 +783,250 @@ asynStatus Xspress3::connect(void)
 }
 
 /**
- * Read the SCA window limits (for SCA 5 and 6) and threshold for SCA 4, for each channel.
+ * Run one phase of connect or restoreSettings over every card or channel.
+ * With more than one connect thread the cards or channels are split into
+ * ranges, each run on its own thread, as the calls for different cards and
+ * channels are independent. The results are left in clockStatus_ and
+ * chanConnect_ for the caller to check.
+ * @param phase The xsp3ConnectPhase
+ * @param count The number of cards (for xsp3ConnectClocks) or channels
  */
-asynStatus Xspress3::readSCAParams(void)
+void Xspress3::runConnectPhase(int phase, int count)
 {
-  asynStatus status = asynSuccess;
-  int xsp3_num_channels = 0;
-  int xsp3_status = 0;
-  u_int32_t xsp3_sca_param1 = 0;
-  u_int32_t xsp3_sca_param2 = 0;
-  const char *functionName = "Xspress3::readSCAParams";
+  int threads = 1;
+  const char *functionName = "Xspress3::runConnectPhase";
 
-  getIntegerParam(xsp3NumChannelsParam, &xsp3_num_channels);
+  getIntegerParam(xsp3ConnectThreadsParam, &threads);
+  if (threads > count) {
+    threads = count;
+  }
+  if (threads <= 1) {
+    xsp3ConnectWork_t work = { this, phase, 0, count, NULL };
+    connectWork(&work);
+    return;
+  }
 
-  for (int chan=0; chan<xsp3_num_channels; chan++) {
-    //SCA 5 window limits
-    xsp3_status = xsp3->get_window(xsp3_handle_, chan, 0, &xsp3_sca_param1, &xsp3_sca_param2);
-    if (xsp3_status < XSP3_OK) {
-      checkStatus(xsp3_status, "xsp3_get_window", functionName);
-      status = asynError;
-    } else {
-      asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s Channel %d, Read back SCA5 window limits: %d, %d\n",
-		functionName, chan, xsp3_sca_param1, xsp3_sca_param2);
-      setIntegerParam(chan, xsp3ChanSca5LlmParam, xsp3_sca_param1);
-      setIntegerParam(chan, xsp3ChanSca5HlmParam, xsp3_sca_param2);
-    }
-    //SCA 6 window limits
-    xsp3_status = xsp3->get_window(xsp3_handle_, chan, 1, &xsp3_sca_param1, &xsp3_sca_param2);
-    if (xsp3_status < XSP3_OK) {
-      checkStatus(xsp3_status, "xsp3_get_window", functionName);
-      status = asynError;
-    } else {
-      setIntegerParam(chan, xsp3ChanSca6LlmParam, xsp3_sca_param1);
-      setIntegerParam(chan, xsp3ChanSca6HlmParam, xsp3_sca_param2);
-      asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s Channel %d, Read back SCA6 window limits: %d, %d\n",
-		functionName, chan, xsp3_sca_param1, xsp3_sca_param2);
+  std::vector<xsp3ConnectWork_t> work(threads);
+  for (int i=0; i<threads; i++) {
+    work[i].pXsp3 = this;
+    work[i].phase = phase;
+    work[i].first = (count * i) / threads;
+    work[i].end = (count * (i+1)) / threads;
+    work[i].done = epicsEventMustCreate(epicsEventEmpty);
+    if (epicsThreadCreate("Xsp3Connect",
+                          epicsThreadPriorityMedium,
+                          epicsThreadGetStackSize(epicsThreadStackMedium),
+                          (EPICSTHREADFUNC)xsp3ConnectTaskC,
+                          &work[i]) == NULL) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s epicsThreadCreate failure, running in this thread.\n", functionName);
+      connectWork(&work[i]);
+      epicsEventSignal(work[i].done);
     }
-    //SCA 4 threshold limit
-    xsp3_status = xsp3->get_good_thres(xsp3_handle_, chan, &xsp3_sca_param1);
-    if (xsp3_status < XSP3_OK) {
-      checkStatus(xsp3_status, "xsp3_get_good_thres", functionName);
-      status = asynError;
-    } else {
-      setIntegerParam(chan, xsp3ChanSca4ThresholdParam, xsp3_sca_param1);
-      asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s Channel %d, Read back SCA4 threshold limit: %d\n",
-		functionName, chan, xsp3_sca_param1);
+  }
+  for (int i=0; i<threads; i++) {
+    epicsEventMustWait(work[i].done);
+    epicsEventDestroy(work[i].done);
+  }
+}
+
+/**
+ * Make the calls of one connect phase for a range of cards or channels.
+ * This runs without the driver lock, so it only uses the Xspress3 API and
+ * its own entries of clockStatus_ and chanConnect_.
+ */
+void Xspress3::connectWork(xsp3ConnectWork_t *work)
+{
+  for (int i=work->first; i<work->end; i++) {
+    if (work->phase == xsp3ConnectClocks) {
+      clockStatus_[i] = xsp3->clocks_setup(xsp3_handle_, i, clockSource_, XSP3_CLK_FLAGS_MASTER | XSP3_CLK_FLAGS_NO_DITHER, 0);
+      continue;
     }
 
-    callParamCallbacks(chan);
+    xsp3ChanConnect_t &chan = chanConnect_[i];
+    switch (work->phase) {
+    case xsp3ConnectFormat:
+      if (subFrames_ > 1) {
+        chan.formatStatus = xsp3->format_sub_frames(xsp3_handle_, i, 0, 0, 0, subFrameBits_, subFrames_, subFrameDivide_);
+      } else {
+        chan.formatStatus = xsp3->format_run(xsp3_handle_, i, 0, 0, 0, 0, 0, 12);
+      }
+      break;
+    case xsp3ConnectWindows:
+      for (int sca=0; sca<2; sca++) {
+        chan.windowStatus[sca] = xsp3->set_window(xsp3_handle_, i, sca, chan.windowLlm[sca], chan.windowHlm[sca]);
+      }
+      break;
+    case xsp3ConnectReadback:
+      for (int sca=0; sca<2; sca++) {
+        chan.scaStatus[sca] = xsp3->get_window(xsp3_handle_, i, sca, &chan.scaLlm[sca], &chan.scaHlm[sca]);
+      }
+      chan.thresholdStatus = xsp3->get_good_thres(xsp3_handle_, i, &chan.sca4Threshold);
+      chan.dtcStatus = xsp3->getDeadtimeCorrectionParameters(xsp3_handle_, i, &chan.dtcFlags,
+                                                             &chan.dtcAeg, &chan.dtcAeo, &chan.dtcIwo, &chan.dtcIwg);
+      chan.trigBStatus = xsp3->get_trigger_b(xsp3_handle_, i, &chan.trigB);
+      break;
+    }
   }
-
-  return status;
 }
 
 /**
- * Read the dead time correction (DTC) parameters for each channel.
+ * Write the SCA 5 and 6 window limits of every channel, as setWindow does
+ * for one channel.
  */
-asynStatus Xspress3::readDTCParams(void)
+asynStatus Xspress3::writeChannelWindows(int numChannels)
 {
   asynStatus status = asynSuccess;
-  int xsp3_num_channels = 0;
-  int xsp3_status = 0;
-  int xsp3_dtc_flags = 0;
-  double xsp3_dtc_all_event_grad = 0.0;
-  double xsp3_dtc_all_event_off = 0.0;
-  double xsp3_dtc_in_window_grad = 0.0;
-  double xsp3_dtc_in_window_off = 0.0;
-  const char *functionName = "Xspress3::readDTCParams";
+  const char *functionName = "Xspress3::writeChannelWindows";
 
-  getIntegerParam(xsp3NumChannelsParam, &xsp3_num_channels);
+  if ((status = checkConnected()) != asynSuccess) {
+    return status;
+  }
+  for (int chan=0; chan<numChannels; chan++) {
+    getIntegerParam(chan, xsp3ChanSca5LlmParam, &chanConnect_[chan].windowLlm[0]);
+    getIntegerParam(chan, xsp3ChanSca5HlmParam, &chanConnect_[chan].windowHlm[0]);
+    getIntegerParam(chan, xsp3ChanSca6LlmParam, &chanConnect_[chan].windowLlm[1]);
+    getIntegerParam(chan, xsp3ChanSca6HlmParam, &chanConnect_[chan].windowHlm[1]);
+    for (int sca=0; sca<2; sca++) {
+      if (chanConnect_[chan].windowLlm[sca] > chanConnect_[chan].windowHlm[sca]) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s ERROR: SCA low limit is higher than high limit.\n", functionName);
+        setStringParam(ADStatusMessage, "ERROR: SCA low limit is higher than high limit.");
+        setIntegerParam(ADStatus, ADStatusError);
+        return asynError;
+      }
+    }
+  }
 
-  for (int chan=0; chan<xsp3_num_channels; chan++) {
-    xsp3_status = xsp3->getDeadtimeCorrectionParameters(xsp3_handle_,
-						       chan,
-						       &xsp3_dtc_flags,
-						       &xsp3_dtc_all_event_grad,
-						       &xsp3_dtc_all_event_off,
-						       &xsp3_dtc_in_window_off,
-						       &xsp3_dtc_in_window_grad);
-    if (xsp3_status < XSP3_OK) {
-      checkStatus(xsp3_status, "xsp3_getDeadtimeCorrectionParameters", functionName);
-      status = asynError;
-    } else {
-      asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
-		"%s Channel %d Dead Time Correction Params: Flags: %d, All Event Grad: %f, All Event Off: %f, In Win Off: %f, In Win Grad: %f\n",
-		functionName, chan, xsp3_dtc_flags, xsp3_dtc_all_event_grad, xsp3_dtc_all_event_off, xsp3_dtc_in_window_off, xsp3_dtc_in_window_grad);
+  runConnectPhase(xsp3ConnectWindows, numChannels);
 
-      setIntegerParam(chan, xsp3ChanDtcFlagsParam, xsp3_dtc_flags);
-      setDoubleParam(chan, xsp3ChanDtcAegParam, static_cast<epicsFloat64>(xsp3_dtc_all_event_grad));
-      setDoubleParam(chan, xsp3ChanDtcAeoParam, static_cast<epicsFloat64>(xsp3_dtc_all_event_off));
-      setDoubleParam(chan, xsp3ChanDtcIwgParam, static_cast<epicsFloat64>(xsp3_dtc_in_window_grad));
-      setDoubleParam(chan, xsp3ChanDtcIwoParam, static_cast<epicsFloat64>(xsp3_dtc_in_window_off));
+  for (int chan=0; chan<numChannels; chan++) {
+    for (int sca=0; sca<2; sca++) {
+      if (chanConnect_[chan].windowStatus[sca] != XSP3_OK) {
+        checkStatus(chanConnect_[chan].windowStatus[sca], "xsp3_set_window", functionName);
+        setStringParam(ADStatusMessage, "Error Setting SCA Window.");
+        setIntegerParam(ADStatus, ADStatusError);
+        status = asynError;
+      }
     }
-
-    callParamCallbacks(chan);
+  }
+  if (status == asynSuccess) {
+    setStringParam(ADStatusMessage, "Set SCA Window.");
   }
 
   return status;
 }
 
+/**
+ * Read back the SCA window limits (for SCA 5 and 6) and threshold for SCA 4,
+ * the dead time correction (DTC) parameters and the event width of every
+ * channel, with one set of callbacks per channel.
+ */
+asynStatus Xspress3::readChannelParams(int numChannels)
+{
+  runConnectPhase(xsp3ConnectReadback, numChannels);
+  return publishChannelParams(numChannels);
+}
 
+/**
+ * Check the channel settings just read back are those read back after the
+ * last full restore, so that the restore can be skipped.
+ * @return true if every channel read back without error and matches.
+ */
+bool Xspress3::verifyChannelParams(int numChannels)
+{
+  if (restoredChannels_.size() != static_cast<size_t>(numChannels))
+    return false;
+
+  runConnectPhase(xsp3ConnectReadback, numChannels);
+
+  for (int chan=0; chan<numChannels; chan++) {
+    const xsp3ChanConnect_t &now = chanConnect_[chan];
+    const xsp3ChanConnect_t &then = restoredChannels_[chan];
+    if (now.scaStatus[0] < XSP3_OK || now.scaStatus[1] < XSP3_OK || now.thresholdStatus < XSP3_OK ||
+        now.dtcStatus < XSP3_OK || now.trigBStatus < XSP3_OK)
+      return false;
+    for (int sca=0; sca<2; sca++) {
+      if (now.scaLlm[sca] != then.scaLlm[sca] || now.scaHlm[sca] != then.scaHlm[sca])
+        return false;
+    }
+    if (now.sca4Threshold != then.sca4Threshold || now.dtcFlags != then.dtcFlags ||
+        now.dtcAeg != then.dtcAeg || now.dtcAeo != then.dtcAeo ||
+        now.dtcIwo != then.dtcIwo || now.dtcIwg != then.dtcIwg ||
+        memcmp(&now.trigB, &then.trigB, sizeof(now.trigB)) != 0)
+      return false;
+  }
+  return true;
+}
 
 /**
- * Read the event width for each channel
+ * Set the channel parameters from the settings read back by the
+ * xsp3ConnectReadback phase.
  */
-asynStatus Xspress3::readTrigB(void)
+asynStatus Xspress3::publishChannelParams(int numChannels)
 {
-    const char *functionName = "Xspress3::readTrigB";
-    asynStatus status = asynSuccess;
-    Xspress3_TriggerB trig_b;
-    int xsp3_status;
+  asynStatus status = asynSuccess;
+  const char *functionName = "Xspress3::publishChannelParams";
 
-    int xsp3_num_channels = 0;
-    getIntegerParam(xsp3NumChannelsParam, &xsp3_num_channels);
+  for (int chan=0; chan<numChannels; chan++) {
+    xsp3ChanConnect_t &conn = chanConnect_[chan];
+
+    //SCA 5 and 6 window limits
+    for (int sca=0; sca<2; sca++) {
+      if (conn.scaStatus[sca] < XSP3_OK) {
+        checkStatus(conn.scaStatus[sca], "xsp3_get_window", functionName);
+        status = asynError;
+      } else {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s Channel %d, Read back SCA%d window limits: %d, %d\n",
+                  functionName, chan, sca+5, conn.scaLlm[sca], conn.scaHlm[sca]);
+        setIntegerParam(chan, sca == 0 ? xsp3ChanSca5LlmParam : xsp3ChanSca6LlmParam, conn.scaLlm[sca]);
+        setIntegerParam(chan, sca == 0 ? xsp3ChanSca5HlmParam : xsp3ChanSca6HlmParam, conn.scaHlm[sca]);
+      }
+    }
+    //SCA 4 threshold limit
+    if (conn.thresholdStatus < XSP3_OK) {
+      checkStatus(conn.thresholdStatus, "xsp3_get_good_thres", functionName);
+      status = asynError;
+    } else {
+      setIntegerParam(chan, xsp3ChanSca4ThresholdParam, conn.sca4Threshold);
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s Channel %d, Read back SCA4 threshold limit: %d\n",
+                functionName, chan, conn.sca4Threshold);
+    }
 
-    for (int chan=0; chan<xsp3_num_channels; chan++) {
-        xsp3_status = xsp3->get_trigger_b(xsp3_handle_, chan, &trig_b);
+    //Dead time correction parameters
+    if (conn.dtcStatus < XSP3_OK) {
+      checkStatus(conn.dtcStatus, "xsp3_getDeadtimeCorrectionParameters", functionName);
+      status = asynError;
+    } else {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+                "%s Channel %d Dead Time Correction Params: Flags: %d, All Event Grad: %f, All Event Off: %f, In Win Off: %f, In Win Grad: %f\n",
+                functionName, chan, conn.dtcFlags, conn.dtcAeg, conn.dtcAeo, conn.dtcIwo, conn.dtcIwg);
+
+      setIntegerParam(chan, xsp3ChanDtcFlagsParam, conn.dtcFlags);
+      setDoubleParam(chan, xsp3ChanDtcAegParam, static_cast<epicsFloat64>(conn.dtcAeg));
+      setDoubleParam(chan, xsp3ChanDtcAeoParam, static_cast<epicsFloat64>(conn.dtcAeo));
+      setDoubleParam(chan, xsp3ChanDtcIwgParam, static_cast<epicsFloat64>(conn.dtcIwg));
+      setDoubleParam(chan, xsp3ChanDtcIwoParam, static_cast<epicsFloat64>(conn.dtcIwo));
+    }
 
-	printf("xsp_get_trigger_b: chan=%d, status=%d, width=%d\n", chan, xsp3_status, trig_b.event_time);
-        if (xsp3_status < XSP3_OK) {
-            checkStatus(xsp3_status, "xsp3_get_trigger_b", functionName);
-            status = asynError;
-        } else {
-	    /* MN 31-Aug-2016, from Stu Fisher:
-	       for detectors with variable width events (and corresponding firmware?),
-	       the following line should be changed to
-	       int width = trig_b.enb_variable_width ? (trig_b.event_time-3) : trig_b.event_time;
-   	    */
-	  double width = trig_b.enb_variable_width ? (trig_b.event_time-3.0) : 1.0*trig_b.event_time;
-	  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s Channel %d Event Width: %.1f\n", functionName, chan, width);
-	  setDoubleParam(chan, xsp3EventWidthParam, width);
-        }
-        callParamCallbacks(chan);
+    //Event width, from Trig B
+    printf("xsp_get_trigger_b: chan=%d, status=%d, width=%d\n", chan, conn.trigBStatus, conn.trigB.event_time);
+    if (conn.trigBStatus < XSP3_OK) {
+      checkStatus(conn.trigBStatus, "xsp3_get_trigger_b", functionName);
+      status = asynError;
+    } else {
+      /* MN 31-Aug-2016, from Stu Fisher:
+         for detectors with variable width events (and corresponding firmware?),
+         the following line should be changed to
+         int width = trig_b.enb_variable_width ? (trig_b.event_time-3) : trig_b.event_time;
+      */
+      double width = conn.trigB.enb_variable_width ? (conn.trigB.event_time-3.0) : 1.0*conn.trigB.event_time;
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s Channel %d Event Width: %.1f\n", functionName, chan, width);
+      setDoubleParam(chan, xsp3EventWidthParam, width);
     }
 
-    return status;
+    callParamCallbacks(chan);
+  }
+
+  return status;
 }
 
 
@@ -578,6 +1042,7 @@ asynStatus Xspress3::disconnect(void)
 
   asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s Calling disconnect. This calls xsp3_close().\n", functionName);
 
+  waitForErase(true);
   if ((status = checkConnected()) == asynSuccess) {
     xsp3_status = xsp3->close(xsp3_handle_);
     if (xsp3_status != XSP3_OK) {
@@ -592,6 +1057,124 @@ asynStatus Xspress3::disconnect(void)
   return status;
 }
 
+/**
+ * Reconnect to the xspress3 system after the link to it was lost, without
+ * setting it up again if it kept its settings. This calls xsp3_close() and,
+ * if FAST_RESTORE can skip the restore, xsp3_config() to open new
+ * connections, then restoreSettings() without its fallback, which only
+ * checks the settings. If the system did not keep them (it was power cycled,
+ * say), or the restore cannot be skipped, the clocks and settings are set up
+ * in full with connect(), so there is only ever one full restore.
+ * @param unlockConfig Release the port lock around xsp3_config()
+ */
+asynStatus Xspress3::warmReconnect(bool unlockConfig)
+{
+  asynStatus status = asynSuccess;
+  int xsp3_num_cards = 0;
+  int xsp3_num_tf = 0;
+  int xsp3_num_channels = 0;
+  int skipped = 0;
+  int count = 0;
+  char configPath[maxStringSize_] = {0};
+  double startTime = xsp3ApiStats::now();
+  const char *functionName = "Xspress3::warmReconnect";
+
+  getIntegerParam(xsp3NumCardsParam, &xsp3_num_cards);
+  getIntegerParam(xsp3NumFramesConfigParam, &xsp3_num_tf);
+  getIntegerParam(xsp3NumChannelsParam, &xsp3_num_channels);
+  getStringParam(xsp3ConfigPathParam, maxStringSize_, configPath);
+
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s Reconnecting. This calls xsp3_close() and xsp3_config().\n", functionName);
+
+  waitForErase(true);
+  xsp3->close(xsp3_handle_);
+  setIntegerParam(xsp3ConnectedParam, 0);
+  if (!fastRestoreAvailable(configPath)) {
+    status = connect(unlockConfig);
+  } else {
+    xsp3_handle_ = configSystem(xsp3_num_cards, xsp3_num_tf, xsp3_num_channels, unlockConfig);
+    if (xsp3_handle_ < 0) {
+      checkStatus(xsp3_handle_, "xsp3_config", functionName);
+      status = asynError;
+    } else {
+      setIntegerParam(xsp3ConnectedParam, 1);
+      status = restoreSettings(false);
+      getIntegerParam(xsp3RestoreSkippedParam, &skipped);
+      if (status == asynSuccess && !skipped) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s Settings were not kept, setting up the system in full.\n", functionName);
+        xsp3->close(xsp3_handle_);
+        setIntegerParam(xsp3ConnectedParam, 0);
+        status = connect(unlockConfig);
+      }
+    }
+  }
+
+  double elapsed = xsp3ApiStats::now() - startTime;
+  setDoubleParam(xsp3ReconnectTimeParam, elapsed);
+  if (status == asynSuccess) {
+    getIntegerParam(xsp3ReconnectCountParam, &count);
+    setIntegerParam(xsp3ReconnectCountParam, count + 1);
+    printf("Xspress3 reconnect: %s in %.3f s\n", skipped ? "settings kept" : "full setup", elapsed);
+    setStringParam(ADStatusMessage, "System Reconnected");
+    setIntegerParam(ADStatus, ADStatusIdle);
+  } else {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s ERROR reconnecting to Xspress3 after %.3f s.\n", functionName, elapsed);
+    setStringParam(ADStatusMessage, "ERROR: failed to reconnect");
+    setIntegerParam(ADStatus, ADStatusDisconnected);
+    setIntegerParam(xsp3ConnectedParam, 0);
+  }
+
+  return status;
+}
+
+/**
+ * Watch for the link to the xspress3 system being lost while it is idle,
+ * and reconnect with warmReconnect(). The link is checked with
+ * xsp3_histogram_is_any_busy() every XSP3_RECONNECT_POLL seconds. Failed
+ * attempts are retried after a delay that doubles each time, up to
+ * XSP3_RECONNECT_MAX_DELAY.
+ */
+void Xspress3::reconnectTask(void)
+{
+  int autoReconnect = 0;
+  int connected = 0;
+  int acquiring = 0;
+  double wait = XSP3_RECONNECT_POLL;
+  const char *functionName = "Xspress3::reconnectTask";
+
+  while (1) {
+    epicsThreadSleep(wait);
+    wait = XSP3_RECONNECT_POLL;
+
+    this->lock();
+    getIntegerParam(xsp3AutoReconnectParam, &autoReconnect);
+    getIntegerParam(xsp3ConnectedParam, &connected);
+    getIntegerParam(ADAcquire, &acquiring);
+    if (autoReconnect && !acquiring) {
+      if (connected && !linkLost_ && xsp3->histogram_is_any_busy(xsp3_handle_) < XSP3_OK) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s Lost the link to the Xspress3: %s\n",
+                  functionName, xsp3->get_error_message());
+        setStringParam(ADStatusMessage, "Link lost, reconnecting");
+        setIntegerParam(ADStatus, ADStatusDisconnected);
+        linkLost_ = true;
+        reconnectDelay_ = XSP3_RECONNECT_MIN_DELAY;
+      }
+      if (linkLost_) {
+        if (warmReconnect(true) == asynSuccess) {
+          linkLost_ = false;
+          setDoubleParam(xsp3ReconnectDelayParam, 0.0);
+        } else {
+          wait = reconnectDelay_;
+          setDoubleParam(xsp3ReconnectDelayParam, wait);
+          reconnectDelay_ = reconnectDelay_*2 < XSP3_RECONNECT_MAX_DELAY ? reconnectDelay_*2 : XSP3_RECONNECT_MAX_DELAY;
+        }
+      }
+      callParamCallbacks();
+    }
+    this->unlock();
+  }
+}
+
 /**
  * Check the connected status.
  * @return asynSuccess if connected, or asynError if disconnected.
@@ -613,6 +1196,47 @@ asynStatus Xspress3::checkConnected(void)
   return asynSuccess;
 }
 
+/**
+ * Replace the detector (or simulator) with a playback of a trace recorded
+ * by xspress3Trace. Must be done before connecting, and not while the
+ * link is lost and being reconnected.
+ * @param fileName The trace file
+ * @param speed How many times faster than recorded to play it back, 0 for as fast as possible
+ */
+asynStatus Xspress3::replayTrace(const char *fileName, double speed)
+{
+  xsp3TraceReplay *replay;
+  int connected = 0;
+  const char *functionName = "Xspress3::replayTrace";
+
+  this->lock();
+  getIntegerParam(xsp3ConnectedParam, &connected);
+  if (connected) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s Disconnect before replaying a trace.\n", functionName);
+    this->unlock();
+    return asynError;
+  }
+  // A reconnect releases the lock around xsp3_config while still using xsp3
+  if (linkLost_ || reconnecting_) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s Reconnecting, cannot replay a trace.\n", functionName);
+    this->unlock();
+    return asynError;
+  }
+  replay = new xsp3TraceReplay(this->pasynUserSelf);
+  if (replay->open(fileName, speed) != XSP3_OK) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s %s\n", functionName, replay->getError());
+    delete replay;
+    this->unlock();
+    return asynError;
+  }
+  delete xsp3;
+  xsp3 = replay;
+  setStringParam(ADStatusMessage, "Init. Trace Replay.");
+  callParamCallbacks();
+  this->unlock();
+  return asynSuccess;
+}
+
 
 /**
  * Save the system settings for the xspress3 system.
@@ -651,94 +1275,254 @@ asynStatus Xspress3::saveSettings(void)
 }
 
 /**
- * Restore the system settings for the xspress3 system.
- * This simply calls xsp3_restore_settings().
+ * Fingerprint the settings that restoreSettings applies: the contents of the
+ * settings directory and the driver settings written after restoring it.
+ * @return false if the settings directory could not be read.
+ */
+bool Xspress3::settingsFingerprint(const char *configPath, uint64_t *fingerprint)
+{
+  xsp3Fingerprint hash;
+  int value;
+
+  bool readable = (hash.addDirectory(configPath) == 0);
+
+  const int params[] = {xsp3NumCardsParam, xsp3NumFramesConfigParam, xsp3NumChannelsParam, xsp3RunFlagsParam};
+  for (size_t i=0; i<sizeof(params)/sizeof(params[0]); i++) {
+    getIntegerParam(params[i], &value);
+    hash.add(value);
+  }
+  hash.add(circBuffer_);
+
+  int numChannels;
+  getIntegerParam(xsp3NumChannelsParam, &numChannels);
+  const int chanParams[] = {xsp3ChanSca5LlmParam, xsp3ChanSca5HlmParam, xsp3ChanSca6LlmParam, xsp3ChanSca6HlmParam};
+  for (int chan=0; chan<numChannels; chan++) {
+    for (size_t i=0; i<sizeof(chanParams)/sizeof(chanParams[0]); i++) {
+      getIntegerParam(chan, chanParams[i], &value);
+      hash.add(value);
+    }
+  }
+
+  *fingerprint = hash.value();
+  return readable;
+}
+
+/**
+ * Format the histogram memory of each channel, with xsp3_format_run() for
+ * whole frames or, if SUB_FRAMES is 2 or more, with xsp3_format_sub_frames()
+ * for that many sub-frames per frame of 2^SUB_FRAME_BITS bins. The layout
+ * is kept for the data task, so this must not be called while acquiring.
  */
-asynStatus Xspress3::restoreSettings(void)
+asynStatus Xspress3::formatChannels(int numChannels)
 {
   asynStatus status = asynSuccess;
   int xsp3_status = 0;
+  const char *functionName = "Xspress3::formatChannels";
+
+  getIntegerParam(xsp3SubFramesParam, &subFrames_);
+  getIntegerParam(xsp3SubFrameBitsParam, &subFrameBits_);
+  getIntegerParam(xsp3SubFrameDivideParam, &subFrameDivide_);
+  if (subFrames_ < 2) {
+    subFrames_ = 1;
+  }
+  if (chanConnect_.size() != (size_t) numChannels) {
+    chanConnect_.assign(numChannels, xsp3ChanConnect_t());
+  }
+
+  runConnectPhase(xsp3ConnectFormat, numChannels);
+  for (int chan=0; chan<numChannels; chan++) {
+    xsp3_status = chanConnect_[chan].formatStatus;
+    if (xsp3_status < XSP3_OK) {
+      checkStatus(xsp3_status, subFrames_ > 1 ? "xsp3_format_sub_frames" : "xsp3_format_run", functionName);
+      status = asynError;
+    } else {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s Channel: %d, Number of time frames configured: %d\n", functionName, chan, xsp3_status);
+    }
+  }
+
+  return status;
+}
+
+/**
+ * Restore the system settings for the xspress3 system.
+ * This calls fullRestore(), which calls xsp3_restore_settings(), then sets up
+ * the channels and reads back their settings. If FAST_RESTORE is set and
+ * neither the settings directory nor the driver settings have changed since
+ * the last full restore, xsp3_restore_settings() and the SCA window writes
+ * are skipped and the channel settings read back are instead checked against
+ * those read back after the last full restore. A full restore is made if
+ * they differ, unless fallback is false, when the settings are left for the
+ * caller to set up and RESTORE_SKIPPED_RBV is 0.
+ */
+asynStatus Xspress3::restoreSettings(bool fallback)
+{
+  asynStatus status = asynSuccess;
   char configPath[maxStringSize_] = {0};
   int connected = 0;
+  bool fast = false;
+  bool restored = true;
+  xsp3RestoreTimes_t times = {0.0, 0.0, 0.0};
+  double phaseTime;
   const char *functionName = "Xspress3::restoreSettings";
 
-  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s Restoring Xspress3 settings. This calls xsp3_restore_settings().\n", functionName);
-
   getIntegerParam(xsp3ConnectedParam, &connected);
   getStringParam(xsp3ConfigPathParam, maxStringSize_, configPath);
 
+  int xsp3_num_channels;
+  getIntegerParam(xsp3NumChannelsParam, &xsp3_num_channels);
+
   if ((configPath == NULL) || (connected != 1)) {
     asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s ERROR: No config path set, or not connected.\n", functionName);
     setIntegerParam(ADStatus, ADStatusError);
-    status = asynError;
-  } else {
-    xsp3_status = xsp3->restore_settings(xsp3_handle_, configPath, 0);
-    if (xsp3_status != XSP3_OK) {
-      checkStatus(xsp3_status, "xsp3_restore_settings", functionName);
-      setStringParam(ADStatusMessage, "Error Restoring Configuration.");
-      setIntegerParam(ADStatus, ADStatusError);
-      status = asynError;
-    } else {
-      setStringParam(ADStatusMessage, "Restored Configuration.");
-    }
-  }
-
-  //Can we do xsp3_format_run here? For normal user operation all the arguments seem to be set to zero.
-  int xsp3_num_channels;
-  getIntegerParam(xsp3NumChannelsParam, &xsp3_num_channels);
-  for (int chan=0; chan<xsp3_num_channels; chan++) {
-    xsp3_status = xsp3->format_run(xsp3_handle_, chan, 0, 0, 0, 0, 0, 12);
-    if (xsp3_status < XSP3_OK) {
-      checkStatus(xsp3_status, "xsp3_format_run", functionName);
-      status = asynError;
-    } else {
-      asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s Channel: %d, Number of time frames configured: %d\n", functionName, chan, xsp3_status);
-    }
+    restoreValid_ = false;
+    setIntegerParam(xsp3RestoreSkippedParam, 0);
+    return asynError;
   }
 
-  //Read run flags parameter
-  int xsp3_run_flags;
-  getIntegerParam(xsp3RunFlagsParam, &xsp3_run_flags);
-  if (xsp3_run_flags == runFlag_MCA_SPECTRA_) {
-    if (circBuffer_ == 0) {
-      xsp3_status = xsp3->set_run_flags(xsp3_handle_, XSP3_RUN_FLAGS_SCALERS | XSP3_RUN_FLAGS_HIST);
-    } else {
-      xsp3_status = xsp3->set_run_flags(xsp3_handle_, XSP3_RUN_FLAGS_SCALERS | XSP3_RUN_FLAGS_HIST | XSP3_RUN_FLAGS_CIRCULAR_BUFFER);
+  fast = fastRestoreAvailable(configPath);
+  if (fast) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s Settings unchanged since the last restore, skipping xsp3_restore_settings().\n", functionName);
+    phaseTime = xsp3ApiStats::now();
+    status = setupChannels(xsp3_num_channels, false);
+    times.setup += xsp3ApiStats::now() - phaseTime;
+    phaseTime = xsp3ApiStats::now();
+    if (status == asynSuccess) {
+      // Read back the SCA, DTC and Trig B (for DTC) parameters
+      fast = verifyChannelParams(xsp3_num_channels);
+      if (fast) {
+        status = publishChannelParams(xsp3_num_channels);
+        setStringParam(ADStatusMessage, "Configuration Unchanged.");
+      }
     }
-    //
-  } else if (xsp3_run_flags == runFlag_PLAYB_MCA_SPECTRA_) {
-      if (circBuffer_ == 0) {
-        xsp3_status = xsp3->set_run_flags(xsp3_handle_, XSP3_RUN_FLAGS_PLAYBACK | XSP3_RUN_FLAGS_SCALERS | XSP3_RUN_FLAGS_HIST);
-    } else {
-        xsp3_status = xsp3->set_run_flags(xsp3_handle_, XSP3_RUN_FLAGS_PLAYBACK | XSP3_RUN_FLAGS_SCALERS | XSP3_RUN_FLAGS_HIST | XSP3_RUN_FLAGS_CIRCULAR_BUFFER);
+    times.readback += xsp3ApiStats::now() - phaseTime;
+    if (status == asynSuccess && !fast && !fallback) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s Channel settings differ from the last restore.\n", functionName);
+      restored = false;
+    } else if (status == asynSuccess && !fast) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s Channel settings differ from the last restore, restoring them.\n", functionName);
+      status = fullRestore(configPath, xsp3_num_channels, &times);
     }
   } else {
-    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s Invalid run flag option when trying to set xsp3_set_run_flags.\n", functionName);
-    status = asynError;
+    status = fullRestore(configPath, xsp3_num_channels, &times);
   }
 
-  if (xsp3_status < XSP3_OK) {
-    checkStatus(xsp3_status, "xsp3_set_run_flags", functionName);
+  setDoubleParam(xsp3ConnectRestoreTimeParam, times.restore);
+  setDoubleParam(xsp3ConnectSetupTimeParam, times.setup);
+  setDoubleParam(xsp3ConnectReadbackTimeParam, times.readback);
+
+  //Remember what a successful full restore applied, for the next one
+  if (status != asynSuccess || !restored) {
+    restoreValid_ = false;
+  } else if (!fast) {
+    restoreValid_ = settingsFingerprint(configPath, &restoreFingerprint_);
+    restoredChannels_ = chanConnect_;
+  }
+  setIntegerParam(xsp3RestoreSkippedParam, (status == asynSuccess) && fast);
+
+  return status;
+}
+
+/**
+ * Whether FAST_RESTORE is set and the settings are unchanged since the last
+ * full restore, so restoreSettings() can skip restoring them.
+ */
+bool Xspress3::fastRestoreAvailable(const char *configPath)
+{
+  int fastRestore = 0;
+  uint64_t fingerprint = 0;
+
+  getIntegerParam(xsp3FastRestoreParam, &fastRestore);
+  return fastRestore && restoreValid_ && settingsFingerprint(configPath, &fingerprint) &&
+         (fingerprint == restoreFingerprint_);
+}
+
+/**
+ * Restore the settings in full: xsp3_restore_settings(), then set up the
+ * channels, write the SCA windows and read back the channel settings.
+ * @param times The time spent in each step is added to these
+ */
+asynStatus Xspress3::fullRestore(const char *configPath, int numChannels, xsp3RestoreTimes_t *times)
+{
+  asynStatus status = asynSuccess;
+  int xsp3_status = 0;
+  double phaseTime = xsp3ApiStats::now();
+  const char *functionName = "Xspress3::fullRestore";
+
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s Restoring Xspress3 settings. This calls xsp3_restore_settings().\n", functionName);
+  restoreValid_ = false;
+  xsp3_status = xsp3->restore_settings(xsp3_handle_, const_cast<char *>(configPath), 0);
+  if (xsp3_status != XSP3_OK) {
+    checkStatus(xsp3_status, "xsp3_restore_settings", functionName);
+    setStringParam(ADStatusMessage, "Error Restoring Configuration.");
+    setIntegerParam(ADStatus, ADStatusError);
     status = asynError;
+  } else {
+    setStringParam(ADStatusMessage, "Restored Configuration.");
   }
+  times->restore += xsp3ApiStats::now() - phaseTime;
+  phaseTime = xsp3ApiStats::now();
 
-    //Need to write the window params, and then read existing SCA params
-    if (status == asynSuccess) {
-        int lo_limit, hi_limit;
-        // Set window for the first Scalar ROI
-        for (int chan=0; chan<xsp3_num_channels && status == asynSuccess; chan++) {
-            getIntegerParam(chan, xsp3ChanSca5HlmParam, &hi_limit);
-            getIntegerParam(chan, xsp3ChanSca5LlmParam, &lo_limit);
-            status = setWindow(chan, 0, lo_limit, hi_limit);
-        }
+  if (setupChannels(numChannels, true) != asynSuccess) {
+    status = asynError;
+  }
+  times->setup += xsp3ApiStats::now() - phaseTime;
+  phaseTime = xsp3ApiStats::now();
 
-        // Set window for the first Scalar ROI
-        for (int chan=0; chan<xsp3_num_channels && status == asynSuccess; chan++) {
-            getIntegerParam(chan, xsp3ChanSca6HlmParam, &hi_limit);
-            getIntegerParam(chan, xsp3ChanSca6LlmParam, &lo_limit);
-            status = setWindow(chan, 1, lo_limit, hi_limit);
-        }
-        status = readSCAParams();
+  // Read back the SCA, DTC and Trig B (for DTC) parameters
+  if (status == asynSuccess) {
+    status = readChannelParams(numChannels);
+  }
+  times->readback += xsp3ApiStats::now() - phaseTime;
+
+  return status;
+}
+
+/**
+ * Set up the channels after restoring the settings: format the histogram
+ * memory, set the run flags and the trigger mode and, for a full restore,
+ * write the SCA windows.
+ */
+asynStatus Xspress3::setupChannels(int numChannels, bool writeWindows)
+{
+  asynStatus status = asynSuccess;
+  int xsp3_status = 0;
+  const char *functionName = "Xspress3::setupChannels";
+
+  //Can we do xsp3_format_run here? For normal user operation all the arguments seem to be set to zero.
+  chanConnect_.assign(numChannels, xsp3ChanConnect_t());
+  if (formatChannels(numChannels) != asynSuccess) {
+    status = asynError;
+  }
+
+  //Read run flags parameter
+  int xsp3_run_flags;
+  getIntegerParam(xsp3RunFlagsParam, &xsp3_run_flags);
+  if (xsp3_run_flags == runFlag_MCA_SPECTRA_) {
+    if (circBuffer_ == 0) {
+      xsp3_status = xsp3->set_run_flags(xsp3_handle_, XSP3_RUN_FLAGS_SCALERS | XSP3_RUN_FLAGS_HIST);
+    } else {
+      xsp3_status = xsp3->set_run_flags(xsp3_handle_, XSP3_RUN_FLAGS_SCALERS | XSP3_RUN_FLAGS_HIST | XSP3_RUN_FLAGS_CIRCULAR_BUFFER);
+    }
+    //
+  } else if (xsp3_run_flags == runFlag_PLAYB_MCA_SPECTRA_) {
+      if (circBuffer_ == 0) {
+        xsp3_status = xsp3->set_run_flags(xsp3_handle_, XSP3_RUN_FLAGS_PLAYBACK | XSP3_RUN_FLAGS_SCALERS | XSP3_RUN_FLAGS_HIST);
+    } else {
+        xsp3_status = xsp3->set_run_flags(xsp3_handle_, XSP3_RUN_FLAGS_PLAYBACK | XSP3_RUN_FLAGS_SCALERS | XSP3_RUN_FLAGS_HIST | XSP3_RUN_FLAGS_CIRCULAR_BUFFER);
+    }
+  } else {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s Invalid run flag option when trying to set xsp3_set_run_flags.\n", functionName);
+    status = asynError;
+  }
+
+  if (xsp3_status < XSP3_OK) {
+    checkStatus(xsp3_status, "xsp3_set_run_flags", functionName);
+    status = asynError;
+  }
+
+    //Need to write the window params, unless they are unchanged
+    if (status == asynSuccess && writeWindows) {
+        status = writeChannelWindows(numChannels);
     }
 
     // Set the trigger mode
@@ -751,16 +1535,6 @@ asynStatus Xspress3::restoreSettings(void)
        status = setTriggerMode(trigger_mode, invert_f0, invert_veto, debounce );
     }
 
-    // Read the DTC parameters
-    if (status == asynSuccess) {
-        status = readDTCParams();
-    }
-
-    // Read Trig B for DTC
-    if (status == asynSuccess) {
-        status = readTrigB();
-    }
-
   return status;
 }
 
@@ -888,9 +1662,14 @@ asynStatus Xspress3::checkRoi(int channel, int roi, int llm, int hlm)
 
 /**
  * Call xsp3_histogram_clear, and clear scalar data.
+ * @param background If ERASE_CHUNK is set, clear only the first ERASE_CHUNK
+ * frames here and leave the rest to the erase task, which clears them in
+ * chunks of that size once Acquire has returned, while the first frames are
+ * counted. Arming holds the port lock, so does not overlap the clearing.
+ * Not used with the circular buffer, where the frames are reused.
  * @return asynStatus
  */
-asynStatus Xspress3::erase(void)
+asynStatus Xspress3::erase(bool background)
 {
   asynStatus status = asynSuccess;
   int xsp3_status = 0;
@@ -898,10 +1677,11 @@ asynStatus Xspress3::erase(void)
   int xsp3_used_frames = 0;
   int xsp3_curr_frames = 0;
   int xsp3_num_channels = 0;
+  int chunk = 0;
+  double startTime = xsp3ApiStats::now();
   const char *functionName = "Xspress3::erase";
 
-  //needs c++11 using namespace std::chrono;
-  //needs c++11 high_resolution_clock::time_point t1 = high_resolution_clock::now();
+  waitForErase(true);
 
   if ((status = checkConnected()) == asynSuccess) {
     asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s Erase data.\n", functionName);
@@ -910,12 +1690,16 @@ asynStatus Xspress3::erase(void)
     getIntegerParam(xsp3NumChannelsParam, &xsp3_num_channels);
     getIntegerParam(NDArrayCounter, &xsp3_used_frames);
     getIntegerParam(ADNumImages, &xsp3_curr_frames);
+    getIntegerParam(xsp3EraseChunkParam, &chunk);
 
     xsp3_curr_frames += 1;
     if (xsp3_used_frames == 0)  {xsp3_curr_frames = 1;}
     if (xsp3_used_frames > xsp3_curr_frames) {xsp3_curr_frames = xsp3_used_frames;}
     if (xsp3_curr_frames > xsp3_time_frames) {xsp3_curr_frames = xsp3_time_frames;}
-    xsp3_status = xsp3->histogram_clear(xsp3_handle_, 0, xsp3_num_channels, 0, xsp3_curr_frames);
+    if (!background || chunk <= 0 || circBuffer_ != 0 || xsp3_curr_frames <= chunk) {
+      chunk = xsp3_curr_frames;
+    }
+    xsp3_status = xsp3->histogram_clear(xsp3_handle_, 0, xsp3_num_channels, 0, chunk);
      if (xsp3_status != XSP3_OK) {
       checkStatus(xsp3_status, "xsp3_histogram_clear", functionName);
       setIntegerParam(ADStatus, ADStatusError);
@@ -929,13 +1713,113 @@ asynStatus Xspress3::erase(void)
 	setIntegerParam(ADStatus, ADStatusError);
       }
     }
+    if (status == asynSuccess && chunk < xsp3_curr_frames) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s Clearing frames %d to %d in the background.\n",
+                functionName, chunk, xsp3_curr_frames - 1);
+      eraseChannels_ = xsp3_num_channels;
+      eraseFirst_ = chunk;
+      eraseEnd_ = xsp3_curr_frames;
+      eraseChunk_ = chunk;
+      eraseStartTime_ = startTime;
+      eraseCancel_ = false;
+      eraseAcquiring_ = false;
+      eraseActive_ = true;
+      epicsEventSignal(eraseStartEvent_);
+    }
+  }
+  if (!eraseActive_) {
+    setDoubleParam(xsp3EraseTimeParam, xsp3ApiStats::now() - startTime);
   }
-  // needs c++11 high_resolution_clock::time_point t2 = high_resolution_clock::now();
-  // needs c++11 duration<double, std::milli> time_span = t2 - t1;
-  // needs c++11 std::cout << "erase took " << time_span.count() << " msec " << std::endl;
   return status;
 }
 
+/**
+ * Wait for the erase task to finish clearing frames.
+ * @param cancel Stop clearing after the current chunk, as the frames left
+ * are not needed.
+ */
+void Xspress3::waitForErase(bool cancel)
+{
+  if (cancel) {
+    eraseCancel_ = true;
+  }
+  while (eraseActive_) {
+    this->unlock();
+    epicsEventWaitWithTimeout(eraseDoneEvent_, 0.1);
+    this->lock();
+  }
+}
+
+/**
+ * Clear the frames handed over by erase() in chunks. Each chunk is cleared
+ * with the port lock held, as the other API calls on the handle are, and
+ * only once the acquisition is known not to have reached it; its progress
+ * is checked again after the chunk is cleared. If the acquisition reaches a
+ * chunk first, its frames may hold counts left from the last one, or have
+ * been cleared after counting, so the acquisition is stopped with an error
+ * and counted in ERASE_OVERTAKEN_RBV.
+ */
+void Xspress3::eraseTask(void)
+{
+  const char *functionName = "Xspress3::eraseTask";
+
+  while (1) {
+    epicsEventMustWait(eraseStartEvent_);
+
+    int xsp3_status = XSP3_OK;
+    int overtakenAt = -1;
+    int frame;
+    this->lock();
+    for (frame=eraseFirst_; frame<eraseEnd_ && !eraseCancel_; frame+=eraseChunk_) {
+      int numFrames = (eraseEnd_ - frame < eraseChunk_) ? eraseEnd_ - frame : eraseChunk_;
+      if (eraseAcquiring_ && xsp3->scaler_check_progress(xsp3_handle_) >= frame) {
+        overtakenAt = frame;
+        break;
+      }
+      xsp3_status = xsp3->histogram_clear(xsp3_handle_, 0, eraseChannels_, frame, numFrames);
+      if (xsp3_status != XSP3_OK)
+        break;
+      if (eraseAcquiring_ && xsp3->scaler_check_progress(xsp3_handle_) >= frame) {
+        overtakenAt = frame;
+        break;
+      }
+      // Let the port thread in between chunks
+      this->unlock();
+      this->lock();
+    }
+
+    if (xsp3_status != XSP3_OK) {
+      checkStatus(xsp3_status, "xsp3_histogram_clear", functionName);
+      setStringParam(ADStatusMessage, "Problem Erasing Data");
+    } else if (overtakenAt >= 0) {
+      int overtaken = 0;
+      int acquiring = 0;
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s ERROR: Acquisition reached frame %d before it was cleared.\n",
+                functionName, overtakenAt);
+      getIntegerParam(xsp3EraseOvertakenParam, &overtaken);
+      setIntegerParam(xsp3EraseOvertakenParam, overtaken + 1);
+      getIntegerParam(ADAcquire, &acquiring);
+      if (acquiring) {
+        // The frames from here on cannot be trusted, so stop rather than publish them
+        eraseFailed_ = true;
+        seqActive_ = false;
+        xsp3_status = xsp3->histogram_stop(xsp3_handle_, -1);
+        if (xsp3_status != XSP3_OK) {
+          checkStatus(xsp3_status, "xsp3_histogram_stop", functionName);
+        }
+        epicsEventSignal(this->stopEvent_);
+      }
+      setStringParam(ADStatusMessage, "ERROR: Acquisition overtook erase");
+      setIntegerParam(ADStatus, ADStatusError);
+    }
+    setDoubleParam(xsp3EraseTimeParam, xsp3ApiStats::now() - eraseStartTime_);
+    eraseActive_ = false;
+    callParamCallbacks();
+    this->unlock();
+    epicsEventSignal(eraseDoneEvent_);
+  }
+}
+
 /**
  * Function to clear the data.
  */
@@ -966,11 +1850,19 @@ asynStatus Xspress3::eraseSCAMCAROI(void)
     paramStatus = ((setDoubleParam(chan, xsp3ChanSca7Param, 0.0) == asynSuccess) && paramStatus);
     paramStatus = ((setDoubleParam(chan, xsp3ChanDTPercentParam, 0.0) == asynSuccess) && paramStatus);
     paramStatus = ((setDoubleParam(chan, xsp3ChanDTFactorParam, 1.0) == asynSuccess) && paramStatus);
+    for (int roi=0; roi<XSP3_NUM_ROIS; roi++) {
+      paramStatus = ((setDoubleParam(chan, xsp3ChanRoiParam[roi], 0.0) == asynSuccess) && paramStatus);
+    }
 
     //callParamCallbacks(chan);
   }
 
-  // Send a blank frame
+  // Send a blank frame, except in step scan mode where it would double the frames sent per point
+  int stepScan = 0;
+  getIntegerParam(xsp3StepScanParam, &stepScan);
+  if (stepScan) {
+    return (paramStatus ? asynSuccess : asynError);
+  }
   NDArray *pMCA;
   int xsp3_max_spectra=0;
   getIntegerParam(xsp3MaxSpectraParam, &xsp3_max_spectra);
@@ -978,10 +1870,10 @@ asynStatus Xspress3::eraseSCAMCAROI(void)
   NDDataType_t dataType= this->getDataType();
 
 
-  size_t dims[2];
-  this->getDims(dims);
+  size_t dims[3];
+  int ndims = this->getDims(dims);
 
-  pMCA= this->pNDArrayPool->alloc(2, dims, dataType, 0, NULL);
+  pMCA= this->pNDArrayPool->alloc(ndims, dims, dataType, 0, NULL);
 
   if (pMCA !=NULL) {
     memset(pMCA->pData,0,pMCA->dataSize);
@@ -1022,6 +1914,7 @@ void Xspress3::report(FILE *fp, int details)
   fprintf(fp, "Xspress3 port=%s\n", this->portName);
   if (details > 0) {
     fprintf(fp, "Xspress3 driver details...\n");
+    xsp3->getStats().report(fp, details);
   }
 
   fprintf(fp, "Xspress3 finished.\n");
@@ -1031,15 +1924,61 @@ void Xspress3::report(FILE *fp, int details)
 
 }
 
+/**
+ * Copy a summary of the API call statistics into the parameter library.
+ * Read out is the time spent in the calls that read frames.
+ */
+void Xspress3::updateApiStats(void)
+{
+  static const int readCalls[] = { xsp3CallHistogramRead4d, xsp3CallHistDtcRead4d, xsp3CallScalerRead };
+  xsp3ApiStats &stats = xsp3->getStats();
+  xsp3ApiCallStats_t callStats;
+  unsigned long count, readCount = 0;
+  double total, readTotal = 0.0, readMax = 0.0;
+  int slowest;
+
+  stats.getTotals(count, total, slowest);
+  for (size_t i=0; i<sizeof(readCalls)/sizeof(readCalls[0]); i++) {
+    stats.get(readCalls[i], callStats);
+    readCount += callStats.count;
+    readTotal += callStats.total;
+    if (callStats.max > readMax) readMax = callStats.max;
+  }
+
+  setIntegerParam(xsp3ApiCallsParam, static_cast<int>(count));
+  setDoubleParam(xsp3ApiTimeParam, total);
+  setDoubleParam(xsp3ApiReadTimeParam, readCount > 0 ? readTotal/readCount*1e6 : 0.0);
+  setDoubleParam(xsp3ApiReadMaxParam, readMax*1e6);
+  setStringParam(xsp3ApiSlowestParam, slowest < 0 ? "" : xsp3ApiStats::name(slowest));
+}
+
 asynStatus Xspress3::setupITFG(void)
 {
     asynStatus status = asynSuccess;
     const char *functionName = "Xspress3::setupITFG";
-    int num_frames, trigger_mode, ppt;
+    int num_frames, trigger_mode, ppt, stepScan;
     double exposureTime;
     int xsp3_status=XSP3_OK;
+    xsp3Fingerprint settings;
 
     getIntegerParam(xsp3TriggerModeParam, &trigger_mode);
+    getIntegerParam(ADNumImages, &num_frames);
+    getDoubleParam(ADAcquireTime, &exposureTime);
+    getIntegerParam(xsp3PulsePerTriggerParam, &ppt);
+    getIntegerParam(xsp3StepScanParam, &stepScan);
+
+    // In step scan mode the ITFG is not set up again if nothing it uses has changed.
+    // Mode 7 also arms the histogram, so is always set up.
+    settings.add(trigger_mode);
+    settings.add(num_frames);
+    settings.add(&exposureTime, sizeof(exposureTime));
+    settings.add(ppt);
+    if (stepScan && itfgValid_ && trigger_mode != 7 && settings.value() == itfgFingerprint_) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s ITFG settings unchanged.\n", functionName);
+        return status;
+    }
+    itfgValid_ = false;
+
 	if(trigger_mode == 7) {
 		getIntegerParam(ADNumImages, &num_frames);
 		getDoubleParam(ADAcquireTime, &exposureTime);
@@ -1072,11 +2011,186 @@ asynStatus Xspress3::setupITFG(void)
     if (xsp3_status != XSP3_OK) {
         checkStatus(xsp3_status, " xsp3_itfg_setup", functionName);
         status = asynError;
+    } else {
+        itfgValid_ = true;
+        itfgFingerprint_ = settings.value();
     }
 
     return status;
 }
 
+/**
+ * Start the acquisition sequence, if SEQ_LENGTH is set, by setting
+ * AcquireTime and NumImages from its first entry. The sequence is limited to
+ * the entries loaded in both SEQ_ACQUIRE_TIME and SEQ_NUM_IMAGES, which are
+ * copied so that loading new ones does not affect the running sequence. The
+ * AcquireTime and NumImages set before it are put back by endSequence.
+ */
+void Xspress3::startSequence(void)
+{
+  int length = 0;
+  const char *functionName = "Xspress3::startSequence";
+
+  seqActive_ = false;
+  getIntegerParam(xsp3SeqLengthParam, &length);
+  if (length > (int)seqAcquireTime_.size()) length = (int)seqAcquireTime_.size();
+  if (length > (int)seqNumImages_.size()) length = (int)seqNumImages_.size();
+  if (length <= 0) {
+    return;
+  }
+
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s Starting a sequence of %d acquisitions.\n", functionName, length);
+  getDoubleParam(ADAcquireTime, &seqSavedAcquireTime_);
+  getIntegerParam(ADNumImages, &seqSavedNumImages_);
+  seqActive_ = true;
+  seqRestore_ = true;
+  seqPrepared_ = false;
+  seqLength_ = length;
+  seqRunAcquireTime_.assign(seqAcquireTime_.begin(), seqAcquireTime_.begin() + length);
+  seqRunNumImages_.assign(seqNumImages_.begin(), seqNumImages_.begin() + length);
+  seqIndex_ = 0;
+  seqFrameOffset_ = 0;
+  applySequenceEntry(0);
+  setIntegerParam(xsp3SeqEntryParam, 0);
+}
+
+/**
+ * End the acquisition sequence, if one was started, putting back the
+ * AcquireTime and NumImages set before it.
+ */
+void Xspress3::endSequence(void)
+{
+  if (seqRestore_) {
+    setDoubleParam(ADAcquireTime, seqSavedAcquireTime_);
+    setIntegerParam(ADNumImages, seqSavedNumImages_);
+    seqRestore_ = false;
+  }
+  seqActive_ = false;
+}
+
+/**
+ * Set AcquireTime and NumImages from an entry of the acquisition sequence.
+ */
+void Xspress3::applySequenceEntry(int entry)
+{
+  setDoubleParam(ADAcquireTime, seqRunAcquireTime_[entry]);
+  setIntegerParam(ADNumImages, seqRunNumImages_[entry]);
+}
+
+/**
+ * The frame of the acquisition, counting through all the entries of a
+ * sequence, from the frame of the current entry.
+ */
+int Xspress3::acquisitionFrame(int frameNumber) const
+{
+  return (seqRestore_ ? seqFrameOffset_ : 0) + frameNumber;
+}
+
+/**
+ * Set up the ITFG for the next entry of the acquisition sequence once every
+ * frame of the current entry has been acquired, while they are still being
+ * read out, so that the next entry can start as soon as they have been.
+ * Not done in mode 7, where setting up the ITFG also arms the histogram.
+ */
+void Xspress3::prepareSequenceEntry(void)
+{
+  int trigger_mode;
+
+  if (!seqActive_ || seqPrepared_ || seqIndex_+1 >= seqLength_) {
+    return;
+  }
+  getIntegerParam(xsp3TriggerModeParam, &trigger_mode);
+  if (trigger_mode == 7) {
+    return;
+  }
+  applySequenceEntry(seqIndex_+1);
+  seqPrepared_ = (setupITFG() == asynSuccess);
+}
+
+/**
+ * Start the next entry of the acquisition sequence once the current one
+ * has been read out, without Acquire going back to 0.
+ * @return 1 if the next entry was started, 0 if there are no more entries,
+ * or -1 if it failed to start, in which case the acquisition is stopped.
+ */
+int Xspress3::startSequenceEntry(void)
+{
+  int xsp3_status = XSP3_OK;
+  int erasestart = 0;
+  int numChannels = 0;
+  int maxFrames = 0;
+  const char *functionName = "Xspress3::startSequenceEntry";
+
+  if (!seqActive_ || seqIndex_+1 >= seqLength_) {
+    return 0;
+  }
+
+  seqFrameOffset_ += seqRunNumImages_[seqIndex_];
+  seqIndex_++;
+  applySequenceEntry(seqIndex_);
+  setIntegerParam(xsp3SeqEntryParam, seqIndex_);
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s Starting sequence entry %d.\n", functionName, seqIndex_);
+
+  xsp3_status = xsp3->histogram_stop(xsp3_handle_, -1);
+  if (xsp3_status != XSP3_OK) {
+    checkStatus(xsp3_status, "xsp3_histogram_stop", functionName);
+  }
+  getIntegerParam(xsp3EraseStartParam, &erasestart);
+  if (erasestart && xsp3_status == XSP3_OK) {
+    getIntegerParam(xsp3NumChannelsParam, &numChannels);
+    getIntegerParam(xsp3NumFramesDriverParam, &maxFrames);
+    int numFrames = seqRunNumImages_[seqIndex_] < maxFrames ? seqRunNumImages_[seqIndex_] : maxFrames;
+    xsp3_status = xsp3->histogram_clear(xsp3_handle_, 0, numChannels, 0, numFrames);
+    if (xsp3_status != XSP3_OK) {
+      checkStatus(xsp3_status, "xsp3_histogram_clear", functionName);
+    }
+  }
+  if (xsp3_status == XSP3_OK && !seqPrepared_ && setupITFG() != asynSuccess) {
+    xsp3_status = XSP3_ERROR;
+  }
+  // Started as Acquire starts, the ITFG set up for this entry is used for the first start
+  if (xsp3_status == XSP3_OK && startHistogram(false, functionName) != asynSuccess) {
+    xsp3_status = XSP3_ERROR;
+  }
+  seqPrepared_ = false;
+
+  if (xsp3_status != XSP3_OK) {
+    setAcqStopParameters(true);
+    setStringParam(ADStatusMessage, "ERROR: sequence entry failed to start");
+    setIntegerParam(ADStatus, ADStatusError);
+    callParamCallbacks();
+    return -1;
+  }
+  return 1;
+}
+
+/**
+ * Start the histogram. The first histogram_start after a stop does not
+ * reliably arm the system, so the ITFG is set up and the histogram started
+ * a second time.
+ * @param setup Set up the ITFG before the first start, unless it already is
+ * @param parentFunction The caller, for the error message
+ * @return asynStatus
+ */
+asynStatus Xspress3::startHistogram(bool setup, const char *parentFunction)
+{
+  int xsp3_status = XSP3_OK;
+
+  if (setup) {
+    setupITFG();
+  }
+  xsp3_status = xsp3->histogram_start(xsp3_handle_, -1);
+  if (xsp3_status == XSP3_OK) {
+    setupITFG();
+    xsp3_status = xsp3->histogram_start(xsp3_handle_, -1);
+  }
+  if (xsp3_status != XSP3_OK) {
+    checkStatus(xsp3_status, "xsp3_histogram_start", parentFunction);
+    return asynError;
+  }
+  return asynSuccess;
+}
+
 /**
  * Function to map the database trigger mode
  * value to the macros defined by the API.
@@ -1139,6 +2253,7 @@ asynStatus Xspress3::setTriggerMode(int mode, int invert_f0, int invert_veto, in
     int xsp3_trigger_mode = 0;
 
     asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s Set Trigger Mode.\n", functionName);
+    itfgValid_ = false;
     getIntegerParam(xsp3NumCardsParam, &xsp3_num_cards);
     for (int card=0; card<xsp3_num_cards && status == asynSuccess; card++) {
         if ( card == 0 ) {
@@ -1217,39 +2332,37 @@ asynStatus Xspress3::writeInt32(asynUser *pasynUser, epicsInt32 value)
     if (value) {
       if (adStatus != ADStatusAcquire) {
 	if ((status = checkConnected()) == asynSuccess) {
+	  double startTime = xsp3ApiStats::now();
 	  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s Starting Data Collection.\n", functionName);
+	  startSequence();
 	  //MNewville: explicitly stop histogram before starting.
 	  getIntegerParam(xsp3NumFramesDriverParam, &xsp3_time_frames);
 	  getIntegerParam(xsp3NumChannelsParam, &xsp3_num_channels);
 	  xsp3_status = xsp3->histogram_stop(xsp3_handle_, -1);
+	  waitForErase(true);
+	  eraseFailed_ = false;
 	  // MNewville Sept 2021, use EraseOnStart to control whether to Erase before Acquire
 	  getIntegerParam(xsp3EraseStartParam, &xsp3_erasestart);
 	  // printf(" erase on start %d\n", xsp3_erasestart);
 	  if (xsp3_erasestart) {
-	    erase();
+	    erase(true);
 	    asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s Erased Before Data Collection\n", functionName);
 	  } else {
 	    asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s No Erase Before Data Collection\n", functionName);
 	  }
-	  setupITFG();
-	  xsp3_status = xsp3->histogram_start(xsp3_handle_, -1 );
-	  if (xsp3_status != XSP3_OK) {
-	    checkStatus(xsp3_status, "xsp3_histogram_start", functionName);
-	    status = asynError;
+	  status = startHistogram(true, functionName);
+	  if (status == asynSuccess) {
+	    eraseAcquiring_ = true;
+	    acqStartTime_ = startTime;
+	    setDoubleParam(xsp3StartTimeParam, xsp3ApiStats::now() - startTime);
+	    epicsEventSignal(this->startEvent_);
+	    asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s Started Data Collection.\n", functionName);
 	  } else {
-	    setupITFG(); 
-	    xsp3_status = xsp3->histogram_start(xsp3_handle_, -1 );
-		
-	    if (xsp3_status != XSP3_OK) {
-	      checkStatus(xsp3_status, "xsp3_histogram_start", functionName);
-	      status = asynError;
-	    }
-	    if (status == asynSuccess) {
-	      epicsEventSignal(this->startEvent_);
-	      asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s Started Data Collection.\n", functionName);
-	    } else {
-	      asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s Start Data Collection, failed.\n", functionName);
-	    }
+	    asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s Start Data Collection, failed.\n", functionName);
+	  }
+	  if (status != asynSuccess) {
+	    // Put back the AcquireTime and NumImages replaced by the first sequence entry
+	    endSequence();
 	  }
 	}
       }
@@ -1257,6 +2370,8 @@ asynStatus Xspress3::writeInt32(asynUser *pasynUser, epicsInt32 value)
       if (adStatus == ADStatusAcquire) {
 	  if ((status = checkConnected()) == asynSuccess) {
 	    asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s Stop Data Collection.\n", functionName);
+	    eraseCancel_ = true;
+	    seqActive_ = false;
 	    xsp3_status = xsp3->histogram_stop(xsp3_handle_, -1);
 	    if (xsp3_status != XSP3_OK) {
 		checkStatus(xsp3_status, "xsp3_histogram_stop", functionName);
@@ -1324,12 +2439,29 @@ asynStatus Xspress3::writeInt32(asynUser *pasynUser, epicsInt32 value)
       status = asynError;
     }
   }
+  else if (reconnecting_ && ((function == xsp3ConnectParam) || (function == xsp3DisconnectParam) ||
+                             (function == xsp3ReconnectParam))) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s ERROR: Reconnecting, try again when it is done.\n", functionName);
+    status = asynError;
+  }
   else if (function == xsp3ConnectParam) {
+    linkLost_ = false;
     status = connect();
   }
   else if (function == xsp3DisconnectParam) {
+    linkLost_ = false;
     status = disconnect();
   }
+  else if (function == xsp3ReconnectParam) {
+    if ((adStatus != ADStatusAcquire)) {
+      status = warmReconnect();
+      linkLost_ = (status != asynSuccess);
+      reconnectDelay_ = XSP3_RECONNECT_MIN_DELAY;
+    } else {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s ERROR: Reconnecting Not Allowed In This Mode.\n", functionName);
+      status = asynError;
+    }
+  }
   else if (function == xsp3SaveSettingsParam) {
     if ((adStatus != ADStatusAcquire)) {
       status = saveSettings();
@@ -1439,60 +2571,292 @@ asynStatus Xspress3::writeInt32(asynUser *pasynUser, epicsInt32 value)
     getIntegerParam(xsp3EraseStartParam, &xsp3_erasestart);
   }
 
-  else {
-    asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s No Matching Parameter In Xspress3 Driver.\n", functionName);
+  else if (function == xsp3ApiStatsParam) {
+    xsp3->getStats().enable(value != 0);
   }
 
-  if (status != asynSuccess) {
-    callParamCallbacks(addr);
-    return asynError;
+  else if (function == xsp3ConnectThreadsParam) {
+    if (value < 1) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s ERROR: At least one connect thread is needed.\n", functionName);
+      status = asynError;
+    }
   }
-
-  //The data readout thread will set ADAcquire back to false.
-  if (function == ADAcquire) {
-    if (!value) {
-      return status;
+  else if (function == xsp3SeqLengthParam) {
+    if (value < 0) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s ERROR: Sequence length must be 0 or more entries.\n", functionName);
+      status = asynError;
     }
   }
-
-  status = (asynStatus) setIntegerParam(addr, function, value);
-  if (status!=asynSuccess) {
-    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-	      "%s Error Setting Parameter. Asyn addr: %d, asynUser->reason: %d, value: %d\n",
-	      functionName, addr, function, value);
-    return(status);
+  else if (function == xsp3EraseChunkParam) {
+    if (value < 0) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s ERROR: Erase chunk must be 0 or more frames.\n", functionName);
+      status = asynError;
+    }
   }
-
-  //Do callbacks so higher layers see any changes
-  callParamCallbacks(addr);
-
-  return status;
-}
-
-
-/**
- * Reimplementing this function from ADDriver to deal with floating point values.
- */
-asynStatus Xspress3::writeFloat64(asynUser *pasynUser, epicsFloat64 value)
-{
-  int function = pasynUser->reason;
-  int addr = 0;
-  asynStatus status = asynSuccess;
-  const char *functionName = "Xspress3::writeFloat64";
-
-  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s Calling writeFloat64.\n", functionName);
-  //Read address (ie. channel number).
-  status = getAddress(pasynUser, &addr);
-  if (status!=asynSuccess) {
-    return(status);
+  else if (function == xsp3CompressParam) {
+    if ((value < xsp3CompressNone) || (value > xsp3CompressBloscZstd)) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s ERROR: Unknown compression codec %d.\n", functionName, value);
+      status = asynError;
+    }
   }
-  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s asynUser->reason: %d, value: %f, addr: %d\n", functionName, function, value, addr);
-
-  //Set in param lib so the user sees a readback straight away. We might overwrite this in the
-  //status task, depending on the parameter.
-  status = (asynStatus) setDoubleParam(function, value);
-
-  //Do callbacks so higher layers see any changes
+  else if (function == xsp3CompressLevelParam) {
+    if ((value < 1) || (value > 9)) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s ERROR: Compression level must be 1 to 9.\n", functionName);
+      status = asynError;
+    }
+  }
+  else if (function == xsp3CompressShuffleParam) {
+    if ((value < 0) || (value > 2)) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s ERROR: Shuffle must be 0 none, 1 byte or 2 bit.\n", functionName);
+      status = asynError;
+    }
+  }
+  else if (function == xsp3CompressThreadsParam) {
+    if (value < 1) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s ERROR: At least one compression thread is needed.\n", functionName);
+      status = asynError;
+    }
+  }
+  else if (function == xsp3H5ChunkFramesParam) {
+    if (value < 1) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s ERROR: An HDF5 chunk must hold at least one frame.\n", functionName);
+      status = asynError;
+    }
+  }
+  else if (function == xsp3ShmSlotsParam) {
+    if (value < 2) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s ERROR: The shared memory ring needs at least 2 slots.\n", functionName);
+      status = asynError;
+    }
+  }
+  else if (function == xsp3StreamCompressParam) {
+    if ((value < xsp3CompressNone) || (value > xsp3CompressBloscZstd)) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s ERROR: Unknown compression codec %d.\n", functionName, value);
+      status = asynError;
+    }
+  }
+  else if (function == xsp3StreamQueueParam) {
+    if (value < 1) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s ERROR: A stream client queue must hold at least one frame.\n", functionName);
+      status = asynError;
+    }
+  }
+  else if (function == xsp3StreamPolicyParam) {
+    if ((value != xsp3StreamDropOldest) && (value != xsp3StreamDisconnect)) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s ERROR: Unknown slow client policy %d.\n", functionName, value);
+      status = asynError;
+    }
+  }
+  else if ((function == xsp3StreamEnableParam) || (function == xsp3StreamPortParam)) {
+    int enable = 0, port = 0;
+    getIntegerParam(xsp3StreamEnableParam, &enable);
+    getIntegerParam(xsp3StreamPortParam, &port);
+    if (function == xsp3StreamEnableParam) {
+      enable = value;
+    } else {
+      port = value;
+    }
+    if ((port < 1) || (port > 65535)) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s ERROR: Stream port must be 1 to 65535.\n", functionName);
+      status = asynError;
+    } else {
+      status = startStreamServer(enable, port);
+    }
+  }
+  else if ((findRoiParam(xsp3ChanRoiLlmParam, function) >= 0) || (findRoiParam(xsp3ChanRoiHlmParam, function) >= 0)) {
+    int roi = findRoiParam(xsp3ChanRoiLlmParam, function);
+    int llm = value, hlm = value;
+    double low = 0, high = 0;
+    if (roi >= 0) {
+      getIntegerParam(addr, xsp3ChanRoiHlmParam[roi], &hlm);
+    } else {
+      roi = findRoiParam(xsp3ChanRoiHlmParam, function);
+      getIntegerParam(addr, xsp3ChanRoiLlmParam[roi], &llm);
+    }
+    getDoubleParam(xsp3RoiLowEnergyParam[roi], &low);
+    getDoubleParam(xsp3RoiHighEnergyParam[roi], &high);
+    if (high > low) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s ERROR: ROI %d is set in keV.\n", functionName, roi+1);
+      status = asynError;
+    } else if ((status = checkRoi(addr, roi+1, llm, hlm)) == asynSuccess) {
+      roiChanged_ = true;
+    }
+  }
+  else if (function == xsp3SparseParam) {
+    if ((value < xsp3SparseNone) || (value > xsp3SparseAuto)) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s ERROR: Unknown sparse encoding %d.\n", functionName, value);
+      status = asynError;
+    }
+  }
+  else if ((function == xsp3MapColumnsParam) || (function == xsp3MapRowsParam)) {
+    if (value < 1) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s ERROR: A map needs at least one row and one column.\n", functionName);
+      status = asynError;
+    }
+  }
+  else if (function == xsp3MapRowMarkerParam) {
+    if ((value < -1) || (value > 31)) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s ERROR: Row marker must be -1, or a marker input from 0 to 31.\n", functionName);
+      status = asynError;
+    }
+  }
+  else if ((function == xsp3SubFramesParam) || (function == xsp3SubFrameBitsParam) || (function == xsp3SubFrameDivideParam)) {
+    int maxSpectra = 0, connected = 0;
+    getIntegerParam(xsp3MaxSpectraParam, &maxSpectra);
+    getIntegerParam(xsp3ConnectedParam, &connected);
+    if (adStatus == ADStatusAcquire) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s ERROR: Sub-frames cannot be changed while acquiring.\n", functionName);
+      status = asynError;
+    } else if (value < 0 ||
+               ((function == xsp3SubFrameBitsParam) && ((value < 1) || (value > 16) || ((1 << value) > maxSpectra)))) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s ERROR: Sub-frame setting out of range.\n", functionName);
+      status = asynError;
+    } else if (connected) {
+      // The channels are formatted again straight away, so the next acquisition uses the new layout
+      int previous = 0;
+      getIntegerParam(function, &previous);
+      setIntegerParam(function, value);
+      getIntegerParam(xsp3NumChannelsParam, &xsp3_num_channels);
+      status = formatChannels(xsp3_num_channels);
+      if (status != asynSuccess) {
+        // Keep the rejected value out of the readback, and the channels in the layout it shows
+        setIntegerParam(function, previous);
+        formatChannels(xsp3_num_channels);
+      }
+    }
+  }
+
+  else if (function == xsp3ApiStatsResetParam) {
+    xsp3->getStats().reset();
+    updateApiStats();
+  }
+
+  else if (function == xsp3ApiStatsUpdateParam) {
+    updateApiStats();
+  }
+
+  else {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s No Matching Parameter In Xspress3 Driver.\n", functionName);
+  }
+
+  if (status != asynSuccess) {
+    callParamCallbacks(addr);
+    return asynError;
+  }
+
+  //The data readout thread will set ADAcquire back to false.
+  if (function == ADAcquire) {
+    if (!value) {
+      return status;
+    }
+  }
+
+  status = (asynStatus) setIntegerParam(addr, function, value);
+  if (status!=asynSuccess) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+	      "%s Error Setting Parameter. Asyn addr: %d, asynUser->reason: %d, value: %d\n",
+	      functionName, addr, function, value);
+    return(status);
+  }
+
+  //Do callbacks so higher layers see any changes
+  callParamCallbacks(addr);
+
+  return status;
+}
+
+
+/**
+ * Reimplementing this function from asynPortDriver to load the NumImages of
+ * each entry of the acquisition sequence.
+ */
+asynStatus Xspress3::writeInt32Array(asynUser *pasynUser, epicsInt32 *value, size_t nElements)
+{
+  int function = pasynUser->reason;
+  const char *functionName = "Xspress3::writeInt32Array";
+
+  if (function == xsp3SeqNumImagesParam) {
+    for (size_t i=0; i<nElements; i++) {
+      if (value[i] < 1) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s ERROR: Sequence entry %d has no images.\n", functionName, (int)i);
+        return asynError;
+      }
+    }
+    seqNumImages_.assign(value, value + nElements);
+    return asynSuccess;
+  }
+  return ADDriver::writeInt32Array(pasynUser, value, nElements);
+}
+
+/**
+ * Reimplementing this function from asynPortDriver to load the AcquireTime
+ * of each entry of the acquisition sequence.
+ */
+asynStatus Xspress3::writeFloat64Array(asynUser *pasynUser, epicsFloat64 *value, size_t nElements)
+{
+  int function = pasynUser->reason;
+  const char *functionName = "Xspress3::writeFloat64Array";
+
+  if (function == xsp3SeqAcquireTimeParam) {
+    for (size_t i=0; i<nElements; i++) {
+      if (!(value[i] > 0.0)) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s ERROR: Sequence entry %d has no acquire time.\n", functionName, (int)i);
+        return asynError;
+      }
+    }
+    seqAcquireTime_.assign(value, value + nElements);
+    return asynSuccess;
+  }
+  return ADDriver::writeFloat64Array(pasynUser, value, nElements);
+}
+
+/**
+ * Reimplementing this function from ADDriver to deal with floating point values.
+ */
+asynStatus Xspress3::writeFloat64(asynUser *pasynUser, epicsFloat64 value)
+{
+  int function = pasynUser->reason;
+  int addr = 0;
+  asynStatus status = asynSuccess;
+  const char *functionName = "Xspress3::writeFloat64";
+
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s Calling writeFloat64.\n", functionName);
+  //Read address (ie. channel number).
+  status = getAddress(pasynUser, &addr);
+  if (status!=asynSuccess) {
+    return(status);
+  }
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s asynUser->reason: %d, value: %f, addr: %d\n", functionName, function, value, addr);
+
+  if ((function == xsp3ChanCalOffsetParam) || (function == xsp3ChanCalGainParam) || (function == xsp3ChanCalQuadParam)) {
+    status = (asynStatus) setDoubleParam(addr, function, value);
+    convertRois();
+    alignChanged_ = true;
+    callParamCallbacks(addr);
+    return status;
+  }
+  if ((function == xsp3AlignOffsetParam) || (function == xsp3AlignGainParam)) {
+    if ((function == xsp3AlignGainParam) && (value <= 0)) {
+      asynPrint(pasynUser, ASYN_TRACE_ERROR, "%s Aligned sum gain must be greater than 0.\n", functionName);
+      return asynError;
+    }
+    status = (asynStatus) setDoubleParam(function, value);
+    alignChanged_ = true;
+    callParamCallbacks();
+    return status;
+  }
+  if ((findRoiParam(xsp3RoiLowEnergyParam, function) >= 0) || (findRoiParam(xsp3RoiHighEnergyParam, function) >= 0)) {
+    status = (asynStatus) setDoubleParam(function, value);
+    convertRois();
+    callParamCallbacks();
+    return status;
+  }
+
+  //Set in param lib so the user sees a readback straight away. We might overwrite this in the
+  //status task, depending on the parameter.
+  status = (asynStatus) setDoubleParam(function, value);
+
+  //Do callbacks so higher layers see any changes
   callParamCallbacks();
 
   return status;
@@ -1663,17 +3027,18 @@ bool Xspress3::createSCAArray(void *&pSCA)
 /**
  * Allocate an NDArray to put a detector frame into
  *
- * @param dims [maximum number of spectral bins, number of channels]
+ * @param dims [maximum number of spectral bins, number of channels], and the number of sub-frames if ndims is 3
  * @param pMCA Reference to a pointer to the NDArray that will be allocated
  * @param dataType The NDDataType_t of the NDArray (NDUInt32 or NDFloat64)
+ * @param ndims The number of dimensions, 2, or 3 in sub-frame mode
  *
  * @return true if an allocation error occurs otherwise false
  */
-bool Xspress3::createMCAArray(size_t dims[2], NDArray *&pMCA, NDDataType_t dataType)
+bool Xspress3::createMCAArray(size_t dims[], NDArray *&pMCA, NDDataType_t dataType, int ndims)
 {
     const char *functionName = "Xspress3::createMCAArray";
     bool error = false;
-    pMCA = this->pNDArrayPool->alloc(2, dims, dataType, 0, NULL);
+    pMCA = this->pNDArrayPool->alloc(ndims, dims, dataType, 0, NULL);
     if (pMCA == NULL) {
         asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s: ERROR: pNDArrayPool->alloc failed.\n", functionName);
         this->adReportError("Memory Error. Check IOC Log.");
@@ -1690,39 +3055,49 @@ bool Xspress3::createMCAArray(size_t dims[2], NDArray *&pMCA, NDDataType_t dataT
  * @param pMCAData A pointer to the array to hold the MCA
  * @param frameNumber The frame to read from the current capture
  * @param maxSpectra The maximum number of spectral bins in the MCA array
+ * @param numChannels The channels in the MCA array, which may be fewer than
+ *        the maximum, as given by getDims
  *
  * @return true if an allocation error occurs otherwise false
  */
-bool Xspress3::readFrame(double* pSCA, double* pMCAData, int frameNumber, int maxSpectra)
+bool Xspress3::readFrame(double* pSCA, double* pMCAData, int frameNumber, int maxSpectra, int numChannels)
 {
     bool error = false;
     int xsp3Status = 0;
     const char* functionName = "Xspress3::readFrame";
-    xsp3Status = xsp3->hist_dtc_read4d(this->xsp3_handle_, pMCAData, pSCA, 0, 0, 0, frameNumber, maxSpectra, 1, this->numChannels_, 1);
+    xsp3Status = xsp3->hist_dtc_read4d(this->xsp3_handle_, pMCAData, pSCA, 0, 0, 0, frameNumber, maxSpectra, 1, numChannels, 1);
 
     if (xsp3Status != XSP3_OK) {
         checkStatus(xsp3Status, "xsp3_hist_dtc_read4d", functionName);
         error = true;
     } else {
-        setIntegerParam(NDArrayCounter, frameNumber+1);
+        setIntegerParam(NDArrayCounter, acquisitionFrame(frameNumber+1));
     }
     if (circBuffer_ == 1) {
-          xsp3_histogram_circ_ack(this->xsp3_handle_, 0, frameNumber, this->numChannels_, 1);
+        xsp3Status = xsp3->histogram_circ_ack(this->xsp3_handle_, 0, frameNumber, this->numChannels_, 1);
+        if (xsp3Status != XSP3_OK) {
+            checkStatus(xsp3Status, "xsp3_histogram_circ_ack", functionName);
+            error = true;
+        }
     }
     return error;
 }
 
-bool Xspress3::readFrame(u_int32_t* pSCA, u_int32_t* pMCAData, int frameNumber, int maxSpectra)
+bool Xspress3::readFrame(u_int32_t* pSCA, u_int32_t* pMCAData, int frameNumber, int maxSpectra, int numChannels)
 {
     bool error = false;
     int xsp3Status = 0;
     const char* functionName = "Xspress3::readFrame";
-    xsp3Status = xsp3->histogram_read4d(this->xsp3_handle_, pMCAData, 0, 0, 0, frameNumber, maxSpectra, 1, this->numChannels_, 1);
+    if (subFrames_ > 1) {
+        xsp3Status = readSubFrameHistogram(pMCAData, frameNumber, numChannels);
+    } else {
+        xsp3Status = xsp3->histogram_read4d(this->xsp3_handle_, pMCAData, 0, 0, 0, frameNumber, maxSpectra, 1, numChannels, 1);
+    }
     if (xsp3Status != XSP3_OK) {
         checkStatus(xsp3Status, "xsp3_histogram_read4d", functionName);
         error = true;
     } else {
-        setIntegerParam(NDArrayCounter, frameNumber);
+        setIntegerParam(NDArrayCounter, acquisitionFrame(frameNumber));
         xsp3Status = xsp3->scaler_read(this->xsp3_handle_, pSCA, 0, 0, frameNumber, XSP3_SW_NUM_SCALERS, this->numChannels_, 1);
         if (xsp3Status != XSP3_OK) {
 	  checkStatus(xsp3Status, "xsp3_scaler_read", functionName);
@@ -1730,16 +3105,52 @@ bool Xspress3::readFrame(u_int32_t* pSCA, u_int32_t* pMCAData, int frameNumber,
         }
         else
         {
-        setIntegerParam(NDArrayCounter, frameNumber+1);
+        setIntegerParam(NDArrayCounter, acquisitionFrame(frameNumber+1));
     }
     }
 //    xsp3_histogram_circ_ack(this->xsp3_handle_, 0, frameOffset, this->numChannels_, 1);
     if (circBuffer_ == 1) {
-    	xsp3_histogram_circ_ack(this->xsp3_handle_, 0, frameNumber, this->numChannels_, 1);
+        xsp3Status = xsp3->histogram_circ_ack(this->xsp3_handle_, 0, frameNumber, this->numChannels_, 1);
+        if (xsp3Status != XSP3_OK) {
+            checkStatus(xsp3Status, "xsp3_histogram_circ_ack", functionName);
+            error = true;
+        }
     }
     return error;
 }
 
+/**
+ * Read the sub-frames of a frame into MCAData as subFrames_ images of
+ * bins x channels. The histogram holds the sub-frames of each channel
+ * together, in place of the auxiliary dimension, so the frame is read in
+ * one call and each channel's sub-frame spectra are copied into place.
+ *
+ * @param pMCAData A pointer to the array to hold the sub-frames
+ * @param frameNumber The frame to read from the current capture
+ * @param numChannels The channels in the array, as given by getDims
+ *
+ * @return the status of xsp3_histogram_read4d
+ */
+int Xspress3::readSubFrameHistogram(u_int32_t* pMCAData, int frameNumber, int numChannels)
+{
+    const size_t bins = (size_t) 1 << subFrameBits_;
+    const size_t subFrames = subFrames_;
+    const size_t channels = numChannels;
+    int xsp3Status;
+
+    subFrameBuffer_.resize(bins*subFrames*channels);
+    xsp3Status = xsp3->histogram_read4d(this->xsp3_handle_, &subFrameBuffer_[0], 0, 0, 0, frameNumber, bins, subFrames, channels, 1);
+    if (xsp3Status == XSP3_OK) {
+        for (size_t chan = 0; chan < channels; chan++) {
+            const u_int32_t *pSpectra = &subFrameBuffer_[chan*subFrames*bins];
+            for (size_t sf = 0; sf < subFrames; sf++) {
+                memcpy(pMCAData + (sf*channels + chan)*bins, pSpectra + sf*bins, bins*sizeof(u_int32_t));
+            }
+        }
+    }
+    return xsp3Status;
+}
+
 /**
  * A shortcut to wait for the stop event and print diagnostics if necessary
  *
@@ -1851,8 +3262,84 @@ void Xspress3::writeOutScas(void *&pSCA, int numChannels, NDDataType_t dataType)
  */
 void Xspress3::setStartingParameters()
 {
-    this->setIntegerParam(this->NDArrayCounter, 0);
-    this->setIntegerParam(this->xsp3FrameCountParam, 0);
+    int flyScan, numFrames, rows, compress, level, shuffle, threads, h5Enable, shmEnable;
+    int streamCompress, streamQueue, streamPolicy, liveMap;
+    char h5FileName[maxStringSize_] = {0};
+    char shmName[maxStringSize_] = {0};
+
+    // The map geometry is fixed for the acquisition, as the data task uses it without the lock.
+    // A sequence is one acquisition, so the counters, compression, shared memory
+    // and stream are only set up, and the map read, for its first entry.
+    bool newAcquisition = !seqRestore_ || seqIndex_ == 0;
+    this->getIntegerParam(ADNumImages, &numFrames);
+    if (newAcquisition) {
+        this->setIntegerParam(this->NDArrayCounter, 0);
+        this->setIntegerParam(this->xsp3FrameCountParam, 0);
+        this->getIntegerParam(this->xsp3FlyScanParam, &flyScan);
+        this->getIntegerParam(this->xsp3MapColumnsParam, &mapColumns_);
+        this->getIntegerParam(this->xsp3MapRowsParam, &rows);
+        this->getIntegerParam(this->xsp3MapSnakeParam, &mapSnake_);
+        this->getIntegerParam(this->xsp3MapRowMarkerParam, &mapRowMarker_);
+        this->getIntegerParam(this->xsp3SparseParam, &sparse_);
+        this->getIntegerParam(this->xsp3CompressParam, &compress);
+        this->getIntegerParam(this->xsp3CompressLevelParam, &level);
+        this->getIntegerParam(this->xsp3CompressShuffleParam, &shuffle);
+        this->getIntegerParam(this->xsp3CompressThreadsParam, &threads);
+        if (compressPool_.configure(compress, level, shuffle, threads) < 1 && compress != xsp3CompressNone) {
+            asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                      "Xspress3::setStartingParameters could not start compression threads, frames will not be compressed.\n");
+        }
+        compressPool_.resetStats();
+        compressFailures_ = 0;
+        this->setDoubleParam(this->xsp3CompressRatioParam, 1.0);
+        this->setDoubleParam(this->xsp3CompressTimeParam, 0.0);
+        this->setIntegerParam(this->xsp3CompressFailuresParam, 0);
+        this->getIntegerParam(this->xsp3ShmEnableParam, &shmEnable);
+        this->getStringParam(this->xsp3ShmNameParam, maxStringSize_, shmName);
+        this->getIntegerParam(this->xsp3ShmSlotsParam, &shmSlots_);
+        shmEnable_ = (shmEnable != 0);
+        shmName_ = shmName;
+        this->getIntegerParam(this->xsp3StreamCompressParam, &streamCompress);
+        this->getIntegerParam(this->xsp3StreamQueueParam, &streamQueue);
+        this->getIntegerParam(this->xsp3StreamPolicyParam, &streamPolicy);
+        streamServer_.configure(streamCompress, level, shuffle, streamQueue, streamPolicy);
+        streamAcquisition_++;
+        updateStreamStats();
+    }
+    // The entries of a sequence all go to the file opened for the first
+    if (!h5Writer_.isOpen()) {
+        this->getIntegerParam(this->xsp3H5EnableParam, &h5Enable);
+        this->getStringParam(this->xsp3H5FileNameParam, maxStringSize_, h5FileName);
+        this->getIntegerParam(this->xsp3H5ChunkFramesParam, &h5ChunkFrames_);
+        this->getIntegerParam(this->xsp3H5SwmrParam, &h5Swmr_);
+        h5Enable_ = (h5Enable != 0);
+        h5FileName_ = h5FileName;
+        this->setIntegerParam(this->xsp3H5FramesParam, 0);
+    }
+    // The spectrum length may have changed since the ROIs were converted
+    convertRois();
+    markersFirst_ = markersEnd_ = 0;
+    alignChanged_ = true;
+    if (newAcquisition) {
+        flyScan_ = (flyScan != 0);
+        mapRow_ = mapIndex_ = mapColumn_ = 0;
+        this->getIntegerParam(this->xsp3LiveMapParam, &liveMap);
+        this->getDoubleParam(this->xsp3LiveMapPeriodParam, &liveMapPeriod_);
+        startLiveMap(liveMap != 0, rows);
+        this->setIntegerParam(this->xsp3MapRowParam, 0);
+        this->setIntegerParam(this->xsp3MapColumnParam, 0);
+        if (seqRestore_) {
+            numFrames = 0;
+            for (int entry = 0; entry < seqLength_; entry++) {
+                numFrames += seqRunNumImages_[entry];
+            }
+        }
+        if (flyScan_ && mapRowMarker_ < 0 && numFrames != rows*mapColumns_) {
+            asynPrint(this->pasynUserSelf, ASYN_TRACE_WARNING,
+                      "Xspress3::setStartingParameters %d frames will not fill a map of %d rows of %d columns.\n",
+                      numFrames, rows, mapColumns_);
+        }
+    }
     this->setIntegerParam(this->ADStatus, ADStatusAcquire);
     this->setStringParam(this->ADStatusMessage, "Acquiring Data");
     this->callParamCallbacks();
@@ -1868,7 +3355,8 @@ const NDDataType_t Xspress3::getDataType()
 {
     int deadTimeCorrect;
     this->getIntegerParam(this->xsp3DtcEnableParam, &deadTimeCorrect);
-    if (deadTimeCorrect) {
+    // Sub-frames share the scalers of their frame, so cannot be corrected
+    if (deadTimeCorrect && subFrames_ < 2) {
         return NDFloat64;
     } else {
         return NDUInt32;
@@ -1877,22 +3365,114 @@ const NDDataType_t Xspress3::getDataType()
 
 /**
  * Get the dimensions of a frame from the xsp3 parameters
- * as [maxSpectra, numChannels]
+ * as [maxSpectra, numChannels], or in sub-frame mode as
+ * [2^SUB_FRAME_BITS, numChannels, subFrames]
  *
  * @param dims A reference to an array to store the dimensions in
+ * @return the number of dimensions
  */
-void Xspress3::getDims(size_t (&dims)[2])
+int Xspress3::getDims(size_t (&dims)[3])
 {
     int numChannels, maxSpectra;
     this->getIntegerParam(this->xsp3NumChannelsParam, &numChannels);
     this->getIntegerParam(this->xsp3MaxSpectraParam, &maxSpectra);
     dims[0] = maxSpectra;
     dims[1] = numChannels;
+    dims[2] = 1;
+    if (subFrames_ > 1) {
+        dims[0] = (size_t) 1 << subFrameBits_;
+        dims[2] = subFrames_;
+        return 3;
+    }
+    return 2;
+}
+
+/**
+ * In fly scan mode read the marker inputs of the frames from first up to
+ * last in one call, unless the markers of first have already been read.
+ * At most XSP3_MARKER_READ_MAX frames are read at a time. If the read
+ * fails the markers of those frames are taken as 0.
+ *
+ * @param first The next frame to be read out
+ * @param last The number of frames acquired so far
+ */
+void Xspress3::readMarkers(int first, int last)
+{
+    const char *functionName = "Xspress3::readMarkers";
+    int xsp3Status;
+
+    if (!flyScan_ || (first >= markersFirst_ && first < markersEnd_)) {
+        return;
+    }
+    if (last - first > XSP3_MARKER_READ_MAX) {
+        last = first + XSP3_MARKER_READ_MAX;
+    }
+    markers_.assign(last - first, 0);
+    xsp3Status = xsp3->histogram_get_tf_markers(this->xsp3_handle_, 0, first, last - first, &markers_[0]);
+    if (xsp3Status < XSP3_OK) {
+        checkStatus(xsp3Status, "xsp3_histogram_get_tf_markers", functionName);
+        markers_.assign(last - first, 0);
+    }
+    markersFirst_ = first;
+    markersEnd_ = last;
+}
+
+/**
+ * If SPARSE is set, replace a frame of uncorrected spectra with its sparse
+ * encoding (see xsp3Sparse.h), a 1D NDUInt32 array, and record the
+ * encoding, its length and the frame's dimensions as attributes to decode
+ * it with. Every frame of an acquisition has the same shape, so the array
+ * is padded with zeros to the longest encoding of that shape; file writers
+ * such as NDFileHDF5 take the dimensions from the first frame. Dead time
+ * corrected frames are left dense.
+ *
+ * @param pMCA A reference to a pointer to the frame, released if it is replaced
+ */
+void Xspress3::sparseEncode(NDArray *&pMCA)
+{
+    const char *functionName = "Xspress3::sparseEncode";
+    NDArray *pSparse;
+    NDArrayInfo_t info;
+    int encoding, bins, channels, subFrames, encodedWords;
+    size_t nonZero, words, maxWords;
+
+    if (sparse_ == xsp3SparseNone || pMCA->dataType != NDUInt32) {
+        return;
+    }
+    bins = pMCA->dims[0].size;
+    channels = pMCA->dims[1].size;
+    subFrames = (pMCA->ndims > 2) ? pMCA->dims[2].size : 1;
+    pMCA->getInfo(&info);
+
+    nonZero = xsp3SparseNonZero(static_cast<uint32_t*>(pMCA->pData), bins, channels*subFrames);
+    encoding = xsp3SparseChoose(sparse_, bins, channels*subFrames, nonZero);
+    words = xsp3SparseSize(encoding, bins, channels*subFrames, nonZero);
+    maxWords = xsp3SparseMaxSize(sparse_, bins, channels*subFrames);
+    pSparse = this->pNDArrayPool->alloc(1, &maxWords, NDUInt32, 0, NULL);
+    if (pSparse == NULL) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s: ERROR: pNDArrayPool->alloc failed, sending the frame dense.\n", functionName);
+        return;
+    }
+    xsp3SparseEncode(encoding, static_cast<uint32_t*>(pMCA->pData), bins, channels*subFrames, static_cast<uint32_t*>(pSparse->pData));
+    memset(static_cast<uint32_t*>(pSparse->pData) + words, 0, (maxWords - words)*sizeof(uint32_t));
+    encodedWords = (int) words;
+    pSparse->pAttributeList->add("SPARSE_ENCODING", "Sparse encoding, 1 pairs or 2 bitmap", NDAttrInt32, &encoding);
+    pSparse->pAttributeList->add("SPARSE_WORDS", "Words of the encoding, before the padding", NDAttrInt32, &encodedWords);
+    pSparse->pAttributeList->add("SPARSE_BINS", "Bins of each encoded spectrum", NDAttrInt32, &bins);
+    pSparse->pAttributeList->add("SPARSE_CHANNELS", "Channels in the encoded frame", NDAttrInt32, &channels);
+    pSparse->pAttributeList->add("SPARSE_SUB_FRAMES", "Sub-frames in the encoded frame", NDAttrInt32, &subFrames);
+    pMCA->release();
+    pMCA = pSparse;
+
+    this->lock();
+    setDoubleParam(xsp3SparseRatioParam, (double) (words*sizeof(uint32_t))/info.totalBytes);
+    this->unlock();
 }
 
 /**
  * Sets the uniqueId of *pMCA to the frame number and sets the timeStamp
- * to the current time.
+ * to the current time. In fly scan mode also adds the map position of the
+ * frame, and the markers it was read with, as attributes.
  *
  * @param pMCA A reference to a pointer to an NDArray
  * @param frameNumber The number of the frame to be written to pMCA->uniqueId
@@ -1906,6 +3486,48 @@ void Xspress3::setNDArrayAttributes(NDArray *&pMCA, int frameNumber)
     pMCA->uniqueId = frameNumber;
     pMCA->timeStamp = currentTime.secPastEpoch + currentTime.nsec/1e9;
     pMCA->pAttributeList->add("TIMESTAMP", "Host Timestamp", NDAttrFloat64, &(pMCA->timeStamp));
+    if (seqRestore_ && frameNumber >= 0) {
+        // Number frames through the whole sequence, and mark the entry each came from
+        pMCA->uniqueId = acquisitionFrame(frameNumber);
+        pMCA->pAttributeList->add("SEQ_ENTRY", "Acquisition sequence entry", NDAttrInt32, &seqIndex_);
+        pMCA->pAttributeList->add("SEQ_FRAME", "Frame within the sequence entry", NDAttrInt32, &frameNumber);
+    }
+    if (flyScan_ && frameNumber > 0) {
+        // frameNumber has already been counted, so this is frame frameNumber-1 of
+        // this entry; the map runs on through all the entries of a sequence
+        int frame = frameNumber - 1;
+        int mapFrame = acquisitionFrame(frame);
+        int markers = 0;
+        int column;
+
+        if (frame >= markersFirst_ && frame < markersEnd_) {
+            markers = markers_[frame - markersFirst_];
+        }
+        if (mapRowMarker_ < 0) {
+            mapRow_ = mapFrame / mapColumns_;
+            mapIndex_ = mapFrame % mapColumns_;
+        } else if (mapFrame > 0) {
+            // Rows are started by the marker, so the row length need not match MAP_COLUMNS
+            if (markers & (1 << mapRowMarker_)) {
+                mapRow_++;
+                mapIndex_ = 0;
+            } else {
+                mapIndex_++;
+            }
+        }
+        column = mapIndex_;
+        if (mapSnake_ && (mapRow_ & 1) && mapIndex_ < mapColumns_) {
+            column = mapColumns_ - 1 - mapIndex_;
+        }
+        mapColumn_ = column;
+        pMCA->pAttributeList->add("MAP_ROW", "Map row of the frame", NDAttrInt32, &mapRow_);
+        pMCA->pAttributeList->add("MAP_COLUMN", "Map column of the frame", NDAttrInt32, &column);
+        pMCA->pAttributeList->add("MAP_MARKERS", "Marker inputs of the frame", NDAttrInt32, &markers);
+        this->lock();
+        this->setIntegerParam(this->xsp3MapRowParam, mapRow_);
+        this->setIntegerParam(this->xsp3MapColumnParam, column);
+        this->unlock();
+    }
     this->getAttributes(pMCA->pAttributeList);
 }
 
@@ -1917,13 +3539,34 @@ void Xspress3::setNDArrayAttributes(NDArray *&pMCA, int frameNumber)
 void Xspress3::setAcqStopParameters(bool aborted)
 {
     this->setIntegerParam(ADAcquire, ADAcquireFalse_);
-    if (aborted) {
+    if (aborted && eraseFailed_) {
+        this->setIntegerParam(ADStatus, ADStatusError);
+        this->setStringParam(ADStatusMessage, "ERROR: Acquisition overtook erase");
+    } else if (aborted) {
         this->setIntegerParam(ADStatus, ADStatusAborted);
         this->setStringParam(ADStatusMessage, "Stopped Acquiring");
     } else {
         this->setIntegerParam(ADStatus, ADStatusIdle);
         this->setStringParam(ADStatusMessage, "Completed Acquisition");
+
+        // Time from Acquire to the last frame being read out, and how much of it was not counting
+        int numImages;
+        double acquireTime;
+        double countTime = 0.0;
+        double pointTime = xsp3ApiStats::now() - acqStartTime_;
+        if (seqRestore_) {
+            for (int entry=0; entry<seqLength_; entry++) {
+                countTime += seqRunNumImages_[entry]*seqRunAcquireTime_[entry];
+            }
+        } else {
+            this->getIntegerParam(ADNumImages, &numImages);
+            this->getDoubleParam(ADAcquireTime, &acquireTime);
+            countTime = numImages*acquireTime;
+        }
+        this->setDoubleParam(xsp3PointTimeParam, pointTime);
+        this->setDoubleParam(xsp3PointOverheadParam, pointTime - countTime);
     }
+    this->endSequence();
     this->callParamCallbacks();
 }
 
@@ -1964,85 +3607,784 @@ void Xspress3::doNDCallbacksIfRequired(NDArray *pMCA)
     }
 }
 
-int Xspress3::getNumFramesRead()
+/**
+ * Publish a frame read out by the data task. With a codec set the frame is
+ * queued for compression, and the frames compressed so far are published in
+ * the order they were read out; otherwise it is published straight away.
+ * Either way the frame is released.
+ *
+ * @param pMCA The frame
+ */
+void Xspress3::publishFrame(NDArray *pMCA)
 {
-    int numFrames = 0;
-    int xsp3Status = xsp3->scaler_check_progress(this->xsp3_handle_);
-    if (xsp3Status < XSP3_OK) {
-        this->checkStatus(xsp3Status, "xsp3_dma_check_desc", "getNumFrameRead");
-    } else {
-        numFrames = xsp3Status;
-        this->setIntegerParam(xsp3FrameCountParam, numFrames);
+    int arrayCallbacks = 0;
+
+    this->getIntegerParam(NDArrayCallbacks, &arrayCallbacks);
+    if (compressPool_.getCodec() == xsp3CompressNone || !arrayCallbacks) {
+        this->doNDCallbacksIfRequired(pMCA);
+        pMCA->release();
+        return;
     }
-    return numFrames;
+    while (!compressPool_.submit(pMCA)) {
+        publishCompressed(true);
+    }
+    publishCompressed(false);
 }
 
-void Xspress3::xspAsynPrint(int asynPrintType, const char *format, ...)
+/**
+ * Publish the frames at the front of the compression queue that are done,
+ * and update the compression statistics.
+ *
+ * @param wait Wait for the oldest frame, and publish at least that one
+ */
+void Xspress3::publishCompressed(bool wait)
 {
-    const int maxMessageLen=1024;
-    va_list pArg;
-    char message[maxMessageLen];
-    va_start(pArg, format);
-    vsprintf(message, format, pArg);
-    asynPrint(this->pasynUserSelf, asynPrintType, message);
-    va_end(pArg);
+    const char *functionName = "Xspress3::publishCompressed";
+    NDArray *pArray;
+    unsigned long frames, failures;
+    double ratio, cpuTime;
+
+    while ((pArray = compressPool_.take(wait)) != NULL) {
+        this->doNDCallbacksIfRequired(pArray);
+        pArray->release();
+        wait = false;
+    }
+    compressPool_.getStats(&frames, &failures, &ratio, &cpuTime);
+    if (failures > compressFailures_) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s: ERROR: Frame sent uncompressed: %s\n",
+                  functionName, compressPool_.getError().c_str());
+        compressFailures_ = failures;
+    }
+    this->lock();
+    setDoubleParam(xsp3CompressRatioParam, ratio);
+    setDoubleParam(xsp3CompressTimeParam, cpuTime);
+    setIntegerParam(xsp3CompressFailuresParam, (int) failures);
+    this->unlock();
 }
 
 /**
- * A function, ordinarily to be run in a seperate thread, to wait for
- * and then execute acquisitions.
+ * Publish the frames still being compressed, at the end of an acquisition.
+ */
+void Xspress3::flushFrames(void)
+{
+    while (!compressPool_.empty()) {
+        publishCompressed(true);
+    }
+    this->lock();
+    this->callParamCallbacks();
+    this->unlock();
+}
+
+/**
+ * Create the HDF5 file for an acquisition, if the writer is enabled and
+ * the file is not already open for an earlier entry of the sequence. The
+ * file name, chunk size and SWMR setting were cached by
+ * setStartingParameters.
  *
- * @param xspAD A pointer to an instance of Xspress3
+ * @param dims The dimensions of a frame, as for createMCAArray
+ * @param ndims The number of dimensions of a frame
+ * @param dataType NDFloat64 for dead time corrected frames, otherwise NDUInt32
  */
-static void xsp3DataTaskC(void *xspAD)
+void Xspress3::openH5File(size_t dims[], int ndims, NDDataType_t dataType)
 {
-    Xspress3 *pXspAD = (Xspress3 *)xspAD;
-    void *pSCA;
-    NDArray *pMCA;
-    NDDataType_t dataType;
-    bool acquire=false;
-    bool aborted=false;
-    bool error=false;
+    const char *functionName = "Xspress3::openH5File";
+    std::string message;
 
-    int numChannels, maxSpectra, frameNumber, numFrames=0, acquired, lastAcquired;
-    //int frame_count, last_frame_count, frame_counter, frames_remaining, frame_offset;
-    size_t dims[2];
-    const double timeout = 0.00001;
-    const int checkTimes = 20;
-    // const char* functionName = "Xspress3::xps3DataTaskC";
-    // The scalar array can be reused so create it now
-    pXspAD->createSCAArray(pSCA);
-    // getIntegerParam(xsp3NumFramesDriverParam, &maxNumFrames);
+    if (!h5Enable_ || h5Writer_.isOpen()) {
+        return;
+    }
+    if (h5Writer_.open(h5FileName_.c_str(), ndims, dims, dataType == NDFloat64, this->numChannels_,
+                       h5ChunkFrames_, h5Swmr_ != 0) == 0) {
+        message = "Writing " + h5FileName_;
+    } else {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s: ERROR: %s: %s\n",
+                  functionName, h5FileName_.c_str(), h5Writer_.getError().c_str());
+        message = "Error: " + h5Writer_.getError();
+    }
+    this->lock();
+    this->setStringParam(this->xsp3H5MessageParam, message.c_str());
+    this->callParamCallbacks();
+    this->unlock();
+}
+
+/**
+ * Add a frame and its scalers to the HDF5 file, before the frame is
+ * encoded or compressed for publishing. The file is closed if a write fails.
+ *
+ * @param pMCA The frame as read out
+ * @param pSCA The scalers of the frame
+ */
+void Xspress3::writeH5Frame(NDArray *pMCA, void *pSCA)
+{
+    const char *functionName = "Xspress3::writeH5Frame";
+    unsigned long frames = h5Writer_.getFrames();
+
+    if (!h5Writer_.isOpen()) {
+        return;
+    }
+    if (h5Writer_.write(pMCA->pData, pSCA) != 0) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s: ERROR: %s, closing %s\n",
+                  functionName, h5Writer_.getError().c_str(), h5FileName_.c_str());
+        h5Writer_.close();
+        this->lock();
+        this->setStringParam(this->xsp3H5MessageParam, ("Error: " + h5Writer_.getError()).c_str());
+        this->setIntegerParam(this->xsp3H5FramesParam, (int) h5Writer_.getFrames());
+        this->unlock();
+    } else if (h5Writer_.getFrames() != frames) {
+        this->lock();
+        this->setIntegerParam(this->xsp3H5FramesParam, (int) h5Writer_.getFrames());
+        this->unlock();
+    }
+}
+
+/**
+ * Write the last partial chunk and close the HDF5 file, at the end of an
+ * acquisition or of the last entry of a sequence.
+ */
+void Xspress3::closeH5File(void)
+{
+    const char *functionName = "Xspress3::closeH5File";
+    std::string message;
+
+    if (!h5Writer_.isOpen()) {
+        return;
+    }
+    if (h5Writer_.close() == 0) {
+        message = "Closed " + h5FileName_;
+    } else {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s: ERROR: %s: %s\n",
+                  functionName, h5FileName_.c_str(), h5Writer_.getError().c_str());
+        message = "Error: " + h5Writer_.getError();
+    }
+    this->lock();
+    this->setStringParam(this->xsp3H5MessageParam, message.c_str());
+    this->setIntegerParam(this->xsp3H5FramesParam, (int) h5Writer_.getFrames());
+    this->callParamCallbacks();
+    this->unlock();
+}
+
+/**
+ * Set up the shared memory ring for an acquisition if it is enabled, or
+ * remove it if not. A ring that already fits the frames is kept, so its
+ * readers carry on from one acquisition to the next.
+ *
+ * @param dims The dimensions of a frame, as for createMCAArray
+ * @param ndims The number of dimensions of a frame
+ * @param dataType NDFloat64 for dead time corrected frames, otherwise NDUInt32
+ * @param newAcquisition false for the later entries of a sequence, which
+ *        carry on the acquisition of the first
+ */
+void Xspress3::openShmRing(size_t dims[], int ndims, NDDataType_t dataType, bool newAcquisition)
+{
+    const char *functionName = "Xspress3::openShmRing";
+    size_t elementBytes = (dataType == NDFloat64) ? sizeof(epicsFloat64) : sizeof(epicsUInt32);
+    size_t dataBytes = elementBytes;
+    std::string message;
+
+    if (!shmEnable_) {
+        if (shmWriter_.isOpen()) {
+            shmWriter_.close();
+            this->lock();
+            this->setStringParam(this->xsp3ShmMessageParam, "Removed");
+            this->callParamCallbacks();
+            this->unlock();
+        }
+        return;
+    }
+    shmFrame_.ndims = ndims;
+    shmFrame_.dims[2] = 1;
+    for (int i = 0; i < ndims; i++) {
+        shmFrame_.dims[i] = dims[i];
+        dataBytes *= dims[i];
+    }
+    shmFrame_.dataType = (dataType == NDFloat64) ? xsp3ShmFloat64 : xsp3ShmUInt32;
+    shmFrame_.numChannels = this->numChannels_;
+    shmFrame_.numScalers = XSP3_SW_NUM_SCALERS;
+    shmFrame_.dataBytes = dataBytes;
+    shmFrame_.scalerBytes = elementBytes*this->numChannels_*XSP3_SW_NUM_SCALERS;
+    if (newAcquisition) {
+        shmFrame_.acquisition++;
+    }
+    if (shmWriter_.open(shmName_.c_str(), shmSlots_, shmFrame_.dataBytes + shmFrame_.scalerBytes) == 0) {
+        message = "Writing " + shmName_;
+    } else {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s: ERROR: %s: %s\n",
+                  functionName, shmName_.c_str(), shmWriter_.getError().c_str());
+        message = "Error: " + shmWriter_.getError();
+    }
+    this->lock();
+    this->setStringParam(this->xsp3ShmMessageParam, message.c_str());
+    this->callParamCallbacks();
+    this->unlock();
+}
+
+/**
+ * Copy a frame and its scalers, as read out, to the shared memory ring.
+ *
+ * @param pMCA The frame
+ * @param pSCA The scalers of the frame
+ * @param frameNumber The frame of the current sequence entry, or of the
+ *        acquisition, from 0
+ */
+void Xspress3::writeShmFrame(NDArray *pMCA, void *pSCA, int frameNumber)
+{
+    const char *functionName = "Xspress3::writeShmFrame";
+    epicsTimeStamp now;
+
+    if (!shmWriter_.isOpen()) {
+        return;
+    }
+    epicsTimeGetCurrent(&now);
+    shmFrame_.frameNumber = acquisitionFrame(frameNumber);
+    shmFrame_.timeStamp = now.secPastEpoch + POSIX_TIME_AT_EPICS_EPOCH + now.nsec/1e9;
+    if (shmWriter_.write(shmFrame_, pMCA->pData, pSCA) != 0) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s: ERROR: %s\n",
+                  functionName, shmWriter_.getError().c_str());
+        return;
+    }
+    this->lock();
+    this->setIntegerParam(this->xsp3ShmFramesParam, (int) shmWriter_.getWritten());
+    this->unlock();
+}
+
+/**
+ * Start or stop the frame streaming server. Changing the port restarts it,
+ * which disconnects the clients.
+ *
+ * @param enable Listen for clients if non-zero
+ * @param port The TCP port to listen on
+ */
+asynStatus Xspress3::startStreamServer(int enable, int port)
+{
+    const char *functionName = "Xspress3::startStreamServer";
+    asynStatus status = asynSuccess;
+    char message[maxStringSize_];
+
+    if (!enable) {
+        streamServer_.stop();
+        this->setStringParam(this->xsp3StreamMessageParam, "Stopped");
+    } else if (streamServer_.start(port) == 0) {
+        epicsSnprintf(message, sizeof(message), "Listening on port %d", streamServer_.getPort());
+        this->setStringParam(this->xsp3StreamMessageParam, message);
+    } else {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s: ERROR: port %d: %s\n",
+                  functionName, port, streamServer_.getError().c_str());
+        epicsSnprintf(message, sizeof(message), "Error: %s", streamServer_.getError().c_str());
+        this->setStringParam(this->xsp3StreamMessageParam, message);
+        status = asynError;
+    }
+    updateStreamStats();
+    return status;
+}
+
+/**
+ * Copy the stream server's counters to their parameters. Called with the lock held.
+ */
+void Xspress3::updateStreamStats(void)
+{
+    int clients;
+    unsigned long frames, dropped, disconnected;
+
+    streamServer_.getStats(&clients, &frames, &dropped, &disconnected);
+    this->setIntegerParam(this->xsp3StreamClientsParam, clients);
+    this->setIntegerParam(this->xsp3StreamFramesParam, (int) frames);
+    this->setIntegerParam(this->xsp3StreamDroppedParam, (int) dropped);
+}
+
+/**
+ * Send a frame and its scalers, as read out, to the stream clients. The
+ * frame is queued without copying, so the data task never waits for them.
+ *
+ * @param pMCA The frame
+ * @param pSCA The scalers of the frame
+ * @param frameNumber The frame of the current sequence entry, or of the
+ *        acquisition, from 0
+ */
+void Xspress3::streamFrame(NDArray *pMCA, void *pSCA, int frameNumber)
+{
+    size_t elementBytes = (pMCA->dataType == NDFloat64) ? sizeof(epicsFloat64) : sizeof(epicsUInt32);
+    xsp3StreamHeader_t info;
+    epicsTimeStamp now;
+
+    if (!streamServer_.isRunning()) {
+        return;
+    }
+    memset(&info, 0, sizeof(info));
+    epicsTimeGetCurrent(&now);
+    info.acquisition = streamAcquisition_;
+    info.frameNumber = acquisitionFrame(frameNumber);
+    info.timeStamp = now.secPastEpoch + POSIX_TIME_AT_EPICS_EPOCH + now.nsec/1e9;
+    info.numScalers = XSP3_SW_NUM_SCALERS;
+    info.scalerBytes = elementBytes*this->numChannels_*XSP3_SW_NUM_SCALERS;
+    if (!streamServer_.submit(pMCA, info, pSCA)) {
+        return;
+    }
+    this->lock();
+    updateStreamStats();
+    this->unlock();
+}
+
+/**
+ * The ROI of a parameter created for each ROI.
+ *
+ * @param params The parameter of each ROI
+ * @param function The parameter to look for
+ * @return The ROI, from 0, or -1 if function is not one of params
+ */
+int Xspress3::findRoiParam(const int params[], int function)
+{
+    for (int roi = 0; roi < XSP3_NUM_ROIS; roi++) {
+        if (params[roi] == function) {
+            return roi;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Convert the ROIs set in keV to bins on each channel through the channel's
+ * calibration, setting their low and high limits. Only called when a
+ * calibration, an ROI or the spectrum length changes, with the lock held.
+ */
+void Xspress3::convertRois(void)
+{
+    const char *functionName = "Xspress3::convertRois";
+    size_t dims[3];
+    int bins, invalid = 0;
+    char message[maxStringSize_] = {0};
+
+    getDims(dims);
+    bins = (int) dims[0];
+    for (int chan = 0; chan < numChannels_; chan++) {
+        xsp3EnergyCal_t cal;
+        this->getDoubleParam(chan, this->xsp3ChanCalOffsetParam, &cal.offset);
+        this->getDoubleParam(chan, this->xsp3ChanCalGainParam, &cal.gain);
+        this->getDoubleParam(chan, this->xsp3ChanCalQuadParam, &cal.quad);
+        bool valid = xsp3EnergyCalValid(cal, bins);
+        if (!valid && invalid++ == 0) {
+            epicsSnprintf(message, sizeof(message), "Channel %d calibration does not rise over the spectrum", chan+1);
+            asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s: ERROR: %s\n", functionName, message);
+        }
+        for (int roi = 0; roi < XSP3_NUM_ROIS; roi++) {
+            double low = 0, high = 0;
+            int llm = 0, hlm = 0;
+            this->getDoubleParam(this->xsp3RoiLowEnergyParam[roi], &low);
+            this->getDoubleParam(this->xsp3RoiHighEnergyParam[roi], &high);
+            if (high <= low) {
+                // Set in bins
+                continue;
+            }
+            if (valid) {
+                xsp3EnergyToBins(cal, low, high, bins, &llm, &hlm);
+            }
+            this->setIntegerParam(chan, this->xsp3ChanRoiLlmParam[roi], llm);
+            this->setIntegerParam(chan, this->xsp3ChanRoiHlmParam[roi], hlm);
+        }
+        this->callParamCallbacks(chan);
+    }
+    this->setStringParam(this->xsp3RoiMessageParam, message);
+    roiChanged_ = true;
+}
+
+/**
+ * Sum the ROIs of every channel of a frame, when ROIs are enabled, into
+ * the XSP3_CHAN_ROI parameters. The bins of each ROI are loaded again only
+ * after they change.
+ *
+ * @param pMCA The frame, before sparse encoding
+ */
+void Xspress3::computeRois(NDArray *pMCA)
+{
+    int enable = 0;
+    int bins = (int) pMCA->dims[0].size;
+    int numChannels = (int) pMCA->dims[1].size;
+    int subFrames = (pMCA->ndims > 2) ? (int) pMCA->dims[2].size : 1;
+
+    this->lock();
+    this->getIntegerParam(this->xsp3RoiEnableParam, &enable);
+    roiEnable_ = (enable == ctrlEnable_);
+    if (roiChanged_) {
+        roiSums_.resize(numChannels_);
+        for (int chan = 0; chan < numChannels_; chan++) {
+            for (int roi = 0; roi < XSP3_NUM_ROIS; roi++) {
+                int llm = 0, hlm = 0;
+                this->getIntegerParam(chan, this->xsp3ChanRoiLlmParam[roi], &llm);
+                this->getIntegerParam(chan, this->xsp3ChanRoiHlmParam[roi], &hlm);
+                roiSums_.setRange(chan, roi, llm, hlm);
+            }
+        }
+        roiTotals_.assign(numChannels_*XSP3_NUM_ROIS, 0.0);
+        roiChanged_ = false;
+    }
+    this->unlock();
+    if (!roiEnable_) {
+        return;
+    }
+
+    if (pMCA->dataType == NDFloat64) {
+        roiSums_.sum(static_cast<epicsFloat64 *>(pMCA->pData), bins, numChannels, subFrames, &roiTotals_[0]);
+    } else {
+        roiSums_.sum(static_cast<epicsUInt32 *>(pMCA->pData), bins, numChannels, subFrames, &roiTotals_[0]);
+    }
+    this->lock();
+    for (int chan = 0; chan < numChannels && chan < numChannels_; chan++) {
+        for (int roi = 0; roi < XSP3_NUM_ROIS; roi++) {
+            this->setDoubleParam(chan, this->xsp3ChanRoiParam[roi], roiTotals_[chan*XSP3_NUM_ROIS + roi]);
+        }
+    }
+    this->unlock();
+}
+
+/**
+ * Set up the live maps for an acquisition, with the lock held. There is a
+ * map for each ROI with bins on any channel, of MAP_ROWS x MAP_COLUMNS
+ * pixels, all zero until their frame is read out. Maps need a fly scan and
+ * the driver's ROIs.
+ *
+ * @param enable Whether LIVE_MAP is set
+ * @param rows MAP_ROWS
+ */
+void Xspress3::startLiveMap(bool enable, int rows)
+{
+    const char *functionName = "Xspress3::startLiveMap";
+    char message[maxStringSize_] = {0};
+    int roiEnable = 0;
+
+    liveMapRois_.clear();
+    liveMapData_.clear();
+    liveMapNames_.clear();
+    liveMapRows_ = 0;
+    liveMapChanged_ = false;
+    memset(&liveMapPublished_, 0, sizeof(liveMapPublished_));
+    this->getIntegerParam(this->xsp3RoiEnableParam, &roiEnable);
+    if (!enable) {
+        // Nothing to report
+    } else if (!flyScan_ || rows < 1 || mapColumns_ < 1) {
+        epicsSnprintf(message, sizeof(message), "Live maps need a fly scan of MAP_ROWS x MAP_COLUMNS");
+    } else if (roiEnable != ctrlEnable_) {
+        epicsSnprintf(message, sizeof(message), "Live maps need CTRL_MCA_ROI enabled");
+    } else {
+        for (int roi = 0; roi < XSP3_NUM_ROIS; roi++) {
+            bool configured = false;
+            for (int chan = 0; chan < numChannels_ && !configured; chan++) {
+                int llm = 0, hlm = 0;
+                this->getIntegerParam(chan, this->xsp3ChanRoiLlmParam[roi], &llm);
+                this->getIntegerParam(chan, this->xsp3ChanRoiHlmParam[roi], &hlm);
+                configured = (hlm > llm);
+            }
+            if (configured) {
+                char name[maxStringSize_] = {0};
+                char entry[maxStringSize_ + 8];
+                this->getStringParam(this->xsp3RoiNameParam[roi], sizeof(name), name);
+                epicsSnprintf(entry, sizeof(entry), "%s%d:%s", liveMapRois_.empty() ? "" : ",", roi+1, name);
+                liveMapNames_ += entry;
+                liveMapRois_.push_back(roi);
+            }
+        }
+        if (liveMapRois_.empty()) {
+            epicsSnprintf(message, sizeof(message), "No ROIs are set for the live maps");
+        } else {
+            liveMapRows_ = rows;
+            liveMapData_.assign(liveMapRois_.size()*rows*mapColumns_, 0.0);
+        }
+    }
+    if (message[0]) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_WARNING, "%s: %s\n", functionName, message);
+    }
+    this->setIntegerParam(this->xsp3LiveMapCountParam, (int) liveMapRois_.size());
+    this->setStringParam(this->xsp3LiveMapMessageParam, message);
+}
+
+/**
+ * Add the ROI totals of the frame just read out to the live maps, at the
+ * frame's map row and column, summed over the channels. The maps are
+ * published when LIVE_MAP_PERIOD has passed since they last were. Called by
+ * the data task after computeRois and setNDArrayAttributes.
+ */
+void Xspress3::updateLiveMap(void)
+{
+    epicsTimeStamp now;
+    int pixel, pixels = liveMapRows_*mapColumns_;
+
+    if (liveMapRois_.empty() || !roiEnable_ || roiTotals_.empty() ||
+        mapRow_ >= liveMapRows_ || mapColumn_ < 0 || mapColumn_ >= mapColumns_) {
+        return;
+    }
+    pixel = mapRow_*mapColumns_ + mapColumn_;
+    for (size_t map = 0; map < liveMapRois_.size(); map++) {
+        double total = 0;
+        for (int chan = 0; chan < numChannels_; chan++) {
+            total += roiTotals_[chan*XSP3_NUM_ROIS + liveMapRois_[map]];
+        }
+        liveMapData_[map*pixels + pixel] = total;
+    }
+    liveMapChanged_ = true;
+    epicsTimeGetCurrent(&now);
+    if (epicsTimeDiffInSeconds(&now, &liveMapPublished_) >= liveMapPeriod_) {
+        publishLiveMap();
+    }
+}
+
+/**
+ * Publish the live maps, if they changed since they were last published, as
+ * one NDFloat64 array of MAP_COLUMNS x MAP_ROWS x maps on asyn address
+ * numChannels_. The MAP_ROIS attribute lists the ROI and name of each map,
+ * as "1:Fe,3:Cu".
+ */
+void Xspress3::publishLiveMap(void)
+{
+    size_t dims[3];
+    int arrayCallbacks = 0;
+    int maps = (int) liveMapRois_.size();
+    NDArray *pMap;
+
+    if (!liveMapChanged_) {
+        return;
+    }
+    epicsTimeGetCurrent(&liveMapPublished_);
+    liveMapChanged_ = false;
+    this->getIntegerParam(NDArrayCallbacks, &arrayCallbacks);
+    if (!arrayCallbacks) {
+        return;
+    }
+    dims[0] = mapColumns_;
+    dims[1] = liveMapRows_;
+    dims[2] = maps;
+    pMap = this->pNDArrayPool->alloc(3, dims, NDFloat64, 0, NULL);
+    if (pMap == NULL) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "Xspress3::publishLiveMap: could not allocate the maps\n");
+        return;
+    }
+    memcpy(pMap->pData, &liveMapData_[0], liveMapData_.size()*sizeof(double));
+    pMap->uniqueId = mapRow_;
+    pMap->timeStamp = liveMapPublished_.secPastEpoch + liveMapPublished_.nsec/1e9;
+    pMap->pAttributeList->add("MAP_ROIS", "ROI of each map", NDAttrString, (void *) liveMapNames_.c_str());
+    pMap->pAttributeList->add("MAP_ROW", "Map row of the latest frame", NDAttrInt32, &mapRow_);
+    this->doCallbacksGenericPointer(pMap, NDArrayData, numChannels_);
+    pMap->release();
+}
+
+/**
+ * Sum the channels of a frame on the common energy axis set by ALIGN_OFFSET
+ * and ALIGN_GAIN, when ALIGN is enabled, resampling each channel through
+ * its calibration. The weights are worked out again only after a
+ * calibration, the axis or the spectrum length changes.
+ *
+ * @param pMCA The frame, before sparse encoding
+ */
+void Xspress3::alignFrame(NDArray *pMCA)
+{
+    const char *functionName = "Xspress3::alignFrame";
+    int enable = 0;
+    int bins = (int) pMCA->dims[0].size;
+    int numChannels = (int) pMCA->dims[1].size;
+    int subFrames = (pMCA->ndims > 2) ? (int) pMCA->dims[2].size : 1;
+
+    this->lock();
+    this->getIntegerParam(this->xsp3AlignParam, &enable);
+    alignEnable_ = (enable == ctrlEnable_);
+    if (alignEnable_ && (alignChanged_ || bins != align_.getInBins())) {
+        std::vector<xsp3EnergyCal_t> cals(numChannels_);
+        double offset = 0, gain = 0;
+        char message[maxStringSize_] = {0};
+
+        for (int chan = 0; chan < numChannels_; chan++) {
+            this->getDoubleParam(chan, this->xsp3ChanCalOffsetParam, &cals[chan].offset);
+            this->getDoubleParam(chan, this->xsp3ChanCalGainParam, &cals[chan].gain);
+            this->getDoubleParam(chan, this->xsp3ChanCalQuadParam, &cals[chan].quad);
+        }
+        this->getDoubleParam(this->xsp3AlignOffsetParam, &offset);
+        this->getDoubleParam(this->xsp3AlignGainParam, &gain);
+        int invalid = align_.configure(cals, bins, offset, gain, bins);
+        if (invalid > 0) {
+            epicsSnprintf(message, sizeof(message), "%d channels left out, their calibration does not rise over the spectrum", invalid);
+            asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s: ERROR: %s\n", functionName, message);
+        }
+        this->setStringParam(this->xsp3AlignMessageParam, message);
+        alignSum_.assign(bins, 0.0);
+        alignChanged_ = false;
+    }
+    this->unlock();
+    if (!alignEnable_) {
+        return;
+    }
+
+    if (pMCA->dataType == NDFloat64) {
+        align_.sum(static_cast<epicsFloat64 *>(pMCA->pData), bins, numChannels, subFrames, &alignSum_[0]);
+    } else {
+        align_.sum(static_cast<epicsUInt32 *>(pMCA->pData), bins, numChannels, subFrames, &alignSum_[0]);
+    }
+}
+
+/**
+ * Publish the aligned sum of a frame as a 1D NDFloat64 array on asyn
+ * address numChannels_+1, with the frame's unique ID, time stamp and
+ * attributes. The sum is dense, so the SPARSE_* attributes of a sparse
+ * frame are left out.
+ *
+ * @param pMCA The frame, with its attributes set
+ */
+void Xspress3::publishAligned(NDArray *pMCA)
+{
+    static const char *sparseAttributes[] = {"SPARSE_ENCODING", "SPARSE_WORDS", "SPARSE_BINS",
+                                             "SPARSE_CHANNELS", "SPARSE_SUB_FRAMES"};
+    size_t dims[1];
+    int arrayCallbacks = 0;
+    NDArray *pSum;
+
+    this->getIntegerParam(NDArrayCallbacks, &arrayCallbacks);
+    if (!alignEnable_ || alignSum_.empty() || !arrayCallbacks) {
+        return;
+    }
+    dims[0] = alignSum_.size();
+    pSum = this->pNDArrayPool->alloc(1, dims, NDFloat64, 0, NULL);
+    if (pSum == NULL) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "Xspress3::publishAligned: could not allocate the sum\n");
+        return;
+    }
+    memcpy(pSum->pData, &alignSum_[0], alignSum_.size()*sizeof(double));
+    pSum->uniqueId = pMCA->uniqueId;
+    pSum->timeStamp = pMCA->timeStamp;
+    pMCA->pAttributeList->copy(pSum->pAttributeList);
+    for (size_t i = 0; i < sizeof(sparseAttributes)/sizeof(sparseAttributes[0]); i++) {
+        pSum->pAttributeList->remove(sparseAttributes[i]);
+    }
+    this->doCallbacksGenericPointer(pSum, NDArrayData, numChannels_ + 1);
+    pSum->release();
+}
+
+int Xspress3::getNumFramesRead()
+{
+    int numFrames = 0;
+    int xsp3Status = xsp3->scaler_check_progress(this->xsp3_handle_);
+    if (xsp3Status < XSP3_OK) {
+        this->checkStatus(xsp3Status, "xsp3_dma_check_desc", "getNumFrameRead");
+    } else {
+        numFrames = xsp3Status;
+        this->setIntegerParam(xsp3FrameCountParam, acquisitionFrame(numFrames));
+    }
+    return numFrames;
+}
+
+void Xspress3::xspAsynPrint(int asynPrintType, const char *format, ...)
+{
+    const int maxMessageLen=1024;
+    va_list pArg;
+    char message[maxMessageLen];
+    va_start(pArg, format);
+    vsprintf(message, format, pArg);
+    asynPrint(this->pasynUserSelf, asynPrintType, message);
+    va_end(pArg);
+}
+
+/**
+ * Thread function for the erase task.
+ */
+static void xsp3EraseTaskC(void *drvPvt)
+{
+    Xspress3 *pXsp3 = (Xspress3 *)drvPvt;
+
+    pXsp3->eraseTask();
+}
+
+/**
+ * Thread function for the reconnect task.
+ */
+static void xsp3ReconnectTaskC(void *drvPvt)
+{
+    Xspress3 *pXsp3 = (Xspress3 *)drvPvt;
+
+    pXsp3->reconnectTask();
+}
+
+/**
+ * Thread function for a range of cards or channels of a connect phase.
+ */
+static void xsp3ConnectTaskC(void *drvPvt)
+{
+    xsp3ConnectWork_t *work = (xsp3ConnectWork_t *)drvPvt;
+
+    work->pXsp3->connectWork(work);
+    epicsEventSignal(work->done);
+}
+
+/**
+ * A function, ordinarily to be run in a seperate thread, to wait for
+ * and then execute acquisitions.
+ *
+ * @param xspAD A pointer to an instance of Xspress3
+ */
+static void xsp3DataTaskC(void *xspAD)
+{
+    Xspress3 *pXspAD = (Xspress3 *)xspAD;
+    void *pSCA;
+    NDArray *pMCA;
+    NDDataType_t dataType;
+    bool acquire=false;
+    bool aborted=false;
+    bool error=false;
+    bool nextEntry=false;
+    bool newAcquisition=true;
+
+    int numChannels, maxSpectra, frameNumber, numFrames=0, acquired, lastAcquired, ndims;
+    //int frame_count, last_frame_count, frame_counter, frames_remaining, frame_offset;
+    size_t dims[3];
+    const double timeout = 0.00001;
+    const int checkTimes = 20;
+    // const char* functionName = "Xspress3::xps3DataTaskC";
+    // The scalar array can be reused so create it now
+    pXspAD->createSCAArray(pSCA);
+    // getIntegerParam(xsp3NumFramesDriverParam, &maxNumFrames);
     // int maxNumFrames;
     // maxNumFrames = pXspAD->getMaxNumFrames();
 
     while (1) {
         acquired = lastAcquired = frameNumber = 0;
         aborted = false;
-        pXspAD->checkForStopEvent(timeout, "Got stop event before start event.\n");
-        if (pXspAD->waitForStartEvent("Got start event.\n") == epicsEventWaitOK) {
+        newAcquisition = !nextEntry;
+        if (nextEntry) {
+            // The next entry of an acquisition sequence was started by startSequenceEntry
             acquire = true;
             pXspAD->lock();
             pXspAD->setStartingParameters();
             pXspAD->unlock();
+        } else {
+            pXspAD->checkForStopEvent(timeout, "Got stop event before start event.\n");
+            if (pXspAD->waitForStartEvent("Got start event.\n") == epicsEventWaitOK) {
+                acquire = true;
+                pXspAD->lock();
+                pXspAD->setStartingParameters();
+                // Frames are read once the background erase has finished with the handle
+                pXspAD->waitForErase(false);
+                pXspAD->unlock();
+            }
         }
+        nextEntry = false;
         dataType = pXspAD->getDataType();
-        pXspAD->getDims(dims);
+        ndims = pXspAD->getDims(dims);
         maxSpectra = dims[0];
         numChannels = dims[1];
         numFrames = pXspAD->getNumFramesToAcquire();
+        pXspAD->openH5File(dims, ndims, dataType);
+        pXspAD->openShmRing(dims, ndims, dataType, newAcquisition);
         pXspAD->xspAsynPrint(ASYN_TRACE_FLOW, "Collect %d frames\n", numFrames);
 	// printf("data task acquire=%d, numframes=%d  / frameNumber=%d\n", (int)acquire, numFrames, frameNumber);
         while (acquire && (frameNumber < numFrames)) {
             acquired = pXspAD->getNumFramesRead();
+            if (acquired >= numFrames) {
+                pXspAD->lock();
+                pXspAD->prepareSequenceEntry();
+                pXspAD->unlock();
+            }
             if (frameNumber < acquired) {
                 lastAcquired = acquired;
-                if (!pXspAD->createMCAArray(dims, pMCA, dataType)) {
+                pXspAD->readMarkers(frameNumber, acquired);
+                if (!pXspAD->createMCAArray(dims, pMCA, dataType, ndims)) {
                     if (dataType == NDFloat64) {
-                        error = pXspAD->readFrame(static_cast<double*>(pSCA), static_cast<double*>(pMCA->pData), frameNumber, maxSpectra);
+                        error = pXspAD->readFrame(static_cast<double*>(pSCA), static_cast<double*>(pMCA->pData), frameNumber, maxSpectra, numChannels);
                     }
                     else {
-                        error = pXspAD->readFrame(static_cast<u_int32_t*>(pSCA), static_cast<u_int32_t*>(pMCA->pData), frameNumber, maxSpectra);
+                        error = pXspAD->readFrame(static_cast<u_int32_t*>(pSCA), static_cast<u_int32_t*>(pMCA->pData), frameNumber, maxSpectra, numChannels);
                     }
                     if (error) {
                         pXspAD->xspAsynPrint(ASYN_TRACE_ERROR, "There was an error during read out %d\n", error);
@@ -2051,13 +4393,20 @@ static void xsp3DataTaskC(void *xspAD)
                     pXspAD->lock();
                     pXspAD->writeOutScas(pSCA, numChannels, dataType);
                     pXspAD->unlock();
+                    pXspAD->writeH5Frame(pMCA, pSCA);
+                    pXspAD->writeShmFrame(pMCA, pSCA, frameNumber);
+                    pXspAD->streamFrame(pMCA, pSCA, frameNumber);
+                    pXspAD->computeRois(pMCA);
+                    pXspAD->alignFrame(pMCA);
                     frameNumber++;
+                    pXspAD->sparseEncode(pMCA);
                     pXspAD->setNDArrayAttributes(pMCA, frameNumber);
+                    pXspAD->updateLiveMap();
+                    pXspAD->publishAligned(pMCA);
                     pXspAD->lock();
                     pXspAD->callParamCallbacks();
                     pXspAD->unlock();
-                    pXspAD->doNDCallbacksIfRequired(pMCA);
-                    pMCA->release();
+                    pXspAD->publishFrame(pMCA);
                 }
                 else {
                     pXspAD->xspAsynPrint(ASYN_TRACE_ERROR, "Did not create a new array!\n");
@@ -2073,11 +4422,20 @@ static void xsp3DataTaskC(void *xspAD)
                 pXspAD->unlock();
             }
         }
+        pXspAD->flushFrames();
+        pXspAD->publishLiveMap();
         if (!aborted) {
             pXspAD->lock();
-            pXspAD->setAcqStopParameters(false);
+            int started = pXspAD->startSequenceEntry();
+            if (started == 0) {
+                pXspAD->setAcqStopParameters(false);
+            }
+            nextEntry = (started == 1);
             pXspAD->unlock();
         }
+        if (!nextEntry) {
+            pXspAD->closeH5File();
+        }
     }
 }
 
@@ -2117,6 +4475,207 @@ extern "C" {
     return(status);
   }
 
+  /**
+   * Find the simulator behind an Xspress3 port, for the xspress3Sim* commands.
+   * @param portName The Asyn port name passed to xspress3Config
+   * @return The simulator, or NULL (with a message) if the port is not running in simulation mode.
+   */
+  static xsp3Simulator *findSimulator(const char *portName)
+  {
+    Xspress3 *pXsp3 = dynamic_cast<Xspress3 *>(findAsynPortDriver(portName));
+    xsp3Simulator *pSim = NULL;
+
+    if (pXsp3 == NULL) {
+      printf("Xspress3 port %s not found.\n", portName ? portName : "(null)");
+    } else if ((pSim = dynamic_cast<xsp3Simulator *>(pXsp3->getXsp3())) == NULL) {
+      printf("Xspress3 port %s is not running in simulation mode.\n", portName);
+    }
+    return pSim;
+  }
+
+  /**
+   * Configure the spectra generated by the simulator.
+   * @param portName The Asyn port name to use
+   * @param countRate The input count rate of each element, in counts/s
+   * @param seed Seed for the generated data. The same seed gives the same frames.
+   */
+  int xspress3SimSpectra(const char *portName, double countRate, int seed)
+  {
+    xsp3Simulator *pSim = findSimulator(portName);
+    if (pSim == NULL) {
+      return asynError;
+    }
+    pSim->setCountRate(countRate);
+    pSim->setSeed(static_cast<unsigned int>(seed));
+    return asynSuccess;
+  }
+
+  /**
+   * Configure the external trigger emulated by the simulator. It is used for the
+   * TTL, LVDS and IDC trigger modes.
+   * @param portName The Asyn port name to use
+   * @param rate Trigger rate in Hz
+   * @param jitter RMS variation of the trigger period, as a fraction of the period
+   * @param seed Seed for the jitter. The same seed gives the same trigger times.
+   */
+  int xspress3SimTrigger(const char *portName, double rate, double jitter, int seed)
+  {
+    xsp3Simulator *pSim = findSimulator(portName);
+    if (pSim == NULL) {
+      return asynError;
+    }
+    pSim->setExternalTrigger(rate, jitter, static_cast<unsigned int>(seed));
+    return asynSuccess;
+  }
+
+  /**
+   * Configure the system the simulator emulates. Call before connecting.
+   * @param portName The Asyn port name to use
+   * @param generation The Xspress generation to report: 0 Xspress3, 1 Xspress3 V7, 2 Xspress3 Mini, 3 Xspress4
+   * @param threads Number of threads generating frames ahead of the driver, 0 to generate on read
+   * @param ringFrames How many frames the threads may generate ahead
+   */
+  int xspress3SimSystem(const char *portName, int generation, int threads, int ringFrames)
+  {
+    xsp3Simulator *pSim = findSimulator(portName);
+    if (pSim == NULL) {
+      return asynError;
+    }
+    if (pSim->setSystem(generation, threads, ringFrames) != XSP3_OK) {
+      printf("xspress3SimSystem: invalid generation %d or could not start %d threads\n", generation, threads);
+      return asynError;
+    }
+    return asynSuccess;
+  }
+
+  /**
+   * Make the simulator replay a capture file instead of generating data.
+   * @param portName The Asyn port name to use
+   * @param fileName The replay file (see etc/hdf5ToReplay.py), or "" to go back to generated data
+   * @param loop 1 to go back to the start at the end of the file, 0 to stop
+   * @param rate Frame rate in Hz, or 0 to use the recorded timestamps
+   */
+  int xspress3SimReplay(const char *portName, const char *fileName, int loop, double rate)
+  {
+    xsp3Simulator *pSim = findSimulator(portName);
+    if (pSim == NULL) {
+      return asynError;
+    }
+    if (pSim->setReplay(fileName, loop != 0, rate) != XSP3_OK) {
+      printf("xspress3SimReplay: %s\n", pSim->getReplayError());
+      return asynError;
+    }
+    return asynSuccess;
+  }
+
+  /**
+   * Inject faults into the simulator at random, to test the driver under failure.
+   * Faults are seeded by xspress3SimSpectra. See xsp3SimFault.h for details.
+   * @param portName The Asyn port name to use
+   * @param fault latency, busy, drop, overrun or error; none to clear all faults, report to print the fault counts
+   * @param probability Chance of the fault per read call, per stop or per frame; 0 turns it off
+   * @param value Delay in seconds for latency, busy polls after a stop for busy (0 stays busy until the next start)
+   */
+  int xspress3SimFault(const char *portName, const char *fault, double probability, double value)
+  {
+    xsp3Simulator *pSim = findSimulator(portName);
+    int type;
+
+    if (pSim == NULL) {
+      return asynError;
+    }
+    if (fault != NULL && strcmp(fault, "none") == 0) {
+      pSim->clearFaults();
+      return asynSuccess;
+    }
+    if (fault == NULL || fault[0] == '\0' || strcmp(fault, "report") == 0) {
+      printf("Simulator faults on %s:\n", portName);
+      pSim->reportFaults(stdout);
+      return asynSuccess;
+    }
+    type = xsp3SimFault::lookup(fault);
+    if (type < 0 || pSim->setFault(type, probability, value) != XSP3_OK) {
+      printf("xspress3SimFault: unknown fault %s or bad probability %g\n", fault, probability);
+      return asynError;
+    }
+    return asynSuccess;
+  }
+
+  /**
+   * Print the Xspress3 API call counts and latencies for a port.
+   * Recording is turned on with the API_STATS PV.
+   * @param portName The Asyn port name to use
+   * @param details 1 for a line per call, 2 to add the latency histograms
+   * @param reset 1 to zero the statistics after printing them
+   */
+  int xspress3ApiStats(const char *portName, int details, int reset)
+  {
+    Xspress3 *pXsp3 = dynamic_cast<Xspress3 *>(findAsynPortDriver(portName));
+
+    if (pXsp3 == NULL) {
+      printf("Xspress3 port %s not found.\n", portName ? portName : "(null)");
+      return asynError;
+    }
+    pXsp3->getXsp3()->getStats().report(stdout, details > 0 ? details : 1);
+    if (reset) {
+      pXsp3->getXsp3()->getStats().reset();
+    }
+    return asynSuccess;
+  }
+
+  /**
+   * Record every Xspress3 API call made by a port into a trace file, for
+   * xspress3TraceReplay. The file is a ring: when it is full the oldest calls are dropped.
+   * @param portName The Asyn port name to use
+   * @param fileName The trace file to create, or "" to stop recording
+   * @param sizeMB Size of the file in MB
+   * @param buffers 1 to record the frame data read, 0 for just the calls and small results
+   */
+  int xspress3Trace(const char *portName, const char *fileName, double sizeMB, int buffers)
+  {
+    Xspress3 *pXsp3 = dynamic_cast<Xspress3 *>(findAsynPortDriver(portName));
+
+    if (pXsp3 == NULL) {
+      printf("Xspress3 port %s not found.\n", portName ? portName : "(null)");
+      return asynError;
+    }
+    if (fileName == NULL || fileName[0] == '\0') {
+      pXsp3->getXsp3()->stopTrace();
+      return asynSuccess;
+    }
+    if (pXsp3->getXsp3()->startTrace(fileName, static_cast<size_t>(sizeMB*1024*1024), buffers != 0) != XSP3_OK) {
+      printf("xspress3Trace: %s\n", pXsp3->getXsp3()->getTraceError());
+      return asynError;
+    }
+    return asynSuccess;
+  }
+
+  /**
+   * Play back a trace recorded by xspress3Trace in place of the detector. Call before connecting.
+   * @param portName The Asyn port name to use
+   * @param fileName The trace file, or "" to print how much of the trace has been played
+   * @param speed How many times faster than recorded to play it back, 0 for as fast as possible
+   */
+  int xspress3TraceReplay(const char *portName, const char *fileName, double speed)
+  {
+    Xspress3 *pXsp3 = dynamic_cast<Xspress3 *>(findAsynPortDriver(portName));
+    xsp3TraceReplay *pReplay;
+
+    if (pXsp3 == NULL) {
+      printf("Xspress3 port %s not found.\n", portName ? portName : "(null)");
+      return asynError;
+    }
+    if (fileName == NULL || fileName[0] == '\0') {
+      if ((pReplay = dynamic_cast<xsp3TraceReplay *>(pXsp3->getXsp3())) == NULL) {
+        printf("Xspress3 port %s is not replaying a trace.\n", portName);
+        return asynError;
+      }
+      pReplay->report(stdout);
+      return asynSuccess;
+    }
+    return pXsp3->replayTrace(fileName, speed);
+  }
+
   /* Code for iocsh registration */
 
   /* xspress3Config */
@@ -2152,9 +4711,139 @@ extern "C" {
     xspress3Config(args[0].sval, args[1].ival, args[2].ival, args[3].sval, args[4].ival, args[5].ival, args[6].ival, args[7].ival, args[8].ival, args[9].ival, args[10].ival, args[11].ival);
   }
 
+  /* xspress3SimSpectra */
+  static const iocshArg xspress3SimSpectraArg0 = {"Port name", iocshArgString};
+  static const iocshArg xspress3SimSpectraArg1 = {"Count rate (counts/s)", iocshArgDouble};
+  static const iocshArg xspress3SimSpectraArg2 = {"Seed", iocshArgInt};
+  static const iocshArg * const xspress3SimSpectraArgs[] = {&xspress3SimSpectraArg0,
+							    &xspress3SimSpectraArg1,
+							    &xspress3SimSpectraArg2};
+
+  static const iocshFuncDef simSpectraXspress3 = {"xspress3SimSpectra", 3, xspress3SimSpectraArgs};
+  static void simSpectraXspress3CallFunc(const iocshArgBuf *args)
+  {
+    xspress3SimSpectra(args[0].sval, args[1].dval, args[2].ival);
+  }
+
+  /* xspress3SimTrigger */
+  static const iocshArg xspress3SimTriggerArg0 = {"Port name", iocshArgString};
+  static const iocshArg xspress3SimTriggerArg1 = {"Trigger rate (Hz)", iocshArgDouble};
+  static const iocshArg xspress3SimTriggerArg2 = {"Jitter (fraction of period)", iocshArgDouble};
+  static const iocshArg xspress3SimTriggerArg3 = {"Seed", iocshArgInt};
+  static const iocshArg * const xspress3SimTriggerArgs[] = {&xspress3SimTriggerArg0,
+							    &xspress3SimTriggerArg1,
+							    &xspress3SimTriggerArg2,
+							    &xspress3SimTriggerArg3};
+
+  static const iocshFuncDef simTriggerXspress3 = {"xspress3SimTrigger", 4, xspress3SimTriggerArgs};
+  static void simTriggerXspress3CallFunc(const iocshArgBuf *args)
+  {
+    xspress3SimTrigger(args[0].sval, args[1].dval, args[2].dval, args[3].ival);
+  }
+
+  /* xspress3SimSystem */
+  static const iocshArg xspress3SimSystemArg0 = {"Port name", iocshArgString};
+  static const iocshArg xspress3SimSystemArg1 = {"Generation", iocshArgInt};
+  static const iocshArg xspress3SimSystemArg2 = {"Producer threads", iocshArgInt};
+  static const iocshArg xspress3SimSystemArg3 = {"Ring frames", iocshArgInt};
+  static const iocshArg * const xspress3SimSystemArgs[] = {&xspress3SimSystemArg0,
+							   &xspress3SimSystemArg1,
+							   &xspress3SimSystemArg2,
+							   &xspress3SimSystemArg3};
+
+  static const iocshFuncDef simSystemXspress3 = {"xspress3SimSystem", 4, xspress3SimSystemArgs};
+  static void simSystemXspress3CallFunc(const iocshArgBuf *args)
+  {
+    xspress3SimSystem(args[0].sval, args[1].ival, args[2].ival, args[3].ival);
+  }
+
+  /* xspress3SimReplay */
+  static const iocshArg xspress3SimReplayArg0 = {"Port name", iocshArgString};
+  static const iocshArg xspress3SimReplayArg1 = {"Replay file", iocshArgString};
+  static const iocshArg xspress3SimReplayArg2 = {"Loop", iocshArgInt};
+  static const iocshArg xspress3SimReplayArg3 = {"Frame rate (Hz, 0 for recorded)", iocshArgDouble};
+  static const iocshArg * const xspress3SimReplayArgs[] = {&xspress3SimReplayArg0,
+							   &xspress3SimReplayArg1,
+							   &xspress3SimReplayArg2,
+							   &xspress3SimReplayArg3};
+
+  static const iocshFuncDef simReplayXspress3 = {"xspress3SimReplay", 4, xspress3SimReplayArgs};
+  static void simReplayXspress3CallFunc(const iocshArgBuf *args)
+  {
+    xspress3SimReplay(args[0].sval, args[1].sval, args[2].ival, args[3].dval);
+  }
+
+  /* xspress3SimFault */
+  static const iocshArg xspress3SimFaultArg0 = {"Port name", iocshArgString};
+  static const iocshArg xspress3SimFaultArg1 = {"Fault", iocshArgString};
+  static const iocshArg xspress3SimFaultArg2 = {"Probability", iocshArgDouble};
+  static const iocshArg xspress3SimFaultArg3 = {"Value", iocshArgDouble};
+  static const iocshArg * const xspress3SimFaultArgs[] = {&xspress3SimFaultArg0,
+							  &xspress3SimFaultArg1,
+							  &xspress3SimFaultArg2,
+							  &xspress3SimFaultArg3};
+
+  static const iocshFuncDef simFaultXspress3 = {"xspress3SimFault", 4, xspress3SimFaultArgs};
+  static void simFaultXspress3CallFunc(const iocshArgBuf *args)
+  {
+    xspress3SimFault(args[0].sval, args[1].sval, args[2].dval, args[3].dval);
+  }
+
+  /* xspress3ApiStats */
+  static const iocshArg xspress3ApiStatsArg0 = {"Port name", iocshArgString};
+  static const iocshArg xspress3ApiStatsArg1 = {"Details", iocshArgInt};
+  static const iocshArg xspress3ApiStatsArg2 = {"Reset", iocshArgInt};
+  static const iocshArg * const xspress3ApiStatsArgs[] = {&xspress3ApiStatsArg0,
+							  &xspress3ApiStatsArg1,
+							  &xspress3ApiStatsArg2};
+
+  static const iocshFuncDef apiStatsXspress3 = {"xspress3ApiStats", 3, xspress3ApiStatsArgs};
+  static void apiStatsXspress3CallFunc(const iocshArgBuf *args)
+  {
+    xspress3ApiStats(args[0].sval, args[1].ival, args[2].ival);
+  }
+
+  /* xspress3Trace */
+  static const iocshArg xspress3TraceArg0 = {"Port name", iocshArgString};
+  static const iocshArg xspress3TraceArg1 = {"Trace file", iocshArgString};
+  static const iocshArg xspress3TraceArg2 = {"Size (MB)", iocshArgDouble};
+  static const iocshArg xspress3TraceArg3 = {"Record buffers", iocshArgInt};
+  static const iocshArg * const xspress3TraceArgs[] = {&xspress3TraceArg0,
+						       &xspress3TraceArg1,
+						       &xspress3TraceArg2,
+						       &xspress3TraceArg3};
+
+  static const iocshFuncDef traceXspress3 = {"xspress3Trace", 4, xspress3TraceArgs};
+  static void traceXspress3CallFunc(const iocshArgBuf *args)
+  {
+    xspress3Trace(args[0].sval, args[1].sval, args[2].dval, args[3].ival);
+  }
+
+  /* xspress3TraceReplay */
+  static const iocshArg xspress3TraceReplayArg0 = {"Port name", iocshArgString};
+  static const iocshArg xspress3TraceReplayArg1 = {"Trace file", iocshArgString};
+  static const iocshArg xspress3TraceReplayArg2 = {"Speed", iocshArgDouble};
+  static const iocshArg * const xspress3TraceReplayArgs[] = {&xspress3TraceReplayArg0,
+							     &xspress3TraceReplayArg1,
+							     &xspress3TraceReplayArg2};
+
+  static const iocshFuncDef traceReplayXspress3 = {"xspress3TraceReplay", 3, xspress3TraceReplayArgs};
+  static void traceReplayXspress3CallFunc(const iocshArgBuf *args)
+  {
+    xspress3TraceReplay(args[0].sval, args[1].sval, args[2].dval);
+  }
+
   static void xspress3Register(void)
   {
     iocshRegister(&configXspress3, configXspress3CallFunc);
+    iocshRegister(&simSpectraXspress3, simSpectraXspress3CallFunc);
+    iocshRegister(&simTriggerXspress3, simTriggerXspress3CallFunc);
+    iocshRegister(&simReplayXspress3, simReplayXspress3CallFunc);
+    iocshRegister(&simSystemXspress3, simSystemXspress3CallFunc);
+    iocshRegister(&simFaultXspress3, simFaultXspress3CallFunc);
+    iocshRegister(&apiStatsXspress3, apiStatsXspress3CallFunc);
+    iocshRegister(&traceXspress3, traceXspress3CallFunc);
+    iocshRegister(&traceReplayXspress3, traceReplayXspress3CallFunc);
   }
 
   epicsExportRegistrar(xspress3Register);
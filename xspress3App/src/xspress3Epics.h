@@ -38,6 +38,7 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <vector>
 
 #include <epicsTime.h>
 #include <epicsThread.h>
@@ -54,6 +55,15 @@
 
 #include "xsp3Detector.h"
 #include "xsp3Simulator.h"
+#include "xsp3TraceReplay.h"
+#include "xsp3Fingerprint.h"
+#include "xsp3Sparse.h"
+#include "xsp3Compress.h"
+#include "xsp3H5Writer.h"
+#include "xsp3ShmRing.h"
+#include "xsp3StreamServer.h"
+#include "xsp3EnergyRoi.h"
+#include "xsp3Align.h"
 
 /* These are the drvInfo strings that are used to identify the parameters.
  * They are used by asyn clients, including standard asyn device support */
@@ -114,13 +124,152 @@
 #define xsp3EventWidthParamString        "XSP3_EVENT_WIDTH"
 #define xsp3ChanDTPercentParamString     "XSP3_CHAN_DTPERCENT"
 #define xsp3ChanDTFactorParamString      "XSP3_CHAN_DTFACTOR"
+#define xsp3ApiStatsParamString          "XSP3_API_STATS"
+#define xsp3ApiStatsResetParamString     "XSP3_API_STATS_RESET"
+#define xsp3ApiStatsUpdateParamString    "XSP3_API_STATS_UPDATE"
+#define xsp3ApiCallsParamString          "XSP3_API_CALLS"
+#define xsp3ApiTimeParamString           "XSP3_API_TIME"
+#define xsp3ApiReadTimeParamString       "XSP3_API_READ_TIME"
+#define xsp3ApiReadMaxParamString        "XSP3_API_READ_MAX"
+#define xsp3ApiSlowestParamString        "XSP3_API_SLOWEST"
+#define xsp3ConnectThreadsParamString    "XSP3_CONNECT_THREADS"
+#define xsp3ConnectTimeParamString       "XSP3_CONNECT_TIME"
+#define xsp3ConnectConfigTimeParamString "XSP3_CONNECT_CONFIG_TIME"
+#define xsp3ConnectClocksTimeParamString "XSP3_CONNECT_CLOCKS_TIME"
+#define xsp3ConnectRestoreTimeParamString "XSP3_CONNECT_RESTORE_TIME"
+#define xsp3ConnectSetupTimeParamString  "XSP3_CONNECT_SETUP_TIME"
+#define xsp3ConnectReadbackTimeParamString "XSP3_CONNECT_READBACK_TIME"
+#define xsp3FastRestoreParamString       "XSP3_FAST_RESTORE"
+#define xsp3RestoreSkippedParamString    "XSP3_RESTORE_SKIPPED"
+#define xsp3AutoReconnectParamString     "XSP3_AUTO_RECONNECT"
+#define xsp3ReconnectParamString         "XSP3_RECONNECT"
+#define xsp3ReconnectTimeParamString     "XSP3_RECONNECT_TIME"
+#define xsp3ReconnectCountParamString    "XSP3_RECONNECT_COUNT"
+#define xsp3ReconnectDelayParamString    "XSP3_RECONNECT_DELAY"
+#define xsp3EraseChunkParamString        "XSP3_ERASE_CHUNK"
+#define xsp3EraseTimeParamString         "XSP3_ERASE_TIME"
+#define xsp3StartTimeParamString         "XSP3_START_TIME"
+#define xsp3EraseOvertakenParamString    "XSP3_ERASE_OVERTAKEN"
+#define xsp3StepScanParamString          "XSP3_STEP_SCAN"
+#define xsp3PointTimeParamString         "XSP3_POINT_TIME"
+#define xsp3PointOverheadParamString     "XSP3_POINT_OVERHEAD"
+#define xsp3SeqAcquireTimeParamString    "XSP3_SEQ_ACQUIRE_TIME"
+#define xsp3SeqNumImagesParamString      "XSP3_SEQ_NUM_IMAGES"
+#define xsp3SeqLengthParamString         "XSP3_SEQ_LENGTH"
+#define xsp3SeqEntryParamString          "XSP3_SEQ_ENTRY"
+#define xsp3FlyScanParamString           "XSP3_FLY_SCAN"
+#define xsp3MapColumnsParamString        "XSP3_MAP_COLUMNS"
+#define xsp3MapRowsParamString           "XSP3_MAP_ROWS"
+#define xsp3MapSnakeParamString          "XSP3_MAP_SNAKE"
+#define xsp3MapRowMarkerParamString      "XSP3_MAP_ROW_MARKER"
+#define xsp3MapRowParamString            "XSP3_MAP_ROW"
+#define xsp3MapColumnParamString         "XSP3_MAP_COLUMN"
+#define xsp3SubFramesParamString         "XSP3_SUB_FRAMES"
+#define xsp3SubFrameBitsParamString      "XSP3_SUB_FRAME_BITS"
+#define xsp3SubFrameDivideParamString    "XSP3_SUB_FRAME_DIVIDE"
+#define xsp3SparseParamString            "XSP3_SPARSE"
+#define xsp3SparseRatioParamString       "XSP3_SPARSE_RATIO"
+#define xsp3CompressParamString          "XSP3_COMPRESS"
+#define xsp3CompressLevelParamString     "XSP3_COMPRESS_LEVEL"
+#define xsp3CompressShuffleParamString   "XSP3_COMPRESS_SHUFFLE"
+#define xsp3CompressThreadsParamString   "XSP3_COMPRESS_THREADS"
+#define xsp3CompressRatioParamString     "XSP3_COMPRESS_RATIO"
+#define xsp3CompressTimeParamString      "XSP3_COMPRESS_TIME"
+#define xsp3CompressFailuresParamString  "XSP3_COMPRESS_FAILURES"
+#define xsp3H5EnableParamString          "XSP3_H5_ENABLE"
+#define xsp3H5FileNameParamString        "XSP3_H5_FILE_NAME"
+#define xsp3H5ChunkFramesParamString     "XSP3_H5_CHUNK_FRAMES"
+#define xsp3H5SwmrParamString            "XSP3_H5_SWMR"
+#define xsp3H5FramesParamString          "XSP3_H5_FRAMES"
+#define xsp3H5MessageParamString         "XSP3_H5_MESSAGE"
+#define xsp3ShmEnableParamString         "XSP3_SHM_ENABLE"
+#define xsp3ShmNameParamString           "XSP3_SHM_NAME"
+#define xsp3ShmSlotsParamString          "XSP3_SHM_SLOTS"
+#define xsp3ShmFramesParamString         "XSP3_SHM_FRAMES"
+#define xsp3ShmMessageParamString        "XSP3_SHM_MESSAGE"
+#define xsp3StreamEnableParamString      "XSP3_STREAM_ENABLE"
+#define xsp3StreamPortParamString        "XSP3_STREAM_PORT"
+#define xsp3StreamCompressParamString    "XSP3_STREAM_COMPRESS"
+#define xsp3StreamQueueParamString       "XSP3_STREAM_QUEUE"
+#define xsp3StreamPolicyParamString      "XSP3_STREAM_POLICY"
+#define xsp3StreamClientsParamString     "XSP3_STREAM_CLIENTS"
+#define xsp3StreamFramesParamString      "XSP3_STREAM_FRAMES"
+#define xsp3StreamDroppedParamString     "XSP3_STREAM_DROPPED"
+#define xsp3StreamMessageParamString     "XSP3_STREAM_MESSAGE"
+#define xsp3ChanCalOffsetParamString     "XSP3_CHAN_CAL_OFFSET"
+#define xsp3ChanCalGainParamString       "XSP3_CHAN_CAL_GAIN"
+#define xsp3ChanCalQuadParamString       "XSP3_CHAN_CAL_QUAD"
+#define xsp3RoiMessageParamString        "XSP3_ROI_MESSAGE"
+#define xsp3LiveMapParamString           "XSP3_LIVE_MAP"
+#define xsp3LiveMapPeriodParamString     "XSP3_LIVE_MAP_PERIOD"
+#define xsp3LiveMapCountParamString      "XSP3_LIVE_MAP_COUNT"
+#define xsp3LiveMapMessageParamString    "XSP3_LIVE_MAP_MESSAGE"
+#define xsp3AlignParamString             "XSP3_ALIGN"
+#define xsp3AlignOffsetParamString       "XSP3_ALIGN_OFFSET"
+#define xsp3AlignGainParamString         "XSP3_ALIGN_GAIN"
+#define xsp3AlignMessageParamString      "XSP3_ALIGN_MESSAGE"
+//Created for each ROI, numbered from 1
+#define xsp3ChanRoiParamString           "XSP3_CHAN_ROI%d"
+#define xsp3ChanRoiLlmParamString        "XSP3_CHAN_ROI%d_LLM"
+#define xsp3ChanRoiHlmParamString        "XSP3_CHAN_ROI%d_HLM"
+#define xsp3RoiNameParamString           "XSP3_ROI%d_NAME"
+#define xsp3RoiLowEnergyParamString      "XSP3_ROI%d_LOW_KEV"
+#define xsp3RoiHighEnergyParamString     "XSP3_ROI%d_HIGH_KEV"
 
 
 extern "C" {
   int xspress3Config(const char *portName, int numChannels, int numCards, const char *baseIP, int maxFrames, int maxDriverFrames, int maxSpectra, int maxBuffers, size_t maxMemory, int debug, int simTest, int circBuffer);
+  int xspress3SimSpectra(const char *portName, double countRate, int seed);
+  int xspress3SimTrigger(const char *portName, double rate, double jitter, int seed);
+  int xspress3SimReplay(const char *portName, const char *fileName, int loop, double rate);
+  int xspress3SimSystem(const char *portName, int generation, int threads, int ringFrames);
+  int xspress3SimFault(const char *portName, const char *fault, double probability, double value);
+  int xspress3ApiStats(const char *portName, int details, int reset);
+  int xspress3Trace(const char *portName, const char *fileName, double sizeMB, int buffers);
+  int xspress3TraceReplay(const char *portName, const char *fileName, double speed);
 }
 
 
+/* The steps of connect and restoreSettings that make the same calls for each card or channel */
+enum xsp3ConnectPhase { xsp3ConnectClocks, xsp3ConnectFormat, xsp3ConnectWindows, xsp3ConnectReadback };
+
+/* Seconds spent in each step of restoreSettings, over a fast restore and any full restore after it */
+typedef struct xsp3RestoreTimes {
+  double restore;
+  double setup;
+  double readback;
+} xsp3RestoreTimes_t;
+
+/* A range of cards or channels for one phase, run on its own thread when connecting in parallel */
+typedef struct xsp3ConnectWork {
+  class Xspress3 *pXsp3;
+  int phase;
+  int first;
+  int end;
+  epicsEventId done;
+} xsp3ConnectWork_t;
+
+/* Settings written to, and read back from, a channel while connecting */
+typedef struct xsp3ChanConnect {
+  int formatStatus;
+  int windowLlm[2];
+  int windowHlm[2];
+  int windowStatus[2];
+  u_int32_t scaLlm[2];
+  u_int32_t scaHlm[2];
+  int scaStatus[2];
+  u_int32_t sca4Threshold;
+  int thresholdStatus;
+  int dtcFlags;
+  double dtcAeg;
+  double dtcAeo;
+  double dtcIwo;
+  double dtcIwg;
+  int dtcStatus;
+  Xspress3_TriggerB trigB;
+  int trigBStatus;
+} xsp3ChanConnect_t;
+
 class Xspress3 : public ADDriver {
 
  public:
@@ -131,6 +280,8 @@ class Xspress3 : public ADDriver {
   /* These are the methods that we override from asynPortDriver */
   virtual asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
   virtual asynStatus writeFloat64(asynUser *pasynUser, epicsFloat64 value);
+  virtual asynStatus writeInt32Array(asynUser *pasynUser, epicsInt32 *value, size_t nElements);
+  virtual asynStatus writeFloat64Array(asynUser *pasynUser, epicsFloat64 *value, size_t nElements);
   virtual asynStatus writeOctet(asynUser *pasynUser, const char *value,
                                     size_t nChars, size_t *nActual);
   virtual void report(FILE *fp, int details);
@@ -138,19 +289,46 @@ class Xspress3 : public ADDriver {
   const int checkForStopEvent(double timeout, const char *message);
   const int waitForStartEvent(const char *message);
   void adReportError(const char* message);
-  bool createMCAArray(size_t dims[2], NDArray *&pMCA, NDDataType_t dataType);
+  bool createMCAArray(size_t dims[], NDArray *&pMCA, NDDataType_t dataType, int ndims = 2);
   bool createSCAArray(void *&pSCA);
-  bool readFrame(double* pSCA, double* pMCAData, int frameNumber, int maxSpectra);
-  bool readFrame(u_int32_t* pSCA, u_int32_t* pMCAData, int frameNumber, int maxSpectra);
+  bool readFrame(double* pSCA, double* pMCAData, int frameNumber, int maxSpectra, int numChannels);
+  bool readFrame(u_int32_t* pSCA, u_int32_t* pMCAData, int frameNumber, int maxSpectra, int numChannels);
   void writeOutScas(void *&pSCA, int numChannels, NDDataType_t dataType);
   void setStartingParameters();
   const NDDataType_t getDataType();
-  void getDims(size_t (&dims)[2]);
+  int getDims(size_t (&dims)[3]);
   asynStatus checkHistBusy(int checkTimes);
   const int getXsp3Handle() { return this->xsp3_handle_; }
   xsp3Api *getXsp3() { return this->xsp3; }
+  asynStatus replayTrace(const char *fileName, double speed);
+  void connectWork(xsp3ConnectWork_t *work);
+  void reconnectTask(void);
+  void eraseTask(void);
+  void readMarkers(int first, int last);
+  void sparseEncode(NDArray *&pMCA);
+  void publishFrame(NDArray *pMCA);
+  void flushFrames(void);
+  void openH5File(size_t dims[], int ndims, NDDataType_t dataType);
+  void writeH5Frame(NDArray *pMCA, void *pSCA);
+  void closeH5File(void);
+  void openShmRing(size_t dims[], int ndims, NDDataType_t dataType, bool newAcquisition);
+  void writeShmFrame(NDArray *pMCA, void *pSCA, int frameNumber);
+  asynStatus startStreamServer(int enable, int port);
+  void streamFrame(NDArray *pMCA, void *pSCA, int frameNumber);
+  void updateStreamStats(void);
+  int findRoiParam(const int params[], int function);
+  void convertRois(void);
+  void computeRois(NDArray *pMCA);
+  void startLiveMap(bool enable, int rows);
+  void updateLiveMap(void);
+  void publishLiveMap(void);
+  void alignFrame(NDArray *pMCA);
+  void publishAligned(NDArray *pMCA);
   void setNDArrayAttributes(NDArray *&pMCA, int frameNumber);
   void setAcqStopParameters(bool aborted);
+  void prepareSequenceEntry(void);
+  int startSequenceEntry(void);
+  void waitForErase(bool cancel);
   int getNumFramesToAcquire();
   int getMaxNumFrames();
   int getFrameCounter();
@@ -162,22 +340,39 @@ class Xspress3 : public ADDriver {
 
   //Put private functions here
   void checkStatus(int status, const char *function, const char *parentFunction);
-  asynStatus connect(void);
+  asynStatus connect(bool unlockConfig = false);
+  int configSystem(int numCards, int numFrames, int numChannels, bool unlockConfig);
   asynStatus disconnect(void);
+  asynStatus warmReconnect(bool unlockConfig = false);
   asynStatus saveSettings(void);
-  asynStatus restoreSettings(void);
+  asynStatus restoreSettings(bool fallback = true);
+  bool fastRestoreAvailable(const char *configPath);
+  asynStatus fullRestore(const char *configPath, int numChannels, xsp3RestoreTimes_t *times);
+  asynStatus setupChannels(int numChannels, bool writeWindows);
   asynStatus checkConnected(void);
   asynStatus setWindow(int channel, int sca, int llm, int hlm);
   asynStatus checkRoi(int channel, int roi, int llm, int hlm);
-  asynStatus erase(void);
+  asynStatus erase(bool background = false);
   asynStatus eraseSCAMCAROI(void);
   asynStatus checkSaveDir(const char *dirName);
-  asynStatus readSCAParams(void);
-  asynStatus readDTCParams(void);
-  asynStatus readTrigB(void);
+  void runConnectPhase(int phase, int count);
+  asynStatus formatChannels(int numChannels);
+  int readSubFrameHistogram(u_int32_t* pMCAData, int frameNumber, int numChannels);
+  void publishCompressed(bool wait);
+  asynStatus writeChannelWindows(int numChannels);
+  asynStatus readChannelParams(int numChannels);
+  asynStatus publishChannelParams(int numChannels);
+  bool verifyChannelParams(int numChannels);
+  bool settingsFingerprint(const char *configPath, uint64_t *fingerprint);
   asynStatus setupITFG(void);
+  asynStatus startHistogram(bool setup, const char *parentFunction);
+  void startSequence(void);
+  void endSequence(void);
+  void applySequenceEntry(int entry);
+  int acquisitionFrame(int frameNumber) const;
   asynStatus mapTriggerMode(int mode, int invert_f0, int invert_veto, int debounce, int *apiMode);
   asynStatus setTriggerMode(int mode, int invert_f0, int invert_veto, int debounce );
+  void updateApiStats(void);
   void createInitialParameters();
   bool setInitialParameters(int maxFrames, int maxDriverFrames, int numCards, int maxSpectra);
 
@@ -204,6 +399,117 @@ class Xspress3 : public ADDriver {
 
   xsp3Api* xsp3;
 
+  //Per card and per channel results of the connect phases
+  int clockSource_;
+  std::vector<int> clockStatus_;
+  std::vector<xsp3ChanConnect_t> chanConnect_;
+
+  //State of the last full restore, to skip restoring unchanged settings
+  bool restoreValid_;
+  uint64_t restoreFingerprint_;
+  std::vector<xsp3ChanConnect_t> restoredChannels_;
+
+  //Automatic reconnection after the link to the system is lost
+  bool linkLost_;
+  double reconnectDelay_;
+  bool reconnecting_;
+
+  //Clearing of the frames ahead of an acquisition on the erase task
+  epicsEventId eraseStartEvent_;
+  epicsEventId eraseDoneEvent_;
+  bool eraseActive_;
+  volatile bool eraseCancel_;
+  volatile bool eraseAcquiring_;
+  bool eraseFailed_;
+  int eraseChannels_;
+  int eraseFirst_;
+  int eraseEnd_;
+  int eraseChunk_;
+  double eraseStartTime_;
+
+  //ITFG settings last written, reused between step scan points
+  bool itfgValid_;
+  uint64_t itfgFingerprint_;
+  double acqStartTime_;
+
+  //Sequence of acquisitions run back to back from one Acquire
+  std::vector<epicsFloat64> seqAcquireTime_;
+  std::vector<epicsInt32> seqNumImages_;
+  std::vector<epicsFloat64> seqRunAcquireTime_;   // copied at the start, so loading new tables cannot change a running sequence
+  std::vector<epicsInt32> seqRunNumImages_;
+  bool seqActive_;
+  bool seqRestore_;
+  bool seqPrepared_;
+  int seqLength_;
+  int seqIndex_;
+  int seqFrameOffset_;
+  double seqSavedAcquireTime_;
+  int seqSavedNumImages_;
+
+  //Fly scan frame markers, read ahead of the frames, and the map position of the last frame
+  std::vector<int> markers_;
+  int markersFirst_;
+  int markersEnd_;
+  bool flyScan_;
+  int mapColumns_;
+  int mapSnake_;
+  int mapRowMarker_;
+  int mapRow_;
+  int mapIndex_;
+  int mapColumn_;
+
+  //Sub-frame layout the channels were last formatted with, and the buffer they are read into
+  int subFrames_;
+  int subFrameBits_;
+  int subFrameDivide_;
+  std::vector<u_int32_t> subFrameBuffer_;
+
+  //Sparse encoding of the frames of this acquisition
+  int sparse_;
+
+  //Frames being compressed before they are published
+  xsp3CompressPool compressPool_;
+  unsigned long compressFailures_;
+
+  //Frames of this acquisition written straight to an HDF5 file by the data task
+  xsp3H5Writer h5Writer_;
+  bool h5Enable_;
+  std::string h5FileName_;
+  int h5ChunkFrames_;
+  int h5Swmr_;
+
+  //Every frame copied to a shared memory ring for local readers
+  xsp3ShmWriter shmWriter_;
+  bool shmEnable_;
+  std::string shmName_;
+  int shmSlots_;
+  xsp3ShmFrameHeader_t shmFrame_;
+
+  //Every frame sent to the clients of a TCP server
+  xsp3StreamServer streamServer_;
+  epicsUInt32 streamAcquisition_;
+
+  //MCA ROIs summed by the data task. The ranges are loaded from the parameters when roiChanged_ is set.
+  xsp3RoiSums roiSums_;
+  bool roiChanged_;
+  bool roiEnable_;
+  std::vector<double> roiTotals_;
+
+  //Maps of the ROIs in a fly scan, summed over channels, published on address numChannels_
+  std::vector<int> liveMapRois_;
+  std::vector<double> liveMapData_;   // [map][row][column]
+  std::string liveMapNames_;
+  int liveMapRows_;
+  double liveMapPeriod_;
+  bool liveMapChanged_;
+  epicsTimeStamp liveMapPublished_;
+
+  //Sum of the channels on a common energy axis, published on address numChannels_+1
+  xsp3Align align_;
+  bool alignChanged_;
+  bool alignEnable_;
+  std::vector<double> alignSum_;
+
   //Constructor parameters.
   const epicsUInt32 debug_; //debug parameter for API
   const epicsInt32 numChannels_; //The number of channels
@@ -270,6 +576,96 @@ class Xspress3 : public ADDriver {
   int xsp3PulsePerTriggerParam;
   int xsp3ITFGStartParam;
   int xsp3ITFGStopParam;
+  int xsp3ApiStatsParam;
+  int xsp3ApiStatsResetParam;
+  int xsp3ApiStatsUpdateParam;
+  int xsp3ApiCallsParam;
+  int xsp3ApiTimeParam;
+  int xsp3ApiReadTimeParam;
+  int xsp3ApiReadMaxParam;
+  int xsp3ApiSlowestParam;
+  int xsp3ConnectThreadsParam;
+  int xsp3ConnectTimeParam;
+  int xsp3ConnectConfigTimeParam;
+  int xsp3ConnectClocksTimeParam;
+  int xsp3ConnectRestoreTimeParam;
+  int xsp3ConnectSetupTimeParam;
+  int xsp3ConnectReadbackTimeParam;
+  int xsp3FastRestoreParam;
+  int xsp3RestoreSkippedParam;
+  int xsp3AutoReconnectParam;
+  int xsp3ReconnectParam;
+  int xsp3ReconnectTimeParam;
+  int xsp3ReconnectCountParam;
+  int xsp3ReconnectDelayParam;
+  int xsp3EraseChunkParam;
+  int xsp3EraseTimeParam;
+  int xsp3StartTimeParam;
+  int xsp3EraseOvertakenParam;
+  int xsp3StepScanParam;
+  int xsp3PointTimeParam;
+  int xsp3PointOverheadParam;
+  int xsp3SeqAcquireTimeParam;
+  int xsp3SeqNumImagesParam;
+  int xsp3SeqLengthParam;
+  int xsp3SeqEntryParam;
+  int xsp3FlyScanParam;
+  int xsp3MapColumnsParam;
+  int xsp3MapRowsParam;
+  int xsp3MapSnakeParam;
+  int xsp3MapRowMarkerParam;
+  int xsp3MapRowParam;
+  int xsp3MapColumnParam;
+  int xsp3SubFramesParam;
+  int xsp3SubFrameBitsParam;
+  int xsp3SubFrameDivideParam;
+  int xsp3SparseParam;
+  int xsp3SparseRatioParam;
+  int xsp3CompressParam;
+  int xsp3CompressLevelParam;
+  int xsp3CompressShuffleParam;
+  int xsp3CompressThreadsParam;
+  int xsp3CompressRatioParam;
+  int xsp3CompressTimeParam;
+  int xsp3CompressFailuresParam;
+  int xsp3H5EnableParam;
+  int xsp3H5FileNameParam;
+  int xsp3H5ChunkFramesParam;
+  int xsp3H5SwmrParam;
+  int xsp3H5FramesParam;
+  int xsp3H5MessageParam;
+  int xsp3ShmEnableParam;
+  int xsp3ShmNameParam;
+  int xsp3ShmSlotsParam;
+  int xsp3ShmFramesParam;
+  int xsp3ShmMessageParam;
+  int xsp3StreamEnableParam;
+  int xsp3StreamPortParam;
+  int xsp3StreamCompressParam;
+  int xsp3StreamQueueParam;
+  int xsp3StreamPolicyParam;
+  int xsp3StreamClientsParam;
+  int xsp3StreamFramesParam;
+  int xsp3StreamDroppedParam;
+  int xsp3StreamMessageParam;
+  int xsp3ChanCalOffsetParam;
+  int xsp3ChanCalGainParam;
+  int xsp3ChanCalQuadParam;
+  int xsp3RoiMessageParam;
+  int xsp3LiveMapParam;
+  int xsp3LiveMapPeriodParam;
+  int xsp3LiveMapCountParam;
+  int xsp3LiveMapMessageParam;
+  int xsp3AlignParam;
+  int xsp3AlignOffsetParam;
+  int xsp3AlignGainParam;
+  int xsp3AlignMessageParam;
+  int xsp3ChanRoiParam[XSP3_NUM_ROIS];
+  int xsp3ChanRoiLlmParam[XSP3_NUM_ROIS];
+  int xsp3ChanRoiHlmParam[XSP3_NUM_ROIS];
+  int xsp3RoiNameParam[XSP3_NUM_ROIS];
+  int xsp3RoiLowEnergyParam[XSP3_NUM_ROIS];
+  int xsp3RoiHighEnergyParam[XSP3_NUM_ROIS];
   int xsp3LastParam;
   #define XSP3_LAST_DRIVER_COMMAND xsp3LastParam
 };
@@ -0,0 +1,114 @@
+/**
+ * License: This file is part of 'xspress3'
+ *
+ * 'xspress3' is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * 'xspress3' is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with 'xspress3'.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @brief Reference client for the driver's frame stream.
+ *
+ * Connects to the TCP server started by STREAM_ENABLE, receives frames and
+ * prints the frame rate, data rate, compression ratio and frames dropped
+ * once a second. With -v each frame header is printed as well. It is also
+ * the smallest example of reading the stream with libxsp3Stream.
+ *
+ * Usage: xspress3StreamClient [-H host] [-p port] [-n frames] [-v]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <sys/time.h>
+
+#include "xsp3Stream.h"
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec/1e6;
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [-H host] [-p port] [-n frames] [-v]\n"
+                    "  -H host    Server to connect to (default localhost)\n"
+                    "  -p port    STREAM_PORT of the driver (default 9999)\n"
+                    "  -n frames  Stop after this many frames (default run until disconnected)\n"
+                    "  -v         Print the header of every frame\n", program);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *host = "localhost";
+    int port = 9999;
+    long maxFrames = 0;
+    bool verbose = false;
+    xsp3StreamClient client;
+    xsp3StreamFrame_t frame;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "H:p:n:vh")) != -1) {
+        switch (opt) {
+        case 'H': host = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 'n': maxFrames = atol(optarg); break;
+        case 'v': verbose = true; break;
+        default:
+            usage(argv[0]);
+            return (opt == 'h') ? 0 : 1;
+        }
+    }
+
+    if (client.connect(host, port) != 0) {
+        fprintf(stderr, "%s:%d: %s\n", host, port, client.getError().c_str());
+        return 1;
+    }
+    fprintf(stderr, "Connected to %s:%d\n", host, port);
+
+    double start = now(), last = start;
+    uint64_t lastFrames = 0, bytes = 0, spectra = 0, uncompressed = 0;
+    while (maxFrames == 0 || (long) client.getFrames() < maxFrames) {
+        if (client.receive(&frame) != 0) {
+            fprintf(stderr, "%s\n", client.getError().c_str());
+            break;
+        }
+        const xsp3StreamHeader_t &h = frame.header;
+        bytes += h.headerBytes + h.dataBytes + h.scalerBytes;
+        spectra += h.dataBytes;
+        uncompressed += h.uncompressedBytes;
+        if (verbose) {
+            printf("acquisition %u frame %u sequence %llu: %u x %u x %u %s, %llu bytes, codec %u, dropped %u\n",
+                   h.acquisition, h.frameNumber, (unsigned long long) h.sequence,
+                   h.dims[0], h.dims[1], h.dims[2], h.dataType ? "Float64" : "UInt32",
+                   (unsigned long long) h.dataBytes, h.codec, h.dropped);
+        }
+        double t = now();
+        if (t - last >= 1.0) {
+            printf("%.1f frames/s, %.1f MB/s, ratio %.2f, %llu frames, %llu dropped\n",
+                   (client.getFrames() - lastFrames)/(t - last), bytes/(t - last)/1e6,
+                   (spectra > 0) ? (double) uncompressed/spectra : 1.0,
+                   (unsigned long long) client.getFrames(), (unsigned long long) client.getDropped());
+            fflush(stdout);
+            last = t;
+            lastFrames = client.getFrames();
+            bytes = spectra = uncompressed = 0;
+        }
+    }
+
+    printf("%llu frames in %.1f s, %llu dropped\n", (unsigned long long) client.getFrames(),
+           now() - start, (unsigned long long) client.getDropped());
+    return 0;
+}